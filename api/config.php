@@ -54,6 +54,25 @@ define('BASE_URL', $protocol . '://' . $host . $basePath);
 define('UPLOAD_DIR', ROOT_DIR . '/uploads');
 define('VEHICLE_IMAGE_DIR', UPLOAD_DIR . '/vehicles');
 
+// Archive backfill ranges waiting to be handed to GPS devices
+// (bus_id => {from, to}, Unix seconds; see api/gps-device.php)
+define('GPS_BACKFILL_FILE', ROOT_DIR . '/logs/gps-backfill.json');
+
+// Largest {"data":[...]} batch a GPS device may upload in one request
+define('GPS_BATCH_MAX_RECORDS', 500);
+
+// Reporting control sent to GPS devices in every response (the "control"
+// block, see api/gps-device.php). null = the device keeps its default.
+define('GPS_CONTROL_INTERVAL_MS', null);    // Live fix interval, 2500..60000
+define('GPS_CONTROL_BATCH_MAX', null);      // Records per backlog window
+define('GPS_CONTROL_FLUSH_ALLOWED', null);  // false = hold backlog uploads
+define('GPS_CONTROL_TTL_S', 600);           // Devices fall back after this
+
+// Load shedding: above this 1-minute load average GPS devices get 503 with
+// Retry-After and are slowed down for GPS_SHED_RETRY_S. 0 = never shed.
+define('GPS_SHED_LOAD_AVG', 0);
+define('GPS_SHED_RETRY_S', 60);
+
 // URL paths for uploaded files
 define('VEHICLE_IMAGE_URL', BASE_URL . '/uploads/vehicles');
 
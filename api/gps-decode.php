@@ -0,0 +1,440 @@
+<?php
+/**
+ * SAWARI — GPS Device Body Decoding
+ *
+ * Decoders for the binary bodies gps-device.php accepts: track blocks
+ * (application/x-sawari-track) and CBOR / MessagePack records and
+ * batches. Each returns plain arrays in the shape of the JSON body, so
+ * the endpoint handles every format the same way.
+ *
+ * Kept apart from the endpoint so the decoders can be checked against
+ * firmware-encoded fixtures without a request (tests/host/wire_conformance.php).
+ */
+
+// ── Track Block Decoding ────────────────────────────────────
+
+/**
+ * Decode a track block (format version 4) into a list of samples.
+ * Mirrors trackDecoderNext() in the firmware: all arithmetic is done on
+ * uint32 bit patterns, so deltas wrap exactly as on the device.
+ *
+ * @return array|null  list of samples, or null if the block is malformed
+ */
+function decodeTrackBlock(string $bytes): ?array
+{
+    $len = strlen($bytes);
+    $version = $len >= 2 ? ord($bytes[0]) : 0;
+    if ($version !== 4 || ord($bytes[1]) === 0) {
+        return null;
+    }
+
+    $count = ord($bytes[1]);
+    $pos = 2;
+    $mask32 = 0xFFFFFFFF;
+
+    $readVarint = function () use ($bytes, $len, &$pos): ?int {
+        $value = 0;
+        for ($shift = 0; $shift < 35; $shift += 7) {
+            if ($pos >= $len) {
+                return null;
+            }
+            $b = ord($bytes[$pos++]);
+            $value |= ($b & 0x7F) << $shift;
+            if (!($b & 0x80)) {
+                // Zig-zag decode to a signed value
+                return ($value >> 1) ^ -($value & 1);
+            }
+        }
+        return null;
+    };
+
+    $signed = function (int $v): int {
+        return $v >= 0x80000000 ? $v - 0x100000000 : $v;
+    };
+
+    // Field order: lat, lon, timestamp, altitude, speed, direction,
+    // satellites, hdop, seq. Satellites and hdop share mask bit 6; seq is
+    // stored as the delta from the previous seq + 1.
+    $fields = 9;
+    $maskBit = [0, 1, 2, 3, 4, 5, 6, 6, 7];
+    $f = array_fill(0, 9, 0);
+    $lastDelta = 0;
+    $samples = [];
+
+    for ($n = 0; $n < $count; $n++) {
+        if ($n === 0) {
+            for ($i = 0; $i < $fields; $i++) {
+                $v = $readVarint();
+                if ($v === null) {
+                    return null;
+                }
+                $f[$i] = $v & $mask32;
+            }
+        } else {
+            if ($pos >= $len) {
+                return null;
+            }
+            $mask = ord($bytes[$pos++]);
+            $d = array_fill(0, 9, 0);
+            for ($i = 0; $i < $fields; $i++) {
+                if ($mask & (1 << $maskBit[$i])) {
+                    $v = $readVarint();
+                    if ($v === null) {
+                        return null;
+                    }
+                    $d[$i] = $v;
+                }
+            }
+            $lastDelta = ($lastDelta + $d[2]) & $mask32;
+            $f[2] = ($f[2] + $lastDelta) & $mask32;
+            foreach ([0, 1, 3, 4, 6, 7] as $i) {
+                $f[$i] = ($f[$i] + $d[$i]) & $mask32;
+            }
+            $f[5] = ($f[5] + $d[5] + 3600) % 3600;
+            $f[8] = ($f[8] + $d[8] + 1) & $mask32;
+        }
+
+        $samples[] = [
+            "latitude" => $signed($f[0]) / 1e6,
+            "longitude" => $signed($f[1]) / 1e6,
+            "timestamp" => gmdate('Y-m-d\TH:i:s\Z', $f[2]),
+            "altitude" => $signed($f[3]) / 10,
+            "speed" => ($f[4] & 0xFFFF) / 10,
+            "direction" => ($f[5] & 0xFFFF) / 10,
+            "satellites" => $f[6] & 0xFF,
+            "hdop" => ($f[7] & 0xFFFF) / 10,
+            "seq" => $f[8]
+        ];
+    }
+
+    return $samples;
+}
+
+// ── CBOR / MessagePack Decoding ─────────────────────────────
+
+/**
+ * Decode a CBOR (RFC 8949) item that makes up the whole string.
+ * Handles integers, strings, arrays, maps, floats and simple values;
+ * a tag is dropped and its content kept (tag 1 → epoch seconds).
+ * Indefinite lengths are not supported.
+ *
+ * @return mixed  decoded value
+ * @throws UnexpectedValueException  if the bytes are malformed
+ */
+function decodeCbor(string $bytes)
+{
+    $len = strlen($bytes);
+    $pos = 0;
+
+    $take = function (int $n) use ($bytes, $len, &$pos): string {
+        if ($n < 0 || $n > $len - $pos) {
+            throw new UnexpectedValueException("Truncated CBOR");
+        }
+        $chunk = (string) substr($bytes, $pos, $n);
+        $pos += $n;
+        return $chunk;
+    };
+
+    $item = function (int $depth) use (&$item, $take) {
+        if ($depth > 8) {
+            throw new UnexpectedValueException("CBOR nested too deep");
+        }
+
+        $initial = ord($take(1));
+        $major = $initial >> 5;
+        $info = $initial & 0x1F;
+
+        if ($major === 7) {
+            switch ($info) {
+                case 20:
+                    return false;
+                case 21:
+                    return true;
+                case 22:
+                case 23:
+                    return null;
+                case 25:
+                    $half = unpack('n', $take(2))[1];
+                    $exp = ($half >> 10) & 0x1F;
+                    $mant = $half & 0x3FF;
+                    if ($exp === 0) {
+                        $value = $mant * 2 ** -24;
+                    } elseif ($exp === 31) {
+                        $value = $mant ? NAN : INF;
+                    } else {
+                        $value = (1024 + $mant) * 2 ** ($exp - 25);
+                    }
+                    return ($half & 0x8000) ? -$value : $value;
+                case 26:
+                    return unpack('G', $take(4))[1];
+                case 27:
+                    return unpack('E', $take(8))[1];
+            }
+            throw new UnexpectedValueException("Unsupported CBOR simple value $info");
+        }
+
+        if ($info < 24) {
+            $arg = $info;
+        } elseif ($info === 24) {
+            $arg = ord($take(1));
+        } elseif ($info === 25) {
+            $arg = unpack('n', $take(2))[1];
+        } elseif ($info === 26) {
+            $arg = unpack('N', $take(4))[1];
+        } elseif ($info === 27) {
+            $arg = unpack('J', $take(8))[1];
+        } else {
+            throw new UnexpectedValueException("Indefinite-length CBOR is not supported");
+        }
+
+        switch ($major) {
+            case 0:
+                return $arg;
+            case 1:
+                return -1 - $arg;
+            case 2:
+            case 3:
+                return $take($arg);
+            case 4:
+                $list = [];
+                for ($i = 0; $i < $arg; $i++) {
+                    $list[] = $item($depth + 1);
+                }
+                return $list;
+            case 5:
+                $map = [];
+                for ($i = 0; $i < $arg; $i++) {
+                    $key = $item($depth + 1);
+                    if (!is_int($key) && !is_string($key)) {
+                        throw new UnexpectedValueException("Unsupported CBOR map key");
+                    }
+                    $map[$key] = $item($depth + 1);
+                }
+                return $map;
+            default:
+                return $item($depth + 1);       // Tag: keep the content
+        }
+    };
+
+    $value = $item(0);
+    if ($pos !== $len) {
+        throw new UnexpectedValueException("Trailing bytes after CBOR item");
+    }
+    return $value;
+}
+
+/**
+ * Decode a MessagePack value that makes up the whole string.
+ * Handles every type except extensions other than the timestamp (type -1),
+ * which is returned as Unix seconds.
+ *
+ * @return mixed  decoded value
+ * @throws UnexpectedValueException  if the bytes are malformed
+ */
+function decodeMsgpack(string $bytes)
+{
+    $len = strlen($bytes);
+    $pos = 0;
+
+    $take = function (int $n) use ($bytes, $len, &$pos): string {
+        if ($n < 0 || $n > $len - $pos) {
+            throw new UnexpectedValueException("Truncated MessagePack");
+        }
+        $chunk = (string) substr($bytes, $pos, $n);
+        $pos += $n;
+        return $chunk;
+    };
+
+    $u8 = function () use ($take): int {
+        return ord($take(1));
+    };
+    $u16 = function () use ($take): int {
+        return unpack('n', $take(2))[1];
+    };
+    $u32 = function () use ($take): int {
+        return unpack('N', $take(4))[1];
+    };
+
+    $ext = function (int $size) use ($take): int {
+        $type = unpack('c', $take(1))[1];
+        $data = $take($size);
+        if ($type !== -1) {
+            throw new UnexpectedValueException("Unsupported MessagePack extension $type");
+        }
+        switch ($size) {
+            case 4:
+                return unpack('N', $data)[1];
+            case 8:
+                return unpack('J', $data)[1] & 0x3FFFFFFFF;     // Low 34 bits: seconds
+            case 12:
+                return unpack('J', substr($data, 4))[1];
+        }
+        throw new UnexpectedValueException("Invalid MessagePack timestamp");
+    };
+
+    $item = function (int $depth) use (&$item, $take, $u8, $u16, $u32, $ext) {
+        if ($depth > 8) {
+            throw new UnexpectedValueException("MessagePack nested too deep");
+        }
+
+        $list = function (int $count) use (&$item, $depth): array {
+            $values = [];
+            for ($i = 0; $i < $count; $i++) {
+                $values[] = $item($depth + 1);
+            }
+            return $values;
+        };
+        $map = function (int $count) use (&$item, $depth): array {
+            $values = [];
+            for ($i = 0; $i < $count; $i++) {
+                $key = $item($depth + 1);
+                if (!is_int($key) && !is_string($key)) {
+                    throw new UnexpectedValueException("Unsupported MessagePack map key");
+                }
+                $values[$key] = $item($depth + 1);
+            }
+            return $values;
+        };
+
+        $b = $u8();
+        if ($b <= 0x7F) {
+            return $b;                              // positive fixint
+        }
+        if ($b >= 0xE0) {
+            return $b - 0x100;                      // negative fixint
+        }
+        if ($b <= 0x8F) {
+            return $map($b & 0x0F);
+        }
+        if ($b <= 0x9F) {
+            return $list($b & 0x0F);
+        }
+        if ($b <= 0xBF) {
+            return $take($b & 0x1F);                // fixstr
+        }
+
+        switch ($b) {
+            case 0xC0:
+                return null;
+            case 0xC2:
+                return false;
+            case 0xC3:
+                return true;
+            case 0xC4:
+            case 0xD9:
+                return $take($u8());                // bin 8 / str 8
+            case 0xC5:
+            case 0xDA:
+                return $take($u16());
+            case 0xC6:
+            case 0xDB:
+                return $take($u32());
+            case 0xC7:
+                return $ext($u8());
+            case 0xC8:
+                return $ext($u16());
+            case 0xC9:
+                return $ext($u32());
+            case 0xCA:
+                return unpack('G', $take(4))[1];
+            case 0xCB:
+                return unpack('E', $take(8))[1];
+            case 0xCC:
+                return $u8();
+            case 0xCD:
+                return $u16();
+            case 0xCE:
+                return $u32();
+            case 0xCF:
+            case 0xD3:
+                return unpack('J', $take(8))[1];
+            case 0xD0:
+                return unpack('c', $take(1))[1];
+            case 0xD1:
+                $v = $u16();
+                return $v >= 0x8000 ? $v - 0x10000 : $v;
+            case 0xD2:
+                $v = $u32();
+                return $v >= 0x80000000 ? $v - 0x100000000 : $v;
+            case 0xD4:
+            case 0xD5:
+            case 0xD6:
+            case 0xD7:
+            case 0xD8:
+                return $ext(1 << ($b - 0xD4));      // fixext 1..16
+            case 0xDC:
+                return $list($u16());
+            case 0xDD:
+                return $list($u32());
+            case 0xDE:
+                return $map($u16());
+            case 0xDF:
+                return $map($u32());
+        }
+        throw new UnexpectedValueException(sprintf("Invalid MessagePack byte 0x%02X", $b));
+    };
+
+    $value = $item(0);
+    if ($pos !== $len) {
+        throw new UnexpectedValueException("Trailing bytes after MessagePack value");
+    }
+    return $value;
+}
+
+/**
+ * Map one binary record to the fields of a JSON record.
+ *
+ * @return array|null  JSON-style record, or null if it is not a record
+ */
+function wireRecordToData($record): ?array
+{
+    $fields = is_array($record) ? count($record) : 0;
+    if ($fields !== 10) {
+        return null;
+    }
+    for ($i = 0; $i < $fields; $i++) {
+        $v = array_key_exists($i, $record) ? $record[$i] : false;
+        if (!is_int($v) && !is_float($v) && !($i === 8 && $v === null)) {
+            return null;
+        }
+    }
+
+    return [
+        "bus_id" => $record[0],
+        "latitude" => $record[1] / 1e6,
+        "longitude" => $record[2] / 1e6,
+        "speed" => $record[3] / 10,
+        "direction" => $record[4] / 10,
+        "altitude" => $record[5] / 10,
+        "satellites" => $record[6],
+        "hdop" => $record[7] / 10,
+        "timestamp" => $record[8] !== null ? gmdate('Y-m-d\TH:i:s\Z', (int) $record[8]) : null,
+        "seq" => $record[9]
+    ];
+}
+
+/**
+ * Decode a CBOR or MessagePack body into what json_decode() returns for
+ * the equivalent JSON body: ["data" => record] or ["data" => [record, ...]].
+ * A record that is not a valid binary record becomes null (rejected).
+ *
+ * @return array|null  null if the body is malformed
+ */
+function decodeWireBody(string $bytes, bool $msgpack): ?array
+{
+    try {
+        $value = $msgpack ? decodeMsgpack($bytes) : decodeCbor($bytes);
+    } catch (UnexpectedValueException $e) {
+        return null;
+    }
+
+    if (!is_array($value)) {
+        return null;
+    }
+    if (isset($value[0]) && is_array($value[0])) {
+        return ["data" => array_map('wireRecordToData', array_values($value))];
+    }
+
+    $record = wireRecordToData($value);
+    return $record === null ? null : ["data" => $record];
+}
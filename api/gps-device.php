@@ -16,10 +16,55 @@
  *         "altitude": 1208.1,
  *         "satellites": 7,
  *         "hdop": 2,
- *         "timestamp": "2026-02-19T09:06:53Z"
+ *         "timestamp": "2026-02-19T09:06:53Z",
+ *         "seq": 4711
  *     }
  * }
  *
+ * Offline backlog can also arrive as a batch, "data" being a list:
+ *     {"data": [{...}, {...}]}
+ * All valid records are stored in one transaction. The response lists one
+ * result per record, in order: "ok" (stored), "rejected" (invalid, see
+ * "errors"; the device drops it) or "retry" (not stored this time).
+ *
+ * Offline backlog can also arrive as a binary track block
+ * (Content-Type: application/x-sawari-track, bus ID in the X-Bus-Id
+ * header): a keyframe plus zig-zag varint deltas, exactly as stored in
+ * the device's offline queue (see sawari_telemetry/track_codec.h).
+ * The newest valid sample updates the vehicle; all samples are logged.
+ *
+ * Archive backfill: an admin can ask a device to re-send a past time
+ * range (vehicles.php?action=request_backfill). The range is handed over
+ * once, in the response to the device's next POST:
+ *     "backfill": {"from": 1771495553, "to": 1771499153}
+ * The device answers with track blocks carrying an X-Backfill: 1 header;
+ * those samples are logged but never move the vehicle's live position.
+ *
+ * Binary records: live fixes and batches may also arrive as CBOR
+ * (Content-Type: application/cbor) or MessagePack (application/msgpack).
+ * A record is then an array of scaled integers,
+ *     [bus_id, latitude x1e6, longitude x1e6, speed x10, direction x10,
+ *      altitude x10, satellites, hdop x10, timestamp, seq]
+ * with the timestamp as CBOR tag 1 / MessagePack timestamp (Unix time) or
+ * null; a batch is an array of records (see sawari_telemetry/wire_codec.h).
+ * They are mapped to the JSON fields and handled exactly like JSON.
+ *
+ * Compressed bodies: any of the above may arrive with
+ * Content-Encoding: gzip (or deflate) and is inflated first. Every response
+ * carries "Accept-Encoding: gzip", which is how devices learn they may
+ * compress; devices that never see it keep sending plain bodies.
+ *
+ * Every sample is stored in gps_samples. The newest one also moves the
+ * vehicle, unless the table already holds a newer fix for it.
+ *
+ * Sequence numbers: "seq" is a per-device counter (1, 2, 3, ... kept
+ * across reboots). A record whose (bus_id, seq) is already stored is a
+ * resend (e.g. its response was lost, or a pipelined request after a
+ * failed one) and is dropped as a duplicate, but still counts as "ok".
+ * The device names the lowest seq it may still send in an X-Seq-Floor
+ * header; the response reports "acked_seq": every seq up to it is stored
+ * (or was given up by the device). Records without seq are always stored.
+ *
  * Field mapping:
  *   bus_id    → vehicle_id (in vehicles table)
  *   latitude  → latitude
@@ -27,14 +72,20 @@
  *   speed     → velocity (km/h)
  *   direction → heading (stored for future use)
  *
- * The endpoint also maintains a rolling debug log at logs/gps-device.json
- * (last 500 entries).
+ * Reporting control: responses may carry
+ *     "control": {"next_interval_ms": 15000, "batch_max": 20,
+ *                 "flush_allowed": 0, "ttl_s": 600}
+ * from the GPS_CONTROL_* settings in config.php (fields left null are
+ * omitted; no block when all are null). Above GPS_SHED_LOAD_AVG the
+ * endpoint answers 503 with Retry-After and a control block that spaces
+ * live fixes out and holds backlog uploads for GPS_SHED_RETRY_S.
  */
 
 header("Content-Type: application/json");
 header("Access-Control-Allow-Origin: *");
 header("Access-Control-Allow-Methods: POST, OPTIONS");
-header("Access-Control-Allow-Headers: Content-Type");
+header("Access-Control-Allow-Headers: Content-Type, Content-Encoding, X-Bus-Id, X-Backfill, X-Seq-Floor");
+header("Accept-Encoding: gzip, deflate");
 
 // Handle preflight
 if ($_SERVER['REQUEST_METHOD'] === 'OPTIONS') {
@@ -49,66 +100,277 @@ if ($_SERVER['REQUEST_METHOD'] !== 'POST') {
     exit;
 }
 
-// ── Parse Input ─────────────────────────────────────────────
-$rawBody = file_get_contents("php://input");
-$input = json_decode($rawBody, true);
+require_once __DIR__ . '/gps-decode.php';
+require_once __DIR__ . '/config.php';
 
-if (json_last_error() !== JSON_ERROR_NONE) {
-    http_response_code(400);
-    echo json_encode(["status" => "error", "message" => "Invalid JSON: " . json_last_error_msg()]);
-    exit;
-}
+/**
+ * Validate one sample and map it to the fields we store.
+ *
+ * @return array|string  normalized sample, or an error message
+ */
+function normalizeSample(array $data)
+{
+    $sample = [
+        "bus_id" => isset($data['bus_id']) ? (int) $data['bus_id'] : 0,
+        "latitude" => isset($data['latitude']) ? (float) $data['latitude'] : null,
+        "longitude" => isset($data['longitude']) ? (float) $data['longitude'] : null,
+        "speed" => isset($data['speed']) ? (float) $data['speed'] : 0,
+        "direction" => isset($data['direction']) ? (float) $data['direction'] : null,
+        "altitude" => isset($data['altitude']) ? (float) $data['altitude'] : null,
+        "satellites" => isset($data['satellites']) ? (int) $data['satellites'] : null,
+        "hdop" => isset($data['hdop']) ? (float) $data['hdop'] : null,
+        "device_ts" => isset($data['timestamp']) ? $data['timestamp'] : null,
+        "seq" => isset($data['seq']) && (int) $data['seq'] > 0 ? (int) $data['seq'] : null
+    ];
 
-if (!isset($input['data']) || !is_array($input['data'])) {
-    http_response_code(400);
-    echo json_encode(["status" => "error", "message" => "Missing 'data' field"]);
-    exit;
+    if (!$sample['bus_id']) {
+        return "Missing or invalid 'bus_id'";
+    }
+
+    if ($sample['latitude'] === null || $sample['longitude'] === null) {
+        return "Missing 'latitude' and/or 'longitude'";
+    }
+
+    // Basic coordinate sanity check (Nepal bounding box: ~26-31°N, 80-89°E)
+    $lat = $sample['latitude'];
+    $lng = $sample['longitude'];
+    if ($lat < 25 || $lat > 32 || $lng < 79 || $lng > 90) {
+        return "Coordinates out of Nepal range";
+    }
+
+    // GPS quality check — if HDOP is too high, the fix is unreliable
+    $hdop = $sample['hdop'];
+    if ($hdop !== null && $hdop > 10) {
+        // Still accept but flag it
+        $sample['gps_quality'] = 'poor';
+    } elseif ($hdop !== null && $hdop > 5) {
+        $sample['gps_quality'] = 'moderate';
+    } else {
+        $sample['gps_quality'] = 'good';
+    }
+
+    return $sample;
 }
 
-$data = $input['data'];
+/**
+ * Device timestamp ("2026-02-19T09:06:53Z") → DATETIME (UTC), or null.
+ */
+function deviceTimeToSql($deviceTs): ?string
+{
+    $time = is_string($deviceTs) ? strtotime($deviceTs) : false;
+    return $time === false ? null : gmdate('Y-m-d H:i:s', $time);
+}
 
-// ── Validate Required Fields ────────────────────────────────
-$busId = isset($data['bus_id']) ? (int) $data['bus_id'] : 0;
-$latitude = isset($data['latitude']) ? (float) $data['latitude'] : null;
-$longitude = isset($data['longitude']) ? (float) $data['longitude'] : null;
-$speed = isset($data['speed']) ? (float) $data['speed'] : 0;
-$direction = isset($data['direction']) ? (float) $data['direction'] : null;
-$altitude = isset($data['altitude']) ? (float) $data['altitude'] : null;
-$satellites = isset($data['satellites']) ? (int) $data['satellites'] : null;
-$hdop = isset($data['hdop']) ? (float) $data['hdop'] : null;
-$deviceTs = isset($data['timestamp']) ? $data['timestamp'] : null;
+/**
+ * The "control" block for a response: the GPS_CONTROL_* settings, or
+ * when shedding load, slow down and hold backlog for GPS_SHED_RETRY_S.
+ *
+ * @return array|null  null when there is nothing to tell the device
+ */
+function deviceControl(bool $shedding = false): ?array
+{
+    if ($shedding) {
+        return [
+            "next_interval_ms" => min(60000, max(5000, GPS_SHED_RETRY_S * 1000)),
+            "flush_allowed" => 0,
+            "ttl_s" => GPS_SHED_RETRY_S
+        ];
+    }
 
-if (!$busId) {
-    http_response_code(400);
-    echo json_encode(["status" => "error", "message" => "Missing or invalid 'bus_id'"]);
-    exit;
+    $control = [];
+    if (GPS_CONTROL_INTERVAL_MS !== null) {
+        $control["next_interval_ms"] = (int) GPS_CONTROL_INTERVAL_MS;
+    }
+    if (GPS_CONTROL_BATCH_MAX !== null) {
+        $control["batch_max"] = (int) GPS_CONTROL_BATCH_MAX;
+    }
+    if (GPS_CONTROL_FLUSH_ALLOWED !== null) {
+        $control["flush_allowed"] = GPS_CONTROL_FLUSH_ALLOWED ? 1 : 0;
+    }
+    if (empty($control)) {
+        return null;
+    }
+    $control["ttl_s"] = (int) GPS_CONTROL_TTL_S;
+    return $control;
 }
 
-if ($latitude === null || $longitude === null) {
-    http_response_code(400);
-    echo json_encode(["status" => "error", "message" => "Missing 'latitude' and/or 'longitude'"]);
-    exit;
+// ── Shed Load ───────────────────────────────────────────────
+if (GPS_SHED_LOAD_AVG > 0 && function_exists('sys_getloadavg')) {
+    $load = sys_getloadavg();
+    if ($load !== false && $load[0] > GPS_SHED_LOAD_AVG) {
+        http_response_code(503);
+        header("Retry-After: " . GPS_SHED_RETRY_S);
+        echo json_encode([
+            "status" => "error",
+            "message" => "Server busy, retry later",
+            "control" => deviceControl(true)
+        ]);
+        exit;
+    }
 }
 
-// Basic coordinate sanity check (Nepal bounding box: ~26-31°N, 80-89°E)
-if ($latitude < 25 || $latitude > 32 || $longitude < 79 || $longitude > 90) {
-    http_response_code(400);
-    echo json_encode(["status" => "error", "message" => "Coordinates out of Nepal range"]);
-    exit;
+// ── Parse Input ─────────────────────────────────────────────
+$rawBody = file_get_contents("php://input");
+
+// Compressed body. A front end that already inflated it (e.g. Apache
+// mod_deflate as input filter) leaves plain bytes, so check the bytes too.
+$contentEncoding = strtolower(trim($_SERVER['HTTP_CONTENT_ENCODING'] ?? ''));
+$maxInflated = 1048576;     // Bytes; guards against decompression bombs
+if ($contentEncoding !== '' && $contentEncoding !== 'identity') {
+    $inflated = null;
+    if ($contentEncoding === 'gzip' || $contentEncoding === 'x-gzip') {
+        $inflated = strncmp($rawBody, "\x1f\x8b", 2) === 0
+            ? @gzdecode($rawBody, $maxInflated)
+            : $rawBody;
+    } elseif ($contentEncoding === 'deflate') {
+        $inflated = @gzuncompress($rawBody, $maxInflated);
+        if ($inflated === false) {
+            $inflated = @gzinflate($rawBody, $maxInflated);     // Raw DEFLATE
+        }
+    } else {
+        http_response_code(415);
+        echo json_encode(["status" => "error", "message" => "Unsupported Content-Encoding '$contentEncoding'"]);
+        exit;
+    }
+
+    if ($inflated === false) {
+        http_response_code(400);
+        echo json_encode(["status" => "error", "message" => "Corrupt or oversized $contentEncoding body"]);
+        exit;
+    }
+    $rawBody = $inflated;
 }
 
-// GPS quality check — if HDOP is too high, the fix is unreliable
-if ($hdop !== null && $hdop > 10) {
-    // Still accept but flag it
-    $gpsQuality = 'poor';
-} elseif ($hdop !== null && $hdop > 5) {
-    $gpsQuality = 'moderate';
+$contentType = $_SERVER['CONTENT_TYPE'] ?? '';
+$isTrackBlock = stripos($contentType, 'application/x-sawari-track') === 0;
+$isCbor = stripos($contentType, 'application/cbor') === 0;
+$isMsgpack = (bool) preg_match('#^application/(x-|vnd\.)?msgpack#i', $contentType);
+$isBackfill = $isTrackBlock && !empty($_SERVER['HTTP_X_BACKFILL']);
+$seqFloor = isset($_SERVER['HTTP_X_SEQ_FLOOR']) ? min(max((int) $_SERVER['HTTP_X_SEQ_FLOOR'], 0), 0xFFFFFFFF) : 0;
+$isBatch = false;
+$rejected = 0;
+
+// Batch uploads: one result per record ("ok" | "rejected" | "retry")
+$results = [];
+$errors = [];
+
+if ($isTrackBlock) {
+    $headerBusId = isset($_SERVER['HTTP_X_BUS_ID']) ? (int) $_SERVER['HTTP_X_BUS_ID'] : 0;
+    if (!$headerBusId) {
+        http_response_code(400);
+        echo json_encode(["status" => "error", "message" => "Missing or invalid 'X-Bus-Id' header"]);
+        exit;
+    }
+
+    $decoded = decodeTrackBlock($rawBody);
+
+    if ($decoded === null) {
+        http_response_code(400);
+        echo json_encode(["status" => "error", "message" => "Invalid track block"]);
+        exit;
+    }
+
+    // Bad samples inside a block are dropped, not fatal for the block
+    $samples = [];
+    foreach ($decoded as $raw) {
+        $raw['bus_id'] = $headerBusId;
+        $sample = normalizeSample($raw);
+        if (is_array($sample)) {
+            $samples[] = $sample;
+        } else {
+            $rejected++;
+        }
+    }
 } else {
-    $gpsQuality = 'good';
+    if ($isCbor || $isMsgpack) {
+        $input = decodeWireBody($rawBody, $isMsgpack);
+
+        if ($input === null) {
+            http_response_code(400);
+            echo json_encode(["status" => "error", "message" => "Invalid " . ($isCbor ? "CBOR" : "MessagePack") . " body"]);
+            exit;
+        }
+    } else {
+        $input = json_decode($rawBody, true);
+
+        if (json_last_error() !== JSON_ERROR_NONE) {
+            http_response_code(400);
+            echo json_encode(["status" => "error", "message" => "Invalid JSON: " . json_last_error_msg()]);
+            exit;
+        }
+    }
+
+    if (!isset($input['data']) || !is_array($input['data'])) {
+        http_response_code(400);
+        echo json_encode(["status" => "error", "message" => "Missing 'data' field"]);
+        exit;
+    }
+
+    if (array_key_exists(0, $input['data'])) {
+        // Batch: invalid records are rejected one by one, not the batch
+        $isBatch = true;
+        $samples = [];
+        foreach (array_values($input['data']) as $i => $record) {
+            $sample = is_array($record) ? normalizeSample($record) : "Record is not an object";
+            if (is_array($sample)) {
+                $sample['index'] = $i;
+                $samples[] = $sample;
+                $results[$i] = 'retry';     // Until stored
+            } else {
+                $results[$i] = 'rejected';
+                $errors[$i] = $sample;
+                $rejected++;
+            }
+        }
+    } else {
+        $sample = normalizeSample($input['data']);
+        if (!is_array($sample)) {
+            http_response_code(400);
+            echo json_encode(["status" => "error", "message" => $sample]);
+            exit;
+        }
+        $samples = [$sample];
+    }
+}
+
+$busId = $isTrackBlock ? $headerBusId : ($samples[0]['bus_id'] ?? 0);
+
+// A batch belongs to one vehicle
+if ($isBatch) {
+    foreach ($samples as $k => $sample) {
+        if ($sample['bus_id'] !== $busId) {
+            $results[$sample['index']] = 'rejected';
+            $errors[$sample['index']] = "bus_id differs from the rest of the batch";
+            $rejected++;
+            unset($samples[$k]);
+        }
+    }
+    $samples = array_values($samples);
 }
 
 // ── Connect to Database ─────────────────────────────────────
-require_once __DIR__ . '/config.php';
+if ($isBatch && (count($results) === 0 || count($results) > GPS_BATCH_MAX_RECORDS)) {
+    http_response_code(count($results) === 0 ? 400 : 413);
+    echo json_encode([
+        "status" => "error",
+        "message" => "Batch must hold 1 to " . GPS_BATCH_MAX_RECORDS . " records"
+    ]);
+    exit;
+}
+
+// Nothing valid in the batch: no database work, just the verdicts
+if ($isBatch && empty($samples)) {
+    echo json_encode([
+        "status" => "success",
+        "message" => "No valid records in batch",
+        "accepted" => 0,
+        "rejected" => $rejected,
+        "results" => $results,
+        "errors" => (object) $errors,
+        "server_time" => date("Y-m-d H:i:s")
+    ]);
+    exit;
+}
 
 try {
     $db = getDB();
@@ -132,67 +394,187 @@ if (!$vehicle) {
     exit;
 }
 
-// ── Update Vehicle GPS Position ─────────────────────────────
-$stmt = $db->prepare("UPDATE vehicles
-                      SET latitude = :lat,
-                          longitude = :lng,
-                          velocity = :vel,
-                          gps_active = 1,
-                          last_gps_update = NOW()
-                      WHERE vehicle_id = :id");
+// ── Store Samples and Update Vehicle (one transaction) ──────
+// Every sample goes into gps_samples. The newest stored sample moves the
+// vehicle, unless the table already holds a newer fix for it (an offline
+// backlog arriving after live data must not drag the bus back); a block
+// of only rejected samples changes nothing, and backfilled history never
+// moves it. In a batch, a record whose insert fails is rolled back alone
+// and reported as "retry"; any other failure rolls back the request.
+// A record whose seq is already stored is a duplicate: skipped, "ok".
+$stored = [];
+$latest = null;
+$duplicates = 0;
+$ackedSeq = null;
+$hasSeq = $seqFloor > 0;
+foreach ($samples as $sample) {
+    $hasSeq = $hasSeq || $sample['seq'] !== null;
+}
 
-$stmt->execute([
-    ':lat' => $latitude,
-    ':lng' => $longitude,
-    ':vel' => $speed,
-    ':id' => $busId
-]);
+try {
+    $db->beginTransaction();
 
-// ── Log to JSON File (rolling, last 500 entries) ────────────
-$logDir = __DIR__ . '/../logs';
-$logFile = $logDir . '/gps-device.json';
+    $newest = $db->prepare("SELECT MAX(device_ts) FROM gps_samples WHERE vehicle_id = :id");
+    $newest->execute([':id' => $busId]);
+    $storedTs = $newest->fetchColumn();
 
-if (!is_dir($logDir)) {
-    @mkdir($logDir, 0755, true);
-}
+    $insert = $db->prepare("INSERT INTO gps_samples
+                                (vehicle_id, latitude, longitude, speed, direction, altitude,
+                                 satellites, hdop, device_ts, seq, backfill)
+                            VALUES (:id, :lat, :lng, :speed, :dir, :alt, :sats, :hdop, :ts, :seq, :backfill)");
 
-$logEntry = [
-    "received_at" => date("Y-m-d H:i:s"),
-    "vehicle_id" => $busId,
-    "vehicle_name" => $vehicle['name'],
-    "latitude" => $latitude,
-    "longitude" => $longitude,
-    "speed" => $speed,
-    "direction" => $direction,
-    "altitude" => $altitude,
-    "satellites" => $satellites,
-    "hdop" => $hdop,
-    "gps_quality" => $gpsQuality,
-    "device_ts" => $deviceTs
-];
+    foreach ($samples as $sample) {
+        $db->exec("SAVEPOINT gps_sample");
+        try {
+            $insert->execute([
+                ':id' => $busId,
+                ':lat' => $sample['latitude'],
+                ':lng' => $sample['longitude'],
+                ':speed' => $sample['speed'],
+                ':dir' => $sample['direction'],
+                ':alt' => $sample['altitude'],
+                ':sats' => $sample['satellites'],
+                ':hdop' => $sample['hdop'],
+                ':ts' => deviceTimeToSql($sample['device_ts']),
+                ':seq' => $sample['seq'],
+                ':backfill' => $isBackfill ? 1 : 0
+            ]);
+        } catch (PDOException $e) {
+            $db->exec("ROLLBACK TO SAVEPOINT gps_sample");
+            if ($sample['seq'] !== null && ($e->errorInfo[1] ?? 0) == 1062) {
+                // Duplicate (vehicle_id, seq): already stored by an earlier request
+                $duplicates++;
+                if ($isBatch) {
+                    $results[$sample['index']] = 'ok';
+                }
+                continue;
+            }
+            if (!$isBatch) {
+                throw $e;       // Single records and blocks are all-or-nothing
+            }
+            continue;
+        }
+        $stored[] = $sample;
+        if ($isBatch) {
+            $results[$sample['index']] = 'ok';
+        }
+    }
 
-$existingLogs = [];
-if (file_exists($logFile)) {
-    $existingLogs = json_decode(file_get_contents($logFile), true);
-    if (!is_array($existingLogs)) {
-        $existingLogs = [];
+    foreach ($stored as $sample) {
+        if ($latest === null || strcmp((string) $sample['device_ts'], (string) $latest['device_ts']) >= 0) {
+            $latest = $sample;
+        }
     }
-}
 
-$existingLogs[] = $logEntry;
+    $latestTs = $latest !== null ? deviceTimeToSql($latest['device_ts']) : null;
+    $isNewest = $storedTs === null || $storedTs === false || $latestTs === null || $latestTs >= $storedTs;
 
-// Keep only the last 500 entries to prevent unbounded growth
-if (count($existingLogs) > 500) {
-    $existingLogs = array_slice($existingLogs, -500);
-}
+    if ($latest !== null && !$isBackfill && $isNewest) {
+        $stmt = $db->prepare("UPDATE vehicles
+                              SET latitude = :lat,
+                                  longitude = :lng,
+                                  velocity = :vel,
+                                  gps_active = 1,
+                                  last_gps_update = NOW()
+                              WHERE vehicle_id = :id");
+
+        $stmt->execute([
+            ':lat' => $latest['latitude'],
+            ':lng' => $latest['longitude'],
+            ':vel' => $latest['speed'],
+            ':id' => $busId
+        ]);
+    }
+
+    // Sequence watermark: everything below the device's floor counts as
+    // received, then walk up through the seqs stored since
+    if ($hasSeq) {
+        $seqRow = $db->prepare("SELECT acked_seq FROM gps_device_seq WHERE vehicle_id = :id FOR UPDATE");
+        $seqRow->execute([':id' => $busId]);
+        $ackedSeq = max((int) $seqRow->fetchColumn(), $seqFloor - 1);
+
+        $next = $db->prepare("SELECT seq FROM gps_samples
+                              WHERE vehicle_id = :id AND seq > :acked
+                              ORDER BY seq LIMIT 500");
+        do {
+            $next->execute([':id' => $busId, ':acked' => $ackedSeq]);
+            $seqs = $next->fetchAll(PDO::FETCH_COLUMN);
+            $walked = 0;
+            foreach ($seqs as $seq) {
+                if ((int) $seq !== $ackedSeq + 1) {
+                    break;
+                }
+                $ackedSeq++;
+                $walked++;
+            }
+        } while ($walked === 500);
+
+        $db->prepare("INSERT INTO gps_device_seq (vehicle_id, acked_seq) VALUES (:id, :acked)
+                      ON DUPLICATE KEY UPDATE acked_seq = GREATEST(acked_seq, VALUES(acked_seq))")
+           ->execute([':id' => $busId, ':acked' => $ackedSeq]);
+    }
 
-file_put_contents($logFile, json_encode($existingLogs, JSON_PRETTY_PRINT));
+    $db->commit();
+} catch (PDOException $e) {
+    if ($db->inTransaction()) {
+        $db->rollBack();
+    }
+    http_response_code(500);
+    echo json_encode(["status" => "error", "message" => "Database error — nothing stored, retry later"]);
+    exit;
+}
 
 // ── Respond Success ─────────────────────────────────────────
-echo json_encode([
+$response = [
     "status" => "success",
     "message" => "GPS position updated for '{$vehicle['name']}' (ID: $busId)",
     "vehicle_id" => $busId,
-    "gps_quality" => $gpsQuality,
+    "gps_quality" => $latest !== null ? $latest['gps_quality'] : null,
     "server_time" => date("Y-m-d H:i:s")
-]);
+];
+
+if ($isTrackBlock || $isBatch) {
+    $response["accepted"] = count($stored);
+    $response["rejected"] = $rejected;
+}
+
+$control = deviceControl();
+if ($control !== null) {
+    $response["control"] = $control;
+}
+
+if ($ackedSeq !== null) {
+    $response["acked_seq"] = $ackedSeq;
+    $response["duplicates"] = $duplicates;
+}
+
+if ($isBatch) {
+    $response["results"] = $results;
+    if (!empty($errors)) {
+        $response["errors"] = (object) $errors;     // Keyed by record index
+    }
+}
+
+// ── Hand Over a Pending Archive Backfill Request ────────────
+if (file_exists(GPS_BACKFILL_FILE)) {
+    $fp = fopen(GPS_BACKFILL_FILE, 'c+');
+    if ($fp && flock($fp, LOCK_EX)) {
+        $pending = json_decode(stream_get_contents($fp), true);
+        if (is_array($pending) && isset($pending[(string) $busId])) {
+            $response["backfill"] = [
+                "from" => (int) $pending[(string) $busId]['from'],
+                "to" => (int) $pending[(string) $busId]['to']
+            ];
+            unset($pending[(string) $busId]);
+            ftruncate($fp, 0);
+            rewind($fp);
+            fwrite($fp, json_encode($pending));
+        }
+        flock($fp, LOCK_UN);
+    }
+    if ($fp) {
+        fclose($fp);
+    }
+}
+
+echo json_encode($response);
@@ -13,6 +13,8 @@
  *   submit     – POST – Agent submits a vehicle
  *   gps_update – POST – Vehicle sends GPS position (lat/lng/velocity)
  *   live       – GET  – Public: returns all GPS-active vehicles with position
+ *   request_backfill – POST – Ask a GPS device to re-send a time range
+ *                             from its on-board archive (admin)
  */
 
 require_once __DIR__ . '/config.php';
@@ -414,6 +416,50 @@ switch ($action) {
         jsonSuccess('GPS tracking stopped.');
         break;
 
+    /* ── Request Archive Backfill (GPS device) ───────────── */
+    // The range is handed to the device in the response to its next POST
+    // to gps-device.php; the device then re-sends it as track blocks.
+    case 'request_backfill':
+        requireAdminAPI();
+        $vehicleId = postInt('vehicle_id');
+
+        // Unix seconds or a UTC date-time ("2026-02-19 09:00")
+        $parseTime = function (string $value) {
+            return ctype_digit($value) ? (int) $value : strtotime($value . ' UTC');
+        };
+        $from = $parseTime(postString('from'));
+        $to = $parseTime(postString('to'));
+
+        if (!$vehicleId)
+            jsonError('Vehicle ID required.');
+        if ($from === false || $to === false || $to < $from)
+            jsonError('Valid from/to date-times required (from <= to).');
+
+        if (!is_dir(dirname(GPS_BACKFILL_FILE)))
+            @mkdir(dirname(GPS_BACKFILL_FILE), 0755, true);
+
+        // Read, add and write under one lock (gps-device.php takes requests
+        // out of the same file), so no concurrent request is lost
+        $fp = @fopen(GPS_BACKFILL_FILE, 'c+');
+        if (!$fp || !flock($fp, LOCK_EX)) {
+            if ($fp)
+                fclose($fp);
+            jsonError('Could not store the backfill request.', 500);
+        }
+        $pending = json_decode(stream_get_contents($fp), true);
+        if (!is_array($pending))
+            $pending = [];
+        $pending[(string) $vehicleId] = ['from' => $from, 'to' => $to];
+        ftruncate($fp, 0);
+        rewind($fp);
+        fwrite($fp, json_encode($pending));
+        fflush($fp);
+        flock($fp, LOCK_UN);
+        fclose($fp);
+
+        jsonSuccess('Backfill requested.', ['from' => $from, 'to' => $to]);
+        break;
+
     default:
         jsonError('Unknown action.', 400);
 }
@@ -0,0 +1,678 @@
+/**
+ * ============================================================================
+ * SAWARI Bus Telemetry Device - Track Archive Implementation
+ * ============================================================================
+ *
+ * Append-only, time-indexed history of GPS fixes on LittleFS.
+ *
+ * Layout (all in ARCHIVE_DIR):
+ *   - <hour>.trk   track blocks of one UTC hour (hour = Unix time / 3600),
+ *                  each framed as [u16 length | 0x8000][block][u32 CRC32]
+ *                  like the offline queue segments
+ *   - <hour>.idx   one 8-byte entry per block: timestamp of its first
+ *                  sample and its offset in <hour>.trk
+ *   - hours.dat    the hours present with their size, CRC-protected and
+ *                  rewritten via a temp file + rename (once per hour)
+ *
+ * Lookup of a time range is a binary search over the hour list (in RAM)
+ * followed by a binary search over that hour's block index (fixed-width
+ * entries, read with seeks). Only the blocks overlapping the range are
+ * read and decoded.
+ *
+ * Writes never touch existing data: a block is appended to the hour file
+ * first and indexed second, so a power cut leaves at worst an unindexed
+ * block. When the archive grows past ARCHIVE_MAX_BYTES (or
+ * ARCHIVE_MAX_HOURS), whole hours are deleted oldest-first.
+ * ============================================================================
+ */
+
+#include "archive_handler.h"
+#include "config.h"
+#include "track_codec.h"
+#include <LittleFS.h>
+#include <algorithm>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// On-flash structures
+// ---------------------------------------------------------------------------
+struct __attribute__((packed)) ArchiveHour {
+    uint32_t hour;          // Unix time / 3600
+    uint32_t bytes;         // Size of <hour>.trk + <hour>.idx
+};
+
+struct __attribute__((packed)) ArchiveBlockRef {
+    uint32_t first;         // Timestamp of the block's first sample
+    uint32_t offset;        // Frame offset in <hour>.trk
+};
+static_assert(sizeof(ArchiveBlockRef) == 8, "ArchiveBlockRef must be 8 bytes");
+
+// Track frames: same layout as the offline queue segments
+#define ARCHIVE_FRAME_FLAG      0x8000
+#define ARCHIVE_FRAME_LEN_MASK  0x7FFF
+#define ARCHIVE_FRAME_OVERHEAD  6       // Length prefix + CRC trailer
+
+#define SECONDS_PER_HOUR        3600UL
+
+// --- Hour list (mounted from ARCHIVE_INDEX_FILE) ---
+static ArchiveHour _hours[ARCHIVE_MAX_HOURS];
+static int         _hourCount  = 0;
+static uint32_t    _totalBytes = 0;
+static uint32_t    _lastTs     = 0;     // Newest archived sample (flash or RAM)
+static bool        _ready      = false;
+
+// --- GPS time sanity (see archiveAppend) ---
+static bool          _lastTsLive  = false;  // _lastTs set by a fix this boot
+static unsigned long _lastTsAt    = 0;      // millis() when it was set
+static uint32_t      _behindTs    = 0;      // Last fix seen behind _lastTs
+static int           _behindCount = 0;      // Consecutive such fixes
+
+// --- Samples not sealed into a block yet ---
+static TrackPoint    _pending[TRACK_BLOCK_SAMPLES];
+static int           _pendingCount = 0;
+static unsigned long _pendingSince = 0;
+
+// --- Block buffers ---
+static uint8_t _blockBuf[TRACK_BLOCK_MAX_BYTES];   // Sealing and frame reads
+static uint8_t _outBuf[TRACK_BLOCK_MAX_BYTES];     // archiveReadBlock() result
+
+// ---------------------------------------------------------------------------
+// Internal helper: file path of an hour's track (.trk) or index (.idx) file
+// ---------------------------------------------------------------------------
+static void _hourPath(uint32_t hour, const char* ext, char* buf, size_t len) {
+    snprintf(buf, len, "%s/%08lu.%s", ARCHIVE_DIR, (unsigned long)hour, ext);
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: size of a file, 0 if it does not exist
+// ---------------------------------------------------------------------------
+static size_t _fileSize(const char* path) {
+    File f = LittleFS.open(path, "r");
+    if (!f) return 0;
+    size_t size = f.size();
+    f.close();
+    return size;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: persist the hour list (temp file + atomic rename)
+// ---------------------------------------------------------------------------
+static void _saveIndex() {
+    File f = LittleFS.open(ARCHIVE_INDEX_TMP_FILE, "w");
+    if (!f) {
+        Serial.println(F("[ARCHIVE] ERROR: Failed to write archive index"));
+        return;
+    }
+    size_t len = _hourCount * sizeof(ArchiveHour);
+    uint32_t crc = trackCrc32((const uint8_t*)_hours, len);
+    size_t written = f.write((const uint8_t*)_hours, len);
+    written += f.write((const uint8_t*)&crc, sizeof(crc));
+    f.close();
+
+    if (written == len + sizeof(crc)) {
+        LittleFS.rename(ARCHIVE_INDEX_TMP_FILE, ARCHIVE_INDEX_FILE);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: load the hour list. Returns false if it is missing,
+// corrupt or out of order (the caller then rebuilds it from the files).
+// ---------------------------------------------------------------------------
+static bool _loadIndex() {
+    File f = LittleFS.open(ARCHIVE_INDEX_FILE, "r");
+    if (!f) return false;
+
+    size_t size = f.size();
+    if (size < sizeof(uint32_t) || (size - sizeof(uint32_t)) % sizeof(ArchiveHour) != 0 ||
+        (size - sizeof(uint32_t)) / sizeof(ArchiveHour) > ARCHIVE_MAX_HOURS) {
+        f.close();
+        return false;
+    }
+
+    int count = (size - sizeof(uint32_t)) / sizeof(ArchiveHour);
+    size_t len = count * sizeof(ArchiveHour);
+    uint32_t crc = 0;
+    bool ok = f.read((uint8_t*)_hours, len) == len &&
+              f.read((uint8_t*)&crc, sizeof(crc)) == sizeof(crc);
+    f.close();
+
+    if (!ok || crc != trackCrc32((const uint8_t*)_hours, len)) return false;
+    for (int i = 1; i < count; i++) {
+        if (_hours[i].hour <= _hours[i - 1].hour) return false;
+    }
+
+    _hourCount = count;
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: delete the oldest hour's files (index saved by caller)
+// ---------------------------------------------------------------------------
+static void _dropOldestHour() {
+    char path[32];
+    _hourPath(_hours[0].hour, "trk", path, sizeof(path));
+    LittleFS.remove(path);
+    _hourPath(_hours[0].hour, "idx", path, sizeof(path));
+    LittleFS.remove(path);
+
+    _totalBytes -= std::min(_totalBytes, _hours[0].bytes);
+    memmove(&_hours[0], &_hours[1], (_hourCount - 1) * sizeof(ArchiveHour));
+    _hourCount--;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: delete the newest hour's files (index saved by caller)
+// ---------------------------------------------------------------------------
+static void _dropNewestHour() {
+    char path[32];
+    ArchiveHour& h = _hours[_hourCount - 1];
+    _hourPath(h.hour, "trk", path, sizeof(path));
+    LittleFS.remove(path);
+    _hourPath(h.hour, "idx", path, sizeof(path));
+    LittleFS.remove(path);
+
+    _totalBytes -= std::min(_totalBytes, h.bytes);
+    _hourCount--;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: rebuild the hour list from the files in ARCHIVE_DIR.
+// Only needed when the index is lost or corrupt.
+// ---------------------------------------------------------------------------
+static void _rebuildIndex() {
+    _hourCount = 0;
+
+    File dir = LittleFS.open(ARCHIVE_DIR);
+    if (!dir || !dir.isDirectory()) return;
+
+    std::vector<uint32_t> hours;
+    File entry = dir.openNextFile();
+    while (entry) {
+        const char* name = entry.name();
+        uint32_t hour = strtoul(name, nullptr, 10);
+        bool isTrack = strstr(name, ".trk") != nullptr;
+        entry.close();
+        if (hour > 0 && isTrack) {
+            hours.push_back(hour);
+        }
+        entry = dir.openNextFile();
+    }
+    dir.close();
+    std::sort(hours.begin(), hours.end());
+
+    // Keep the newest ARCHIVE_MAX_HOURS hours
+    char path[32];
+    size_t excess = hours.size() > ARCHIVE_MAX_HOURS ? hours.size() - ARCHIVE_MAX_HOURS : 0;
+    for (size_t i = 0; i < hours.size(); i++) {
+        if (i < excess) {
+            _hourPath(hours[i], "trk", path, sizeof(path));
+            LittleFS.remove(path);
+            _hourPath(hours[i], "idx", path, sizeof(path));
+            LittleFS.remove(path);
+            continue;
+        }
+        ArchiveHour& h = _hours[_hourCount++];
+        h.hour = hours[i];
+        _hourPath(h.hour, "trk", path, sizeof(path));
+        h.bytes = _fileSize(path);
+        _hourPath(h.hour, "idx", path, sizeof(path));
+        h.bytes += _fileSize(path);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: read and verify the frame at `offset` into _blockBuf.
+// @return block length, or 0 if the frame is torn or corrupt
+// ---------------------------------------------------------------------------
+static size_t _readFrame(File& trk, uint32_t offset) {
+    uint8_t header[2];
+    if (!trk.seek(offset) || trk.read(header, sizeof(header)) != sizeof(header)) return 0;
+
+    uint16_t prefix = header[0] | (header[1] << 8);
+    size_t len = prefix & ARCHIVE_FRAME_LEN_MASK;
+    if (!(prefix & ARCHIVE_FRAME_FLAG) || len == 0 || len > sizeof(_blockBuf)) return 0;
+
+    uint8_t trailer[4];
+    if (trk.read(_blockBuf, len) != len || trk.read(trailer, sizeof(trailer)) != sizeof(trailer)) return 0;
+
+    uint32_t crc = trailer[0] | (trailer[1] << 8) | ((uint32_t)trailer[2] << 16) |
+                   ((uint32_t)trailer[3] << 24);
+    return crc == trackCrc32(_blockBuf, len) ? len : 0;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: the newest hour may have been cut short by a power cut.
+// Refresh its size, drop a torn index entry and find the newest sample.
+// ---------------------------------------------------------------------------
+static void _mountLastHour() {
+    ArchiveHour& h = _hours[_hourCount - 1];
+    char trkPath[32], idxPath[32];
+    _hourPath(h.hour, "trk", trkPath, sizeof(trkPath));
+    _hourPath(h.hour, "idx", idxPath, sizeof(idxPath));
+
+    size_t idxSize = _fileSize(idxPath);
+    size_t refs = idxSize / sizeof(ArchiveBlockRef);
+
+    // A torn index entry would misalign every entry appended after it:
+    // copy the whole entries to a temp file and rename it over the index
+    if (idxSize % sizeof(ArchiveBlockRef) != 0) {
+        File src = LittleFS.open(idxPath, "r");
+        File dst = LittleFS.open(ARCHIVE_INDEX_TMP_FILE, "w");
+        size_t keep = refs * sizeof(ArchiveBlockRef);
+        size_t copied = 0;
+        while (src && dst && copied < keep) {
+            size_t chunk = std::min(keep - copied, sizeof(_blockBuf));
+            if (src.read(_blockBuf, chunk) != chunk || dst.write(_blockBuf, chunk) != chunk) break;
+            copied += chunk;
+        }
+        if (src) src.close();
+        if (dst) dst.close();
+        if (copied == keep) {
+            LittleFS.rename(ARCHIVE_INDEX_TMP_FILE, idxPath);
+        }
+        Serial.println(F("[ARCHIVE] Repaired torn block index entry"));
+    }
+
+    h.bytes = _fileSize(trkPath) + refs * sizeof(ArchiveBlockRef);
+
+    // Samples must keep moving forward from the newest archived one
+    _lastTs = h.hour * SECONDS_PER_HOUR - 1;
+    if (refs == 0) return;
+
+    File idx = LittleFS.open(idxPath, "r");
+    File trk = LittleFS.open(trkPath, "r");
+    ArchiveBlockRef ref;
+    if (idx && idx.seek((refs - 1) * sizeof(ref)) &&
+        idx.read((uint8_t*)&ref, sizeof(ref)) == sizeof(ref)) {
+        _lastTs = ref.first;
+
+        size_t len = trk ? _readFrame(trk, ref.offset) : 0;
+        TrackDecoder dec;
+        TrackPoint point;
+        if (len > 0 && trackDecoderBegin(&dec, _blockBuf, len)) {
+            while (trackDecoderNext(&dec, &point)) {
+                _lastTs = point.timestamp;
+            }
+        }
+    }
+    if (idx) idx.close();
+    if (trk) trk.close();
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: delete the oldest hours while over the size cap
+// ---------------------------------------------------------------------------
+static void _enforceCap() {
+    int dropped = 0;
+    while (_hourCount > 1 && _totalBytes > ARCHIVE_MAX_BYTES) {
+        _dropOldestHour();
+        dropped++;
+    }
+    if (dropped > 0) {
+        _saveIndex();
+        Serial.print(F("[ARCHIVE] Size cap reached — deleted "));
+        Serial.print(dropped);
+        Serial.println(F(" oldest hour(s)"));
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: GPS time went back to `ts` and stayed there, so the
+// samples at or after it carry a bogus future time. Drop them — whole
+// hours on flash, since blocks are never rewritten — so `ts` can follow.
+// ---------------------------------------------------------------------------
+static void _rewind(uint32_t ts) {
+    int keep = 0;
+    while (keep < _pendingCount && _pending[keep].timestamp < ts) keep++;
+    int droppedSamples = _pendingCount - keep;
+    _pendingCount = keep;
+
+    uint32_t hour = ts / SECONDS_PER_HOUR;
+    int droppedHours = 0;
+    while (_hourCount > 0 && _hours[_hourCount - 1].hour > hour) {
+        _dropNewestHour();
+        droppedHours++;
+    }
+    if (_hourCount > 0 && _hours[_hourCount - 1].hour == hour) {
+        _mountLastHour();
+        if (_lastTs >= ts) {
+            _dropNewestHour();
+            droppedHours++;
+        }
+    }
+
+    _lastTs = 0;
+    if (_hourCount > 0) _mountLastHour();
+    if (_pendingCount > 0) _lastTs = _pending[_pendingCount - 1].timestamp;
+
+    _totalBytes = 0;
+    for (int i = 0; i < _hourCount; i++) {
+        _totalBytes += _hours[i].bytes;
+    }
+    _saveIndex();
+
+    Serial.print(F("[ARCHIVE] GPS time went back — dropped "));
+    Serial.print(droppedHours);
+    Serial.print(F(" hour(s) and "));
+    Serial.print(droppedSamples);
+    Serial.println(F(" buffered sample(s) with a future time"));
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: encode the buffered samples into one block and append
+// it to its hour. The frame is written before its index entry, so a
+// power cut can lose the block but never index a torn one.
+// ---------------------------------------------------------------------------
+static void _sealPending() {
+    if (_pendingCount == 0) return;
+
+    uint32_t hour = _pending[0].timestamp / SECONDS_PER_HOUR;
+    if (_hourCount == 0 || _hours[_hourCount - 1].hour != hour) {
+        if (_hourCount >= ARCHIVE_MAX_HOURS) {
+            _dropOldestHour();
+        }
+        _hours[_hourCount].hour  = hour;
+        _hours[_hourCount].bytes = 0;
+        _hourCount++;
+        _saveIndex();
+    }
+
+    TrackEncoder enc;
+    trackEncoderBegin(&enc, _blockBuf);
+    for (int i = 0; i < _pendingCount; i++) {
+        trackEncoderAdd(&enc, &_pending[i]);
+    }
+    ArchiveBlockRef ref = { _pending[0].timestamp, 0 };
+    _pendingCount = 0;
+
+    char path[32];
+    _hourPath(hour, "trk", path, sizeof(path));
+    File trk = LittleFS.open(path, "a");
+    if (!trk) {
+        Serial.println(F("[ARCHIVE] ERROR: Failed to open hour file"));
+        return;
+    }
+    ref.offset = trk.size();
+
+    uint16_t prefix = enc.len | ARCHIVE_FRAME_FLAG;
+    uint32_t crc = trackCrc32(_blockBuf, enc.len);
+    uint8_t header[2]  = { (uint8_t)(prefix & 0xFF), (uint8_t)(prefix >> 8) };
+    uint8_t trailer[4] = { (uint8_t)crc, (uint8_t)(crc >> 8),
+                           (uint8_t)(crc >> 16), (uint8_t)(crc >> 24) };
+    size_t written = trk.write(header, sizeof(header));
+    written += trk.write(_blockBuf, enc.len);
+    written += trk.write(trailer, sizeof(trailer));
+    trk.close();
+
+    ArchiveHour& h = _hours[_hourCount - 1];
+    h.bytes += written;
+    _totalBytes += written;
+
+    if (written != enc.len + ARCHIVE_FRAME_OVERHEAD) {
+        Serial.println(F("[ARCHIVE] ERROR: Short write — block not indexed"));
+        return;
+    }
+
+    _hourPath(hour, "idx", path, sizeof(path));
+    File idx = LittleFS.open(path, "a");
+    if (idx) {
+        written = idx.write((const uint8_t*)&ref, sizeof(ref));
+        idx.close();
+        h.bytes += written;
+        _totalBytes += written;
+    }
+
+    _enforceCap();
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: pass the samples of one hour with from <= t <= to to
+// `take`. Returns false once the range or `take` is exhausted.
+// ---------------------------------------------------------------------------
+static bool _readHour(uint32_t hour, uint32_t from, uint32_t to,
+                      const std::function<bool(const TrackPoint*)>& take) {
+    char trkPath[32], idxPath[32];
+    _hourPath(hour, "trk", trkPath, sizeof(trkPath));
+    _hourPath(hour, "idx", idxPath, sizeof(idxPath));
+
+    File idx = LittleFS.open(idxPath, "r");
+    if (!idx) return true;
+    File trk = LittleFS.open(trkPath, "r");
+    if (!trk) {
+        idx.close();
+        return true;
+    }
+
+    // Binary search: first block that starts after `from`. The block
+    // before it is the one that may contain `from`.
+    size_t refs = idx.size() / sizeof(ArchiveBlockRef);
+    size_t lo = 0, hi = refs;
+    ArchiveBlockRef ref;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (!idx.seek(mid * sizeof(ref)) || idx.read((uint8_t*)&ref, sizeof(ref)) != sizeof(ref)) break;
+        if (ref.first <= from) lo = mid + 1;
+        else hi = mid;
+    }
+
+    bool more = true;
+    idx.seek((lo > 0 ? lo - 1 : 0) * sizeof(ref));
+    while (more && idx.read((uint8_t*)&ref, sizeof(ref)) == sizeof(ref)) {
+        if (ref.first > to) {
+            more = false;
+            break;
+        }
+
+        size_t len = _readFrame(trk, ref.offset);
+        TrackDecoder dec;
+        if (len == 0 || !trackDecoderBegin(&dec, _blockBuf, len)) continue;   // Skip a bad block
+
+        TrackPoint point;
+        while (more && trackDecoderNext(&dec, &point)) {
+            if (point.timestamp < from) continue;
+            if (point.timestamp > to) {
+                more = false;
+                break;
+            }
+            more = take(&point);
+        }
+    }
+
+    idx.close();
+    trk.close();
+    return more;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: range read shared by archiveRead() / archiveReadBlock()
+// ---------------------------------------------------------------------------
+static int _read(uint32_t* from, uint32_t to,
+                 const std::function<void(const TrackPoint*)>& emit, int maxSamples) {
+    if (!_ready || *from > to || maxSamples <= 0) return 0;
+
+    int count = 0;
+    uint32_t next = *from;
+    std::function<bool(const TrackPoint*)> take = [&](const TrackPoint* point) -> bool {
+        emit(point);
+        count++;
+        next = point->timestamp + 1;
+        return count < maxSamples;
+    };
+
+    // Binary search: first archived hour at or after the one holding `from`
+    uint32_t fromHour = *from / SECONDS_PER_HOUR;
+    int i = std::lower_bound(_hours, _hours + _hourCount, fromHour,
+                             [](const ArchiveHour& h, uint32_t hour) { return h.hour < hour; }) - _hours;
+
+    bool more = true;
+    for (; more && i < _hourCount && _hours[i].hour <= to / SECONDS_PER_HOUR; i++) {
+        more = _readHour(_hours[i].hour, *from, to, take);
+    }
+
+    // Then the samples still buffered in RAM (newer than anything on flash)
+    for (int k = 0; more && k < _pendingCount; k++) {
+        if (_pending[k].timestamp < *from) continue;
+        if (_pending[k].timestamp > to) break;
+        more = take(&_pending[k]);
+    }
+
+    *from = next;
+    return count;
+}
+
+// ============================================================================
+// PUBLIC API
+// ============================================================================
+
+bool archiveInit() {
+    if (!LittleFS.exists(ARCHIVE_DIR)) {
+        LittleFS.mkdir(ARCHIVE_DIR);
+    }
+
+    _pendingCount = 0;
+    _lastTs = 0;
+    _lastTsLive = false;
+    _behindCount = 0;
+
+    if (!_loadIndex()) {
+        Serial.println(F("[ARCHIVE] Rebuilding archive index from hour files..."));
+        _rebuildIndex();
+        _saveIndex();
+    }
+    if (_hourCount > 0) {
+        _mountLastHour();
+    }
+
+    _totalBytes = 0;
+    for (int i = 0; i < _hourCount; i++) {
+        _totalBytes += _hours[i].bytes;
+    }
+    _ready = true;
+    _enforceCap();
+
+    Serial.print(F("[ARCHIVE] Archive holds "));
+    Serial.print(_hourCount);
+    Serial.print(F(" hours ("));
+    Serial.print(_totalBytes);
+    Serial.println(F(" bytes)"));
+    return true;
+}
+
+bool archiveAppend(const TelemetryData* data) {
+    if (!_ready) return false;
+
+    TrackPoint point;
+    trackPointFromTelemetry(data, &point);
+    if (point.timestamp < ARCHIVE_MIN_EPOCH) return false;
+
+    // Within one boot GPS time cannot run ahead of the clock: a fix far
+    // past the last one is a bad decode, not progress
+    if (_lastTsLive &&
+        point.timestamp > _lastTs + (millis() - _lastTsAt) / 1000 + ARCHIVE_FUTURE_SLACK_S) {
+        return false;
+    }
+
+    // Fixes must move forward, but a steady run of them behind the newest
+    // archived one (possibly restored from flash) means that one was bogus
+    if (point.timestamp <= _lastTs) {
+        if (point.timestamp + ARCHIVE_FUTURE_SLACK_S >= _lastTs) return false;
+        _behindCount = (_behindCount > 0 && point.timestamp > _behindTs) ? _behindCount + 1 : 1;
+        _behindTs = point.timestamp;
+        if (_behindCount < ARCHIVE_REWIND_FIXES) return false;
+        _rewind(point.timestamp);
+    }
+    _behindCount = 0;
+
+    // Blocks never span two hours
+    if (_pendingCount > 0 &&
+        point.timestamp / SECONDS_PER_HOUR != _pending[0].timestamp / SECONDS_PER_HOUR) {
+        _sealPending();
+    }
+
+    if (_pendingCount == 0) {
+        _pendingSince = millis();
+    }
+    _pending[_pendingCount++] = point;
+    _lastTs = point.timestamp;
+    _lastTsLive = true;
+    _lastTsAt = millis();
+
+    if (_pendingCount >= TRACK_BLOCK_SAMPLES) {
+        _sealPending();
+    }
+    return true;
+}
+
+void archiveUpdate() {
+    if (_pendingCount > 0 && millis() - _pendingSince >= ARCHIVE_SEAL_MS) {
+        _sealPending();
+    }
+}
+
+void archiveSync() {
+    _sealPending();
+}
+
+int archiveRead(uint32_t* from, uint32_t to,
+                std::function<void(const TelemetryData*)> emit, int maxSamples) {
+    return _read(from, to, [&](const TrackPoint* point) {
+        TelemetryData data;
+        trackPointToTelemetry(point, &data);
+        emit(&data);
+    }, maxSamples);
+}
+
+int archiveReadBlock(uint32_t* from, uint32_t to, const uint8_t** block, size_t* len) {
+    TrackEncoder enc;
+    trackEncoderBegin(&enc, _outBuf);
+
+    int count = _read(from, to, [&](const TrackPoint* point) {
+        trackEncoderAdd(&enc, point);
+    }, TRACK_BLOCK_SAMPLES);
+
+    *block = _outBuf;
+    *len = enc.len;
+    return count;
+}
+
+bool archiveGetSpan(uint32_t* first, uint32_t* last) {
+    uint32_t from = 0;
+    uint32_t oldest = 0;
+    if (_read(&from, UINT32_MAX, [&](const TrackPoint* point) { oldest = point->timestamp; }, 1) == 0) {
+        return false;
+    }
+    *first = oldest;
+    *last = _lastTs;
+    return true;
+}
+
+int archiveGetHours() {
+    return _hourCount;
+}
+
+uint32_t archiveGetBytes() {
+    return _totalBytes;
+}
+
+void archiveListHours(std::function<void(uint32_t, uint32_t)> hourFunc) {
+    char path[32];
+    for (int i = 0; i < _hourCount; i++) {
+        _hourPath(_hours[i].hour, "trk", path, sizeof(path));
+        hourFunc(_hours[i].hour, _fileSize(path));
+    }
+}
+
+int archiveReadHour(uint32_t hour, uint32_t offset, uint8_t* buf, size_t len) {
+    char path[32];
+    _hourPath(hour, "trk", path, sizeof(path));
+
+    File f = LittleFS.open(path, "r");
+    if (!f) return -1;
+
+    int n = 0;
+    if (offset < f.size() && f.seek(offset)) {
+        n = f.read(buf, std::min(len, (size_t)(f.size() - offset)));
+    }
+    f.close();
+    return n;
+}
@@ -0,0 +1,107 @@
+/**
+ * ============================================================================
+ * SAWARI Bus Telemetry Device - Track Archive Header
+ * ============================================================================
+ * Keeps a multi-day history of GPS fixes on LittleFS, independent of the
+ * offline queue. Data stays here after it has been uploaded, so the device
+ * can answer "where was the bus at ..." over serial and re-send a time
+ * range when the server requests a backfill.
+ * ============================================================================
+ */
+
+#ifndef ARCHIVE_HANDLER_H
+#define ARCHIVE_HANDLER_H
+
+#include <Arduino.h>
+#include <functional>
+#include "gps_handler.h"
+
+/**
+ * Load the archive index. Call after storageInit() (LittleFS mounted).
+ * @return true if the archive is usable
+ */
+bool archiveInit();
+
+/**
+ * Add a fix to the archive. Samples must move forward in time; a fix
+ * that is not newer than the last archived one is ignored, as is one
+ * further ahead than the uptime since then allows. After
+ * ARCHIVE_REWIND_FIXES fixes in a row well behind the last archived
+ * one, the samples newer than them are dropped and archiving resumes.
+ * Samples are buffered in RAM and sealed into a track block per
+ * TRACK_BLOCK_SAMPLES, per UTC hour or after ARCHIVE_SEAL_MS.
+ *
+ * @param data  pointer to the telemetry sample to archive
+ * @return true if the sample was accepted
+ */
+bool archiveAppend(const TelemetryData* data);
+
+/**
+ * Seal buffered samples once they are older than ARCHIVE_SEAL_MS.
+ * Call every loop pass.
+ */
+void archiveUpdate();
+
+/**
+ * Seal buffered samples now (e.g. before a deliberate restart).
+ */
+void archiveSync();
+
+/**
+ * Read archived samples with from <= timestamp <= to, oldest first.
+ * The start is located by binary search, so each call costs the same
+ * however far back the range begins.
+ *
+ * @param from        in: first Unix time wanted; out: just past the last
+ *                    sample returned, to resume the read with
+ * @param to          last Unix time wanted (inclusive)
+ * @param emit        called once per sample
+ * @param maxSamples  stop after this many samples
+ * @return number of samples returned (0 = range exhausted)
+ */
+int archiveRead(uint32_t* from, uint32_t to,
+                std::function<void(const TelemetryData*)> emit, int maxSamples);
+
+/**
+ * Like archiveRead(), but encodes up to TRACK_BLOCK_SAMPLES samples into
+ * one track block for upload. The block stays valid until the next call.
+ *
+ * @param from   in/out as for archiveRead()
+ * @param to     last Unix time wanted (inclusive)
+ * @param block  receives a pointer to the encoded block
+ * @param len    receives the block length in bytes
+ * @return number of samples in the block (0 = range exhausted)
+ */
+int archiveReadBlock(uint32_t* from, uint32_t to, const uint8_t** block, size_t* len);
+
+/**
+ * Get the time span held by the archive.
+ * @param first  receives the Unix time of the oldest sample
+ * @param last   receives the Unix time of the newest sample
+ * @return false if the archive is empty
+ */
+bool archiveGetSpan(uint32_t* first, uint32_t* last);
+
+/**
+ * Get the number of hours held by the archive.
+ */
+int archiveGetHours();
+
+/**
+ * Get the archive size in bytes (track + block index files).
+ */
+uint32_t archiveGetBytes();
+
+/**
+ * List the archived hours for a bulk offload, oldest first.
+ * @param hourFunc  called with (hour = Unix time / 3600, track file bytes)
+ */
+void archiveListHours(std::function<void(uint32_t, uint32_t)> hourFunc);
+
+/**
+ * Read raw bytes of an hour's track file (CRC-framed blocks).
+ * @return bytes read, 0 at the end, -1 if the hour no longer exists
+ */
+int archiveReadHour(uint32_t hour, uint32_t offset, uint8_t* buf, size_t len);
+
+#endif // ARCHIVE_HANDLER_H
@@ -73,6 +73,158 @@
 // HTTP request timeout in milliseconds
 #define HTTP_TIMEOUT        5000
 
+// POSTs reuse one keep-alive connection to the API host. It is reopened
+// after this much idle time (or at once if the server closed it).
+#define HTTP_KEEPALIVE_IDLE_MS  30000
+
+// How long the API host's resolved address is reused before a new lookup
+#define HTTP_DNS_TTL_MS         600000      // 10 minutes
+
+// Response bytes kept for parsing (results, backfill); the rest is skipped
+#define HTTP_RESPONSE_MAX       2048
+
+// gzip batch request bodies of at least HTTP_COMPRESS_MIN_BYTES (in
+// practice: backlog batches, ~5x smaller as JSON and ~1.5x as CBOR /
+// MessagePack; a live fix stays plain, track blocks are never gzipped).
+// Only used once the server has answered with "Accept-Encoding: gzip",
+// so devices and servers without it keep working. 0 = never compress.
+// Costs 12KB of match tables (deflate_codec.h) + a QUEUE_BATCH_MAX_BYTES
+// output buffer.
+#define HTTP_COMPRESS           1
+#define HTTP_COMPRESS_MIN_BYTES 512
+
+// HTTPS for the API connection (tls_client.h): set API_ENDPOINT to
+// "https://..." and paste the server's certificate (or the CA that signs
+// it) into server_cert.h. Nothing else is trusted: the certificate is
+// pinned at build time. The TLS session is kept and resumed on every
+// reconnect (session ID or ticket), so only the first connect after boot
+// pays for a full handshake; the keep-alive connection carries all POSTs
+// in between. Only the HTTP connection is encrypted: MQTT_TRANSPORT and
+// UDP_TELEMETRY would send positions in cleartext, so they cannot be
+// combined with HTTP_TLS.
+#define HTTP_TLS                0
+#define HTTP_TLS_SESSION_REUSE  1
+
+// Body format of live fixes and offline queue batches (wire_codec.h):
+//   WIRE_FORMAT_JSON     {"data":{...}} text, ~190 bytes per fix; any server
+//   WIRE_FORMAT_CBOR     application/cbor, ~30 bytes per fix
+//   WIRE_FORMAT_MSGPACK  application/msgpack, ~30 bytes per fix
+// The binary formats need a gps-device.php that decodes them (api/
+// gps-decode.php); an older server rejects every fix. Upgrade the server
+// first, then switch devices over. JSON stays the default so a device can
+// be flashed before its server is upgraded.
+#define WIRE_FORMAT_JSON        0
+#define WIRE_FORMAT_CBOR        1
+#define WIRE_FORMAT_MSGPACK     2
+#define WIRE_FORMAT             WIRE_FORMAT_JSON
+
+// Circuit breaker: after BREAKER_FAILURES uploads in a row fail at the
+// server (no connection, no answer, HTTP 5xx / 408 / 429), stop trying.
+// Live fixes go straight to the offline queue and flushes pause. After a
+// backoff one request goes through as a probe. If it fails, the backoff
+// doubles, up to BREAKER_MAX_MS. Every wait is a random 50-100% of the
+// backoff, so a fleet does not return to a restarted server all at once.
+// Other 4xx answers mean the server is up and do not count.
+#define BREAKER_FAILURES        3
+#define BREAKER_BASE_MS         15000
+#define BREAKER_MAX_MS          600000      // 10 minutes
+
+// ============================================================================
+// SENDER TASK
+// ============================================================================
+// Uploads run in a FreeRTOS task of their own, pinned to core 0 (WiFi/lwIP
+// core; the Arduino loop runs on core 1), so a slow server or a half-dead
+// AP never stalls the GPS feed, display or BOOT button.
+#define SENDER_TASK_CORE        0
+#define SENDER_TASK_PRIORITY    1
+#define SENDER_TASK_STACK       (HTTP_TLS ? 12288 : 8192)  // Bytes (TLS handshakes need more)
+
+// Live fixes waiting for the sender task. When it is full (the server is
+// slow), new fixes go straight to the offline queue instead.
+#define SENDER_QUEUE_DEPTH      8
+
+// ============================================================================
+// UDP TELEMETRY
+// ============================================================================
+// Send live fixes as UDP datagrams (udp_protocol.h) to UDP_PORT on the API
+// host instead of one HTTP POST each (1). No handshake, no headers, no
+// retransmit stalls on a flaky AP. The receiver acknowledges sequence
+// ranges; a fix not acknowledged within UDP_ACK_TIMEOUT_MS goes to the
+// offline queue, which still drains over HTTP. Requires a UDP receiver
+// on the API host running with --forward to api/gps-device.php
+// (tools/sawari-udp-receiver.cpp): it acknowledges a fix only after the API
+// stored it. Without --forward fixes only reach its JSONL output, never
+// gps_samples.
+#define UDP_TELEMETRY           0
+#define UDP_PORT                5684
+
+// Unacknowledged fixes kept in flight. Every datagram repeats all of them,
+// so a lost datagram is made up by the next one. When the window is full,
+// new fixes go to the offline queue.
+#define UDP_WINDOW              8
+
+// Send the unacknowledged fixes again after this long without an ACK
+#define UDP_RESEND_MS           1000
+
+// Give up on a fix (→ offline queue) this long after it was first sent
+#define UDP_ACK_TIMEOUT_MS      15000
+
+// Sender task wake-up period while UDP is on (to read ACKs)
+#define UDP_POLL_MS             20
+
+// ============================================================================
+// MQTT TRANSPORT
+// ============================================================================
+// Publish over one long-lived MQTT 3.1.1 connection to a broker instead of
+// HTTP POSTs (1). Everything goes out QoS 1 under
+// MQTT_TOPIC_PREFIX "<BUS_ID>/":
+//   live      one fix (wire_codec.h body)
+//   batch     offline queue batch (wire_codec.h body)
+//   track     offline queue track block (track_codec.h)
+//   backfill  archived track block requested by the server
+// and the device subscribes to "<BUS_ID>/cmd" for server messages, e.g.
+// {"backfill":{"from":t,"to":t}}. The session is persistent (clean
+// session off, fixed client id "sawari-bus-<BUS_ID>"): the subscription
+// and commands published while the bus was away survive WiFi drops, and
+// unacknowledged fixes are published again (DUP) on reconnect.
+// The broker does not store anything: run tools/sawari-mqtt-bridge.cpp
+// next to it (--format matching WIRE_FORMAT) to forward every message into
+// api/gps-device.php; without it no MQTT fix reaches gps_samples. The
+// bridge acknowledges a message to the broker only once the API took it,
+// so the broker holds it until then. The broker's PUBACK counts as
+// delivered here, so records the server rejects are only logged by the
+// bridge. Not combined with UDP_TELEMETRY.
+#define MQTT_TRANSPORT          0
+#define MQTT_HOST               "zenithkandel.com.np"
+#define MQTT_PORT               1883
+#define MQTT_USER               ""          // "" = no username / password
+#define MQTT_PASSWORD           ""
+#define MQTT_TOPIC_PREFIX       "sawari/bus/"
+
+// Broker keep-alive: a PINGREQ goes out after half of it without traffic
+#define MQTT_KEEPALIVE_S        60
+
+// Live fixes published but not yet acknowledged (PUBACK). When it is
+// full, new fixes go to the offline queue.
+#define MQTT_MAX_INFLIGHT       8
+
+// Wait between attempts to reach the broker (longer once the circuit
+// breaker has opened, see BREAKER_FAILURES)
+#define MQTT_RECONNECT_MS       5000
+
+// Largest incoming packet kept (commands); longer ones are skipped
+#define MQTT_RX_MAX             512
+
+// Sender task wake-up period while MQTT is on (PUBACKs, commands, pings)
+#define MQTT_POLL_MS            20
+
+#if MQTT_TRANSPORT && UDP_TELEMETRY
+#error "Enable either MQTT_TRANSPORT or UDP_TELEMETRY, not both"
+#endif
+#if HTTP_TLS && (MQTT_TRANSPORT || UDP_TELEMETRY)
+#error "HTTP_TLS cannot be combined with MQTT_TRANSPORT or UDP_TELEMETRY (both are plaintext)"
+#endif
+
 // ============================================================================
 // TIMING INTERVALS (all in milliseconds)
 // ============================================================================
@@ -82,12 +234,65 @@
 // How often to refresh the OLED display
 #define DISPLAY_UPDATE_INTERVAL     500
 
-// How often to check WiFi connectivity and retry connection
+// How often to refresh the WiFi LED / SSID and log the offline state.
+// Losing and regaining the link is handled from the WiFi events instead,
+// on the next loop pass.
 #define WIFI_CHECK_INTERVAL         10000       // 10 seconds
 
 // How often to attempt flushing the offline queue
 #define QUEUE_FLUSH_INTERVAL        15000
 
+// Flush work per upload. While a backlog drains, the sender task gets one
+// bounded upload at a time: one track block, or in batch mode one batch
+// POST of up to this many records.
+#define QUEUE_FLUSH_BATCH_RECORDS   40
+
+// Uploads a backlog flush keeps in flight on the keep-alive connection
+// (HTTP/1.1 pipelining): the requests are written back to back and the
+// responses read in order, so a slow link costs one round trip per window
+// instead of one per block / batch. 1 = one request at a time.
+#define QUEUE_PIPELINE_DEPTH        4
+
+// Backlog budget per upload window. The sender task sends waiting live
+// fixes before every window, so a window that is over within
+// QUEUE_FLUSH_BUDGET_MS keeps the live map less than one SEND_INTERVAL
+// behind while a backlog drains. Windows are sized from the throughput
+// measured on the earlier ones (QUEUE_FLUSH_RATE_INIT bytes/s until then,
+// a slow link), at most QUEUE_FLUSH_BUDGET_BYTES and never less than one
+// block / batch.
+#define QUEUE_FLUSH_BUDGET_MS       2000
+#define QUEUE_FLUSH_BUDGET_BYTES    8192
+#define QUEUE_FLUSH_RATE_INIT       512         // bytes/s
+
+#if QUEUE_FLUSH_BUDGET_MS >= SEND_INTERVAL
+#error "QUEUE_FLUSH_BUDGET_MS must be shorter than SEND_INTERVAL"
+#endif
+
+// Server-directed reporting: a POST response (2xx or not: an overloaded
+// server answers 429 / 503) or an MQTT command may carry
+//   "control": {"next_interval_ms": 15000, "batch_max": 20,
+//               "flush_allowed": 0, "ttl_s": 600}
+// to slow the live fixes down (shed load) or speed them up (bus near a
+// stop), cap the records per backlog window, or hold backlog and backfill
+// uploads. Every field is optional (missing = default). Values are clamped
+// to the bounds below, and the block lapses after "ttl_s" (CONTROL_TTL_MS
+// if absent), so a device that stops hearing from the server returns to
+// SEND_INTERVAL on its own. An error response with "Retry-After: <s>" but
+// no block holds flushes and spaces live fixes out to <s> for that long.
+// Live fixes skipped while slowed down are still archived. Server side:
+// GPS_CONTROL_* and GPS_SHED_* in api/config.php.
+#define CONTROL_INTERVAL_MIN_MS     2500
+#define CONTROL_INTERVAL_MAX_MS     60000
+#define CONTROL_TTL_MS              600000      // 10 minutes
+#define CONTROL_TTL_MAX_MS          3600000     // 1 hour
+
+#if QUEUE_FLUSH_BUDGET_MS >= CONTROL_INTERVAL_MIN_MS
+#error "QUEUE_FLUSH_BUDGET_MS must be shorter than CONTROL_INTERVAL_MIN_MS"
+#endif
+#if CONTROL_INTERVAL_MIN_MS > SEND_INTERVAL || CONTROL_INTERVAL_MAX_MS < SEND_INTERVAL
+#error "SEND_INTERVAL must lie within CONTROL_INTERVAL_MIN_MS .. CONTROL_INTERVAL_MAX_MS"
+#endif
+
 // GPS watchdog: restart ESP32 if no GPS fix for this duration
 #define GPS_WATCHDOG_TIMEOUT        600000      // 10 minutes
 
@@ -97,15 +302,224 @@
 // WiFi reconnect cooldown (avoid spamming reconnect attempts)
 #define WIFI_RECONNECT_INTERVAL     10000       // 10 seconds (matches WIFI_CHECK_INTERVAL)
 
+// Fast reconnect: known networks (see WIFI_KNOWN_MAX) are kept in
+// WIFI_CACHE_FILE with their last access point (BSSID), channel and DHCP
+// lease. While offline the device tries a direct connect to the last one
+// used on its channel (no scan), each attempt given WIFI_FAST_TIMEOUT_MS.
+// After WIFI_FAST_MAX_TRIES misses in a row it runs a passive scan for
+// any known network (given WIFI_SCAN_TIMEOUT_MS, at most one per
+// WIFI_RECONNECT_INTERVAL) and connects directly to the best one found;
+// fast attempts in between. 0 = full scans (WiFi.reconnect()) only.
+#define WIFI_FAST_RECONNECT     1
+#define WIFI_CACHE_FILE         "/wifi.dat"
+#define WIFI_CACHE_TMP_FILE     "/wifi.tmp"
+#define WIFI_FAST_TIMEOUT_MS    2000
+#define WIFI_FAST_MAX_TRIES     3
+#define WIFI_SCAN_TIMEOUT_MS    4000
+#define WIFI_SCAN_MS_PER_CHANNEL 120        // Passive scan dwell time
+
+// Known networks kept: every network the device has connected to (e.g.
+// through the portal) plus WIFI_KNOWN_NETWORKS. When the list is full the
+// lowest ranked one makes room for a new one.
+#define WIFI_KNOWN_MAX          8
+
+// Networks known from the start (depot APs, terminal hotspots, partner
+// shops), as { "ssid", "password" }, entries:
+//   #define WIFI_KNOWN_NETWORKS { "Depot-1", "secret" }, { "Terminal", "secret" },
+#define WIFI_KNOWN_NETWORKS
+
+// Ranking: an access point scores its RSSI plus up to
+// WIFI_QUALITY_BONUS_DB for the share of its connected windows that got
+// something delivered (failed connects count against it).
+#define WIFI_QUALITY_BONUS_DB   15
+
+// Roaming: while the link is weaker than WIFI_ROAM_RSSI, scan every
+// WIFI_ROAM_SCAN_MS and switch to a known access point that scores at
+// least WIFI_ROAM_MARGIN_DB higher, before the link is lost. 0 = off.
+#define WIFI_ROAM               1
+#define WIFI_ROAM_RSSI          -72         // dBm
+#define WIFI_ROAM_SCAN_MS       20000
+#define WIFI_ROAM_MARGIN_DB     8
+
+// Upload burst: while a backlog waits and the link is at least
+// WIFI_BURST_RSSI, WiFi modem sleep is off, roaming scans are held back and
+// the backlog drains back to back, so a short pass by a strong access point
+// moves as much as it can. Ends when the backlog is gone or the signal
+// falls WIFI_BURST_EXIT_DB below the threshold.
+#define WIFI_BURST_RSSI         -65         // dBm
+#define WIFI_BURST_EXIT_DB      6
+
+// A fast attempt reuses the cached DHCP lease as a static address (no
+// DHCP exchange) while the lease is younger than this; it was obtained
+// in this boot, so after a reboot the first connect runs DHCP. 0 = always
+// DHCP.
+#define WIFI_LEASE_REUSE_MS     1800000     // 30 minutes
+
 // ============================================================================
 // OFFLINE STORAGE CONFIGURATION
 // ============================================================================
-// File path on LittleFS for the offline data queue
-#define QUEUE_FILE          "/queue.jsonl"
+// Directory on LittleFS holding the offline queue segment files.
+// The queue is a ring of small segment files so that eviction at capacity
+// deletes one whole segment instead of rewriting the live queue.
+#define QUEUE_DIR           "/queue"
+
+// Legacy single-file queue used by firmware <= 2.0.0.
+// Imported into segments at boot and then removed.
+#define QUEUE_LEGACY_FILE   "/queue.jsonl"
+
+// Staging file for samples not yet sealed into a track block.
+// Holds up to TRACK_BLOCK_SAMPLES fixed-width, CRC-checked records.
+#define QUEUE_OPEN_FILE     "/queue/open.rec"
+
+// Queue metadata (head/tail segments, read cursor, per-segment counts),
+// CRC-protected so boot can mount the queue without reading it.
+// Rewritten via the temp file and an atomic rename.
+#define QUEUE_META_FILE     "/queue/meta.dat"
+#define QUEUE_META_TMP_FILE "/queue/meta.tmp"
+
+// Per-device sequence counter. Every kept fix gets the next number, so the
+// server can drop resent duplicates and report what it holds. Numbers are
+// reserved SEQ_RESERVE at a time (one flash write per block, not per fix);
+// after a reboot the counter resumes past the reserved block, so numbers
+// are never reused.
+#define SEQ_FILE            "/seq.dat"
+#define SEQ_TMP_FILE        "/seq.tmp"
+#define SEQ_RESERVE         256
+
+// RAM write-back buffer in front of the staging file. Samples are
+// committed to flash in one write every QUEUE_WRITEBACK_RECORDS samples
+// or once the oldest is QUEUE_WRITEBACK_MS old, whichever comes first.
+// This is the data-loss window on a sudden power cut: at most this many
+// samples / this much time. 1 = write every sample through.
+#define QUEUE_WRITEBACK_RECORDS 8
+#define QUEUE_WRITEBACK_MS      60000
+
+// Binary record layout version. Stored as the first byte of every
+// fixed-width record in the staging file; each record also ends in a
+// CRC32. Records with another version or a bad CRC are skipped.
+#define QUEUE_RECORD_VERSION    4
+
+// Samples per compressed track block (keyframe + deltas). Staged samples
+// are sealed into a block once this many have accumulated. Max 255.
+#define TRACK_BLOCK_SAMPLES     32
+
+// Target size of one segment file in bytes (one 4KB LittleFS block).
+// A new segment is started when the next block would not fit.
+#define QUEUE_SEGMENT_BYTES     4096
+
+// Maximum number of segment files kept on flash.
+// When a new segment is needed and this limit is reached, the oldest
+// segment is deleted. 96 segments ≈ 384KB — about 2.5 days of driving
+// at a 5-second cadence (much longer while parked).
+#define QUEUE_SEGMENT_COUNT     96
+
+// What to do when all QUEUE_SEGMENT_COUNT segments are in use:
+//   QUEUE_EVICT_DROP             delete the oldest segment
+//   QUEUE_EVICT_DECIMATE         merge the two oldest segments with room,
+//                                keeping every QUEUE_THIN_DECIMATE-th sample
+//   QUEUE_EVICT_DOUGLAS_PEUCKER  merge them keeping only the samples needed
+//                                to rebuild the track within
+//                                QUEUE_THIN_TOLERANCE_M (turns, stops and
+//                                speed changes are kept)
+// The thinning policies fall back to dropping the oldest segment once
+// every segment is already thinned and full.
+#define QUEUE_EVICT_DROP            0
+#define QUEUE_EVICT_DECIMATE        1
+#define QUEUE_EVICT_DOUGLAS_PEUCKER 2
+#define QUEUE_EVICT_POLICY          QUEUE_EVICT_DOUGLAS_PEUCKER
+
+#define QUEUE_THIN_TOLERANCE_M      15.0f   // Max position error (metres)
+#define QUEUE_THIN_DECIMATE         4       // Keep 1 sample in N
+#define QUEUE_THIN_WINDOW           128     // Samples thinned at once (RAM)
+#define QUEUE_THIN_MAX_TRIES        3       // Segment pairs tried per eviction
+
+// Temp file a thinned segment is written to before it replaces the original.
+#define QUEUE_THIN_TMP_FILE         "/queue/thin.tmp"
+
+// Temp file used when cutting a torn write off a queue file (the kept part
+// is copied here and renamed over the original).
+#define QUEUE_REPAIR_TMP_FILE       "/queue/repair.tmp"
+
+// Flush uploads sealed track blocks as-is (1) instead of batches of
+// records in WIRE_FORMAT, e.g. {"data":[...]} (0). Requires the block-
+// and batch-aware gps-device.php.
+#define QUEUE_UPLOAD_BLOCKS     1
+
+// Backlog order: oldest first replays the trip in order; newest first
+// fills in the recent past first (the server only moves the bus on the
+// map for a newer fix, so order does not matter there). Newest first
+// needs QUEUE_UPLOAD_BLOCKS.
+#define QUEUE_ORDER_OLDEST_FIRST    0
+#define QUEUE_ORDER_NEWEST_FIRST    1
+#define QUEUE_FLUSH_ORDER           QUEUE_ORDER_NEWEST_FIRST
+
+#if QUEUE_FLUSH_ORDER == QUEUE_ORDER_NEWEST_FIRST && !QUEUE_UPLOAD_BLOCKS
+#error "QUEUE_ORDER_NEWEST_FIRST needs QUEUE_UPLOAD_BLOCKS"
+#endif
+
+// Batch mode: request body limit for one pipelined window of batches
+// (~200 bytes per record in WIRE_FORMAT_JSON, ~35 in CBOR / MessagePack).
+// Caps QUEUE_FLUSH_BATCH_RECORDS x QUEUE_PIPELINE_DEPTH on long records.
+#define QUEUE_BATCH_MAX_BYTES   8192
+
+// ============================================================================
+// TRACK ARCHIVE CONFIGURATION
+// ============================================================================
+// Every fix is also kept in an append-only archive that outlives the
+// offline queue, so past positions can be looked up over serial or
+// re-sent when the server asks for a backfill.
+// One track file per UTC hour (/archive/<hour>.trk) plus a block index per
+// hour (<hour>.idx); the list of hours is kept in ARCHIVE_INDEX_FILE.
+// Time-range lookups are binary searches over both indexes.
+#define ARCHIVE_DIR             "/archive"
+#define ARCHIVE_INDEX_FILE      "/archive/hours.dat"
+#define ARCHIVE_INDEX_TMP_FILE  "/archive/hours.tmp"
+
+// Size cap of the archive (track + block index bytes). The oldest hours
+// are deleted to stay below it. Keep room for the offline queue
+// (QUEUE_SEGMENT_COUNT x QUEUE_SEGMENT_BYTES) on the LittleFS partition.
+#define ARCHIVE_MAX_BYTES       (512UL * 1024)
+
+// Max hours kept (8 bytes of RAM each). 336 = two weeks.
+#define ARCHIVE_MAX_HOURS       336
+
+// Samples are buffered in RAM and sealed into a block at
+// TRACK_BLOCK_SAMPLES samples, at the hour boundary, or once the oldest
+// is this old. Unsealed samples are lost on a power cut.
+#define ARCHIVE_SEAL_MS         300000      // 5 minutes
+
+// Guards against a bogus GPS time (bad decode, receiver cold start).
+// Fixes before ARCHIVE_MIN_EPOCH (e.g. after a GPS week rollover) are
+// not archived. A fix more than ARCHIVE_FUTURE_SLACK_S ahead of the last
+// one plus the uptime since then is ignored. ARCHIVE_REWIND_FIXES fixes
+// in a row more than ARCHIVE_FUTURE_SLACK_S behind the newest archived
+// sample (possibly from before a reboot) mark that one as bogus: the
+// samples at or after them are dropped and archiving resumes.
+#define ARCHIVE_MIN_EPOCH       1767225600UL    // 2026-01-01 00:00 UTC
+#define ARCHIVE_FUTURE_SLACK_S  600
+#define ARCHIVE_REWIND_FIXES    12              // 1 minute at 5s per fix
+
+// Samples printed per loop pass by a serial archive dump (one ~200-byte
+// JSON line each). Backfill uploads send one track block per pass.
+#define ARCHIVE_DUMP_BATCH      8
+
+// ============================================================================
+// SERIAL CONSOLE & USB BULK OFFLOAD
+// ============================================================================
+// Debug log / console baud rate
+#define SERIAL_BAUD             115200
+
+// Baud rate of a depot bulk offload (console command "offload", host tool
+// tools/sawari-offload). The USB-UART bridge must support it.
+#define OFFLOAD_BAUD            921600
+
+// Raw data chunks (OFFLOAD_CHUNK_BYTES each) sent per loop pass:
+// 8 x 1KB ≈ 90ms of line time at 921600 baud
+#define OFFLOAD_CHUNKS_PER_PASS 8
 
-// Maximum number of records to keep in offline queue.
-// Oldest records are discarded when this limit is exceeded.
-#define MAX_QUEUE_SIZE      500
+// The session ends (port back to SERIAL_BAUD) after this long without a
+// host request
+#define OFFLOAD_IDLE_MS         10000
 
 // ============================================================================
 // HARDWARE WATCHDOG
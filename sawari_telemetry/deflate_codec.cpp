@@ -0,0 +1,193 @@
+/**
+ * ============================================================================
+ * SAWARI Bus Telemetry Device - Deflate (gzip) Encoder Implementation
+ * ============================================================================
+ *
+ * Output layout (RFC 1952 around RFC 1951):
+ *   [10]    gzip header: 1F 8B, CM=8, no flags, no mtime, OS=unknown
+ *   [...]   one final DEFLATE block, BTYPE=01 (fixed Huffman codes)
+ *   [4]     CRC32 of the input (trackCrc32, same polynomial), LE
+ *   [4]     input length, LE
+ *
+ * DEFLATE packs bits LSB first, but Huffman codes go out MSB first, so
+ * codes are bit-reversed before they are written.
+ * ============================================================================
+ */
+
+#include "deflate_codec.h"
+#include "track_codec.h"
+
+#define WINDOW_SIZE     (1U << DEFLATE_WINDOW_BITS)
+#define WINDOW_MASK     (WINDOW_SIZE - 1)
+#define HASH_SIZE       (1U << DEFLATE_HASH_BITS)
+#define MIN_MATCH       3
+#define MAX_MATCH       258
+
+static_assert(DEFLATE_WINDOW_BITS <= 15, "DEFLATE allows at most a 32KB window");
+
+// Match tables: most recent position + 1 per hash (0 = none), and the
+// previous position + 1 with the same hash, per window slot
+static uint16_t _head[HASH_SIZE];
+static uint16_t _prev[WINDOW_SIZE];
+
+// Length symbols 257..285: base length and extra bits
+static const uint16_t _lenBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t _lenExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+// Distance codes 0..29: base distance and extra bits
+static const uint16_t _distBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577
+};
+static const uint8_t _distExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// ---------------------------------------------------------------------------
+// LSB-first bit writer over the caller's buffer
+// ---------------------------------------------------------------------------
+struct BitWriter {
+    uint8_t* out;
+    size_t   max;
+    size_t   pos;
+    uint32_t bits;          // Pending bits, LSB first
+    int      count;         // Number of pending bits
+    bool     overflow;
+};
+
+static void _putBits(BitWriter* w, uint32_t value, int n) {
+    w->bits |= value << w->count;
+    w->count += n;
+    while (w->count >= 8) {
+        if (w->pos < w->max) {
+            w->out[w->pos++] = (uint8_t)w->bits;
+        } else {
+            w->overflow = true;
+        }
+        w->bits >>= 8;
+        w->count -= 8;
+    }
+}
+
+// Write a Huffman code of `n` bits, most significant bit first
+static void _putCode(BitWriter* w, uint32_t code, int n) {
+    uint32_t reversed = 0;
+    for (int i = 0; i < n; i++) {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+    _putBits(w, reversed, n);
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: one literal/length symbol in the fixed code
+// ---------------------------------------------------------------------------
+static void _putSymbol(BitWriter* w, int sym) {
+    if (sym < 144) {
+        _putCode(w, 0x30 + sym, 8);
+    } else if (sym < 256) {
+        _putCode(w, 0x190 + (sym - 144), 9);
+    } else if (sym < 280) {
+        _putCode(w, sym - 256, 7);
+    } else {
+        _putCode(w, 0xC0 + (sym - 280), 8);
+    }
+}
+
+static void _putMatch(BitWriter* w, int len, int dist) {
+    int code = 28;
+    while (_lenBase[code] > len) code--;
+    _putSymbol(w, 257 + code);
+    _putBits(w, len - _lenBase[code], _lenExtra[code]);
+
+    code = 29;
+    while (_distBase[code] > dist) code--;
+    _putCode(w, code, 5);
+    _putBits(w, dist - _distBase[code], _distExtra[code]);
+}
+
+static inline uint32_t _hash(const uint8_t* p) {
+    uint32_t v = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+    return (uint32_t)(v * 2654435761U) >> (32 - DEFLATE_HASH_BITS);
+}
+
+static inline void _insert(const uint8_t* in, size_t pos) {
+    uint32_t h = _hash(in + pos);
+    _prev[pos & WINDOW_MASK] = _head[h];
+    _head[h] = (uint16_t)(pos + 1);
+}
+
+static void _putLE32(BitWriter* w, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        _putBits(w, (v >> (8 * i)) & 0xFF, 8);
+    }
+}
+
+// ============================================================================
+// PUBLIC API
+// ============================================================================
+
+size_t deflateGzip(const uint8_t* in, size_t len, uint8_t* out, size_t outMax) {
+    if (len > DEFLATE_MAX_INPUT || outMax < DEFLATE_GZIP_OVERHEAD + 2) return 0;
+
+    static const uint8_t header[10] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF };
+    memcpy(out, header, sizeof(header));
+
+    BitWriter w = { out, outMax, sizeof(header), 0, 0, false };
+    memset(_head, 0, sizeof(_head));
+
+    _putBits(&w, 1, 1);             // BFINAL
+    _putBits(&w, 1, 2);             // BTYPE = 01, fixed Huffman codes
+
+    size_t pos = 0;
+    while (pos < len && !w.overflow) {
+        int bestLen = 0;
+        int bestDist = 0;
+
+        if (pos + MIN_MATCH <= len) {
+            int limit = (len - pos < MAX_MATCH) ? (int)(len - pos) : MAX_MATCH;
+            uint16_t cand = _head[_hash(in + pos)];
+            for (int chain = DEFLATE_MAX_CHAIN; cand != 0 && chain > 0; chain--) {
+                size_t from = cand - 1;
+                size_t dist = pos - from;
+                if (dist > WINDOW_SIZE) break;
+
+                int n = 0;
+                while (n < limit && in[from + n] == in[pos + n]) n++;
+                if (n > bestLen) {
+                    bestLen = n;
+                    bestDist = (int)dist;
+                    if (n == limit) break;
+                }
+                cand = _prev[from & WINDOW_MASK];
+            }
+        }
+
+        if (bestLen >= MIN_MATCH) {
+            _putMatch(&w, bestLen, bestDist);
+            for (int i = 0; i < bestLen; i++, pos++) {
+                if (pos + MIN_MATCH <= len) _insert(in, pos);
+            }
+        } else {
+            _putSymbol(&w, in[pos]);
+            if (pos + MIN_MATCH <= len) _insert(in, pos);
+            pos++;
+        }
+    }
+
+    _putSymbol(&w, 256);            // End of block
+    _putBits(&w, 0, (8 - w.count) & 7);     // Pad to a byte boundary
+
+    _putLE32(&w, trackCrc32(in, len));
+    _putLE32(&w, (uint32_t)len);
+
+    return w.overflow ? 0 : w.pos;
+}
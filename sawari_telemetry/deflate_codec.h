@@ -0,0 +1,50 @@
+/**
+ * ============================================================================
+ * SAWARI Bus Telemetry Device - Deflate (gzip) Encoder Header
+ * ============================================================================
+ * Small-footprint gzip compressor for HTTP request bodies
+ * (Content-Encoding: gzip). Any standard inflater (PHP gzdecode, zlib,
+ * Apache mod_deflate) decodes the output.
+ *
+ * One DEFLATE block with the fixed Huffman codes of RFC 1951, fed by a
+ * greedy LZ77 matcher over a DEFLATE_WINDOW_BITS window with hash chains.
+ * Fixed codes need no code tables on the device or in the stream and
+ * suit short, ASCII-only JSON bodies; RAM use is the two match tables
+ * below (12KB), allocated statically.
+ * ============================================================================
+ */
+
+#ifndef DEFLATE_CODEC_H
+#define DEFLATE_CODEC_H
+
+#include <Arduino.h>
+
+// Match window (bytes back a match may start): 1 << DEFLATE_WINDOW_BITS
+#define DEFLATE_WINDOW_BITS     12
+
+// Hash table size for 3-byte prefixes: 1 << DEFLATE_HASH_BITS entries
+#define DEFLATE_HASH_BITS       11
+
+// Candidates tried per position (more = better ratio, slower)
+#define DEFLATE_MAX_CHAIN       32
+
+// Largest input accepted (match positions are 16-bit)
+#define DEFLATE_MAX_INPUT       65535
+
+// gzip header + trailer bytes around the DEFLATE stream
+#define DEFLATE_GZIP_OVERHEAD   18
+
+/**
+ * Compress `len` bytes into a gzip member.
+ * Not reentrant: the match tables are shared (sender task only).
+ *
+ * @param in      input bytes
+ * @param len     input length (at most DEFLATE_MAX_INPUT)
+ * @param out     output buffer
+ * @param outMax  output buffer size
+ * @return compressed length, or 0 if the output did not fit in outMax
+ *         (pass outMax < len to only accept output that saves bytes)
+ */
+size_t deflateGzip(const uint8_t* in, size_t len, uint8_t* out, size_t outMax);
+
+#endif // DEFLATE_CODEC_H
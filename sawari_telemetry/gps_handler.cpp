@@ -21,11 +21,14 @@
 #include "gps_handler.h"
 #include "config.h"
 #include <TinyGPSPlus.h>
+#include <sys/time.h>
 
 // --- GPS parser and serial instances ---
 static TinyGPSPlus _gps;
 static HardwareSerial _gpsSerial(2);    // UART2
 
+static bool _clockSet = false;          // System clock set from GPS time
+
 /**
  * Initialize UART2 for GPS communication at 9600 baud.
  * NEO-6M default baud rate is 9600.
@@ -46,6 +49,23 @@ void gpsUpdate() {
         char c = _gpsSerial.read();
         _gps.encode(c);
     }
+
+    // Set the system clock once, from the time of a valid fix (TLS checks
+    // certificate dates against it). Before its first fix the module
+    // reports a guessed date, so time without a fix is not used.
+    if (!_clockSet && gpsHasFix() && gpsHasTime() && _gps.time.age() < 1000) {
+        char iso[25];
+        snprintf(iso, sizeof(iso), "%04d-%02d-%02dT%02d:%02d:%02dZ",
+                 _gps.date.year(), _gps.date.month(), _gps.date.day(),
+                 _gps.time.hour(), _gps.time.minute(), _gps.time.second());
+        uint32_t epoch = gpsTimestampToEpoch(iso);
+        struct timeval tv = { (time_t)epoch, 0 };
+        if (epoch >= CLOCK_SET_EPOCH && settimeofday(&tv, nullptr) == 0) {
+            _clockSet = true;
+            Serial.print(F("[GPS] System clock set from GPS: "));
+            Serial.println(iso);
+        }
+    }
 }
 
 /**
@@ -118,6 +138,9 @@ void gpsGetTelemetry(TelemetryData* data) {
         // Fallback if GPS time not yet acquired
         strncpy(data->timestamp, "1970-01-01T00:00:00Z", sizeof(data->timestamp));
     }
+
+    // Numbered by the caller once the fix is kept (storageNextSeq)
+    data->seq = 0;
 }
 
 /**
@@ -141,8 +164,29 @@ void gpsGetTelemetry(TelemetryData* data) {
  */
 String gpsFormatPayload(const TelemetryData* data) {
     char buffer[400];
-    snprintf(buffer, sizeof(buffer),
-        "{\"data\":{"
+    gpsFormatPayload(data, buffer, sizeof(buffer));
+    return String(buffer);
+}
+
+/**
+ * Same payload, written into a caller-provided buffer.
+ */
+size_t gpsFormatPayload(const TelemetryData* data, char* buf, size_t len) {
+    if (len < 10) return 0;
+    memcpy(buf, "{\"data\":", 8);
+    size_t n = 8 + gpsFormatRecord(data, buf + 8, len - 9);
+    buf[n++] = '}';
+    buf[n] = '\0';
+    return n;
+}
+
+/**
+ * Write one record's JSON object (the value of "data" above) into buf.
+ * Batch uploads concatenate these without a String per record.
+ */
+size_t gpsFormatRecord(const TelemetryData* data, char* buf, size_t len) {
+    int n = snprintf(buf, len,
+        "{"
         "\"bus_id\":%d,"
         "\"latitude\":%.6f,"
         "\"longitude\":%.6f,"
@@ -151,8 +195,9 @@ String gpsFormatPayload(const TelemetryData* data) {
         "\"altitude\":%.1f,"
         "\"satellites\":%d,"
         "\"hdop\":%.1f,"
-        "\"timestamp\":\"%s\""
-        "}}",
+        "\"timestamp\":\"%s\","
+        "\"seq\":%lu"
+        "}",
         BUS_ID,
         data->latitude,
         data->longitude,
@@ -161,7 +206,100 @@ String gpsFormatPayload(const TelemetryData* data) {
         data->altitude,
         data->satellites,
         data->hdop,
-        data->timestamp
+        data->timestamp,
+        (unsigned long)data->seq
     );
-    return String(buffer);
+    if (n < 0) return 0;
+    return ((size_t)n < len) ? (size_t)n : len - 1;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: read the number following "key": in a flat JSON object
+// ---------------------------------------------------------------------------
+static bool _jsonNumber(const char* json, const char* key, double* out) {
+    char pattern[24];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char* p = strstr(json, pattern);
+    if (!p) return false;
+    *out = atof(p + strlen(pattern));
+    return true;
+}
+
+/**
+ * Parse a payload produced by gpsFormatPayload().
+ * This is not a general JSON parser — it locates each known key with
+ * strstr(), which is all that is needed to read back our own records.
+ */
+bool gpsParsePayload(const char* json, TelemetryData* data) {
+    double value = 0.0;
+    bool hasLat = _jsonNumber(json, "latitude", &data->latitude);
+    bool hasLon = _jsonNumber(json, "longitude", &data->longitude);
+
+    data->speed      = _jsonNumber(json, "speed", &value) ? value : 0.0;
+    data->direction  = _jsonNumber(json, "direction", &value) ? value : 0.0;
+    data->altitude   = _jsonNumber(json, "altitude", &value) ? value : 0.0;
+    data->satellites = _jsonNumber(json, "satellites", &value) ? (int)value : 0;
+    data->hdop       = _jsonNumber(json, "hdop", &value) ? value : 99.9;
+    data->seq        = _jsonNumber(json, "seq", &value) ? (uint32_t)value : 0;
+
+    strncpy(data->timestamp, "1970-01-01T00:00:00Z", sizeof(data->timestamp));
+    const char* ts = strstr(json, "\"timestamp\":\"");
+    if (ts) {
+        ts += strlen("\"timestamp\":\"");
+        size_t n = 0;
+        while (ts[n] && ts[n] != '"' && n < sizeof(data->timestamp) - 1) {
+            data->timestamp[n] = ts[n];
+            n++;
+        }
+        data->timestamp[n] = '\0';
+    }
+
+    return hasLat && hasLon;
+}
+
+/**
+ * ISO 8601 → Unix time.
+ * Uses the days-from-civil algorithm (proleptic Gregorian calendar),
+ * so no dependency on the C library's timezone handling.
+ */
+uint32_t gpsTimestampToEpoch(const char* iso) {
+    int year, month, day, hour, minute, second;
+    if (sscanf(iso, "%d-%d-%dT%d:%d:%d", &year, &month, &day,
+               &hour, &minute, &second) != 6) {
+        return 0;
+    }
+    if (year < 1970 || month < 1 || month > 12 || day < 1 || day > 31) {
+        return 0;
+    }
+
+    int y = year - (month <= 2 ? 1 : 0);
+    int era = y / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int32_t days = era * 146097 + doe - 719468;
+
+    return (uint32_t)days * 86400UL + hour * 3600UL + minute * 60UL + second;
+}
+
+/**
+ * Unix time → ISO 8601 (inverse of gpsTimestampToEpoch).
+ */
+void gpsEpochToTimestamp(uint32_t epoch, char* buf, size_t len) {
+    uint32_t days = epoch / 86400UL;
+    uint32_t rem  = epoch % 86400UL;
+
+    int32_t z = (int32_t)days + 719468;
+    int era = z / 146097;
+    int doe = z - era * 146097;
+    int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int mp  = (5 * doy + 2) / 153;
+    int day = doy - (153 * mp + 2) / 5 + 1;
+    int month = mp < 10 ? mp + 3 : mp - 9;
+    int year  = yoe + era * 400 + (month <= 2 ? 1 : 0);
+
+    snprintf(buf, len, "%04d-%02d-%02dT%02d:%02d:%02dZ",
+             year, month, day,
+             (int)(rem / 3600), (int)((rem % 3600) / 60), (int)(rem % 60));
 }
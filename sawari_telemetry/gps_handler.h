@@ -24,8 +24,12 @@ struct TelemetryData {
     int     satellites;
     double  hdop;
     char    timestamp[25];  // ISO 8601: "YYYY-MM-DDTHH:MM:SSZ"
+    uint32_t seq;           // Per-device sequence number (0 = none yet)
 };
 
+// Unix time below which the system clock counts as not set (2020-01-01)
+#define CLOCK_SET_EPOCH     1577836800UL
+
 /**
  * Initialize GPS serial communication on UART2.
  */
@@ -34,6 +38,7 @@ void gpsInit();
 /**
  * Feed characters from GPS serial to TinyGPSPlus parser.
  * Must be called frequently (every loop iteration) for reliable parsing.
+ * Sets the system clock (time()) from GPS time at the first valid fix.
  */
 void gpsUpdate();
 
@@ -70,4 +75,46 @@ void gpsGetTelemetry(TelemetryData* data);
  */
 String gpsFormatPayload(const TelemetryData* data);
 
+/**
+ * Build the same JSON payload into a caller-provided buffer (no String).
+ * @param data  pointer to populated TelemetryData struct
+ * @param buf   destination buffer
+ * @param len   buffer size in bytes
+ * @return characters written, NUL-terminated (truncated to fit)
+ */
+size_t gpsFormatPayload(const TelemetryData* data, char* buf, size_t len);
+
+/**
+ * Write the JSON object for one record (without the {"data": ...}
+ * wrapper) into a caller-provided buffer, NUL-terminated.
+ * @param data  pointer to populated TelemetryData struct
+ * @param buf   destination buffer
+ * @param len   buffer size in bytes
+ * @return characters written (truncated to fit)
+ */
+size_t gpsFormatRecord(const TelemetryData* data, char* buf, size_t len);
+
+/**
+ * Parse a JSON payload produced by gpsFormatPayload() back into telemetry.
+ * Only understands our own flat payload format (used to migrate old queues).
+ * @param json  null-terminated JSON string
+ * @param data  pointer to TelemetryData struct to fill
+ * @return true if latitude and longitude were found
+ */
+bool gpsParsePayload(const char* json, TelemetryData* data);
+
+/**
+ * Convert an ISO 8601 UTC timestamp ("YYYY-MM-DDTHH:MM:SSZ") to Unix time.
+ * @return seconds since 1970-01-01T00:00:00Z, or 0 if unparseable
+ */
+uint32_t gpsTimestampToEpoch(const char* iso);
+
+/**
+ * Format Unix time as an ISO 8601 UTC timestamp ("YYYY-MM-DDTHH:MM:SSZ").
+ * @param epoch  seconds since 1970-01-01T00:00:00Z
+ * @param buf    output buffer (at least 21 bytes)
+ * @param len    size of the output buffer
+ */
+void gpsEpochToTimestamp(uint32_t epoch, char* buf, size_t len);
+
 #endif // GPS_HANDLER_H
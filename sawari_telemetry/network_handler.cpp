@@ -9,17 +9,54 @@
  *   - Auto-connect to saved credentials on boot
  *   - On-demand captive portal via button press (non-blocking)
  *   - Auto-close portal when WiFi connects
- *   - 10-second WiFi availability check interval
  *   - Offline mode fallback with automatic reconnection
- *   - HTTP POST telemetry with timeout handling
+ *   - Fast reconnect: direct connect to the last access point on its
+ *     channel (cached on flash), on the cached lease while recent
+ *     (WIFI_FAST_RECONNECT); passive scan for the other known networks,
+ *     ranked by signal and past delivery, as the fallback
+ *   - Roaming: a weak link is left for a clearly better known access
+ *     point (WIFI_ROAM); upload bursts with modem sleep off while a
+ *     backlog drains on a strong link
+ *   - Event-driven link state (WiFi.onEvent): loss and recovery are seen
+ *     on the next loop pass; connected windows with nothing delivered
+ *     are counted
+ *   - HTTP POST telemetry over one keep-alive connection (cached DNS,
+ *     fixed buffers, transparent reconnect)
+ *   - Optional HTTPS (HTTP_TLS, tls_client.h): pinned server certificate,
+ *     TLS session resumed on reconnect
+ *   - Raw track block upload for offline queue flushes
+ *   - Batched JSON upload with per-record results
+ *   - Server-requested archive backfill (time range in the POST response)
+ *   - Server-directed reporting: live fix interval, backlog window cap and
+ *     flush hold from a "control" block, clamped and lapsing after a TTL;
+ *     error responses count too, and a Retry-After without a block holds
+ *     flushes and spaces live fixes out until it has passed
+ *   - gzip request bodies for large JSON uploads, once the server has
+ *     advertised support (Accept-Encoding in a response)
+ *   - Optional UDP transport for live fixes with sequence numbers and
+ *     range acknowledgements (UDP_TELEMETRY, udp_protocol.h)
+ *   - Optional MQTT transport: QoS 1 publishes on a persistent broker
+ *     session, server commands by subscription (MQTT_TRANSPORT)
+ *   - Circuit breaker: no uploads while the server keeps failing, probes
+ *     with jittered exponential backoff
+ *   - Pipelined backlog uploads: up to QUEUE_PIPELINE_DEPTH requests in
+ *     flight on the keep-alive connection, responses read in order
+ *   - Sequence-number watermark: X-Seq-Floor on every POST, "acked_seq"
+ *     read back from the responses
  * ============================================================================
  */
 
 #include "network_handler.h"
 #include "config.h"
+#include "deflate_codec.h"
+#include "wire_codec.h"
+#include "track_codec.h"
+#include "udp_protocol.h"
+#include "tls_client.h"
 #include <WiFi.h>
-#include <HTTPClient.h>
+#include <WiFiUdp.h>
 #include <WiFiManager.h>
+#include <LittleFS.h>
 
 // --- WiFiManager instance (persistent for on-demand portal) ---
 static WiFiManager _wm;
@@ -29,21 +66,722 @@ static unsigned long _lastReconnectAttempt = 0;
 static bool _wasConnected = false;
 static bool _portalActive = false;
 
+// --- Reconnect attempt / scan in progress (networkCheckReconnect) ---
+#define ATTEMPT_NONE    0
+#define ATTEMPT_FAST    1       // Known access point and channel, no scan
+#define ATTEMPT_FULL    2       // WiFi.reconnect(): scan for the saved network
+#define ATTEMPT_SCAN    3       // Passive scan for known networks (offline or roaming)
+static uint8_t _attempt      = ATTEMPT_NONE;
+static bool    _attemptLease = false;       // Fast attempt on the cached lease (no DHCP)
+static bool    _attemptSeen  = false;       // Fast attempt to an access point just scanned
+static int     _fastMisses   = 0;           // Fast attempts in a row that timed out
+static unsigned long _lastFullAttempt = 0;  // Last full attempt or offline scan
+static unsigned long _lastRoamScan    = 0;
+
+// --- Known networks, persisted in WIFI_CACHE_FILE ---
+#define AP_STORE_MAGIC  0x53504157      // "WAPS"
+
+struct KnownAp {
+    char     ssid[33];
+    char     psk[65];
+    uint8_t  bssid[6];              // Last access point used (or found by a scan)
+    uint8_t  channel;               // 0 = never seen: found by scan only
+    uint32_t ip;                    // Last DHCP lease
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+    uint16_t fails;                 // Connects to a scanned access point that failed
+    uint16_t windows;               // Connected windows
+    uint16_t delivered;             // ... with something delivered
+    uint32_t lastUsed;              // Store clock at the last connect (0 = never)
+};
+
+struct ApStore {
+    uint32_t magic;
+    uint32_t clock;                 // Advanced on every connect
+    uint32_t count;
+    KnownAp  ap[WIFI_KNOWN_MAX];
+    uint32_t crc;                   // CRC32 of the fields above
+};
+
+struct BuiltinAp {
+    const char* ssid;
+    const char* psk;
+};
+static const BuiltinAp _builtinAps[] = { WIFI_KNOWN_NETWORKS { nullptr, nullptr } };
+
+static ApStore       _aps;
+static int           _apCurrent = -1;       // Entry of the link that is up
+static int           _apTarget  = -1;       // Entry fast attempts go to
+static int           _leaseAp   = -1;       // Entry whose lease is from DHCP in this boot
+static unsigned long _leaseAt   = 0;        // millis() of that lease
+
+// --- Upload burst (networkUpdateBurst) ---
+#define BURST_CHECK_MS  500
+static bool          _burst        = false;
+static unsigned long _burstCheckAt = 0;
+static unsigned long _burstSince   = 0;
+
+// --- Reconnect timing (logged: link up, then first delivery) ---
+static unsigned long          _linkLostAt       = 0;    // 0 = never connected
+static volatile unsigned long _linkUpAt         = 0;
+static volatile unsigned long _linkAttemptAt    = 0;    // Start of the attempt that worked
+static volatile bool          _firstPostPending = false;
+
+// --- WiFi events (set by the WiFi event task, taken by networkCheckReconnect) ---
+#define LINK_EVENT_UP       0x01    // Got an IP address
+#define LINK_EVENT_DOWN     0x02    // Disconnected / lost the IP address
+
+static portMUX_TYPE      _linkMux    = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t           _linkEvents = 0;
+static unsigned long     _linkDownEventAt = 0;   // millis() of the last DOWN event
+
+// --- Connected windows (link up → link down) ---
+static volatile bool _windowDelivered = false;   // Something got through in this window
+static uint32_t      _windows         = 0;       // Windows that have ended
+static uint32_t      _windowsMissed   = 0;       // ... with nothing delivered
+
+// --- Keep-alive HTTP connection to the API host ---
+static WiFiClient    _client;
+static IPAddress     _hostIP;
+static bool          _hostResolved   = false;
+static unsigned long _hostResolvedAt = 0;
+static unsigned long _lastUse        = 0;   // millis() of the last exchange
+static volatile bool _dropConnection = false;   // WiFi lost: reopen before next use
+
+// --- API endpoint, split once from API_ENDPOINT ---
+static char     _apiHost[64];
+static char     _apiHostHeader[72];         // Host header ("host[:port]")
+static char     _apiPath[128];
+static uint16_t _apiPort   = HTTP_TLS ? 443 : 80;
+static bool     _apiParsed = false;
+static_assert((API_ENDPOINT[4] == 's') == (HTTP_TLS != 0),
+              "API_ENDPOINT must be https:// exactly when HTTP_TLS is set");
+
+// --- Fixed request / response buffers ---
+static char   _reqHead[352];
+static char   _respBody[HTTP_RESPONSE_MAX + 1];
+static size_t _respLen = 0;
+static long   _retryAfterS = 0;             // Retry-After of the last response, 0 = none
+
+// --- Request body compression (HTTP_COMPRESS) ---
+static bool _serverGzip = false;            // Server takes Content-Encoding: gzip
+#if HTTP_COMPRESS
+static uint8_t _gzBody[QUEUE_BATCH_MAX_BYTES];     // Shared by a pipelined window
+#endif
+
+// --- Pipelined upload: the requests as they go on the wire ---
+static_assert(QUEUE_PIPELINE_DEPTH >= 1, "QUEUE_PIPELINE_DEPTH must be >= 1");
+struct WirePart {
+    const uint8_t* body;
+    size_t         len;
+    bool           gzip;
+};
+static WirePart _wire[QUEUE_PIPELINE_DEPTH];
+
+// --- Sequence numbers (floor set by the main loop, acked from responses) ---
+static volatile uint32_t _seqFloor = 0;     // X-Seq-Floor, 0 = not sent
+static volatile uint32_t _ackedSeq = 0;     // Highest "acked_seq" answered
+
+// --- Backfill range requested by the server (see networkTakeBackfillRequest) ---
+// Set from the sender task, taken by the main loop.
+static portMUX_TYPE _backfillMux = portMUX_INITIALIZER_UNLOCKED;
+static bool     _backfillPending = false;
+static uint32_t _backfillFrom    = 0;
+static uint32_t _backfillTo      = 0;
+
+// --- Reporting parameters set by the server (see networkGetControl) ---
+// Set from the sender task, read by the main loop.
+static const ServerControl _controlDefault = { SEND_INTERVAL, 0, true };
+static portMUX_TYPE  _controlMux    = portMUX_INITIALIZER_UNLOCKED;
+static ServerControl _control       = _controlDefault;
+static bool          _controlActive = false;
+static unsigned long _controlUntil  = 0;    // millis() when it lapses
+
+// --- Circuit breaker (updated by the sender task, read by the main loop) ---
+#define BREAKER_CLOSED      0       // Uploads go out
+#define BREAKER_OPEN        1       // Failing: nothing goes out until _breakerWait
+#define BREAKER_HALF_OPEN   2       // The next upload is a probe
+
+static portMUX_TYPE  _breakerMux = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t       _breakerState    = BREAKER_CLOSED;
+static int           _breakerFailures = 0;      // In a row
+static uint32_t      _breakerBackoff  = 0;      // Current backoff, before jitter
+static uint32_t      _breakerWait     = 0;      // This opening's wait, jittered
+static unsigned long _breakerOpenedAt = 0;
+
+#if UDP_TELEMETRY
+// --- UDP telemetry: unacknowledged fixes, oldest first, consecutive seqs ---
+struct UdpFix {
+    TelemetryData data;
+    uint32_t      seq;
+    unsigned long sentAt;       // millis() of the first transmission
+    bool          acked;
+};
+
+static WiFiUDP       _udp;
+static bool          _udpOpen    = false;
+static uint32_t      _udpSession = 0;       // Random per boot
+static uint32_t      _udpNextSeq = 0;
+static UdpFix        _udpWindow[UDP_WINDOW];
+static int           _udpFirst   = 0;       // Slot of the oldest fix
+static int           _udpCount   = 0;
+static unsigned long _udpLastTx  = 0;
+static uint8_t       _udpBuf[UDP_MAX_DATAGRAM];
+#endif
+
+#if MQTT_TRANSPORT
+// --- MQTT: published live fixes awaiting their PUBACK, oldest first ---
+struct MqttFix {
+    TelemetryData data;
+    uint16_t      packetId;
+    bool          acked;
+};
+
+static WiFiClient    _mqtt;
+static bool          _mqttUp       = false;     // CONNACK accepted
+static volatile bool _mqttDrop     = false;     // WiFi lost: close before next use
+static unsigned long _mqttLastTry  = 0;         // millis() of the last connect
+static unsigned long _mqttLastTx   = 0;
+static bool          _mqttPingOut  = false;     // PINGREQ sent, nothing heard since
+static unsigned long _mqttPingAt   = 0;
+static uint16_t      _mqttNextId   = 0;
+static MqttFix       _mqttWindow[MQTT_MAX_INFLIGHT];
+static int           _mqttFirst    = 0;         // Slot of the oldest fix
+static int           _mqttCount    = 0;
+static uint16_t      _mqttBulkId   = 0;         // Bulk publish awaiting its PUBACK
+static bool          _mqttBulkAcked = false;
+static uint8_t       _mqttRx[MQTT_RX_MAX + 1];  // Incoming packet body (+ NUL)
+static size_t        _mqttRxLen    = 0;
+static bool          _mqttRxCut    = false;     // Body was longer than MQTT_RX_MAX
+static uint8_t       _mqttPayload[400];         // Live fix, wireEncodePayload()
+
+static bool _mqttPublishWait(const char* leaf, const uint8_t* body, size_t len);
+#endif
+
+// ============================================================================
+// KNOWN NETWORKS, FAST RECONNECT & ROAMING
+// ============================================================================
+// Every network that worked is kept on flash with its last access point,
+// channel, lease and a record of how well it served. Reconnecting to a
+// known access point on its channel skips the scan, and with a recent
+// lease the DHCP exchange as well, so a bus passing a known hotspot is
+// online in a few hundred milliseconds instead of several seconds. Passive
+// scans find the other known networks; a weak link is left for a clearly
+// better one before it drops.
+
+// ---------------------------------------------------------------------------
+// Internal helper: share of an access point's connected windows that got
+// something delivered, 0..1 (failed connects count as empty windows)
+// ---------------------------------------------------------------------------
+static float _apQuality(const KnownAp* ap) {
+    return (ap->delivered + 1.0f) / (ap->windows + ap->fails + 2.0f);
+}
+
+// Ranking score of a known network heard at `rssi`
+static float _apScore(int index, int rssi) {
+    if (index < 0) return rssi;
+    return rssi + WIFI_QUALITY_BONUS_DB * _apQuality(&_aps.ap[index]);
+}
+
+static int _findAp(const char* ssid) {
+    for (uint32_t i = 0; i < _aps.count; i++) {
+        if (strcmp(_aps.ap[i].ssid, ssid) == 0) return (int)i;
+    }
+    return -1;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: entry for `ssid`, added if new. A full list gives up
+// its lowest ranked entry (oldest among equals).
+// ---------------------------------------------------------------------------
+static int _addAp(const char* ssid, const char* psk) {
+    int index = _findAp(ssid);
+    if (index < 0) {
+        if (_aps.count < WIFI_KNOWN_MAX) {
+            index = (int)_aps.count++;
+        } else {
+            index = 0;
+            for (int i = 1; i < WIFI_KNOWN_MAX; i++) {
+                float q = _apQuality(&_aps.ap[i]);
+                float worst = _apQuality(&_aps.ap[index]);
+                if (q < worst || (q == worst && _aps.ap[i].lastUsed < _aps.ap[index].lastUsed)) {
+                    index = i;
+                }
+            }
+            Serial.print(F("[NETWORK] Known networks full — dropping "));
+            Serial.println(_aps.ap[index].ssid);
+            if (_apTarget == index) _apTarget = -1;
+            if (_leaseAp == index) _leaseAp = -1;
+        }
+        memset(&_aps.ap[index], 0, sizeof(KnownAp));
+        strncpy(_aps.ap[index].ssid, ssid, sizeof(_aps.ap[index].ssid) - 1);
+    }
+    strncpy(_aps.ap[index].psk, psk, sizeof(_aps.ap[index].psk) - 1);
+    return index;
+}
+
+static void _saveApStore() {
+    _aps.magic = AP_STORE_MAGIC;
+    _aps.crc = trackCrc32((const uint8_t*)&_aps, offsetof(ApStore, crc));
+
+    File f = LittleFS.open(WIFI_CACHE_TMP_FILE, "w");
+    bool saved = f && f.write((const uint8_t*)&_aps, sizeof(_aps)) == sizeof(_aps);
+    if (f) f.close();
+    if (!saved || !LittleFS.rename(WIFI_CACHE_TMP_FILE, WIFI_CACHE_FILE)) {
+        Serial.println(F("[NETWORK] WARNING: Could not save the known networks"));
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: load the known networks (WIFI_CACHE_FILE), add
+// WIFI_KNOWN_NETWORKS and aim the fast attempts at the network used last
+// ---------------------------------------------------------------------------
+static void _loadApStore() {
+    File f = LittleFS.open(WIFI_CACHE_FILE, "r");
+    bool ok = f && f.size() == sizeof(ApStore) &&
+              f.read((uint8_t*)&_aps, sizeof(_aps)) == sizeof(_aps) &&
+              _aps.magic == AP_STORE_MAGIC && _aps.count <= WIFI_KNOWN_MAX &&
+              _aps.crc == trackCrc32((const uint8_t*)&_aps, offsetof(ApStore, crc));
+    if (f) f.close();
+    if (!ok) {
+        memset(&_aps, 0, sizeof(_aps));
+    }
+
+    for (const BuiltinAp* b = _builtinAps; b->ssid != nullptr; b++) {
+        if (_findAp(b->ssid) < 0) _addAp(b->ssid, b->psk);
+    }
+
+    _apTarget = -1;
+    _leaseAp = -1;
+    for (uint32_t i = 0; i < _aps.count; i++) {
+        if (_aps.ap[i].channel != 0 && _aps.ap[i].lastUsed > 0 &&
+            (_apTarget < 0 || _aps.ap[i].lastUsed > _aps.ap[_apTarget].lastUsed)) {
+            _apTarget = (int)i;
+        }
+    }
+
+    Serial.print(F("[NETWORK] Known networks: "));
+    Serial.println(_aps.count);
+    if (_apTarget >= 0) {
+        Serial.print(F("[NETWORK] Last used: "));
+        Serial.print(_aps.ap[_apTarget].ssid);
+        Serial.print(F(", channel "));
+        Serial.println(_aps.ap[_apTarget].channel);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: remember the link just established (access point,
+// channel, lease) as the one the next fast attempts go to
+// ---------------------------------------------------------------------------
+static void _rememberLink() {
+    const uint8_t* bssid = WiFi.BSSID();
+    if (bssid == nullptr) return;
+
+    int index = _addAp(WiFi.SSID().c_str(), WiFi.psk().c_str());
+    KnownAp* ap = &_aps.ap[index];
+    memcpy(ap->bssid, bssid, sizeof(ap->bssid));
+    ap->channel  = (uint8_t)WiFi.channel();
+    ap->lastUsed = ++_aps.clock;
+
+    // A fast attempt on the cached lease did not renew it
+    if (!(_attempt == ATTEMPT_FAST && _attemptLease)) {
+        ap->ip      = (uint32_t)WiFi.localIP();
+        ap->gateway = (uint32_t)WiFi.gatewayIP();
+        ap->subnet  = (uint32_t)WiFi.subnetMask();
+        ap->dns     = (uint32_t)WiFi.dnsIP();
+        _leaseAp = index;
+        _leaseAt = millis();
+    }
+
+    _apCurrent = index;
+    _apTarget = index;
+    _saveApStore();     // With the window statistics gathered since the last connect
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: direct connect to the _apTarget access point on its
+// channel, on its cached lease while that is recent enough (else DHCP).
+// `seen`: the access point was just found by a scan (a miss counts
+// against it).
+// ---------------------------------------------------------------------------
+static void _startFastAttempt(bool seen) {
+    const KnownAp* ap = &_aps.ap[_apTarget];
+    _attempt = ATTEMPT_FAST;
+    _attemptSeen = seen;
+    _attemptLease = WIFI_LEASE_REUSE_MS > 0 && _leaseAp == _apTarget &&
+                    millis() - _leaseAt < WIFI_LEASE_REUSE_MS;
+    _lastReconnectAttempt = millis();
+
+    if (_fastMisses == 0) {
+        Serial.print(F("[NETWORK] Fast reconnect to "));
+        Serial.print(ap->ssid);
+        Serial.print(F(" (channel "));
+        Serial.print(ap->channel);
+        Serial.println(_attemptLease ? F(", cached lease)...") : F(", DHCP)..."));
+    }
+
+    WiFi.disconnect();
+    if (_attemptLease) {
+        WiFi.config(IPAddress(ap->ip), IPAddress(ap->gateway),
+                    IPAddress(ap->subnet), IPAddress(ap->dns));
+    } else {
+        WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+    }
+    WiFi.begin(ap->ssid, ap->psk, ap->channel, ap->bssid);
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: full attempt (scan for the saved network, DHCP), when
+// no network is known yet
+// ---------------------------------------------------------------------------
+static void _startFullAttempt() {
+    _attempt = ATTEMPT_FULL;
+    _lastReconnectAttempt = millis();
+    _lastFullAttempt = _lastReconnectAttempt;
+    _fastMisses = 0;
+
+    Serial.println(F("[NETWORK] Attempting WiFi reconnect..."));
+    WiFi.disconnect();
+#if WIFI_FAST_RECONNECT
+    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+#endif
+    WiFi.reconnect();
+}
+
+// Start a passive scan in the background (WiFi.scanComplete() tells)
+static void _startScan() {
+    _attempt = ATTEMPT_SCAN;
+    _lastReconnectAttempt = millis();
+    WiFi.scanNetworks(true, false, true, WIFI_SCAN_MS_PER_CHANNEL);
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: best scored known access point among `found` scan
+// results, other than the one connected to. Its BSSID / channel are
+// copied to `bssid` / `channel`.
+// @return entry index, or -1 if no known network was found
+// ---------------------------------------------------------------------------
+static int _pickScanned(int found, float* score, uint8_t* bssid, uint8_t* channel) {
+    const uint8_t* current = networkIsConnected() ? WiFi.BSSID() : nullptr;
+    int best = -1;
+    for (int i = 0; i < found; i++) {
+        int index = _findAp(WiFi.SSID(i).c_str());
+        const uint8_t* b = WiFi.BSSID(i);
+        if (index < 0 || b == nullptr) continue;
+        if (current != nullptr && memcmp(b, current, 6) == 0) continue;
+
+        float s = _apScore(index, WiFi.RSSI(i));
+        if (best < 0 || s > *score) {
+            best = index;
+            *score = s;
+            memcpy(bssid, b, 6);
+            *channel = (uint8_t)WiFi.channel(i);
+        }
+    }
+    return best;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: an offline scan has finished: connect directly to the
+// best known network it found
+// ---------------------------------------------------------------------------
+static void _scanDone(int found) {
+    float score;
+    uint8_t bssid[6];
+    uint8_t channel;
+    int best = _pickScanned(found, &score, bssid, &channel);
+    WiFi.scanDelete();
+    _attempt = ATTEMPT_NONE;
+    if (best < 0) return;
+
+    KnownAp* ap = &_aps.ap[best];
+    memcpy(ap->bssid, bssid, sizeof(ap->bssid));
+    ap->channel = channel;
+    _apTarget = best;
+    _fastMisses = 0;
+    _startFastAttempt(true);
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: start the next reconnect attempt once the current one
+// has had its time. Without WIFI_FAST_RECONNECT: a full attempt every
+// WIFI_RECONNECT_INTERVAL.
+// ---------------------------------------------------------------------------
+static void _reconnectStep() {
+    unsigned long now = millis();
+    if (_attempt == ATTEMPT_FAST) {
+        if (now - _lastReconnectAttempt < WIFI_FAST_TIMEOUT_MS) return;
+        _fastMisses++;
+        if (_attemptSeen) _aps.ap[_apTarget].fails++;
+        _attempt = ATTEMPT_NONE;
+    } else if (_attempt == ATTEMPT_SCAN) {
+        int found = WiFi.scanComplete();
+        if (found == WIFI_SCAN_RUNNING && now - _lastReconnectAttempt < WIFI_SCAN_TIMEOUT_MS) {
+            return;
+        }
+        _scanDone(found);
+        if (_attempt != ATTEMPT_NONE) return;
+    } else if (_attempt == ATTEMPT_FULL) {
+        if (now - _lastReconnectAttempt < WIFI_SCAN_TIMEOUT_MS) return;
+        _attempt = ATTEMPT_NONE;
+    }
+
+    bool scanDue = now - _lastFullAttempt >= WIFI_RECONNECT_INTERVAL;
+#if WIFI_FAST_RECONNECT
+    if (_apTarget >= 0 && (_fastMisses < WIFI_FAST_MAX_TRIES || !scanDue)) {
+        _startFastAttempt(false);
+        return;
+    }
+    if (scanDue && _aps.count > 0) {
+        _lastFullAttempt = now;
+        _fastMisses = 0;
+        WiFi.disconnect();      // A pending connect would hold the scan off
+        _startScan();
+        return;
+    }
+#endif
+    if (scanDue) {
+        _startFullAttempt();
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: while connected on a weak link, scan now and then and
+// move to a known access point that scores clearly higher. Dropping the
+// link is all it takes: the reconnect goes to _apTarget.
+// ---------------------------------------------------------------------------
+static void _roamStep() {
+#if WIFI_ROAM && WIFI_FAST_RECONNECT
+    unsigned long now = millis();
+    if (_attempt == ATTEMPT_SCAN) {
+        int found = WiFi.scanComplete();
+        if (found == WIFI_SCAN_RUNNING && now - _lastReconnectAttempt < WIFI_SCAN_TIMEOUT_MS) {
+            return;
+        }
+        _attempt = ATTEMPT_NONE;
+
+        int rssi = WiFi.RSSI();
+        float score;
+        uint8_t bssid[6];
+        uint8_t channel;
+        int best = _pickScanned(found, &score, bssid, &channel);
+        WiFi.scanDelete();
+        if (best < 0 || score < _apScore(_apCurrent, rssi) + WIFI_ROAM_MARGIN_DB) return;
+
+        Serial.print(F("[NETWORK] Roaming: "));
+        Serial.print(rssi);
+        Serial.print(F(" dBm here, "));
+        Serial.print(_aps.ap[best].ssid);
+        Serial.print(F(" (channel "));
+        Serial.print(channel);
+        Serial.println(F(") scores higher — switching"));
+
+        KnownAp* ap = &_aps.ap[best];
+        memcpy(ap->bssid, bssid, sizeof(ap->bssid));
+        ap->channel = channel;
+        _apTarget = best;
+        WiFi.disconnect();
+        return;
+    }
+
+    if (_burst || now - _lastRoamScan < WIFI_ROAM_SCAN_MS) return;
+    if (WiFi.RSSI() >= WIFI_ROAM_RSSI) return;
+    _lastRoamScan = now;
+    _startScan();
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: WiFi event callback (WiFi event task). Only records the
+// event; the state change itself happens in networkCheckReconnect(). A
+// dead connection is dropped at once, so the sender task does not wait
+// on it.
+// ---------------------------------------------------------------------------
+static void _onWiFiEvent(arduino_event_id_t event, arduino_event_info_t info) {
+    (void)info;
+    uint8_t flag;
+    switch (event) {
+        case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+            flag = LINK_EVENT_UP;
+            break;
+        case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+        case ARDUINO_EVENT_WIFI_STA_LOST_IP:
+            flag = LINK_EVENT_DOWN;
+            break;
+        default:
+            return;
+    }
+
+    portENTER_CRITICAL(&_linkMux);
+    _linkEvents |= flag;
+    if (flag == LINK_EVENT_DOWN) _linkDownEventAt = millis();
+    portEXIT_CRITICAL(&_linkMux);
+
+    if (flag == LINK_EVENT_DOWN && _wasConnected) {
+        _dropConnection = true;
+#if MQTT_TRANSPORT
+        _mqttDrop = true;
+#endif
+    }
+}
+
+// Take the WiFi events recorded since the last call
+static uint8_t _takeLinkEvents(unsigned long* downAt) {
+    portENTER_CRITICAL(&_linkMux);
+    uint8_t events = _linkEvents;
+    _linkEvents = 0;
+    *downAt = _linkDownEventAt;
+    portEXIT_CRITICAL(&_linkMux);
+    return events;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: the link is gone: close the connected window (counted
+// as missed if nothing was delivered in it) and start reconnecting
+// ---------------------------------------------------------------------------
+static void _linkDown(unsigned long at) {
+    Serial.println(F("[NETWORK] WiFi connection LOST — switching to offline mode"));
+    _wasConnected = false;
+    _dropConnection = true;     // Closed by the sender task, which owns it
+#if MQTT_TRANSPORT
+    _mqttDrop = true;
+#endif
+
+    _windows++;
+    if (!_windowDelivered) {
+        _windowsMissed++;
+        Serial.print(F("[NETWORK] Connected window of "));
+        Serial.print((at - _linkUpAt) / 1000);
+        Serial.print(F(" s missed: nothing delivered ("));
+        Serial.print(_windowsMissed);
+        Serial.print(F(" of "));
+        Serial.print(_windows);
+        Serial.println(F(" windows)"));
+    }
+    if (_apCurrent >= 0) {
+        // Saved with the next connect
+        KnownAp* ap = &_aps.ap[_apCurrent];
+        if (ap->windows == 0xFFFF) {
+            ap->windows /= 2;
+            ap->delivered /= 2;
+        }
+        ap->windows++;
+        if (_windowDelivered) ap->delivered++;
+        _apCurrent = -1;
+    }
+    if (_attempt == ATTEMPT_SCAN) WiFi.scanDelete();    // Roaming scan cut short
+    if (_burst) {
+        _burst = false;
+        WiFi.setSleep(true);
+        Serial.println(F("[NETWORK] Upload burst ended: link lost"));
+    }
+
+    _linkLostAt = at;
+    _firstPostPending = false;
+    _attempt = ATTEMPT_NONE;
+    _lastFullAttempt = at - WIFI_RECONNECT_INTERVAL;    // Due at once
+    _fastMisses = 0;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: the link is up: log how long the attempt took and
+// start timing the first delivery
+// ---------------------------------------------------------------------------
+static void _linkUp() {
+    unsigned long now = millis();
+    if (_attempt != ATTEMPT_NONE) {
+        Serial.print(F("[NETWORK] Link up "));
+        Serial.print(now - _lastReconnectAttempt);
+        Serial.print(_attempt == ATTEMPT_FULL ? F(" ms after a full scan attempt")
+                     : _attemptSeen           ? F(" ms after a scan and a direct connect")
+                     : _attemptLease          ? F(" ms after a fast attempt (cached lease)")
+                                              : F(" ms after a fast attempt (DHCP)"));
+        if (_linkLostAt != 0) {
+            Serial.print(F(", offline "));
+            Serial.print((now - _linkLostAt) / 1000);
+            Serial.print(F(" s"));
+        }
+        Serial.println();
+        _linkAttemptAt = _lastReconnectAttempt;
+    } else {
+        _linkAttemptAt = now;
+    }
+    _linkUpAt = now;
+    _firstPostPending = true;
+    _windowDelivered = false;
+
+    // Events up to here led to this link (e.g. the attempt's own disconnect)
+    unsigned long downAt;
+    _takeLinkEvents(&downAt);
+
+    _rememberLink();
+    _attempt = ATTEMPT_NONE;
+    _fastMisses = 0;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: the server took something (POST answered, MQTT PUBACK,
+// UDP ACK). Logs the first one since the link came up. Sender task.
+// ---------------------------------------------------------------------------
+static void _delivered() {
+    _windowDelivered = true;
+    if (!_firstPostPending) return;
+    _firstPostPending = false;
+
+    unsigned long now = millis();
+    Serial.print(F("[NETWORK] First delivery after reconnect: "));
+    Serial.print(now - _linkAttemptAt);
+    Serial.print(F(" ms from the attempt ("));
+    Serial.print(now - _linkUpAt);
+    Serial.println(F(" ms after link up)"));
+}
+
 /**
  * Initialize WiFi using WiFiManager with captive portal support.
  * This call is BLOCKING during AP mode — it waits for the user to
  * configure WiFi via the captive portal, up to AP_TIMEOUT seconds.
  */
 bool networkInit() {
-    _wm.setConfigPortalTimeout(AP_TIMEOUT);
-    _wm.setConnectTimeout(15);
-    _wm.setCleanConnect(true);
+    bool connected = false;
 
-    Serial.println(F("[NETWORK] Starting WiFiManager..."));
-    Serial.print(F("[NETWORK] AP Name: "));
-    Serial.println(AP_NAME);
+    WiFi.onEvent(_onWiFiEvent);
 
-    bool connected = _wm.autoConnect(AP_NAME);
+#if WIFI_FAST_RECONNECT
+    // Fast attempts must not rewrite the saved credentials each time
+    // (WiFiManager saves new ones itself)
+    WiFi.persistent(false);
+
+    // Try the network used last before WiFiManager's scan
+    _loadApStore();
+    if (_apTarget >= 0) {
+        WiFi.mode(WIFI_STA);
+        _startFastAttempt(false);
+        while (!networkIsConnected() &&
+               millis() - _lastReconnectAttempt < WIFI_FAST_TIMEOUT_MS) {
+            delay(10);
+        }
+        connected = networkIsConnected();
+    }
+#endif
+
+    if (!connected) {
+        _wm.setConfigPortalTimeout(AP_TIMEOUT);
+        _wm.setConnectTimeout(15);
+        _wm.setCleanConnect(true);
+
+        Serial.println(F("[NETWORK] Starting WiFiManager..."));
+        Serial.print(F("[NETWORK] AP Name: "));
+        Serial.println(AP_NAME);
+
+        _attempt = ATTEMPT_NONE;
+        connected = _wm.autoConnect(AP_NAME);
+    }
+
+#if WIFI_FAST_RECONNECT
+    WiFi.setAutoReconnect(false);   // networkCheckReconnect() picks the kind of attempt
+#endif
 
     if (connected) {
         Serial.println(F("[NETWORK] WiFi connected successfully"));
@@ -55,6 +793,7 @@ bool networkInit() {
         Serial.print(WiFi.RSSI());
         Serial.println(F(" dBm"));
         _wasConnected = true;
+        _linkUp();
     } else {
         Serial.println(F("[NETWORK] WiFi connection failed / portal timed out"));
         Serial.println(F("[NETWORK] Operating in offline mode"));
@@ -71,32 +810,39 @@ bool networkIsConnected() {
 }
 
 /**
- * Periodically attempt WiFi reconnection if disconnected.
- * Called every WIFI_CHECK_INTERVAL (10 seconds).
+ * Apply the WiFi events since the last pass (link lost / back), then
+ * drive the reconnect attempts: fast attempts to the network used last,
+ * a passive scan for the known networks after WIFI_FAST_MAX_TRIES
+ * misses. While connected on a weak link, looks for a better known
+ * access point (WIFI_ROAM). Called on every loop() pass; each attempt
+ * gets its time.
  */
-void networkCheckReconnect() {
+int networkCheckReconnect() {
+    unsigned long downAt;
+    uint8_t events = _takeLinkEvents(&downAt);
     bool currentlyConnected = networkIsConnected();
+    int change = NET_LINK_UNCHANGED;
 
-    if (_wasConnected && !currentlyConnected) {
-        Serial.println(F("[NETWORK] WiFi connection LOST — switching to offline mode"));
-        _wasConnected = false;
-    } else if (!_wasConnected && currentlyConnected) {
+    // A drop and a quick reconnect between two passes still ends the window
+    if (_wasConnected && (!currentlyConnected || (events & LINK_EVENT_DOWN))) {
+        _linkDown((events & LINK_EVENT_DOWN) ? downAt : millis());
+        change = NET_LINK_DOWN;
+    }
+    if (!_wasConnected && currentlyConnected) {
         Serial.println(F("[NETWORK] WiFi RECONNECTED"));
         Serial.print(F("[NETWORK] IP: "));
         Serial.println(WiFi.localIP());
         _wasConnected = true;
-        return;
+        _linkUp();
+        return NET_LINK_UP;
     }
 
     if (!currentlyConnected && !_portalActive) {
-        unsigned long now = millis();
-        if (now - _lastReconnectAttempt >= WIFI_RECONNECT_INTERVAL) {
-            _lastReconnectAttempt = now;
-            Serial.println(F("[NETWORK] Attempting WiFi reconnect..."));
-            WiFi.disconnect();
-            WiFi.reconnect();
-        }
+        _reconnectStep();
+    } else if (currentlyConnected && !_portalActive) {
+        _roamStep();
     }
+    return change;
 }
 
 /**
@@ -141,6 +887,8 @@ bool networkPortalLoop() {
         Serial.print(F("[NETWORK] IP: "));
         Serial.println(WiFi.localIP());
         _wasConnected = true;
+        _attempt = ATTEMPT_NONE;
+        _linkUp();
         networkStopPortal();
         return true;
     }
@@ -166,80 +914,1529 @@ bool networkIsPortalActive() {
     return _portalActive;
 }
 
-/**
- * Send a JSON payload to the API endpoint via HTTP POST.
- * Includes retry logic for transient failures and detailed error logging.
- *
- * @param json  The JSON string to POST
- * @return true if server responded with HTTP 2xx
- */
-bool networkSendData(const String& json) {
-    if (!networkIsConnected()) {
-        Serial.println(F("[NETWORK] Cannot send — WiFi not connected"));
+// ============================================================================
+// HTTP CONNECTION MANAGER
+// ============================================================================
+// One keep-alive connection to the API host, reused for every POST while
+// the server keeps it open. The host's address is cached for
+// HTTP_DNS_TTL_MS. Requests and responses go through fixed buffers, so a
+// send allocates nothing.
+
+// Exchange outcomes below zero (above zero: the HTTP status code)
+#define HTTP_ERR_CONNECT    -1      // DNS lookup or TCP connect failed
+#define HTTP_ERR_CLOSED     -2      // Connection closed before any response
+#define HTTP_ERR_TIMEOUT    -3      // No complete response in HTTP_TIMEOUT
+#define HTTP_ERR_RESPONSE   -4      // Response could not be parsed
+
+// ---------------------------------------------------------------------------
+// Internal helpers: I/O on the keep-alive connection, through TLS when
+// HTTP_TLS is set
+// ---------------------------------------------------------------------------
+static int _connRead() {
+#if HTTP_TLS
+    return tlsRead();
+#else
+    return _client.read();
+#endif
+}
+
+static int _connRead(uint8_t* buf, size_t len) {
+#if HTTP_TLS
+    return tlsRead(buf, len);
+#else
+    return _client.read(buf, len);
+#endif
+}
+
+static int _connAvailable() {
+#if HTTP_TLS
+    return tlsAvailable();
+#else
+    return _client.available();
+#endif
+}
+
+static bool _connConnected() {
+#if HTTP_TLS
+    return tlsConnected();
+#else
+    return _client.connected();
+#endif
+}
+
+static size_t _connWrite(const uint8_t* buf, size_t len) {
+#if HTTP_TLS
+    return tlsWrite(buf, len);
+#else
+    return _client.write(buf, len);
+#endif
+}
+
+static void _connStop() {
+#if HTTP_TLS
+    tlsStop();
+#endif
+    _client.stop();
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: read one CRLF-terminated line into buf.
+// Returns 1 = line read, 0 = timeout, -1 = connection closed.
+// ---------------------------------------------------------------------------
+static int _readLine(char* buf, size_t len, unsigned long deadline) {
+    size_t n = 0;
+    while ((long)(deadline - millis()) > 0) {
+        int c = _connRead();
+        if (c < 0) {
+            if (!_connConnected()) return -1;
+            delay(1);
+            continue;
+        }
+        if (c == '\n') {
+            if (n > 0 && buf[n - 1] == '\r') n--;
+            buf[n] = '\0';
+            return 1;
+        }
+        if (n < len - 1) buf[n++] = (char)c;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: read `want` body bytes (SIZE_MAX: until the server
+// closes). The first HTTP_RESPONSE_MAX bytes are kept in _respBody.
+// ---------------------------------------------------------------------------
+static bool _readBody(size_t want, unsigned long deadline) {
+    uint8_t scratch[64];
+    while (want > 0 && (long)(deadline - millis()) > 0) {
+        int avail = _connAvailable();
+        if (avail <= 0) {
+            if (!_connConnected()) return want == SIZE_MAX;
+            delay(1);
+            continue;
+        }
+
+        size_t room = HTTP_RESPONSE_MAX - _respLen;
+        uint8_t* dst = room > 0 ? (uint8_t*)_respBody + _respLen : scratch;
+        size_t chunk = room > 0 ? room : sizeof(scratch);
+        if (chunk > want) chunk = want;
+        if (chunk > (size_t)avail) chunk = avail;
+
+        int n = _connRead(dst, chunk);
+        if (n <= 0) continue;
+        if (room > 0) _respLen += n;
+        if (want != SIZE_MAX) want -= n;
+    }
+    _respBody[_respLen] = '\0';
+    return want == 0;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: split API_ENDPOINT ("http[s]://host[:port]/path") once
+// ---------------------------------------------------------------------------
+static void _parseEndpoint() {
+    if (_apiParsed) return;
+
+    const char* url = API_ENDPOINT;
+    if (strncmp(url, "http://", 7) == 0) url += 7;
+    else if (strncmp(url, "https://", 8) == 0) url += 8;
+
+    const char* slash = strchr(url, '/');
+    size_t hostLen = slash ? (size_t)(slash - url) : strlen(url);
+    const char* colon = (const char*)memchr(url, ':', hostLen);
+    if (colon) {
+        _apiPort = (uint16_t)atoi(colon + 1);
+        snprintf(_apiHostHeader, sizeof(_apiHostHeader), "%.*s", (int)hostLen, url);
+        hostLen = colon - url;
+    }
+    snprintf(_apiHost, sizeof(_apiHost), "%.*s", (int)hostLen, url);
+    if (!colon) {
+        snprintf(_apiHostHeader, sizeof(_apiHostHeader), "%s", _apiHost);
+    }
+    snprintf(_apiPath, sizeof(_apiPath), "%s", slash ? slash : "/");
+    _apiParsed = true;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: the API host's address, from cache while fresh. If a
+// refresh fails, the previous address is kept for another TTL.
+// ---------------------------------------------------------------------------
+static bool _resolveHost() {
+    unsigned long now = millis();
+    if (_hostResolved && now - _hostResolvedAt < HTTP_DNS_TTL_MS) {
+        return true;
+    }
+
+    IPAddress ip;
+    if (WiFi.hostByName(_apiHost, ip) == 1) {
+        _hostIP = ip;
+        _hostResolved = true;
+        _hostResolvedAt = now;
+        return true;
+    }
+
+    Serial.print(F("[NETWORK] DNS lookup failed for "));
+    Serial.println(_apiHost);
+    if (_hostResolved) {
+        _hostResolvedAt = now;
+        return true;
+    }
+    return false;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: make sure the keep-alive connection is open.
+// `reused` tells whether an existing connection is being used again.
+// ---------------------------------------------------------------------------
+static bool _ensureConnection(bool* reused) {
+    if (_dropConnection) {
+        _dropConnection = false;
+        _connStop();
+    }
+    if (_connConnected() && millis() - _lastUse < HTTP_KEEPALIVE_IDLE_MS) {
+        *reused = true;
+        return true;
+    }
+
+    _connStop();
+    *reused = false;
+    if (!_resolveHost()) return false;
+
+    if (!_client.connect(_hostIP, _apiPort, HTTP_TIMEOUT)) {
+        _hostResolved = false;      // Look the host up again next time
         return false;
     }
+    _client.setNoDelay(true);
+#if HTTP_TLS
+    if (!tlsConnect(&_client, _apiHost, HTTP_TIMEOUT)) {
+        _client.stop();
+        return false;
+    }
+#endif
+    return true;
+}
 
-    HTTPClient http;
-    http.begin(API_ENDPOINT);
-    http.addHeader("Content-Type", "application/json");
-    http.setTimeout(HTTP_TIMEOUT);
+// ---------------------------------------------------------------------------
+// Internal helper: write one request on the open connection
+// ---------------------------------------------------------------------------
+static bool _writeRequest(const char* contentType, const WirePart* part, bool backfill) {
+    char floor[32] = "";
+    uint32_t seqFloor = _seqFloor;
+    if (seqFloor > 0) {
+        snprintf(floor, sizeof(floor), "X-Seq-Floor: %lu\r\n", (unsigned long)seqFloor);
+    }
 
-    Serial.print(F("[NETWORK] POST → "));
-    Serial.println(API_ENDPOINT);
-    Serial.print(F("[NETWORK] Payload ("));
-    Serial.print(json.length());
-    Serial.println(F(" bytes)"));
+    int headLen = snprintf(_reqHead, sizeof(_reqHead),
+        "POST %s HTTP/1.1\r\n"
+        "Host: %s\r\n"
+        "Content-Type: %s\r\n"
+        "%s"
+        "X-Bus-Id: %d\r\n"
+        "%s"
+        "%s"
+        "Content-Length: %u\r\n"
+        "Connection: keep-alive\r\n"
+        "\r\n",
+        _apiPath, _apiHostHeader, contentType,
+        part->gzip ? "Content-Encoding: gzip\r\n" : "", BUS_ID,
+        backfill ? "X-Backfill: 1\r\n" : "", floor, (unsigned)part->len);
 
-    int httpCode = http.POST(json);
+    return _connWrite((const uint8_t*)_reqHead, headLen) == (size_t)headLen &&
+           _connWrite(part->body, part->len) == part->len;
+}
 
-    if (httpCode > 0) {
-        String responseBody = http.getString();
-
-        if (httpCode >= 200 && httpCode < 300) {
-            Serial.print(F("[NETWORK] ✓ POST success (HTTP "));
-            Serial.print(httpCode);
-            Serial.println(F(")"));
-            if (responseBody.length() > 0) {
-                Serial.print(F("[NETWORK] Response: "));
-                Serial.println(responseBody.substring(0, 200));
+// ---------------------------------------------------------------------------
+// Internal helper: read the next response on the open connection.
+// Leaves the response body in _respBody.
+// ---------------------------------------------------------------------------
+static int _readResponse() {
+    unsigned long deadline = millis() + HTTP_TIMEOUT;
+    char line[128];
+
+    // Status line: "HTTP/1.1 200 OK"
+    int got = _readLine(line, sizeof(line), deadline);
+    if (got <= 0) return got < 0 ? HTTP_ERR_CLOSED : HTTP_ERR_TIMEOUT;
+    if (strncmp(line, "HTTP/1.", 7) != 0) return HTTP_ERR_RESPONSE;
+    bool keepAlive = line[7] == '1';
+    int status = atoi(line + 9);
+
+    // Headers
+    size_t contentLength = SIZE_MAX;
+    bool chunked = false;
+    _retryAfterS = 0;
+    for (;;) {
+        got = _readLine(line, sizeof(line), deadline);
+        if (got <= 0) return HTTP_ERR_TIMEOUT;
+        if (line[0] == '\0') break;
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            contentLength = strtoul(line + 15, nullptr, 10);
+        } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strstr(line, "chunked")) {
+            chunked = true;
+        } else if (strncasecmp(line, "Connection:", 11) == 0) {
+            keepAlive = strcasestr(line, "close") == nullptr;
+        } else if (strncasecmp(line, "Accept-Encoding:", 16) == 0) {
+            _serverGzip = strcasestr(line, "gzip") != nullptr;
+        } else if (strncasecmp(line, "Retry-After:", 12) == 0) {
+            _retryAfterS = strtol(line + 12, nullptr, 10);     // HTTP-date form: ignored
+        }
+    }
+
+    // Body (none for 1xx / 204 / 304)
+    if ((status >= 100 && status < 200) || status == 204 || status == 304) {
+        contentLength = 0;
+    }
+    _respLen = 0;
+    bool complete;
+    if (chunked) {
+        complete = false;
+        for (;;) {
+            if (_readLine(line, sizeof(line), deadline) <= 0) break;
+            size_t size = strtoul(line, nullptr, 16);
+            if (size == 0) {
+                while (_readLine(line, sizeof(line), deadline) > 0 && line[0] != '\0') {}
+                complete = true;
+                break;
             }
-            http.end();
-            return true;
+            if (!_readBody(size, deadline) || _readLine(line, sizeof(line), deadline) <= 0) break;
+        }
+    } else {
+        complete = _readBody(contentLength, deadline);
+        if (contentLength == SIZE_MAX) keepAlive = false;
+    }
+    _respBody[_respLen] = '\0';
+
+    if (!complete) return HTTP_ERR_TIMEOUT;
+    if (!keepAlive) _connStop();
+    return status;
+}
+
+// ============================================================================
+// CIRCUIT BREAKER
+// ============================================================================
+// Server-level failures in a row open the breaker; while open, uploads fail
+// at once without touching the network. The first upload after the wait
+// is the probe: success closes the breaker, failure reopens it with twice
+// the backoff.
+
+// ---------------------------------------------------------------------------
+// Internal helper: may an upload go out now? Once the wait is over the
+// breaker turns half-open and lets the probe through.
+// ---------------------------------------------------------------------------
+static bool _breakerAllow() {
+    portENTER_CRITICAL(&_breakerMux);
+    bool allow = true;
+    if (_breakerState == BREAKER_OPEN) {
+        if (millis() - _breakerOpenedAt >= _breakerWait) {
+            _breakerState = BREAKER_HALF_OPEN;
         } else {
-            Serial.print(F("[NETWORK] ✗ POST rejected (HTTP "));
-            Serial.print(httpCode);
-            Serial.println(F(")"));
-            Serial.print(F("[NETWORK] Response: "));
-            Serial.println(responseBody.substring(0, 200));
+            allow = false;
         }
+    }
+    portEXIT_CRITICAL(&_breakerMux);
+    return allow;
+}
+
+// The server answered: close the breaker
+static void _breakerSuccess() {
+    portENTER_CRITICAL(&_breakerMux);
+    bool wasOpen = _breakerState != BREAKER_CLOSED;
+    _breakerState = BREAKER_CLOSED;
+    _breakerFailures = 0;
+    _breakerBackoff = 0;
+    portEXIT_CRITICAL(&_breakerMux);
+
+    if (wasOpen) {
+        Serial.println(F("[NETWORK] Server answering again — circuit closed"));
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: count a server-level failure; open the breaker after
+// BREAKER_FAILURES in a row, or at once if the probe failed
+// ---------------------------------------------------------------------------
+static void _breakerFailure() {
+    uint32_t jitter = esp_random();
+
+    portENTER_CRITICAL(&_breakerMux);
+    _breakerFailures++;
+    bool open = _breakerState == BREAKER_HALF_OPEN || _breakerFailures >= BREAKER_FAILURES;
+    if (open) {
+        uint32_t backoff = _breakerBackoff == 0 ? BREAKER_BASE_MS : _breakerBackoff * 2;
+        _breakerBackoff = backoff < BREAKER_MAX_MS ? backoff : BREAKER_MAX_MS;
+        _breakerWait = _breakerBackoff / 2 + jitter % (_breakerBackoff / 2 + 1);
+        _breakerOpenedAt = millis();
+        _breakerState = BREAKER_OPEN;
+    }
+    int failures = _breakerFailures;
+    uint32_t wait = _breakerWait;
+    portEXIT_CRITICAL(&_breakerMux);
+
+    if (open) {
+        Serial.print(F("[NETWORK] Circuit open after "));
+        Serial.print(failures);
+        Serial.print(F(" failures — next try in "));
+        Serial.print(wait / 1000);
+        Serial.println(F(" s"));
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: pick up a backfill request from a response body,
+// e.g. {"status":"success",...,"backfill":{"from":1771495553,"to":1771499153}}
+// ---------------------------------------------------------------------------
+static void _parseBackfill(const char* response) {
+    const char* pos = strstr(response, "\"backfill\"");
+    if (!pos) return;
+
+    const char* fromPos = strstr(pos, "\"from\":");
+    const char* toPos = strstr(pos, "\"to\":");
+    if (!fromPos || !toPos) return;
+
+    uint32_t from = strtoul(fromPos + 7, nullptr, 10);
+    uint32_t to = strtoul(toPos + 5, nullptr, 10);
+    if (from == 0 || to < from) return;
+
+    portENTER_CRITICAL(&_backfillMux);
+    _backfillFrom = from;
+    _backfillTo = to;
+    _backfillPending = true;
+    portEXIT_CRITICAL(&_backfillMux);
+    Serial.print(F("[NETWORK] Server requested archive backfill: "));
+    Serial.print(from);
+    Serial.print(F(" .. "));
+    Serial.println(to);
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: a number field between `pos` and `end`, clamped to
+// [lo, hi]. Returns false if the field is absent or not a number (null,
+// a quoted string), so a malformed field never turns into a bound.
+// ---------------------------------------------------------------------------
+static bool _controlField(const char* pos, const char* end, const char* key,
+                          long lo, long hi, long* value) {
+    const char* at = strstr(pos, key);
+    if (!at || at > end) return false;
+
+    at += strlen(key);
+    while (*at == ' ') at++;
+    if (strncmp(at, "true", 4) == 0) {
+        *value = 1;
+    } else if (strncmp(at, "false", 5) == 0) {
+        *value = 0;
     } else {
-        Serial.print(F("[NETWORK] ✗ Connection error: "));
-        Serial.println(http.errorToString(httpCode));
+        char* digitsEnd;
+        *value = strtol(at, &digitsEnd, 10);
+        if (digitsEnd == at) return false;
+    }
+    if (*value < lo) *value = lo;
+    if (*value > hi) *value = hi;
+    return true;
+}
 
-        // Provide human-readable guidance for common errors
-        switch (httpCode) {
-            case HTTPC_ERROR_CONNECTION_REFUSED:
-                Serial.println(F("[NETWORK]   → Server refused connection. Check URL/port."));
-                break;
-            case HTTPC_ERROR_SEND_HEADER_FAILED:
-            case HTTPC_ERROR_SEND_PAYLOAD_FAILED:
-                Serial.println(F("[NETWORK]   → Send failed. WiFi may have dropped."));
-                break;
-            case HTTPC_ERROR_CONNECTION_LOST:
-                Serial.println(F("[NETWORK]   → Connection lost mid-transfer."));
-                break;
-            case HTTPC_ERROR_READ_TIMEOUT:
-                Serial.println(F("[NETWORK]   → Server did not respond in time."));
-                break;
-            default:
-                break;
+// ---------------------------------------------------------------------------
+// Internal helper: make `control` the reporting parameters for `ttl`
+// seconds
+// ---------------------------------------------------------------------------
+static void _applyControl(const ServerControl& control, long ttl) {
+    portENTER_CRITICAL(&_controlMux);
+    bool changed = !_controlActive || control.intervalMs != _control.intervalMs ||
+                   control.batchMax != _control.batchMax ||
+                   control.flushAllowed != _control.flushAllowed;
+    _control = control;
+    _controlActive = true;
+    _controlUntil = millis() + (unsigned long)ttl * 1000;
+    portEXIT_CRITICAL(&_controlMux);
+
+    if (changed) {
+        Serial.print(F("[NETWORK] Server control: live every "));
+        Serial.print(control.intervalMs);
+        Serial.print(F(" ms, backlog window "));
+        if (control.batchMax > 0) {
+            Serial.print(F("<= "));
+            Serial.print(control.batchMax);
+            Serial.print(F(" records"));
+        } else {
+            Serial.print(F("uncapped"));
         }
+        Serial.print(control.flushAllowed ? F(", flushes allowed, for ") : F(", flushes held, for "));
+        Serial.print(ttl);
+        Serial.println(F(" s"));
     }
+}
 
-    http.end();
-    return false;
+// ---------------------------------------------------------------------------
+// Internal helper: pick up reporting parameters from a response body,
+// e.g. {"status":"success",...,"control":{"next_interval_ms":15000,
+// "batch_max":20,"flush_allowed":0,"ttl_s":600}}. The block replaces the
+// previous one as a whole; fields left out are back at their default.
+// Returns false if the body has no control block.
+// ---------------------------------------------------------------------------
+static bool _parseControl(const char* response) {
+    const char* pos = strstr(response, "\"control\"");
+    if (!pos) return false;
+    const char* end = strchr(pos, '}');
+    if (!end) return false;
+
+    ServerControl control = _controlDefault;
+    long value;
+    if (_controlField(pos, end, "\"next_interval_ms\":",
+                      CONTROL_INTERVAL_MIN_MS, CONTROL_INTERVAL_MAX_MS, &value)) {
+        control.intervalMs = value;
+    }
+    if (_controlField(pos, end, "\"batch_max\":", 1, 0xFFFF, &value)) {
+        control.batchMax = value;
+    }
+    if (_controlField(pos, end, "\"flush_allowed\":", 0, 1, &value)) {
+        control.flushAllowed = value != 0;
+    }
+    long ttl = CONTROL_TTL_MS / 1000;
+    _controlField(pos, end, "\"ttl_s\":", 1, CONTROL_TTL_MAX_MS / 1000, &ttl);
+    _applyControl(control, ttl);
+    return true;
 }
 
+// ---------------------------------------------------------------------------
+// Internal helper: an error response without a control block but with
+// "Retry-After: <seconds>" (429 / 503): hold backlog uploads and space the
+// live fixes out to the retry delay until it has passed
+// ---------------------------------------------------------------------------
+static void _retryAfterControl(long seconds) {
+    if (seconds > CONTROL_TTL_MAX_MS / 1000) seconds = CONTROL_TTL_MAX_MS / 1000;
+    long ms = seconds * 1000;
+
+    ServerControl control = _controlDefault;
+    control.intervalMs = ms < SEND_INTERVAL ? SEND_INTERVAL
+                       : ms > CONTROL_INTERVAL_MAX_MS ? CONTROL_INTERVAL_MAX_MS : ms;
+    control.flushAllowed = false;
+    _applyControl(control, seconds);
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: read the per-record results of a batch upload,
+// e.g. {"status":"success",...,"results":["ok","rejected","retry"]}.
+// Records without a result (short or missing list) count as RETRY.
+// ---------------------------------------------------------------------------
+static void _parseBatchResults(const char* response, int count, uint8_t* results) {
+    const char* next = strstr(response, "\"results\":[");
+    const char* end = next ? strchr(next, ']') : nullptr;
+    if (next) next += 11;
+
+    for (int i = 0; i < count; i++) {
+        results[i] = BATCH_RESULT_RETRY;
+
+        const char* open = end ? strchr(next, '"') : nullptr;
+        if (!open || open > end) {
+            end = nullptr;      // List exhausted
+            continue;
+        }
+        if (strncmp(open + 1, "ok\"", 3) == 0) {
+            results[i] = BATCH_RESULT_OK;
+        } else if (strncmp(open + 1, "rejected\"", 9) == 0) {
+            results[i] = BATCH_RESULT_REJECTED;
+        }
+        const char* close = strchr(open + 1, '"');
+        if (!close) end = nullptr;
+        next = close + 1;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: highest seq up to which the server holds every record,
+// e.g. {"status":"success",...,"acked_seq":1234}
+// ---------------------------------------------------------------------------
+static void _parseAckedSeq(const char* response) {
+    const char* pos = strstr(response, "\"acked_seq\":");
+    if (!pos) return;
+
+    uint32_t acked = strtoul(pos + 12, nullptr, 10);
+    if (acked > _ackedSeq) _ackedSeq = acked;
+}
+
+// Print the start of the response body (up to 200 bytes)
+static void _logResponse() {
+    Serial.write((const uint8_t*)_respBody, _respLen < 200 ? _respLen : 200);
+    Serial.println();
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: take in a 2xx response to `part` (still in _respBody)
+// ---------------------------------------------------------------------------
+static void _takeResponse(const UploadPart* part, int httpCode,
+                          unsigned long elapsed, bool reused) {
+    Serial.print(F("[NETWORK] ✓ POST success (HTTP "));
+    Serial.print(httpCode);
+    Serial.print(F(", "));
+    Serial.print(elapsed);
+    Serial.println(reused ? F(" ms, reused connection)") : F(" ms, new connection)"));
+    if (_respLen > 0) {
+        Serial.print(F("[NETWORK] Response: "));
+        _logResponse();
+    }
+    _delivered();
+    _parseBackfill(_respBody);
+    _parseControl(_respBody);
+    _parseAckedSeq(_respBody);
+    if (part->results) {
+        _parseBatchResults(_respBody, part->count, part->results);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: POST the requests in _wire back to back on the
+// keep-alive connection (HTTP/1.1 pipelining), then read the responses
+// in order, stopping at the first one that is not 2xx. If the connection
+// closes part way (keep-alive limit, or a reused connection the server
+// had dropped), the rest go out again on a new one.
+// @param httpCode  receives the last response code, or an HTTP_ERR_* code
+// @return number of leading requests answered with 2xx
+// ---------------------------------------------------------------------------
+static int _httpPipeline(const char* contentType, const UploadPart* parts, int count,
+                         bool backfill, int* httpCode) {
+    _parseEndpoint();
+    unsigned long started = millis();
+
+    int done = 0;
+    while (done < count) {
+        bool reused;
+        if (!_ensureConnection(&reused)) {
+            *httpCode = HTTP_ERR_CONNECT;
+            return done;
+        }
+
+        int sent = done;
+        while (sent < count && _writeRequest(contentType, &_wire[sent], backfill)) {
+            sent++;
+        }
+
+        int first = done;
+        int status = HTTP_ERR_CLOSED;
+        while (done < sent) {
+            status = _readResponse();
+            if (status <= 0) break;
+            if (status < 200 || status >= 300) {
+                // An overloaded server (429 / 503) may still slow us down
+                if (!_parseControl(_respBody) && _retryAfterS > 0) {
+                    _retryAfterControl(_retryAfterS);
+                }
+                // Drop what is still in flight: it goes out again later
+                _connStop();
+                *httpCode = status;
+                return done;
+            }
+            _takeResponse(&parts[done], status, millis() - started, reused);
+            done++;
+        }
+        _lastUse = millis();
+        *httpCode = status;
+        if (done == count) return done;
+
+        _connStop();
+        if (status > 0) status = HTTP_ERR_CLOSED;      // A write failed
+        *httpCode = status;
+        if (status != HTTP_ERR_CLOSED || (done == first && !reused)) return done;
+    }
+    return done;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: POST one or more bodies (pipelined) and report the
+// outcome on Serial.
+// @return number of leading parts the server accepted (2xx)
+// ---------------------------------------------------------------------------
+static int _postParts(const char* contentType, const UploadPart* parts, int count,
+                      bool backfill) {
+    if (!_breakerAllow()) {
+        Serial.println(F("[NETWORK] Circuit open — not sending"));
+        return 0;
+    }
+
+    Serial.print(F("[NETWORK] POST → "));
+    Serial.println(API_ENDPOINT);
+
+    // Large batch bodies (backlog) go out gzipped if that saves bytes;
+    // track blocks are already packed. A window shares _gzBody.
+    size_t gzUsed = 0;
+    for (int i = 0; i < count; i++) {
+        WirePart* wire = &_wire[i];
+        wire->body = parts[i].body;
+        wire->len = parts[i].len;
+        wire->gzip = false;
+
+        Serial.print(F("[NETWORK] Payload ("));
+        Serial.print(wire->len);
+#if HTTP_COMPRESS
+        if (_serverGzip && wire->len >= HTTP_COMPRESS_MIN_BYTES &&
+            strcmp(contentType, WIRE_CONTENT_TYPE) == 0) {
+            size_t room = sizeof(_gzBody) - gzUsed;
+            size_t max = wire->len - 1 < room ? wire->len - 1 : room;
+            size_t packed = deflateGzip(wire->body, wire->len, _gzBody + gzUsed, max);
+            if (packed > 0) {
+                Serial.print(F(" bytes, gzip → "));
+                Serial.print(packed);
+                wire->body = _gzBody + gzUsed;
+                wire->len = packed;
+                wire->gzip = true;
+                gzUsed += packed;
+            }
+        }
+#endif
+        Serial.println(F(" bytes)"));
+    }
+
+    unsigned long started = millis();
+    int httpCode;
+    int accepted = _httpPipeline(contentType, parts, count, backfill, &httpCode);
+    unsigned long elapsed = millis() - started;
+
+    // Connection errors, 5xx, 408 (timeout) and 429 (overloaded) are the
+    // server's trouble; anything else it answered means it is up
+    if (accepted == 0 &&
+        (httpCode <= 0 || httpCode >= 500 || httpCode == 408 || httpCode == 429)) {
+        _breakerFailure();
+    } else {
+        _breakerSuccess();
+    }
+
+    if (accepted == count) {
+        return accepted;
+    }
+    if (accepted > 0) {
+        Serial.print(F("[NETWORK] "));
+        Serial.print(accepted);
+        Serial.print(F(" of "));
+        Serial.print(count);
+        Serial.println(F(" pipelined requests accepted"));
+    }
+
+    if (httpCode > 0) {
+        Serial.print(F("[NETWORK] ✗ POST rejected (HTTP "));
+        Serial.print(httpCode);
+        Serial.println(F(")"));
+        if (_wire[accepted].gzip && httpCode == 415) {
+            // Unsupported Media Type: send plain bodies from now on
+            Serial.println(F("[NETWORK]   → Server refused the gzip body; compression off"));
+            _serverGzip = false;
+        }
+        Serial.print(F("[NETWORK] Response: "));
+        _logResponse();
+    } else {
+        Serial.print(F("[NETWORK] ✗ Connection error after "));
+        Serial.print(elapsed);
+        Serial.println(F(" ms"));
+
+        // Provide human-readable guidance for common errors
+        switch (httpCode) {
+            case HTTP_ERR_CONNECT:
+                Serial.println(F("[NETWORK]   → Could not reach the server. Check URL/port."));
+                break;
+            case HTTP_ERR_CLOSED:
+                Serial.println(F("[NETWORK]   → Connection dropped. WiFi may have dropped."));
+                break;
+            case HTTP_ERR_TIMEOUT:
+                Serial.println(F("[NETWORK]   → Server did not respond in time."));
+                break;
+            case HTTP_ERR_RESPONSE:
+                Serial.println(F("[NETWORK]   → Server sent something other than HTTP."));
+                break;
+            default:
+                break;
+        }
+    }
+
+    return accepted;
+}
+
+// Internal helper: POST a single body; true if the server accepted it
+static bool _postBody(const char* contentType, const uint8_t* body, size_t len,
+                      bool backfill = false) {
+    UploadPart part = { body, len, 1, nullptr };
+    return _postParts(contentType, &part, 1, backfill) == 1;
+}
+
+/**
+ * Send one encoded fix to the API endpoint via HTTP POST.
+ *
+ * @param body  The body to POST (WIRE_FORMAT)
+ * @param len   Length in bytes
+ * @return true if server responded with HTTP 2xx
+ */
+bool networkSendData(const uint8_t* body, size_t len) {
+    if (!networkIsConnected()) {
+        Serial.println(F("[NETWORK] Cannot send — WiFi not connected"));
+        return false;
+    }
+
+#if MQTT_TRANSPORT
+    return _mqttPublishWait("live", body, len);
+#else
+    return _postBody(WIRE_CONTENT_TYPE, body, len);
+#endif
+}
+
+/**
+ * Send a window of queue uploads, pipelined on the keep-alive connection.
+ */
+int networkSendUpload(const UploadPart* parts, int count, bool blocks) {
+    if (!networkIsConnected()) {
+        Serial.println(F("[NETWORK] Cannot send — WiFi not connected"));
+        return 0;
+    }
+
+#if MQTT_TRANSPORT
+    // One publish at a time; a PUBACK covers the whole message, so every
+    // record of a batch counts as delivered
+    int done = 0;
+    while (done < count &&
+           _mqttPublishWait(blocks ? "track" : "batch", parts[done].body, parts[done].len)) {
+        if (parts[done].results) {
+            memset(parts[done].results, BATCH_RESULT_OK, parts[done].count);
+        }
+        done++;
+    }
+    return done;
+#else
+    return _postParts(blocks ? "application/x-sawari-track" : WIRE_CONTENT_TYPE,
+                      parts, count, false);
+#endif
+}
+
+/**
+ * Send an archived track block in answer to a server backfill request.
+ */
+bool networkSendBackfillBlock(const uint8_t* block, size_t len) {
+    if (!networkIsConnected()) {
+        Serial.println(F("[NETWORK] Cannot send — WiFi not connected"));
+        return false;
+    }
+
+#if MQTT_TRANSPORT
+    return _mqttPublishWait("backfill", block, len);
+#else
+    return _postBody("application/x-sawari-track", block, len, true);
+#endif
+}
+
+/**
+ * False while the circuit breaker is open and the next probe is not due.
+ */
+bool networkServerAvailable() {
+    portENTER_CRITICAL(&_breakerMux);
+    bool available = _breakerState != BREAKER_OPEN ||
+                     millis() - _breakerOpenedAt >= _breakerWait;
+    portEXIT_CRITICAL(&_breakerMux);
+    return available;
+}
+
+/**
+ * Connected windows (link up → link down) that have ended so far.
+ */
+uint32_t networkGetWindowCount() {
+    return _windows;
+}
+
+/**
+ * Connected windows that ended with nothing delivered.
+ */
+uint32_t networkGetMissedWindows() {
+    return _windowsMissed;
+}
+
+/**
+ * Enter / leave an upload burst: modem sleep off and no roaming scans
+ * while a backlog drains on a strong link. Rechecked every
+ * BURST_CHECK_MS; leaving takes WIFI_BURST_EXIT_DB of hysteresis.
+ */
+bool networkUpdateBurst(bool backlog) {
+    unsigned long now = millis();
+    if (now - _burstCheckAt < BURST_CHECK_MS) return _burst;
+    _burstCheckAt = now;
+
+    bool connected = networkIsConnected();
+    int rssi = connected ? WiFi.RSSI() : -127;
+    if (!_burst) {
+        if (!connected || !backlog || rssi < WIFI_BURST_RSSI || _attempt == ATTEMPT_SCAN) {
+            return false;
+        }
+        _burst = true;
+        _burstSince = now;
+        WiFi.setSleep(false);
+        Serial.print(F("[NETWORK] Upload burst: "));
+        Serial.print(rssi);
+        Serial.println(F(" dBm, draining the backlog"));
+    } else if (!connected || !backlog || rssi < WIFI_BURST_RSSI - WIFI_BURST_EXIT_DB) {
+        _burst = false;
+        WiFi.setSleep(true);
+        Serial.print(F("[NETWORK] Upload burst ended after "));
+        Serial.print(now - _burstSince);
+        Serial.println(backlog ? F(" ms: signal too weak") : F(" ms: backlog drained"));
+    }
+    return _burst;
+}
+
+/**
+ * Print the known networks, best ranked first.
+ */
+void networkLogKnownNetworks() {
+    bool listed[WIFI_KNOWN_MAX] = { false };
+    Serial.print(F("[NETWORK] Known networks: "));
+    Serial.println(_aps.count);
+
+    for (uint32_t n = 0; n < _aps.count; n++) {
+        int best = -1;
+        for (uint32_t i = 0; i < _aps.count; i++) {
+            if (!listed[i] && (best < 0 || _apQuality(&_aps.ap[i]) > _apQuality(&_aps.ap[best]))) {
+                best = (int)i;
+            }
+        }
+        listed[best] = true;
+
+        const KnownAp* ap = &_aps.ap[best];
+        Serial.print(F("  "));
+        Serial.print(ap->ssid);
+        Serial.print(best == _apCurrent ? F(" [connected]") : F(""));
+        Serial.print(F(" — channel "));
+        Serial.print(ap->channel);
+        Serial.print(F(", "));
+        Serial.print(ap->delivered);
+        Serial.print(F("/"));
+        Serial.print(ap->windows);
+        Serial.print(F(" windows delivered, "));
+        Serial.print(ap->fails);
+        Serial.print(F(" failed connects, quality "));
+        Serial.println(_apQuality(ap), 2);
+    }
+}
+
+/**
+ * Lowest seq the device may still send (X-Seq-Floor, 0 = unknown).
+ */
+void networkSetSeqFloor(uint32_t floor) {
+    _seqFloor = floor;
+}
+
+/**
+ * Highest "acked_seq" the server has answered with so far.
+ */
+uint32_t networkGetAckedSeq() {
+    return _ackedSeq;
+}
+
+/**
+ * Hand over the pending backfill request (once).
+ */
+bool networkTakeBackfillRequest(uint32_t* from, uint32_t* to) {
+    portENTER_CRITICAL(&_backfillMux);
+    bool pending = _backfillPending;
+    if (pending) {
+        *from = _backfillFrom;
+        *to = _backfillTo;
+        _backfillPending = false;
+    }
+    portEXIT_CRITICAL(&_backfillMux);
+    return pending;
+}
+
+/**
+ * Reporting parameters in force (defaults once the server's have lapsed).
+ */
+void networkGetControl(ServerControl* control) {
+    portENTER_CRITICAL(&_controlMux);
+    bool lapsed = _controlActive && (long)(millis() - _controlUntil) >= 0;
+    if (lapsed) {
+        _control = _controlDefault;
+        _controlActive = false;
+    }
+    *control = _control;
+    portEXIT_CRITICAL(&_controlMux);
+
+    if (lapsed) {
+        Serial.println(F("[NETWORK] Server control lapsed — back to defaults"));
+    }
+}
+
+// ============================================================================
+// UDP TELEMETRY
+// ============================================================================
+// Live fixes as datagrams to UDP_PORT on the API host (udp_protocol.h).
+// Runs entirely in the sender task; nothing here blocks.
+
+#if UDP_TELEMETRY
+
+// DATA datagram: header + first sequence number, then the track block
+#define UDP_DATA_HEADER     (sizeof(UdpHeader) + sizeof(uint32_t))
+
+static_assert(UDP_WINDOW <= TRACK_BLOCK_SAMPLES, "UDP_WINDOW exceeds a track block");
+static_assert(UDP_DATA_HEADER + 2 + TRACK_FIELD_COUNT * 5 +
+              (UDP_WINDOW - 1) * (1 + TRACK_FIELD_COUNT * 5) + UDP_TRAILER_BYTES
+              <= UDP_MAX_DATAGRAM, "UDP_WINDOW fixes do not fit in one datagram");
+
+static UdpFix* _udpAt(int i) {
+    return &_udpWindow[(_udpFirst + i) % UDP_WINDOW];
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: send every fix from the oldest unacknowledged one on in
+// one DATA datagram
+// ---------------------------------------------------------------------------
+static void _udpTransmit() {
+    int start = 0;
+    while (start < _udpCount && _udpAt(start)->acked) start++;
+    if (start == _udpCount) return;
+
+    _parseEndpoint();
+    if (!_resolveHost()) return;
+
+    UdpHeader header = { UDP_PROTOCOL_VERSION, UDP_DATA, BUS_ID, _udpSession };
+    uint32_t first = _udpAt(start)->seq;
+    memcpy(_udpBuf, &header, sizeof(header));
+    memcpy(_udpBuf + sizeof(header), &first, sizeof(first));
+
+    TrackEncoder enc;
+    trackEncoderBegin(&enc, _udpBuf + UDP_DATA_HEADER);
+    for (int i = start; i < _udpCount; i++) {
+        TrackPoint point;
+        trackPointFromTelemetry(&_udpAt(i)->data, &point);
+        trackEncoderAdd(&enc, &point);
+    }
+
+    size_t len = UDP_DATA_HEADER + enc.len;
+    uint32_t crc = trackCrc32(_udpBuf, len);
+    memcpy(_udpBuf + len, &crc, UDP_TRAILER_BYTES);
+    len += UDP_TRAILER_BYTES;
+
+    _udp.beginPacket(_hostIP, UDP_PORT);
+    _udp.write(_udpBuf, len);
+    _udp.endPacket();
+    _udpLastTx = millis();
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: mark the fixes covered by waiting ACKs
+// ---------------------------------------------------------------------------
+static void _udpReadAcks() {
+    const size_t rangesAt = sizeof(UdpHeader) + 1;
+
+    while (_udp.parsePacket() > 0) {
+        int n = _udp.read(_udpBuf, sizeof(_udpBuf));
+        if (n < (int)(rangesAt + UDP_TRAILER_BYTES)) continue;
+
+        uint32_t crc;
+        memcpy(&crc, _udpBuf + n - UDP_TRAILER_BYTES, sizeof(crc));
+        if (crc != trackCrc32(_udpBuf, n - UDP_TRAILER_BYTES)) continue;
+
+        UdpHeader header;
+        memcpy(&header, _udpBuf, sizeof(header));
+        uint8_t count = _udpBuf[sizeof(header)];
+        if (header.version != UDP_PROTOCOL_VERSION || header.type != UDP_ACK ||
+            header.busId != BUS_ID || header.session != _udpSession ||
+            count > UDP_MAX_ACK_RANGES ||
+            n != (int)(rangesAt + count * sizeof(UdpRange) + UDP_TRAILER_BYTES)) {
+            continue;
+        }
+
+        for (int r = 0; r < count; r++) {
+            UdpRange range;
+            memcpy(&range, _udpBuf + rangesAt + r * sizeof(range), sizeof(range));
+            for (int i = 0; i < _udpCount; i++) {
+                UdpFix* fix = _udpAt(i);
+                // Wrap-safe: seq in [first, last]
+                if (fix->seq - range.first <= range.last - range.first) {
+                    fix->acked = true;
+                    _delivered();
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Queue a fix in the UDP window and send the window.
+ */
+bool networkUdpSend(const TelemetryData* data) {
+    if (!networkIsConnected() || _udpCount == UDP_WINDOW) return false;
+
+    if (!_udpOpen) {
+        if (!_udp.begin(UDP_PORT)) return false;
+        _udpOpen = true;
+        _udpSession = esp_random();
+    }
+
+    UdpFix* fix = _udpAt(_udpCount++);
+    fix->data = *data;
+    fix->seq = _udpNextSeq++;
+    fix->sentAt = millis();
+    fix->acked = false;
+    _udpTransmit();
+    return true;
+}
+
+/**
+ * Process ACKs, resend on silence, hand back acknowledged / expired fixes.
+ */
+int networkUdpPoll(std::function<bool(const TelemetryData*, bool)> doneFunc) {
+    if (!_udpOpen) return 0;
+    _udpReadAcks();
+
+    unsigned long now = millis();
+    int count = 0;
+    while (_udpCount > 0) {
+        UdpFix* fix = _udpAt(0);
+        if (!fix->acked && now - fix->sentAt < UDP_ACK_TIMEOUT_MS) break;
+        if (!doneFunc(&fix->data, fix->acked)) break;
+        _udpFirst = (_udpFirst + 1) % UDP_WINDOW;
+        _udpCount--;
+        count++;
+    }
+
+    if (_udpCount > 0 && now - _udpLastTx >= UDP_RESEND_MS && networkIsConnected()) {
+        _udpTransmit();
+    }
+    return count;
+}
+
+#else
+
+bool networkUdpSend(const TelemetryData*) {
+    return false;
+}
+
+int networkUdpPoll(std::function<bool(const TelemetryData*, bool)>) {
+    return 0;
+}
+
+#endif
+
+// ============================================================================
+// MQTT TRANSPORT
+// ============================================================================
+// A minimal MQTT 3.1.1 client (CONNECT, PUBLISH / PUBACK at QoS 1,
+// SUBSCRIBE, PINGREQ) on a connection of its own, used only by the sender
+// task. Live fixes are published without waiting and stay in _mqttWindow
+// until their PUBACK, across reconnects. Bulk uploads wait for their
+// PUBACK the way a POST waits for its response; one that is not
+// acknowledged fails and stays in the offline queue for the next flush.
+
+#if MQTT_TRANSPORT
+
+// Control packet types (first byte)
+#define MQTT_CONNECT        0x10
+#define MQTT_CONNACK        0x20
+#define MQTT_PUBLISH        0x30
+#define MQTT_PUBACK         0x40
+#define MQTT_SUBSCRIBE      0x82        // Flags 0010 are mandatory
+#define MQTT_SUBACK         0x90
+#define MQTT_PINGREQ        0xC0
+
+// PUBLISH flags
+#define MQTT_DUP            0x08
+#define MQTT_QOS1           0x02
+
+// CONNECT flags
+#define MQTT_FLAG_USERNAME  0x80
+#define MQTT_FLAG_PASSWORD  0x40
+
+#define MQTT_TOPIC_MAX      64
+
+static MqttFix* _mqttAt(int i) {
+    return &_mqttWindow[(_mqttFirst + i) % MQTT_MAX_INFLIGHT];
+}
+
+static uint16_t _mqttNewPacketId() {
+    if (++_mqttNextId == 0) _mqttNextId = 1;    // 0 is not a valid id
+    return _mqttNextId;
+}
+
+static void _mqttClose() {
+    _mqtt.stop();
+    _mqttUp = false;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helpers: packet fields
+// ---------------------------------------------------------------------------
+static uint8_t* _mqttPutLength(uint8_t* p, size_t len) {
+    // Remaining Length: 7 bits per byte, least significant first
+    do {
+        uint8_t b = len & 0x7F;
+        len >>= 7;
+        *p++ = len > 0 ? b | 0x80 : b;
+    } while (len > 0);
+    return p;
+}
+
+static uint8_t* _mqttPutString(uint8_t* p, const char* s, size_t len) {
+    *p++ = (uint8_t)(len >> 8);
+    *p++ = (uint8_t)len;
+    memcpy(p, s, len);
+    return p + len;
+}
+
+// Topic "<MQTT_TOPIC_PREFIX><BUS_ID>/<leaf>"
+static int _mqttTopic(char* out, const char* leaf) {
+    return snprintf(out, MQTT_TOPIC_MAX, MQTT_TOPIC_PREFIX "%d/%s", BUS_ID, leaf);
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: write a packet (head, then body). A failed write
+// closes the connection.
+// ---------------------------------------------------------------------------
+static bool _mqttWrite(const uint8_t* head, size_t headLen,
+                       const uint8_t* body = nullptr, size_t len = 0) {
+    if (_mqtt.write(head, headLen) != headLen ||
+        (len > 0 && _mqtt.write(body, len) != len)) {
+        _mqttClose();
+        return false;
+    }
+    _mqttLastTx = millis();
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: QoS 1 PUBLISH to "<BUS_ID>/<leaf>"
+// ---------------------------------------------------------------------------
+static bool _mqttSendPublish(const char* leaf, uint16_t packetId, bool dup,
+                             const uint8_t* body, size_t len) {
+    char topic[MQTT_TOPIC_MAX];
+    int topicLen = _mqttTopic(topic, leaf);
+
+    uint8_t head[1 + 4 + 2 + MQTT_TOPIC_MAX + 2];
+    uint8_t* p = head;
+    *p++ = MQTT_PUBLISH | MQTT_QOS1 | (dup ? MQTT_DUP : 0);
+    p = _mqttPutLength(p, 2 + topicLen + 2 + len);
+    p = _mqttPutString(p, topic, topicLen);
+    *p++ = (uint8_t)(packetId >> 8);
+    *p++ = (uint8_t)packetId;
+    return _mqttWrite(head, p - head, body, len);
+}
+
+static bool _mqttPublishFix(MqttFix* fix, bool dup) {
+    size_t len = wireEncodePayload(&fix->data, _mqttPayload, sizeof(_mqttPayload));
+    return _mqttSendPublish("live", fix->packetId, dup, _mqttPayload, len);
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: one byte by the deadline, -1 on timeout / closed
+// ---------------------------------------------------------------------------
+static int _mqttReadByte(unsigned long deadline) {
+    while ((long)(deadline - millis()) > 0) {
+        int c = _mqtt.read();
+        if (c >= 0) return c;
+        if (!_mqtt.connected()) return -1;
+        delay(1);
+    }
+    return -1;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: read one packet; the body goes to _mqttRx (the first
+// MQTT_RX_MAX bytes of it). Returns the first byte, or -1 if the
+// connection failed (it is closed).
+// ---------------------------------------------------------------------------
+static int _mqttReadPacket(unsigned long deadline) {
+    int first = _mqttReadByte(deadline);
+    size_t len = 0;
+    for (int shift = 0; first >= 0; shift += 7) {
+        int b = _mqttReadByte(deadline);
+        if (b < 0 || shift > 21) {
+            first = -1;
+            break;
+        }
+        len |= (size_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) break;
+    }
+
+    for (size_t i = 0; first >= 0 && i < len; i++) {
+        int b = _mqttReadByte(deadline);
+        if (b < 0) first = -1;
+        else if (i < MQTT_RX_MAX) _mqttRx[i] = (uint8_t)b;
+    }
+    if (first < 0) {
+        _mqttClose();
+        return -1;
+    }
+
+    _mqttRxCut = len > MQTT_RX_MAX;
+    _mqttRxLen = _mqttRxCut ? MQTT_RX_MAX : len;
+    _mqttPingOut = false;           // The broker is alive
+    return first;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: a message on our "<BUS_ID>/cmd" subscription. QoS 1
+// messages are acknowledged even if not understood, or the session would
+// deliver them again on every reconnect.
+// ---------------------------------------------------------------------------
+static void _mqttReceive(int first) {
+    if (_mqttRxLen < 2) return;
+    size_t at = 2 + ((_mqttRx[0] << 8) | _mqttRx[1]);     // Skip the topic
+
+    if (first & 0x06) {             // QoS 1 (2 is never granted)
+        if (at + 2 > _mqttRxLen) return;
+        uint8_t ack[4] = { MQTT_PUBACK, 2, _mqttRx[at], _mqttRx[at + 1] };
+        _mqttWrite(ack, sizeof(ack));
+        at += 2;
+    }
+    if (_mqttRxCut) {
+        Serial.println(F("[NETWORK] MQTT command too long — ignored"));
+        return;
+    }
+    if (at > _mqttRxLen) return;
+
+    _mqttRx[_mqttRxLen] = '\0';
+    const char* message = (const char*)_mqttRx + at;
+    Serial.print(F("[NETWORK] MQTT command: "));
+    Serial.println(message);
+    _parseBackfill(message);
+    _parseControl(message);
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: act on one packet from the broker
+// ---------------------------------------------------------------------------
+static void _mqttHandle(int first) {
+    switch (first & 0xF0) {
+        case MQTT_PUBACK: {
+            if (_mqttRxLen < 2) break;
+            uint16_t id = (_mqttRx[0] << 8) | _mqttRx[1];
+            _delivered();
+            if (id == _mqttBulkId) {
+                _mqttBulkAcked = true;
+                break;
+            }
+            for (int i = 0; i < _mqttCount; i++) {
+                if (_mqttAt(i)->packetId == id) _mqttAt(i)->acked = true;
+            }
+            break;
+        }
+        case MQTT_PUBLISH:
+            _mqttReceive(first);
+            break;
+        case MQTT_SUBACK:
+            if (_mqttRxLen >= 3 && _mqttRx[2] == 0x80) {
+                Serial.println(F("[NETWORK] MQTT: broker refused the command subscription"));
+            }
+            break;
+        default:
+            break;                  // PINGRESP: being heard from is enough
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: connect and resume the session. Publishes every
+// unacknowledged fix again (DUP), as MQTT requires of a resumed session.
+// ---------------------------------------------------------------------------
+static bool _mqttConnect() {
+    _mqttLastTry = millis();
+    _mqttClose();
+
+    IPAddress ip;
+    if (WiFi.hostByName(MQTT_HOST, ip) != 1) {
+        Serial.print(F("[NETWORK] DNS lookup failed for "));
+        Serial.println(MQTT_HOST);
+        return false;
+    }
+    if (!_mqtt.connect(ip, MQTT_PORT, HTTP_TIMEOUT)) {
+        Serial.println(F("[NETWORK] MQTT broker not reachable"));
+        return false;
+    }
+    _mqtt.setNoDelay(true);
+
+    // CONNECT: "MQTT" level 4, clean session off, fixed client id
+    char clientId[24];
+    int idLen = snprintf(clientId, sizeof(clientId), "sawari-bus-%d", BUS_ID);
+    size_t userLen = strlen(MQTT_USER);
+    size_t passLen = strlen(MQTT_PASSWORD);
+    uint8_t flags = userLen > 0 ? MQTT_FLAG_USERNAME | MQTT_FLAG_PASSWORD : 0;
+
+    uint8_t packet[5 + 10 + sizeof(clientId) + sizeof(MQTT_USER) + sizeof(MQTT_PASSWORD) + 4];
+    uint8_t* p = packet;
+    *p++ = MQTT_CONNECT;
+    p = _mqttPutLength(p, 10 + 2 + idLen + (flags ? 4 + userLen + passLen : 0));
+    p = _mqttPutString(p, "MQTT", 4);
+    *p++ = 4;                       // Protocol level: 3.1.1
+    *p++ = flags;
+    *p++ = (uint8_t)(MQTT_KEEPALIVE_S >> 8);
+    *p++ = (uint8_t)MQTT_KEEPALIVE_S;
+    p = _mqttPutString(p, clientId, idLen);
+    if (flags) {
+        p = _mqttPutString(p, MQTT_USER, userLen);
+        p = _mqttPutString(p, MQTT_PASSWORD, passLen);
+    }
+    if (!_mqttWrite(packet, p - packet)) return false;
+
+    // CONNACK: session-present flag, return code
+    int first = _mqttReadPacket(millis() + HTTP_TIMEOUT);
+    if (first != MQTT_CONNACK || _mqttRxLen != 2 || _mqttRx[1] != 0) {
+        Serial.print(F("[NETWORK] MQTT connection refused (code "));
+        Serial.print(first == MQTT_CONNACK ? _mqttRx[1] : -1);
+        Serial.println(F(")"));
+        _mqttClose();
+        return false;
+    }
+    bool resumed = _mqttRx[0] & 0x01;
+    _mqttUp = true;
+
+    Serial.print(F("[NETWORK] MQTT connected to "));
+    Serial.print(MQTT_HOST);
+    Serial.print(resumed ? F(" (session resumed, ") : F(" (new session, "));
+    Serial.print(_mqttCount);
+    Serial.println(F(" fixes in flight)"));
+
+    if (!resumed) {
+        // A new session has no subscription yet
+        char topic[MQTT_TOPIC_MAX];
+        int topicLen = _mqttTopic(topic, "cmd");
+        uint16_t id = _mqttNewPacketId();
+        uint8_t sub[1 + 4 + 2 + 2 + MQTT_TOPIC_MAX + 1];
+        p = sub;
+        *p++ = MQTT_SUBSCRIBE;
+        p = _mqttPutLength(p, 2 + 2 + topicLen + 1);
+        *p++ = (uint8_t)(id >> 8);
+        *p++ = (uint8_t)id;
+        p = _mqttPutString(p, topic, topicLen);
+        *p++ = 1;                   // Requested QoS
+        _mqttWrite(sub, p - sub);
+    }
+
+    for (int i = 0; i < _mqttCount && _mqttUp; i++) {
+        if (!_mqttAt(i)->acked) _mqttPublishFix(_mqttAt(i), true);
+    }
+    return _mqttUp;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: session upkeep before every use — close on WiFi loss,
+// reconnect every MQTT_RECONNECT_MS, read what the broker sent, ping
+// when idle. Returns true if the session is up.
+// ---------------------------------------------------------------------------
+static bool _mqttService() {
+    if (_mqttDrop) {
+        _mqttDrop = false;
+        _mqttClose();
+    }
+    if (_mqttUp && !_mqtt.connected()) {
+        Serial.println(F("[NETWORK] MQTT connection lost"));
+        _mqttClose();
+    }
+    if (!_mqttUp) {
+        if (!networkIsConnected()) return false;
+        if (_mqttLastTry != 0 && millis() - _mqttLastTry < MQTT_RECONNECT_MS) return false;
+        if (!_breakerAllow()) return false;
+        if (!_mqttConnect()) {
+            _breakerFailure();
+            return false;
+        }
+        _breakerSuccess();
+    }
+
+    while (_mqttUp && _mqtt.available()) {
+        int first = _mqttReadPacket(millis() + HTTP_TIMEOUT);
+        if (first >= 0) _mqttHandle(first);
+    }
+    if (!_mqttUp) return false;
+
+    unsigned long now = millis();
+    if (_mqttPingOut) {
+        if (now - _mqttPingAt >= HTTP_TIMEOUT) {
+            Serial.println(F("[NETWORK] MQTT broker stopped answering"));
+            _mqttClose();
+        }
+    } else if (now - _mqttLastTx >= MQTT_KEEPALIVE_S * 500UL) {
+        static const uint8_t ping[2] = { MQTT_PINGREQ, 0 };
+        if (_mqttWrite(ping, sizeof(ping))) {
+            _mqttPingOut = true;
+            _mqttPingAt = now;
+        }
+    }
+    return _mqttUp;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: publish a bulk upload and wait for its PUBACK (up to
+// HTTP_TIMEOUT). PUBACKs for live fixes and commands are handled meanwhile.
+// ---------------------------------------------------------------------------
+static bool _mqttPublishWait(const char* leaf, const uint8_t* body, size_t len) {
+    Serial.print(F("[NETWORK] MQTT publish → "));
+    Serial.print(leaf);
+    Serial.print(F(" ("));
+    Serial.print(len);
+    Serial.println(F(" bytes)"));
+
+    if (!_mqttService()) {
+        Serial.println(F("[NETWORK] ✗ MQTT broker not connected"));
+        return false;
+    }
+
+    unsigned long started = millis();
+    _mqttBulkId = _mqttNewPacketId();
+    _mqttBulkAcked = false;
+    if (_mqttSendPublish(leaf, _mqttBulkId, false, body, len)) {
+        unsigned long deadline = started + HTTP_TIMEOUT;
+        while (!_mqttBulkAcked && _mqttUp && (long)(deadline - millis()) > 0) {
+            if (_mqtt.available()) {
+                int first = _mqttReadPacket(deadline);
+                if (first >= 0) _mqttHandle(first);
+            } else if (!_mqtt.connected()) {
+                _mqttClose();
+            } else {
+                delay(1);
+            }
+        }
+    }
+    _mqttBulkId = 0;
+
+    if (!_mqttBulkAcked) {
+        Serial.println(F("[NETWORK] ✗ MQTT publish not acknowledged"));
+        return false;
+    }
+    Serial.print(F("[NETWORK] ✓ MQTT publish acknowledged ("));
+    Serial.print(millis() - started);
+    Serial.println(F(" ms)"));
+    return true;
+}
+
+/**
+ * Publish a live fix and keep it in flight until its PUBACK.
+ */
+bool networkMqttPublish(const TelemetryData* data) {
+    if (_mqttCount == MQTT_MAX_INFLIGHT || !_mqttService()) return false;
+
+    MqttFix* fix = _mqttAt(_mqttCount++);
+    fix->data = *data;
+    fix->packetId = _mqttNewPacketId();
+    fix->acked = false;
+    _mqttPublishFix(fix, false);    // If it fails, it goes out on reconnect
+    return true;
+}
+
+/**
+ * Session upkeep; hand back acknowledged fixes.
+ */
+int networkMqttPoll(std::function<bool(const TelemetryData*, bool)> doneFunc) {
+    _mqttService();
+
+    int count = 0;
+    while (_mqttCount > 0 && _mqttAt(0)->acked) {
+        if (!doneFunc(&_mqttAt(0)->data, true)) break;
+        _mqttFirst = (_mqttFirst + 1) % MQTT_MAX_INFLIGHT;
+        _mqttCount--;
+        count++;
+    }
+    return count;
+}
+
+#else
+
+bool networkMqttPublish(const TelemetryData*) {
+    return false;
+}
+
+int networkMqttPoll(std::function<bool(const TelemetryData*, bool)>) {
+    return 0;
+}
+
+#endif
+
 /**
  * Get the device's current IP address as a string.
  */
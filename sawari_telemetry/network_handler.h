@@ -2,7 +2,8 @@
  * ============================================================================
  * SAWARI Bus Telemetry Device - Network Handler Header
  * ============================================================================
- * Manages WiFi connectivity via WiFiManager and HTTP POST data transmission.
+ * Manages WiFi connectivity via WiFiManager and HTTP POST data transmission
+ * (or UDP / MQTT, see config.h).
  * Supports on-demand captive portal via button press, auto-reconnection,
  * and automatic portal close on successful WiFi connection.
  * ============================================================================
@@ -12,6 +13,8 @@
 #define NETWORK_HANDLER_H
 
 #include <Arduino.h>
+#include <functional>
+#include "gps_handler.h"
 
 /**
  * Initialize WiFi using WiFiManager.
@@ -27,12 +30,22 @@ bool networkInit();
  */
 bool networkIsConnected();
 
+// --- Link changes reported by networkCheckReconnect() ---
+#define NET_LINK_UNCHANGED  0
+#define NET_LINK_UP         1       // Link (with an IP address) just came back
+#define NET_LINK_DOWN       2       // Link just lost
+
 /**
- * Attempt to reconnect WiFi if disconnected.
- * Uses a cooldown interval to avoid spamming reconnect attempts.
- * Call this periodically from loop() (every WIFI_CHECK_INTERVAL).
+ * Apply the WiFi events (WiFi.onEvent) recorded since the last call, and
+ * attempt to reconnect WiFi if disconnected: fast attempts to the access
+ * point used last, then a passive scan for the known networks
+ * (WIFI_FAST_RECONNECT). Each attempt gets its time before the next one
+ * starts. While connected, a weak link is left for a clearly better
+ * known access point (WIFI_ROAM).
+ * Call this on every loop() pass.
+ * @return NET_LINK_UP / NET_LINK_DOWN on a change, else NET_LINK_UNCHANGED
  */
-void networkCheckReconnect();
+int networkCheckReconnect();
 
 /**
  * Start the WiFiManager captive portal on demand (e.g. button press).
@@ -61,12 +74,185 @@ void networkStopPortal();
  */
 bool networkIsPortalActive();
 
+// --- Uploads: each blocks for up to HTTP_TIMEOUT, so they are called from
+//     the sender task (sender_handler.h), not from the main loop. With
+//     MQTT_TRANSPORT the batch / block uploads are QoS 1 publishes on the
+//     broker session instead of POSTs ---
+
 /**
- * Send a JSON payload to the configured API endpoint via HTTP POST.
- * @param json  JSON string to send as request body
+ * Send one fix (wireEncodePayload) to the configured API endpoint via
+ * HTTP POST, as WIRE_CONTENT_TYPE.
+ * All POSTs share one keep-alive connection (reopened transparently).
+ * @param body  request body
+ * @param len   length in bytes
  * @return true if HTTP response code is 2xx (success)
  */
-bool networkSendData(const String& json);
+bool networkSendData(const uint8_t* body, size_t len);
+
+// Per-record outcome of a batch upload (networkSendUpload)
+#define BATCH_RESULT_OK         0   // Stored by the server
+#define BATCH_RESULT_REJECTED   1   // Invalid record, will never be accepted
+#define BATCH_RESULT_RETRY      2   // Not stored this time: send it again
+
+/** One request of a queue upload (networkSendUpload). */
+struct UploadPart {
+    const uint8_t* body;        // Track block, or batch (wireBatchBegin..wireBatchEnd)
+    size_t         len;         // Body length in bytes
+    int            count;       // Batch: number of records
+    uint8_t*       results;     // Batch: receives one BATCH_RESULT_* per record
+};
+
+/**
+ * Upload up to QUEUE_PIPELINE_DEPTH offline queue requests as one window:
+ * all are written to the keep-alive connection back to back and the
+ * responses read in order (HTTP/1.1 pipelining), so a slow link costs one
+ * round trip per window. Requests after a failed one may still have been
+ * stored; the server drops them as duplicates (seq) when they are resent.
+ *
+ * Track blocks (`blocks`) are posted as application/x-sawari-track with
+ * the bus ID in the X-Bus-Id header; the server decodes the block.
+ * Batches (e.g. {"data":[{...},{...}]} in WIRE_FORMAT_JSON) are answered
+ * with one entry per record in "results" ("ok" / "rejected" / "retry");
+ * a missing entry counts as retry.
+ *
+ * @param parts   the requests, oldest data first
+ * @param count   number of parts (1..QUEUE_PIPELINE_DEPTH)
+ * @param blocks  true for track blocks, false for batches
+ * @return number of leading parts answered with HTTP 2xx
+ */
+int networkSendUpload(const UploadPart* parts, int count, bool blocks);
+
+/**
+ * Send a track block re-read from the archive for a server backfill.
+ * Posted like a networkSendUpload() block plus an X-Backfill: 1 header, so
+ * the server logs the samples without moving the vehicle's live position.
+ * @param block  encoded block bytes
+ * @param len    block length in bytes
+ * @return true if HTTP response code is 2xx (success)
+ */
+bool networkSendBackfillBlock(const uint8_t* block, size_t len);
+
+/**
+ * Lowest sequence number the device may still send, reported to the
+ * server as X-Seq-Floor on every POST: everything below it was delivered
+ * or dropped, so the server may count it as acknowledged.
+ * @param floor  0 = unknown (header not sent)
+ */
+void networkSetSeqFloor(uint32_t floor);
+
+/**
+ * Highest "acked_seq" the server has answered with: it holds every
+ * record up to this sequence number. 0 until the first answer.
+ */
+uint32_t networkGetAckedSeq();
+
+/**
+ * Send a live fix over UDP (UDP_TELEMETRY, udp_protocol.h): it gets the
+ * next sequence number and joins the window of unacknowledged fixes,
+ * which all go out in one datagram. Never waits for an answer.
+ * @param data  telemetry sample (copied)
+ * @return false if WiFi is down or UDP_WINDOW fixes are unacknowledged;
+ *         the caller queues the fix offline
+ */
+bool networkUdpSend(const TelemetryData* data);
+
+/**
+ * Read the receiver's ACKs, resend unacknowledged fixes after
+ * UDP_RESEND_MS, and hand back finished fixes, oldest first. Call often
+ * (every UDP_POLL_MS) from the same task as networkUdpSend().
+ * @param doneFunc  called with (fix, true if acknowledged / false if it
+ *                  timed out); returns false to stop (no room to report
+ *                  more, the rest are handed back on a later call)
+ * @return number of fixes handed back
+ */
+int networkUdpPoll(std::function<bool(const TelemetryData*, bool)> doneFunc);
+
+/**
+ * Publish a live fix over MQTT (MQTT_TRANSPORT) to "<BUS_ID>/live", QoS 1.
+ * The fix stays in the session until the broker acknowledges it, and is
+ * published again after a reconnect. Never waits for an answer.
+ * @param data  telemetry sample (copied)
+ * @return false if the broker is not reachable or MQTT_MAX_INFLIGHT fixes
+ *         are unacknowledged; the caller queues the fix offline
+ */
+bool networkMqttPublish(const TelemetryData* data);
+
+/**
+ * Keep the MQTT session alive: (re)connect, read PUBACKs and commands,
+ * ping, and hand back acknowledged fixes, oldest first. Call often (every
+ * MQTT_POLL_MS) from the same task as the uploads.
+ * @param doneFunc  called with (fix, true) for each acknowledged fix;
+ *                  returns false to stop (the rest are handed back on a
+ *                  later call)
+ * @return number of fixes handed back
+ */
+int networkMqttPoll(std::function<bool(const TelemetryData*, bool)> doneFunc);
+
+/**
+ * Check whether uploads should be tried now. False while the circuit
+ * breaker is open (BREAKER_FAILURES in config.h): the server kept
+ * failing, so fixes go to the offline queue without a send. True again
+ * when the next probe is due.
+ * @return true if the server is worth trying
+ */
+bool networkServerAvailable();
+
+/**
+ * Connected windows (link up → link down) that have ended since boot.
+ * @return number of windows
+ */
+uint32_t networkGetWindowCount();
+
+/**
+ * Connected windows that ended before anything was delivered (no POST
+ * answered, no MQTT PUBACK, no UDP ACK): time online that was wasted.
+ * @return number of missed windows
+ */
+uint32_t networkGetMissedWindows();
+
+/**
+ * Start or end an upload burst. While connected with a backlog and a
+ * strong signal (WIFI_BURST_RSSI), modem sleep is turned off and roaming
+ * scans wait, so the backlog drains back-to-back; the burst ends when
+ * the backlog is gone or the signal drops WIFI_BURST_EXIT_DB below the
+ * threshold. Call on every loop() pass.
+ * @param backlog  true if the offline queue holds records
+ * @return true while bursting
+ */
+bool networkUpdateBurst(bool backlog);
+
+/**
+ * Print the known networks with their channel and delivery record,
+ * best ranked first (serial console).
+ */
+void networkLogKnownNetworks();
+
+/**
+ * Take the time range the server last asked to be backfilled, if any.
+ * The server requests one by adding "backfill": {"from": t, "to": t}
+ * (Unix seconds) to a POST response. The request is returned once.
+ * @param from  receives the first Unix time wanted
+ * @param to    receives the last Unix time wanted (inclusive)
+ * @return true if a backfill request was pending
+ */
+bool networkTakeBackfillRequest(uint32_t* from, uint32_t* to);
+
+// Reporting parameters set by the server (see networkGetControl)
+struct ServerControl {
+    uint32_t intervalMs;        // Live fix interval
+    int      batchMax;          // Records per backlog window (0 = no cap)
+    bool     flushAllowed;      // Backlog and backfill uploads allowed
+};
+
+/**
+ * Get the reporting parameters in force. The server sets them by adding
+ * "control": {"next_interval_ms": n, "batch_max": n, "flush_allowed": 0|1,
+ * "ttl_s": n} to a POST response or an MQTT command; values are clamped to
+ * the CONTROL_* bounds in config.h. Defaults (SEND_INTERVAL, no cap,
+ * flushes allowed) until then and once the block has lapsed.
+ * @param control  receives the parameters
+ */
+void networkGetControl(ServerControl* control);
 
 /**
  * Get the device's current local IP address as a string.
@@ -0,0 +1,248 @@
+/**
+ * ============================================================================
+ * SAWARI Bus Telemetry Device - USB Bulk Offload Implementation
+ * ============================================================================
+ *
+ * Serves the host-driven protocol in offload_protocol.h.
+ *
+ * The device is stateless between requests: the host lists the files,
+ * reads byte ranges and, once the data is safely written on its side,
+ * commits the queue part so the device can drop it. Files go out raw, as
+ * stored, so nothing is decoded or re-encoded on the device and the link
+ * runs at full speed (no per-chunk acknowledgement). A chunk that arrives
+ * damaged is simply read again from its offset.
+ *
+ * Work per loop pass is bounded (OFFLOAD_CHUNKS_PER_PASS chunks), so the
+ * GPS feed, display and watchdog keep running during an offload.
+ * ============================================================================
+ */
+
+#include <algorithm>
+#include "offload_handler.h"
+#include "offload_protocol.h"
+#include "config.h"
+#include "storage_handler.h"
+#include "archive_handler.h"
+#include "track_codec.h"
+
+#define OFFLOAD_MAX_REQUEST     sizeof(OffloadCommit)   // Largest request payload
+
+// --- Session state ---
+static bool          _active      = false;
+static unsigned long _lastRequest = 0;
+
+// --- Request parser ---
+static uint8_t _rx[OFFLOAD_HEADER_BYTES + 16 + OFFLOAD_TRAILER_BYTES];
+static size_t  _rxLen = 0;
+static_assert(OFFLOAD_MAX_REQUEST <= 16, "request payloads must fit the parser buffer");
+
+// --- READ in progress ---
+static bool        _reading  = false;
+static OffloadRead _job;
+static uint32_t    _jobSent  = 0;
+
+// Frame being sent (payload built in place after the header)
+static uint8_t _tx[OFFLOAD_HEADER_BYTES + OFFLOAD_MAX_PAYLOAD + OFFLOAD_TRAILER_BYTES];
+
+// ---------------------------------------------------------------------------
+// Internal helper: frame and send a payload. The payload may already sit
+// at _tx + OFFLOAD_HEADER_BYTES.
+// ---------------------------------------------------------------------------
+static void _sendFrame(uint8_t type, const void* payload, size_t len) {
+    uint8_t* body = _tx + OFFLOAD_HEADER_BYTES;
+    if (len > 0 && payload != body) {
+        memcpy(body, payload, len);
+    }
+
+    _tx[0] = OFFLOAD_SYNC0;
+    _tx[1] = OFFLOAD_SYNC1;
+    _tx[2] = type;
+    _tx[3] = len & 0xFF;
+    _tx[4] = len >> 8;
+
+    uint32_t crc = trackCrc32(_tx + 2, 3 + len);
+    uint8_t* trailer = body + len;
+    trailer[0] = crc;
+    trailer[1] = crc >> 8;
+    trailer[2] = crc >> 16;
+    trailer[3] = crc >> 24;
+
+    Serial.write(_tx, OFFLOAD_HEADER_BYTES + len + OFFLOAD_TRAILER_BYTES);
+}
+
+static void _sendEnd(uint8_t status, uint32_t bytes) {
+    OffloadEnd end = { status, bytes };
+    _sendFrame(OFFLOAD_END, &end, sizeof(end));
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: leave offload mode and give the port back to the console
+// ---------------------------------------------------------------------------
+static void _end() {
+    _active = false;
+    _reading = false;
+    Serial.flush();
+    Serial.updateBaudRate(SERIAL_BAUD);
+    Serial.println(F("[OFFLOAD] Session ended"));
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: LIST — queue segments, then archive hours
+// ---------------------------------------------------------------------------
+static void _sendList() {
+    OffloadInfo info;
+    info.version = OFFLOAD_PROTOCOL_VERSION;
+    info.busId = BUS_ID;
+    info.queueSamples = storageGetCount();
+    info.queueToken = storageGetOffloadToken();
+    _sendFrame(OFFLOAD_INFO, &info, sizeof(info));
+
+    uint32_t files = 0;
+    storageListSegments([&](uint32_t seq, uint32_t size, uint32_t start, uint8_t skip) {
+        OffloadFile file = { OFFLOAD_KIND_QUEUE, seq, size, start, skip };
+        _sendFrame(OFFLOAD_FILE, &file, sizeof(file));
+        files++;
+    });
+
+    archiveSync();      // Buffered archive samples go out too
+    archiveListHours([&](uint32_t hour, uint32_t size) {
+        OffloadFile file = { OFFLOAD_KIND_ARCHIVE, hour, size, 0, 0 };
+        _sendFrame(OFFLOAD_FILE, &file, sizeof(file));
+        files++;
+    });
+
+    _sendEnd(OFFLOAD_END_OK, files);
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: send the next chunk of the READ in progress
+// ---------------------------------------------------------------------------
+static void _sendChunk() {
+    uint32_t want = std::min((uint32_t)OFFLOAD_CHUNK_BYTES, _job.length - _jobSent);
+    if (want == 0) {
+        _reading = false;
+        _sendEnd(OFFLOAD_END_OK, _jobSent);
+        return;
+    }
+
+    uint8_t* body = _tx + OFFLOAD_HEADER_BYTES;
+    uint8_t* data = body + sizeof(OffloadData);
+    int n = (_job.kind == OFFLOAD_KIND_QUEUE)
+            ? storageReadSegment(_job.id, _job.offset, data, want)
+            : archiveReadHour(_job.id, _job.offset, data, want);
+
+    if (n <= 0) {
+        _reading = false;
+        _sendEnd(n < 0 ? OFFLOAD_END_MISSING : OFFLOAD_END_OK, _jobSent);
+        return;
+    }
+
+    OffloadData hdr = { _job.kind, _job.id, _job.offset };
+    memcpy(body, &hdr, sizeof(hdr));
+    _sendFrame(OFFLOAD_DATA, body, sizeof(hdr) + n);
+
+    _job.offset += n;
+    _jobSent += n;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: act on one verified request frame
+// ---------------------------------------------------------------------------
+static void _handleRequest(uint8_t type, const uint8_t* payload, size_t len) {
+    _lastRequest = millis();
+
+    switch (type) {
+        case OFFLOAD_LIST:
+            _reading = false;
+            _sendList();
+            break;
+
+        case OFFLOAD_READ:
+            if (len != sizeof(OffloadRead)) break;
+            memcpy(&_job, payload, sizeof(_job));
+            _jobSent = 0;
+            _reading = true;        // A new READ replaces one in progress
+            break;
+
+        case OFFLOAD_COMMIT: {
+            if (len != sizeof(OffloadCommit)) break;
+            OffloadCommit commit;
+            memcpy(&commit, payload, sizeof(commit));
+            bool ok = storageCommitOffload(commit.segment, commit.offset, commit.queueToken);
+            _sendFrame(ok ? OFFLOAD_ACK : OFFLOAD_NAK, nullptr, 0);
+            break;
+        }
+
+        case OFFLOAD_QUIT:
+            _sendFrame(OFFLOAD_ACK, nullptr, 0);
+            _end();
+            break;
+
+        default:
+            break;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: feed one received byte to the frame parser
+// ---------------------------------------------------------------------------
+static void _feed(uint8_t b) {
+    if (_rxLen == 0 && b != OFFLOAD_SYNC0) return;
+    if (_rxLen == 1 && b != OFFLOAD_SYNC1) {
+        _rxLen = (b == OFFLOAD_SYNC0) ? 1 : 0;
+        return;
+    }
+    _rx[_rxLen++] = b;
+    if (_rxLen < OFFLOAD_HEADER_BYTES) return;
+
+    size_t len = _rx[3] | (_rx[4] << 8);
+    size_t total = OFFLOAD_HEADER_BYTES + len + OFFLOAD_TRAILER_BYTES;
+    if (total > sizeof(_rx)) {
+        _rxLen = 0;         // Not a request we know: resynchronize
+        return;
+    }
+    if (_rxLen < total) return;
+
+    const uint8_t* t = _rx + OFFLOAD_HEADER_BYTES + len;
+    uint32_t crc = t[0] | (t[1] << 8) | ((uint32_t)t[2] << 16) | ((uint32_t)t[3] << 24);
+    if (crc == trackCrc32(_rx + 2, 3 + len)) {
+        _handleRequest(_rx[2], _rx + OFFLOAD_HEADER_BYTES, len);
+    }
+    _rxLen = 0;
+}
+
+// ============================================================================
+// PUBLIC API
+// ============================================================================
+
+void offloadBegin() {
+    Serial.print(F(OFFLOAD_READY_LINE " "));
+    Serial.println(OFFLOAD_BAUD);
+    Serial.flush();
+    Serial.updateBaudRate(OFFLOAD_BAUD);
+
+    _active = true;
+    _reading = false;
+    _rxLen = 0;
+    _lastRequest = millis();
+}
+
+bool offloadIsActive() {
+    return _active;
+}
+
+void offloadUpdate() {
+    if (!_active) return;
+
+    while (_active && Serial.available() > 0) {
+        _feed(Serial.read());
+    }
+
+    for (int i = 0; _active && _reading && i < OFFLOAD_CHUNKS_PER_PASS; i++) {
+        _sendChunk();
+    }
+
+    if (_active && !_reading && millis() - _lastRequest >= OFFLOAD_IDLE_MS) {
+        _end();
+    }
+}
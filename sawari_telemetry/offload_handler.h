@@ -0,0 +1,36 @@
+/**
+ * ============================================================================
+ * SAWARI Bus Telemetry Device - USB Bulk Offload Header
+ * ============================================================================
+ * Depot offload of the offline queue and the track archive over the USB
+ * serial port at OFFLOAD_BAUD, much faster than draining the queue one
+ * HTTP POST at a time over weak depot WiFi. The host side is
+ * tools/sawari-offload.cpp; the wire format is in offload_protocol.h.
+ * ============================================================================
+ */
+
+#ifndef OFFLOAD_HANDLER_H
+#define OFFLOAD_HANDLER_H
+
+#include <Arduino.h>
+
+/**
+ * Start an offload session (console command "offload"): acknowledge on
+ * the console, then switch the serial port to OFFLOAD_BAUD.
+ */
+void offloadBegin();
+
+/**
+ * Check whether an offload session is running. While it is, the serial
+ * port carries binary frames and the console is not read.
+ */
+bool offloadIsActive();
+
+/**
+ * Serve host requests and stream up to OFFLOAD_CHUNKS_PER_PASS data
+ * chunks. Call every loop pass. The session ends on QUIT or after
+ * OFFLOAD_IDLE_MS without a request; the port then returns to SERIAL_BAUD.
+ */
+void offloadUpdate();
+
+#endif // OFFLOAD_HANDLER_H
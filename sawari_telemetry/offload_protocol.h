@@ -0,0 +1,120 @@
+/**
+ * ============================================================================
+ * SAWARI Bus Telemetry Device - USB Bulk Offload Protocol
+ * ============================================================================
+ * Wire format shared by the firmware (offload_handler.cpp) and the Linux
+ * receiver (tools/sawari-offload.cpp). Plain C types only, no Arduino
+ * dependencies, so the host tool can include it as-is.
+ *
+ * Session:
+ *   1. Host sends "offload\n" on the serial console (SERIAL_BAUD).
+ *   2. Device answers "@OFFLOAD <baud>\n" and switches to OFFLOAD_BAUD.
+ *   3. Host switches too and drives the session with request frames.
+ *      The device leaves offload mode on QUIT or after OFFLOAD_IDLE_MS
+ *      without a request.
+ *
+ * Frame (all integers little-endian):
+ *   [0xA5][0x5A][type u8][length u16][payload][CRC32 of type..payload]
+ * Bytes that are not part of a valid frame (debug log lines) are skipped
+ * by the receiver, which resynchronizes on the next sync pair.
+ *
+ * Requests (host -> device) and replies:
+ *   LIST    -> INFO, one FILE per queue segment and archive hour, END
+ *   READ    -> DATA chunks of the requested byte range, END
+ *   COMMIT  -> ACK / NAK  (drop offloaded queue data on the device)
+ *   QUIT    -> ACK, device returns to the console baud rate
+ *
+ * Files are sent raw, exactly as stored: sequences of track block frames
+ * [u16 length | 0x8000][block][CRC32] (see storage_handler.cpp). A
+ * transfer is resumed by reading again from the end of the last complete
+ * block frame the host has kept.
+ * ============================================================================
+ */
+
+#ifndef OFFLOAD_PROTOCOL_H
+#define OFFLOAD_PROTOCOL_H
+
+#include <stdint.h>
+
+#define OFFLOAD_PROTOCOL_VERSION    1
+
+#define OFFLOAD_SYNC0               0xA5
+#define OFFLOAD_SYNC1               0x5A
+#define OFFLOAD_HEADER_BYTES        5       // Sync pair + type + length
+#define OFFLOAD_TRAILER_BYTES       4       // CRC32
+
+// Raw file bytes per DATA frame
+#define OFFLOAD_CHUNK_BYTES         1024
+
+// Console line that acknowledges "offload" (followed by the baud rate)
+#define OFFLOAD_READY_LINE          "@OFFLOAD"
+
+// --- Frame types ---
+#define OFFLOAD_LIST                'L'
+#define OFFLOAD_READ                'R'
+#define OFFLOAD_COMMIT              'C'
+#define OFFLOAD_QUIT                'Q'
+#define OFFLOAD_INFO                'I'
+#define OFFLOAD_FILE                'F'
+#define OFFLOAD_DATA                'D'
+#define OFFLOAD_END                 'E'
+#define OFFLOAD_ACK                 'A'
+#define OFFLOAD_NAK                 'N'
+
+// --- File kinds ---
+#define OFFLOAD_KIND_QUEUE          1       // id = queue segment sequence number
+#define OFFLOAD_KIND_ARCHIVE        2       // id = archive hour (Unix time / 3600)
+
+// --- END status ---
+#define OFFLOAD_END_OK              0
+#define OFFLOAD_END_MISSING         1       // File no longer exists
+
+/** INFO: first reply to LIST. */
+struct __attribute__((packed)) OffloadInfo {
+    uint8_t  version;       // OFFLOAD_PROTOCOL_VERSION
+    uint32_t busId;
+    uint32_t queueSamples;  // Samples in the offline queue (incl. unsealed)
+    uint32_t queueToken;    // Pass back in COMMIT; changes if the queue is rewritten
+};
+
+/** FILE: one offloadable file. */
+struct __attribute__((packed)) OffloadFile {
+    uint8_t  kind;          // OFFLOAD_KIND_*
+    uint32_t id;
+    uint32_t size;          // Bytes of whole frames
+    uint32_t start;         // First unsent byte (queue read cursor), else 0
+    uint8_t  skip;          // Samples of the block at `start` already sent
+};
+
+/** READ: request a byte range of a file. */
+struct __attribute__((packed)) OffloadRead {
+    uint8_t  kind;
+    uint32_t id;
+    uint32_t offset;
+    uint32_t length;
+};
+
+/** DATA: header in front of up to OFFLOAD_CHUNK_BYTES raw bytes. */
+struct __attribute__((packed)) OffloadData {
+    uint8_t  kind;
+    uint32_t id;
+    uint32_t offset;        // File offset of the first byte in this chunk
+};
+
+/** END: closes a LIST or READ reply. */
+struct __attribute__((packed)) OffloadEnd {
+    uint8_t  status;        // OFFLOAD_END_*
+    uint32_t bytes;         // Bytes sent (READ) or files listed (LIST)
+};
+
+/** COMMIT: everything before (segment, offset) has been kept by the host. */
+struct __attribute__((packed)) OffloadCommit {
+    uint32_t segment;
+    uint32_t offset;        // End of the last block frame kept
+    uint32_t queueToken;    // From INFO
+};
+
+// Largest payload of any frame
+#define OFFLOAD_MAX_PAYLOAD         (sizeof(OffloadData) + OFFLOAD_CHUNK_BYTES)
+
+#endif // OFFLOAD_PROTOCOL_H
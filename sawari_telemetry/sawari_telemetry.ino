@@ -34,15 +34,33 @@
  *   3. Display shows connection status (connected SSID / offline mode)
  *   4. Main loop (non-blocking):
  *      a. Feed GPS parser continuously
- *      b. Every 2s: if GPS fix valid, build JSON and send to server
- *      c. If WiFi down: queue data locally in LittleFS (max 500 records)
- *      d. Every 10s: check WiFi availability, auto-reconnect if possible
- *      e. When WiFi reconnects: flush offline queue automatically
+ *      b. Every 5s: if GPS fix valid, build the body (JSON, or CBOR /
+ *         MessagePack with WIRE_FORMAT) and send to server (the server
+ *         may slow this down or speed it up, cap backlog windows or hold
+ *         flushes for a while: "control" in its responses)
+ *      c. If WiFi down: queue data locally in LittleFS (compressed track blocks)
+ *      d. WiFi loss and recovery arrive as events (WiFi.onEvent) and are
+ *         applied on the next loop pass; while down, reconnect to the last
+ *         access point first, then scan for the other known networks
+ *      e. When WiFi reconnects: drain offline queue (newest or oldest
+ *         first), one pipelined window of blocks / batches per pass,
+ *         sized to the measured throughput so live fixes keep going out
  *      f. Every 500ms: update OLED with lat, lon, speed, WiFi info, mode
  *      g. BOOT button long-press: open WiFi config portal on OLED
  *      h. Portal auto-closes on successful connection, display updates
  *      i. Monitor WiFi, manage LEDs, feed watchdog
  *      j. If no GPS fix for 10 minutes: restart ESP32 (watchdog)
+ *      k. Every fix is also kept in the on-flash track archive; ranges
+ *         can be dumped over serial or re-sent when the server asks
+ *      l. All uploads run in a sender task on core 0; the loop only hands
+ *         data over and collects the outcome, it never waits on the network
+ *
+ * SERIAL CONSOLE (115200 baud, newline-terminated):
+ *   archive               archive span and size
+ *   archive <from> <to>   print archived fixes in [from, to] (Unix
+ *                         seconds) as JSON lines
+ *   offload               switch to OFFLOAD_BAUD for a bulk offload of
+ *                         the queue and archive (tools/sawari-offload)
  *
  * ============================================================================
  * SAWARI Transport Intelligence Platform
@@ -59,7 +77,13 @@
 #include "gps_handler.h"
 #include "display_handler.h"
 #include "storage_handler.h"
+#include "archive_handler.h"
+#include "offload_handler.h"
 #include "network_handler.h"
+#include "sender_handler.h"
+#include "tls_client.h"
+#include "wire_codec.h"
+#include "track_codec.h"
 
 // === ESP32 Watchdog ===
 #include <esp_task_wdt.h>
@@ -70,14 +94,22 @@
 
 // Task scheduling timestamps (millis()-based, non-blocking)
 static unsigned long lastSendTime     = 0;
+static unsigned long lastLiveTime     = 0;     // Last fix handed to the sender task
 static unsigned long lastDisplayTime  = 0;
 static unsigned long lastWiFiCheck    = 0;
 static unsigned long lastQueueFlush   = 0;
 static unsigned long lastGpsFixTime   = 0;
+static unsigned long displayHoldUntil = 0;     // A notification stays up until then
 
 // GPS watchdog tracking
 static bool everHadGpsFix = false;
 
+// true while a backlog is draining: flush one batch every loop pass
+static bool queueDraining = false;
+
+// Reporting parameters from the server (refreshed every loop pass)
+static ServerControl control = { SEND_INTERVAL, 0, true };
+
 // --- BOOT Button state ---
 static bool     buttonPressed       = false;
 static unsigned long buttonDownTime = 0;
@@ -88,6 +120,41 @@ static bool isOfflineMode = false;           // true = WiFi unavailable, storing
 // Cached WiFi SSID for display (avoids repeated WiFi.SSID() calls)
 static char cachedSSID[33] = "";
 
+// --- Serial console ---
+static char    serialLine[48];
+static uint8_t serialLen = 0;
+
+// --- Archive range jobs, resumed one batch per loop pass ---
+static bool     dumpActive     = false;     // Serial "archive <from> <to>"
+static uint32_t dumpFrom       = 0;
+static uint32_t dumpTo         = 0;
+static uint32_t dumpCount      = 0;
+static bool     backfillActive = false;     // Range requested by the server
+static uint32_t backfillFrom   = 0;
+static uint32_t backfillTo     = 0;
+static unsigned long lastBackfillTry = 0;
+static uint32_t backfillNext   = 0;         // Resume point once the block is in
+
+// --- Upload handed to the sender task (one at a time) ---
+#define UPLOAD_NONE      0
+#define UPLOAD_QUEUE     1                  // Offline queue block / batch
+#define UPLOAD_BACKFILL  2                  // Archive block for a backfill
+static uint8_t  uploadJob     = UPLOAD_NONE;
+static uint32_t uploadMark    = 0;          // Queue mark when posted (see startQueueFlush)
+
+// --- Queue upload: a window of up to QUEUE_PIPELINE_DEPTH requests whose
+//     bodies share uploadBody ---
+#if QUEUE_UPLOAD_BLOCKS
+static uint8_t    uploadBody[QUEUE_PIPELINE_DEPTH * TRACK_BLOCK_MAX_BYTES];
+#else
+#define BATCH_WINDOW_RECORDS (QUEUE_FLUSH_BATCH_RECORDS * QUEUE_PIPELINE_DEPTH)
+static uint8_t    uploadBody[QUEUE_BATCH_MAX_BYTES];
+static TrackPoint batchPoints[BATCH_WINDOW_RECORDS];     // The records sent
+static uint8_t    batchResults[BATCH_WINDOW_RECORDS];
+#endif
+static UploadPart uploadParts[QUEUE_PIPELINE_DEPTH];
+static int        uploadPartCount = 0;
+
 // ============================================================================
 // HELPER: Update cached Wi-Fi SSID
 // ============================================================================
@@ -101,6 +168,201 @@ static void updateCachedSSID() {
     }
 }
 
+// ============================================================================
+// HELPER: Hand the next window of the offline queue (up to
+// QUEUE_PIPELINE_DEPTH blocks or batches, QUEUE_FLUSH_ORDER) to the sender
+// task. It stays queued until finishQueueFlush() sees what the server
+// accepted. The window is sized to go through in QUEUE_FLUSH_BUDGET_MS at
+// the measured throughput, so the next live fix is not held back long, and
+// holds no more records than the server's batch_max (at least one block).
+// ============================================================================
+static bool startQueueFlush() {
+    size_t used = 0;
+    int records = 0;
+    uploadPartCount = 0;
+
+    size_t budget = (size_t)((uint64_t)senderGetBulkRate() * QUEUE_FLUSH_BUDGET_MS / 1000);
+    if (budget > QUEUE_FLUSH_BUDGET_BYTES) budget = QUEUE_FLUSH_BUDGET_BYTES;
+
+#if QUEUE_UPLOAD_BLOCKS
+    // Upload sealed track blocks as-is (many samples per request)
+    auto addBlock = [&](const uint8_t* block, size_t len, int samples) -> bool {
+        if (uploadPartCount > 0 && (used + len > budget ||
+            (control.batchMax > 0 && records + samples > control.batchMax))) {
+            return false;
+        }
+        memcpy(uploadBody + used, block, len);
+        uploadParts[uploadPartCount++] = { uploadBody + used, len, samples, nullptr };
+        used += len;
+        records += samples;
+        return true;
+    };
+#if QUEUE_FLUSH_ORDER == QUEUE_ORDER_NEWEST_FIRST
+    storagePeekNewestBlocks(addBlock, QUEUE_PIPELINE_DEPTH);
+#else
+    storagePeekBlocks(addBlock, QUEUE_PIPELINE_DEPTH);
+#endif
+    if (uploadPartCount == 0 || !senderPostUpload(uploadParts, uploadPartCount, true)) {
+        return false;
+    }
+#else
+    // Pack the oldest records into batches of QUEUE_FLUSH_BATCH_RECORDS
+    // (WIRE_FORMAT), one request each
+    WireBatch batch;
+    int maxRecords = BATCH_WINDOW_RECORDS;
+    if (control.batchMax > 0 && control.batchMax < maxRecords) maxRecords = control.batchMax;
+    auto endBatch = [&]() {
+        size_t len = wireBatchEnd(&batch);
+        uploadParts[uploadPartCount++] = { batch.buf, len, batch.count,
+                                           batchResults + records - batch.count };
+        used += len;
+        batch.count = 0;        // Closed
+    };
+
+    wireBatchBegin(&batch, uploadBody, sizeof(uploadBody));
+    storagePeek([&](const TelemetryData* record) -> bool {
+        if (records > 0 && used + batch.len >= budget) return false;
+        if (batch.count == QUEUE_FLUSH_BATCH_RECORDS || !wireBatchAdd(&batch, record)) {
+            // This batch is full: start the next one in the space left
+            if (batch.count == 0 || uploadPartCount + 1 == QUEUE_PIPELINE_DEPTH) return false;
+            endBatch();
+            if (sizeof(uploadBody) - used < WIRE_RECORD_MAX_BYTES) return false;
+            wireBatchBegin(&batch, uploadBody + used, sizeof(uploadBody) - used);
+            if (!wireBatchAdd(&batch, record)) return false;
+        }
+        trackPointFromTelemetry(record, &batchPoints[records++]);
+        return true;
+    }, maxRecords);
+    if (batch.count > 0) endBatch();
+    if (uploadPartCount == 0 || !senderPostUpload(uploadParts, uploadPartCount, false)) {
+        return false;
+    }
+#endif
+#if QUEUE_FLUSH_ORDER == QUEUE_ORDER_NEWEST_FIRST
+    uploadMark = storageGetTailMark();
+#else
+    uploadMark = storageGetReadMark();
+#endif
+    uploadJob = UPLOAD_QUEUE;
+    return true;
+}
+
+// ============================================================================
+// HELPER: Consume the leading `accepted` requests of an offline queue
+// upload (the server accepted those)
+// ============================================================================
+static void finishQueueFlush(int accepted) {
+    ledBlinkData();
+
+    // Evicted, thinned or offloaded meanwhile (newest first: appended to
+    // as well): the blocks sent are no longer the ones to consume, so keep
+    // them (they go out again; the server drops duplicates by seq)
+#if QUEUE_FLUSH_ORDER == QUEUE_ORDER_NEWEST_FIRST
+    bool changed = storageGetTailMark() != uploadMark;
+#else
+    bool changed = storageGetReadMark() != uploadMark;
+#endif
+    if (changed) {
+        Serial.println(F("[MAIN] Queue changed during upload — not consuming it"));
+        return;
+    }
+
+#if QUEUE_FLUSH_ORDER == QUEUE_ORDER_NEWEST_FIRST
+    storageFlushNewestBlocks(accepted);
+#elif QUEUE_UPLOAD_BLOCKS
+    storageFlushBlocks([](const uint8_t*, size_t) -> bool { return true; }, accepted);
+#else
+    // Stored and rejected (invalid) records are done; records the server
+    // could not store this time go back in at the tail of the queue
+    int count = 0;
+    for (int i = 0; i < accepted; i++) {
+        count += uploadParts[i].count;
+    }
+    storageFlush([](const TelemetryData*) -> bool { return true; }, count);
+    int done = 0;
+    int rejected = 0;
+    for (int i = 0; i < count; i++) {
+        if (batchResults[i] == BATCH_RESULT_RETRY) {
+            TelemetryData record;
+            trackPointToTelemetry(&batchPoints[i], &record);
+            storageEnqueue(&record);
+        } else {
+            done++;
+            if (batchResults[i] == BATCH_RESULT_REJECTED) rejected++;
+        }
+    }
+    if (done < count) storageSync();
+    if (rejected > 0) {
+        Serial.print(F("[MAIN] Server rejected "));
+        Serial.print(rejected);
+        Serial.println(F(" invalid records (dropped)"));
+    }
+#endif
+}
+
+// ============================================================================
+// HELPER: Run one serial console command
+// ============================================================================
+static void runSerialCommand(const char* line) {
+    unsigned long from, to;
+
+    if (sscanf(line, "archive %lu %lu", &from, &to) == 2) {
+        dumpFrom = from;
+        dumpTo = to;
+        dumpCount = 0;
+        dumpActive = true;
+        Serial.println(F("[ARCHIVE] Dump started"));
+    } else if (strcmp(line, "archive") == 0) {
+        uint32_t first, last;
+        Serial.print(F("[ARCHIVE] "));
+        Serial.print(archiveGetHours());
+        Serial.print(F(" hours, "));
+        Serial.print(archiveGetBytes());
+        Serial.println(F(" bytes"));
+        if (archiveGetSpan(&first, &last)) {
+            Serial.print(F("[ARCHIVE] Span: "));
+            Serial.print(first);
+            Serial.print(F(" .. "));
+            Serial.println(last);
+        }
+    } else if (strcmp(line, "offload") == 0) {
+        dumpActive = false;
+        offloadBegin();
+    } else if (strcmp(line, "wifi") == 0) {
+        Serial.print(F("[NETWORK] "));
+        Serial.print(networkIsConnected() ? F("Connected, ") : F("Offline, "));
+        Serial.print(networkGetWindowCount());
+        Serial.print(F(" connected windows ended, "));
+        Serial.print(networkGetMissedWindows());
+        Serial.println(F(" missed (nothing delivered)"));
+        networkLogKnownNetworks();
+    } else if (strcmp(line, "tls") == 0) {
+        tlsLogStats();
+    } else {
+        Serial.println(F("[CONSOLE] Commands: archive | archive <from> <to> | offload | wifi | tls"));
+    }
+}
+
+// ============================================================================
+// HELPER: Collect serial console input (non-blocking, line-buffered)
+// ============================================================================
+static void handleSerialConsole() {
+    while (Serial.available() > 0) {
+        char c = Serial.read();
+        if (c != '\n' && c != '\r') {
+            if (serialLen < sizeof(serialLine) - 1) {
+                serialLine[serialLen++] = c;
+            }
+            continue;
+        }
+        if (serialLen == 0) continue;
+
+        serialLine[serialLen] = '\0';
+        serialLen = 0;
+        runSerialCommand(serialLine);
+    }
+}
+
 // ============================================================================
 // HELPER: Handle BOOT button (GPIO0) for WiFi portal
 // ============================================================================
@@ -134,7 +396,7 @@ static void handleBootButton() {
 // ============================================================================
 void setup() {
     // --- 1. Serial debug ---
-    Serial.begin(115200);
+    Serial.begin(SERIAL_BAUD);
     delay(100);
 
     Serial.println();
@@ -168,6 +430,8 @@ void setup() {
         Serial.println(F("[INIT] WARNING: Storage init failed!"));
         displayBootProgress(20, "Storage FAILED!");
         delay(500);
+    } else {
+        archiveInit();
     }
     delay(200);
 
@@ -218,9 +482,14 @@ void setup() {
     esp_task_wdt_init(&wdt_config);
     esp_task_wdt_add(NULL);
 
-    // --- 9. Timing baselines ---
+    // --- 9. Sender task (all uploads) ---
+    Serial.println(F("[INIT] Starting sender task..."));
+    senderInit();
+
+    // --- 10. Timing baselines ---
     unsigned long now = millis();
     lastSendTime    = now;
+    lastLiveTime    = now;
     lastDisplayTime = now;
     lastWiFiCheck   = now;
     lastQueueFlush  = now;
@@ -277,14 +546,10 @@ void loop() {
 
             Serial.println(F("[MAIN] WiFi connected via portal — switching to online mode"));
 
-            // Flush any queued offline data
+            // Start draining any queued offline data (TASK 7)
             if (storageGetCount() > 0) {
                 Serial.println(F("[MAIN] Flushing offline queue after portal connect..."));
-                storageFlush([](const String& json) -> bool {
-                    bool success = networkSendData(json);
-                    if (success) ledBlinkData();
-                    return success;
-                });
+                queueDraining = true;
             }
         }
 
@@ -304,39 +569,67 @@ void loop() {
     }
 
     // ===================================================================
-    // TASK 4: TELEMETRY DATA TRANSMISSION (every SEND_INTERVAL ms)
+    // TASK 4: TELEMETRY DATA TRANSMISSION (every SEND_INTERVAL ms, live
+    //         fixes at the server's interval when it sets one)
     // ===================================================================
-    if (now - lastSendTime >= SEND_INTERVAL) {
+    networkGetControl(&control);
+    unsigned long fixInterval = control.intervalMs < SEND_INTERVAL ? control.intervalMs
+                                                                   : SEND_INTERVAL;
+    if (now - lastSendTime >= fixInterval) {
         lastSendTime = now;
 
         if (gpsFix) {
             TelemetryData telemetry;
             gpsGetTelemetry(&telemetry);
-            String payload = gpsFormatPayload(&telemetry);
-
-            if (networkIsConnected()) {
-                // --- ONLINE: Send directly ---
-                Serial.println(F("[MAIN] Sending telemetry to server..."));
-                bool sent = networkSendData(payload);
-
-                if (sent) {
-                    ledBlinkData();
-                } else {
-                    Serial.println(F("[MAIN] Send failed — queuing for retry"));
-                    storageEnqueue(payload);
+            telemetry.seq = storageNextSeq();
+            archiveAppend(&telemetry);
+
+            if (networkIsConnected() && networkServerAvailable()) {
+                // --- ONLINE: Hand over to the sender task, at the
+                // server's pace (fixes skipped stay in the archive) ---
+                if (now - lastLiveTime + fixInterval / 2 >= control.intervalMs) {
+                    lastLiveTime = now;
+                    senderSubmit(&telemetry);
                 }
+            } else if (networkIsConnected()) {
+                // --- SERVER DOWN: circuit open, do not wait on it ---
+                Serial.println(F("[MAIN] Server unavailable — queuing telemetry data"));
+                storageEnqueue(&telemetry);
             } else {
                 // --- OFFLINE: Queue locally ---
                 Serial.println(F("[MAIN] WiFi offline — queuing telemetry data"));
-                storageEnqueue(payload);
+                storageEnqueue(&telemetry);
             }
         }
     }
 
+    // Outcomes of fixes the sender task has finished with
+    senderPollLive([](const TelemetryData* data, bool sent) {
+        if (sent) {
+            ledBlinkData();
+        } else {
+            Serial.println(F("[MAIN] Send failed — queuing for retry"));
+            storageEnqueue(data);
+        }
+    });
+
+    // Sequence watermark: every seq below the oldest one still queued or
+    // in flight was delivered or dropped, so the server may count it as
+    // received. A counter the server is already past (e.g. lost with a
+    // flash format) moves on, so new fixes are not taken for duplicates.
+    uint32_t seqFloor = storageGetSeqFloor();
+    uint32_t liveOldest = senderOldestSeq();
+    if (seqFloor != 0 && liveOldest != 0 && liveOldest < seqFloor) {
+        seqFloor = liveOldest;
+    }
+    networkSetSeqFloor(seqFloor);
+    storageSkipSeq(networkGetAckedSeq());
+
     // ===================================================================
     // TASK 5: OLED DISPLAY UPDATE (every DISPLAY_UPDATE_INTERVAL ms)
     // ===================================================================
-    if (now - lastDisplayTime >= DISPLAY_UPDATE_INTERVAL) {
+    if (now - lastDisplayTime >= DISPLAY_UPDATE_INTERVAL &&
+        (long)(now - displayHoldUntil) >= 0) {
         lastDisplayTime = now;
 
         bool wifiOk = networkIsConnected();
@@ -360,36 +653,52 @@ void loop() {
     }
 
     // ===================================================================
-    // TASK 6: WIFI CHECK & AUTO-RECONNECT (every WIFI_CHECK_INTERVAL = 10s)
+    // TASK 6: WIFI STATE & AUTO-RECONNECT (link changes every pass, from
+    //         the WiFi events; status refresh every WIFI_CHECK_INTERVAL)
     // ===================================================================
+    int linkChange = networkCheckReconnect();
+    if (linkChange == NET_LINK_UP) {
+        // WiFi came back! Switch from offline → online
+        isOfflineMode = false;
+        updateCachedSSID();
+        ledSetWiFi(true);
+        Serial.println(F("[MAIN] WiFi restored — switching to online mode"));
+
+        // Use the window at once: the current position goes out on the
+        // next pass, and the offline queue starts draining (TASK 7)
+        lastSendTime = now - SEND_INTERVAL;
+        lastLiveTime = now - control.intervalMs;
+        if (storageGetCount() > 0) {
+            queueDraining = true;
+        }
+
+        // Show brief connection notification (held without blocking)
+        displayWiFiConnected(cachedSSID, networkGetIP().c_str(), networkGetRSSI());
+        displayHoldUntil = now + 1000;
+    }
+    else if (linkChange == NET_LINK_DOWN) {
+        // WiFi lost — switch to offline mode
+        isOfflineMode = true;
+        updateCachedSSID();
+        ledSetWiFi(false);
+        Serial.println(F("[MAIN] WiFi lost — switching to offline mode"));
+        Serial.println(F("[MAIN] Data will be stored locally"));
+    }
+
+    // Strong link and a backlog: drain it back-to-back (modem sleep off)
+    if (networkUpdateBurst(storageGetCount() > 0) && !queueDraining &&
+        uploadJob == UPLOAD_NONE) {
+        queueDraining = true;
+    }
+
     if (now - lastWiFiCheck >= WIFI_CHECK_INTERVAL) {
         lastWiFiCheck = now;
 
         bool wifiOk = networkIsConnected();
         ledSetWiFi(wifiOk);
 
-        if (wifiOk && isOfflineMode) {
-            // WiFi came back! Switch from offline → online
-            isOfflineMode = false;
-            updateCachedSSID();
-            Serial.println(F("[MAIN] WiFi restored — switching to online mode"));
-
-            // Show brief connection notification
-            displayWiFiConnected(cachedSSID, networkGetIP().c_str(), networkGetRSSI());
-            delay(1000);
-        }
-        else if (!wifiOk && !isOfflineMode) {
-            // WiFi lost — switch to offline mode
-            isOfflineMode = true;
-            Serial.println(F("[MAIN] WiFi lost — switching to offline mode"));
-            Serial.println(F("[MAIN] Data will be stored locally"));
-        }
-
         if (!wifiOk) {
-            networkCheckReconnect();
-            Serial.print(F("[MAIN] WiFi offline — next check in "));
-            Serial.print(WIFI_CHECK_INTERVAL / 1000);
-            Serial.println(F("s. Hold BOOT (2s) for portal."));
+            Serial.println(F("[MAIN] WiFi offline — reconnecting. Hold BOOT (2s) for portal."));
         } else {
             // Refresh cached SSID periodically
             updateCachedSSID();
@@ -397,45 +706,120 @@ void loop() {
     }
 
     // ===================================================================
-    // TASK 7: OFFLINE QUEUE FLUSH (every QUEUE_FLUSH_INTERVAL ms)
+    // TASK 7: OFFLINE QUEUE FLUSH (every QUEUE_FLUSH_INTERVAL ms,
+    //         then one bounded batch per loop pass while draining;
+    //         the upload itself runs in the sender task)
     // ===================================================================
-    if (now - lastQueueFlush >= QUEUE_FLUSH_INTERVAL) {
-        lastQueueFlush = now;
-
-        if (networkIsConnected() && storageGetCount() > 0) {
-            Serial.println(F("[MAIN] WiFi available — flushing offline queue..."));
+    int accepted;
+    if (uploadJob != UPLOAD_NONE && senderPollBulk(&accepted)) {
+        bool uploadOk = accepted > 0;
+        if (uploadJob == UPLOAD_QUEUE) {
+            if (uploadOk) finishQueueFlush(accepted);
+
+            // Keep draining while windows get through; back off once one
+            // fails as a whole
+            bool more = uploadOk && storageGetCount() > 0;
+            if (uploadOk && !more) {
+                Serial.println(F("[MAIN] Offline queue drained"));
+            }
+            queueDraining = more;
+        } else if (uploadOk) {
+            ledBlinkData();
+            backfillFrom = backfillNext;    // Sent: resume after this block
+        } else {
+            lastBackfillTry = now;
+        }
+        uploadJob = UPLOAD_NONE;
+    }
 
-            int sent = storageFlush([](const String& json) -> bool {
-                bool success = networkSendData(json);
-                if (success) ledBlinkData();
-                return success;
-            });
+    if (uploadJob == UPLOAD_NONE &&
+        (queueDraining || now - lastQueueFlush >= QUEUE_FLUSH_INTERVAL)) {
+        lastQueueFlush = now;
 
-            if (sent > 0) {
-                Serial.print(F("[MAIN] Flushed "));
-                Serial.print(sent);
-                Serial.println(F(" queued records"));
+        if (networkIsConnected() && networkServerAvailable() && control.flushAllowed &&
+            storageGetCount() > 0) {
+            if (!queueDraining) {
+                Serial.print(F("[MAIN] WiFi available — flushing offline queue ("));
+                Serial.print(QUEUE_FLUSH_ORDER == QUEUE_ORDER_NEWEST_FIRST ? F("newest") : F("oldest"));
+                Serial.print(F(" first, ~"));
+                Serial.print(senderGetBulkRate());
+                Serial.println(F(" B/s)..."));
             }
+            queueDraining = startQueueFlush();
+        } else {
+            queueDraining = false;
         }
     }
 
     // ===================================================================
-    // TASK 8: LED & DISPLAY ANIMATION UPDATE (continuous)
+    // TASK 8: LED, DISPLAY ANIMATION & STORAGE WRITE-BACK (continuous)
     // ===================================================================
     ledUpdate();
     displayAnimationTick();
 
+    // Commit offline / archive samples that have sat in RAM too long
+    storageUpdate();
+    archiveUpdate();
+
     // ===================================================================
     // TASK 9: GPS WATCHDOG — Restart if no fix for 10 minutes
     // ===================================================================
     if (now - lastGpsFixTime >= GPS_WATCHDOG_TIMEOUT) {
         if (everHadGpsFix || now > GPS_WATCHDOG_TIMEOUT * 2) {
             Serial.println(F("[WATCHDOG] No GPS fix for 10 minutes — RESTARTING ESP32"));
+            storageSync();      // Don't lose samples still buffered in RAM
+            archiveSync();
             Serial.flush();
             ESP.restart();
         }
     }
 
+    // ===================================================================
+    // TASK 10: SERIAL CONSOLE, USB OFFLOAD & ARCHIVE QUERIES
+    //          (one bounded batch per loop pass)
+    // ===================================================================
+    if (offloadIsActive()) {
+        offloadUpdate();
+    } else {
+        handleSerialConsole();
+    }
+
+    if (dumpActive) {
+        int n = archiveRead(&dumpFrom, dumpTo, [](const TelemetryData* record) {
+            Serial.println(gpsFormatPayload(record));
+        }, ARCHIVE_DUMP_BATCH);
+        dumpCount += n;
+        if (n == 0) {
+            dumpActive = false;
+            Serial.print(F("[ARCHIVE] Dump done: "));
+            Serial.print(dumpCount);
+            Serial.println(F(" samples"));
+        }
+    }
+
+    if (!backfillActive && networkTakeBackfillRequest(&backfillFrom, &backfillTo)) {
+        backfillActive = true;
+    }
+
+    // The live offline queue goes first; retry a failed block after
+    // QUEUE_FLUSH_INTERVAL instead of every pass (outcome: TASK 7)
+    if (backfillActive && uploadJob == UPLOAD_NONE && !queueDraining &&
+        networkIsConnected() && networkServerAvailable() && control.flushAllowed &&
+        now - lastBackfillTry >= QUEUE_FLUSH_INTERVAL) {
+        backfillNext = backfillFrom;
+        const uint8_t* block;
+        size_t len;
+
+        if (archiveReadBlock(&backfillNext, backfillTo, &block, &len) == 0) {
+            backfillActive = false;
+            Serial.println(F("[MAIN] Archive backfill complete"));
+        } else if (senderPostBlock(block, len, true)) {
+            uploadJob = UPLOAD_BACKFILL;
+        } else {
+            lastBackfillTry = now;
+        }
+    }
+
     // === Yield for FreeRTOS background tasks ===
     yield();
 }
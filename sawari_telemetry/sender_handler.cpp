@@ -0,0 +1,323 @@
+/**
+ * ============================================================================
+ * SAWARI Bus Telemetry Device - Sender Task Implementation
+ * ============================================================================
+ *
+ * The main loop (core 1) and the sender task (SENDER_TASK_CORE) share
+ * three things, none of them behind a lock:
+ *   - the live ring:    main loop pushes fixes, task pops them
+ *   - the done ring:    task pushes outcomes, main loop pops them
+ *   - the bulk slot:    main loop fills it and marks it pending, the task
+ *                       runs it and marks it done, the main loop frees it
+ * Each side only writes its own index / state transition, published with
+ * release ordering after the data it covers.
+ *
+ * A queue upload is a window of up to QUEUE_PIPELINE_DEPTH blocks or
+ * batches (networkSendUpload); the main loop learns how many of them, from
+ * the oldest on, the server accepted.
+ *
+ * The task sleeps on a task notification and is woken by every hand-over
+ * (and every UDP_POLL_MS / MQTT_POLL_MS with UDP_TELEMETRY /
+ * MQTT_TRANSPORT, to read acknowledgements). Live fixes go before a bulk
+ * job: they are the freshest data. The main loop sizes queue windows from
+ * the throughput measured here (senderGetBulkRate), so no window holds a
+ * live fix back for long.
+ * ============================================================================
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <esp_task_wdt.h>
+#include "sender_handler.h"
+#include "config.h"
+#include "network_handler.h"
+#include "storage_handler.h"
+#include "track_codec.h"
+#include "wire_codec.h"
+
+// ---------------------------------------------------------------------------
+// Single-producer / single-consumer ring. `head` is written only by the
+// producer and `tail` only by the consumer; both count up and wrap freely.
+// ---------------------------------------------------------------------------
+template <typename T>
+struct SpscRing {
+    T                     slots[SENDER_QUEUE_DEPTH];
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+};
+
+template <typename T>
+static bool _ringPush(SpscRing<T>* ring, const T* item) {
+    uint32_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) >= SENDER_QUEUE_DEPTH) {
+        return false;
+    }
+    ring->slots[head % SENDER_QUEUE_DEPTH] = *item;
+    ring->head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+static bool _ringPop(SpscRing<T>* ring, T* item) {
+    uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+    if (tail == ring->head.load(std::memory_order_acquire)) {
+        return false;
+    }
+    *item = ring->slots[tail % SENDER_QUEUE_DEPTH];
+    ring->tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+static bool _ringHasRoom(SpscRing<T>* ring) {
+    return ring->head.load(std::memory_order_relaxed) -
+           ring->tail.load(std::memory_order_acquire) < SENDER_QUEUE_DEPTH;
+}
+
+// Outcome of one live fix
+struct LiveResult {
+    TelemetryData data;
+    bool          sent;
+};
+
+static SpscRing<TelemetryData> _live;   // Main loop → task
+static SpscRing<LiveResult>    _done;   // Task → main loop
+
+// --- Seqs of live fixes handed over and not yet collected (main loop only):
+//     both rings, the fix the task holds and the transport's window ---
+#if MQTT_TRANSPORT
+#define LIVE_WINDOW     MQTT_MAX_INFLIGHT
+#elif UDP_TELEMETRY
+#define LIVE_WINDOW     UDP_WINDOW
+#else
+#define LIVE_WINDOW     0
+#endif
+#define LIVE_OUTSTANDING    (2 * SENDER_QUEUE_DEPTH + LIVE_WINDOW + 1)
+
+static uint32_t _liveSeqs[LIVE_OUTSTANDING];
+static int      _liveSeqCount = 0;
+
+// --- Bulk job slot ---
+#define BULK_IDLE       0       // Free: the main loop may post
+#define BULK_PENDING    1       // Posted: the task owns the fields below
+#define BULK_DONE       2       // Finished: the main loop collects it
+
+#define BULK_UPLOAD     0       // Queue window (networkSendUpload)
+#define BULK_BLOCK      1       // One copied block
+#define BULK_BACKFILL   2
+
+static std::atomic<uint8_t> _bulkState(BULK_IDLE);
+static uint8_t    _bulkKind      = BULK_BLOCK;
+static uint8_t    _bulkBlock[TRACK_BLOCK_MAX_BYTES];
+static size_t     _bulkLen       = 0;
+static UploadPart _bulkParts[QUEUE_PIPELINE_DEPTH];
+static int        _bulkPartCount = 0;
+static bool       _bulkBlocks    = false;
+static int        _bulkAccepted  = 0;
+
+// --- Backlog throughput (bytes/s), measured on whole queue windows ---
+static std::atomic<uint32_t> _bulkRate(QUEUE_FLUSH_RATE_INIT);
+
+// --- Task ---
+#if MQTT_TRANSPORT
+#define IDLE_WAIT_MS    MQTT_POLL_MS    // PUBACKs and commands arrive on their own
+#elif UDP_TELEMETRY
+#define IDLE_WAIT_MS    UDP_POLL_MS     // ACKs arrive on their own
+#else
+#define IDLE_WAIT_MS    1000
+#endif
+
+static TaskHandle_t _task = nullptr;
+static uint8_t      _payload[400];      // Live payload, encoded by the task
+
+// ---------------------------------------------------------------------------
+// Internal helper: send waiting live fixes while there is room to report
+// their outcome.
+// ---------------------------------------------------------------------------
+static void _sendLive() {
+    LiveResult result;
+#if MQTT_TRANSPORT || UDP_TELEMETRY
+    // Published fixes report back once acknowledged (or timed out, UDP)
+    auto report = [](const TelemetryData* data, bool acked) -> bool {
+        LiveResult done = { *data, acked };
+        return _ringPush(&_done, &done);
+    };
+#endif
+#if MQTT_TRANSPORT
+    networkMqttPoll(report);
+#elif UDP_TELEMETRY
+    networkUdpPoll(report);
+#endif
+
+    while (_ringHasRoom(&_done) && _ringPop(&_live, &result.data)) {
+#if MQTT_TRANSPORT
+        if (networkMqttPublish(&result.data)) continue;
+        result.sent = false;        // Window full or no broker: queue it
+#elif UDP_TELEMETRY
+        if (networkUdpSend(&result.data)) continue;
+        result.sent = false;        // Window full or offline: queue it
+#else
+        size_t len = wireEncodePayload(&result.data, _payload, sizeof(_payload));
+        result.sent = networkSendData(_payload, len);
+#endif
+        _ringPush(&_done, &result);
+        esp_task_wdt_reset();
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: fold a queue window that went through as a whole into
+// the throughput estimate: a slower window is taken as is (the next one
+// must not overrun the budget), a faster one moves it up by a quarter of
+// the difference. A window cut short by a failure says more about the
+// failure than about the link.
+// ---------------------------------------------------------------------------
+static void _measureRate(unsigned long start) {
+    if (_bulkAccepted != _bulkPartCount) return;
+
+    uint32_t bytes = 0;
+    for (int i = 0; i < _bulkPartCount; i++) {
+        bytes += _bulkParts[i].len;
+    }
+    unsigned long elapsed = millis() - start;
+    uint32_t rate = (uint32_t)((uint64_t)bytes * 1000 / (elapsed > 0 ? elapsed : 1));
+    uint32_t old = _bulkRate.load(std::memory_order_relaxed);
+    if (rate > old) rate = (uint32_t)((3 * (uint64_t)old + rate) / 4);
+    _bulkRate.store(std::max<uint32_t>(1, rate), std::memory_order_relaxed);
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: run the pending bulk job
+// ---------------------------------------------------------------------------
+static void _runBulk() {
+    unsigned long start = millis();
+    switch (_bulkKind) {
+        case BULK_UPLOAD:
+            _bulkAccepted = networkSendUpload(_bulkParts, _bulkPartCount, _bulkBlocks);
+            _measureRate(start);
+            break;
+        case BULK_BACKFILL:
+            _bulkAccepted = networkSendBackfillBlock(_bulkBlock, _bulkLen) ? 1 : 0;
+            break;
+        default: {
+            UploadPart part = { _bulkBlock, _bulkLen, 1, nullptr };
+            _bulkAccepted = networkSendUpload(&part, 1, true);
+            break;
+        }
+    }
+    _bulkState.store(BULK_DONE, std::memory_order_release);
+}
+
+static void _senderTask(void*) {
+    esp_task_wdt_add(nullptr);
+
+    for (;;) {
+        esp_task_wdt_reset();
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(IDLE_WAIT_MS));
+
+        _sendLive();
+        if (_bulkState.load(std::memory_order_acquire) == BULK_PENDING) {
+            _runBulk();
+            _sendLive();        // Fixes that arrived during a long upload
+        }
+    }
+}
+
+static void _wake() {
+    if (_task) xTaskNotifyGive(_task);
+}
+
+// ============================================================================
+// PUBLIC API
+// ============================================================================
+
+bool senderInit() {
+    BaseType_t ok = xTaskCreatePinnedToCore(_senderTask, "sender", SENDER_TASK_STACK,
+                                            nullptr, SENDER_TASK_PRIORITY, &_task,
+                                            SENDER_TASK_CORE);
+    if (ok != pdPASS) {
+        _task = nullptr;
+        Serial.println(F("[SENDER] ERROR: could not start the sender task"));
+        return false;
+    }
+
+    Serial.print(F("[SENDER] Sender task running on core "));
+    Serial.println(SENDER_TASK_CORE);
+    return true;
+}
+
+bool senderSubmit(const TelemetryData* data) {
+    if (_task && _liveSeqCount < LIVE_OUTSTANDING && _ringPush(&_live, data)) {
+        _liveSeqs[_liveSeqCount++] = data->seq;
+        _wake();
+        return true;
+    }
+
+    Serial.println(F("[SENDER] Send queue full — queuing fix offline"));
+    storageEnqueue(data);
+    return false;
+}
+
+int senderPollLive(std::function<void(const TelemetryData*, bool)> doneFunc) {
+    int count = 0;
+    LiveResult result;
+    while (_ringPop(&_done, &result)) {
+        for (int i = 0; i < _liveSeqCount; i++) {
+            if (_liveSeqs[i] == result.data.seq) {
+                _liveSeqs[i] = _liveSeqs[--_liveSeqCount];
+                break;
+            }
+        }
+        doneFunc(&result.data, result.sent);
+        count++;
+    }
+    if (count > 0) _wake();     // Room to report more: resume a stalled ring
+    return count;
+}
+
+uint32_t senderOldestSeq() {
+    uint32_t oldest = 0;
+    for (int i = 0; i < _liveSeqCount; i++) {
+        if (oldest == 0 || _liveSeqs[i] < oldest) oldest = _liveSeqs[i];
+    }
+    return oldest;
+}
+
+bool senderBulkBusy() {
+    return _bulkState.load(std::memory_order_acquire) != BULK_IDLE;
+}
+
+bool senderPostBlock(const uint8_t* block, size_t len, bool backfill) {
+    if (!_task || senderBulkBusy() || len > sizeof(_bulkBlock)) return false;
+
+    memcpy(_bulkBlock, block, len);
+    _bulkKind = backfill ? BULK_BACKFILL : BULK_BLOCK;
+    _bulkLen = len;
+    _bulkState.store(BULK_PENDING, std::memory_order_release);
+    _wake();
+    return true;
+}
+
+bool senderPostUpload(const UploadPart* parts, int count, bool blocks) {
+    if (!_task || senderBulkBusy() || count < 1 || count > QUEUE_PIPELINE_DEPTH) return false;
+
+    memcpy(_bulkParts, parts, count * sizeof(UploadPart));
+    _bulkKind = BULK_UPLOAD;
+    _bulkPartCount = count;
+    _bulkBlocks = blocks;
+    _bulkState.store(BULK_PENDING, std::memory_order_release);
+    _wake();
+    return true;
+}
+
+uint32_t senderGetBulkRate() {
+    return _bulkRate.load(std::memory_order_relaxed);
+}
+
+bool senderPollBulk(int* accepted) {
+    if (_bulkState.load(std::memory_order_acquire) != BULK_DONE) return false;
+
+    *accepted = _bulkAccepted;
+    _bulkState.store(BULK_IDLE, std::memory_order_release);
+    return true;
+}
@@ -0,0 +1,93 @@
+/**
+ * ============================================================================
+ * SAWARI Bus Telemetry Device - Sender Task Header
+ * ============================================================================
+ * Runs every upload in a FreeRTOS task pinned to SENDER_TASK_CORE, so the
+ * main loop only hands work over and never waits on the network.
+ *
+ * Live fixes go through a bounded lock-free ring (main loop → task) and
+ * come back through a second ring with their outcome (task → main loop).
+ * Offline queue and backfill uploads are one "bulk" job at a time (a
+ * window of pipelined requests for the queue): the main loop reads the
+ * data from flash, the task posts it, and the main loop consumes what has
+ * been accepted from flash. Storage is only ever touched by the main loop.
+ * ============================================================================
+ */
+
+#ifndef SENDER_HANDLER_H
+#define SENDER_HANDLER_H
+
+#include <Arduino.h>
+#include <functional>
+#include "gps_handler.h"
+#include "network_handler.h"
+
+/**
+ * Start the sender task. Call from setup() after the watchdog is set up;
+ * the task registers itself with it.
+ * @return true if the task is running
+ */
+bool senderInit();
+
+/**
+ * Hand a live fix to the sender task. Never blocks: if SENDER_QUEUE_DEPTH
+ * fixes are already waiting, this one is put in the offline queue
+ * (storageEnqueue) instead.
+ * @param data  pointer to the telemetry sample to send (copied)
+ * @return true if the fix was handed to the task
+ */
+bool senderSubmit(const TelemetryData* data);
+
+/**
+ * Collect the outcome of live fixes the task has finished with.
+ * Call every loop pass.
+ * @param doneFunc  called with (fix, true if the server accepted it)
+ * @return number of outcomes collected
+ */
+int senderPollLive(std::function<void(const TelemetryData*, bool)> doneFunc);
+
+/**
+ * Lowest seq of the live fixes handed to the task whose outcome has not
+ * been collected yet (0 = none).
+ */
+uint32_t senderOldestSeq();
+
+/**
+ * Check whether a bulk job is in flight (posted and not yet collected
+ * with senderPollBulk()). Only one bulk job runs at a time.
+ */
+bool senderBulkBusy();
+
+/**
+ * Post one track block as the bulk job (networkSendUpload, or
+ * networkSendBackfillBlock if `backfill`). The block is copied.
+ * @return false if a bulk job is already in flight or the block is too big
+ */
+bool senderPostBlock(const uint8_t* block, size_t len, bool backfill);
+
+/**
+ * Post a window of queue uploads (networkSendUpload) as the bulk job.
+ * The parts are copied; their bodies and results arrays are used in
+ * place: leave them alone until the job has been collected.
+ * @param count  1..QUEUE_PIPELINE_DEPTH parts
+ * @return false if a bulk job is already in flight
+ */
+bool senderPostUpload(const UploadPart* parts, int count, bool blocks);
+
+/**
+ * Backlog upload throughput measured on the queue windows that went
+ * through as a whole: follows a slowdown at once, a speedup gradually
+ * (QUEUE_FLUSH_RATE_INIT until the first window).
+ * @return bytes per second
+ */
+uint32_t senderGetBulkRate();
+
+/**
+ * Collect the bulk job once the task has finished it.
+ * @param accepted  receives the number of leading parts the server
+ *                  accepted (a single block: 1 or 0)
+ * @return true if a job was collected (the slot is free again)
+ */
+bool senderPollBulk(int* accepted);
+
+#endif // SENDER_HANDLER_H
@@ -0,0 +1,26 @@
+/**
+ * ============================================================================
+ * SAWARI Bus Telemetry Device - Pinned Server Certificate
+ * ============================================================================
+ * Trust anchor for HTTPS (HTTP_TLS in config.h): the API server's own
+ * certificate, or the CA certificate that issued it, in PEM form. The
+ * server's chain must end here; no other root is trusted.
+ *
+ * Get it from the server with, for example:
+ *   openssl s_client -connect zenithkandel.com.np:443 -showcerts </dev/null
+ * and paste the last certificate of the chain (the issuing CA) below, or
+ * the first one to pin the server certificate itself (then replace it
+ * here before the server's certificate is renewed).
+ * ============================================================================
+ */
+
+#ifndef SERVER_CERT_H
+#define SERVER_CERT_H
+
+static const char SERVER_CERT_PEM[] = R"PEM(
+-----BEGIN CERTIFICATE-----
+Paste the pinned certificate here.
+-----END CERTIFICATE-----
+)PEM";
+
+#endif // SERVER_CERT_H
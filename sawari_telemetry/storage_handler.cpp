@@ -2,107 +2,1199 @@
  * ============================================================================
  * SAWARI Bus Telemetry Device - Storage Handler Implementation
  * ============================================================================
- * 
- * Implements a FIFO offline data queue on LittleFS using a JSONL file format
- * (one JSON record per line). This provides store-and-forward capability
- * for when WiFi connectivity is lost.
- * 
- * Queue Management Strategy:
- *   - Records are appended as newline-delimited JSON lines to /queue.jsonl
- *   - Queue count is tracked in RAM and synced from file on boot
- *   - When the queue exceeds MAX_QUEUE_SIZE (500), the oldest records
- *     are discarded by rewriting the file with only the newest entries
- *   - On flush, each record is sent via callback; failures are retained
- * 
+ *
+ * Implements a FIFO offline data queue on LittleFS using compressed track
+ * blocks (see track_codec.h). This provides store-and-forward capability
+ * for when WiFi connectivity is lost. JSON is only generated at send time.
+ *
+ * Queue Management Strategy (segmented ring of track blocks):
+ *   - New samples collect in a small RAM write-back buffer and are
+ *     committed to a staging file (/queue/open.rec) as fixed-width
+ *     32-byte CRC-checked records, one append per QUEUE_WRITEBACK_RECORDS
+ *     samples or QUEUE_WRITEBACK_MS, whichever comes first
+ *   - Every TRACK_BLOCK_SAMPLES samples the staging file is sealed into a
+ *     keyframe + varint-delta block and appended to the tail segment
+ *   - Segments are files in /queue/ named by a monotonically increasing
+ *     sequence number (e.g. /queue/00000042.trk), each a sequence of
+ *     frames up to QUEUE_SEGMENT_BYTES in size. A frame is a 2-byte
+ *     length (top bit = CRC present), the block and its CRC32
+ *   - When QUEUE_SEGMENT_COUNT segments exist and another is needed, a
+ *     slot is freed per QUEUE_EVICT_POLICY: the oldest pair of neighbouring
+ *     segments with room is merged into one thinned segment (Douglas-Peucker
+ *     or decimation), keeping the whole trip at lower resolution. If
+ *     nothing can be thinned — or with QUEUE_EVICT_DROP — the oldest
+ *     (head) segment file is deleted
+ *   - Flush streams from a persisted read cursor (segment, block offset,
+ *     sample index) and sends a bounded batch per call, either as whole
+ *     blocks or decoded records. Acknowledged data is committed by
+ *     advancing the cursor; fully consumed segments are deleted. Nothing
+ *     is ever rewritten, and flush RAM is one block regardless of depth
+ *   - Newest-first block flushes (QUEUE_FLUSH_ORDER) read the last frames
+ *     of the tail segment instead and cut them off once acknowledged
+ *     (copy + rename); an emptied tail segment is deleted
+ *   - Head/tail sequence numbers, the cursor and per-segment counts are
+ *     kept in a CRC-checked metadata file (/queue/meta.dat), so boot
+ *     mounts the queue in constant time. The segment files are only
+ *     walked when the metadata is missing, corrupt or stale
+ *   - Crash recovery only touches the tail: boot verifies the frames
+ *     written after the last metadata commit and cuts a torn frame or
+ *     record off the end (copy + rename, never an in-place rewrite).
+ *     A frame that fails its CRC later is skipped at flush time
+ *   - The v2.0.0 single-file queue (/queue.jsonl) is converted on boot
+ *   - Every fix carries a per-device sequence number (storageNextSeq) so
+ *     the server can drop a sample it already has; the counter survives
+ *     reboots (SEQ_FILE)
+ *
  * LittleFS is chosen over SPIFFS because:
  *   - LittleFS is actively maintained (SPIFFS is deprecated on ESP32)
  *   - LittleFS has journaling for power-loss safety (important in vehicles)
  *   - LittleFS supports directories and has better wear leveling
- * 
+ *
  * Storage Considerations:
- *   - Each JSON record is approximately 200 bytes
- *   - 500 records ≈ 100KB, well within ESP32 LittleFS partition capacity
+ *   - A moving bus costs ~7 bytes per sample, a parked bus ~1 byte
+ *     (vs 32 bytes fixed-width and ~200 bytes as JSON)
+ *   - 96 segments x 4KB ≈ 384KB, tens of thousands of samples
  *   - ESP32 default LittleFS partition is typically 1.5MB
  * ============================================================================
  */
 
 #include "storage_handler.h"
 #include "config.h"
+#include "track_codec.h"
 #include <LittleFS.h>
+#include <algorithm>
+#include <stddef.h>
 
-// --- In-memory record count for fast access ---
-static int _queueCount = 0;
+// ---------------------------------------------------------------------------
+// Fixed-width record used in the staging file
+// ---------------------------------------------------------------------------
+struct __attribute__((packed)) QueueRecord {
+    uint8_t    version;     // QUEUE_RECORD_VERSION
+    TrackPoint point;
+    uint32_t   crc;         // CRC32 of version + point
+};
+static_assert(sizeof(QueueRecord) == 32, "QueueRecord must be 32 bytes");
+
+// --- In-memory queue state (mounted from the metadata on boot) ---
+static int      _queueCount   = 0;      // Total samples (segments + staging)
+static int      _openCount    = 0;      // Samples in the staging file
+static size_t   _tailBytes    = 0;      // Size of the newest segment file
+static uint32_t _lastSeg      = 0;      // Highest segment sequence number used
+static uint32_t _rewrites     = 0;      // Bumped when segment files are rewritten
+static uint32_t _headEpoch    = 0;      // Bumped when unsent data moves or goes
+                                        // other than by a flush (storageGetReadMark)
+static uint32_t _tailEpoch    = 0;      // Bumped when a frame is appended or cut
+                                        // off the tail (storageGetTailMark)
+static uint32_t _lowSeq       = 0;      // No queued sample has a lower seq
+                                        // (0 = unknown: queued before this boot)
+
+// --- Sequence numbers (see storageNextSeq) ---
+#define SEQ_MAGIC           0x51535753UL    // "SWSQ"
+
+struct __attribute__((packed)) SeqState {
+    uint32_t magic;
+    uint32_t reserved;      // Numbers below this may have been handed out
+    uint32_t crc;           // CRC32 of magic + reserved
+};
+
+static uint32_t _seqNext     = 1;       // Next number to hand out
+static uint32_t _seqReserved = 0;       // End of the block recorded in SEQ_FILE
+
+// ---------------------------------------------------------------------------
+// Live segments, oldest first. Sequence numbers always increase but need
+// not be contiguous: thinning merges two neighbours into one file.
+// ---------------------------------------------------------------------------
+#define SEG_THINNED     0x01    // Holds a thinned (simplified) track
+#define SEG_FULL        0x02    // Too full to absorb a neighbour when thinning
+
+struct __attribute__((packed)) QueueSegment {
+    uint32_t seq;           // File name (see _segmentPath)
+    uint16_t samples;       // Unsent samples in the file
+    uint8_t  flags;         // SEG_*
+    uint8_t  reserved;
+};
+
+static QueueSegment _segs[QUEUE_SEGMENT_COUNT];
+static int          _segTotal = 0;
+
+// RAM write-back buffer: samples not yet committed to the staging file
+static_assert(QUEUE_WRITEBACK_RECORDS >= 1, "QUEUE_WRITEBACK_RECORDS must be >= 1");
+static QueueRecord   _ramRecords[QUEUE_WRITEBACK_RECORDS];
+static int           _ramCount = 0;
+static unsigned long _ramSince = 0;     // millis() when the oldest was buffered
+
+// Scratch buffers for one block (kept off the loop task's stack)
+static uint8_t  _blockBuf[TRACK_BLOCK_MAX_BYTES];   // Encoding
+static uint8_t  _frameBuf[TRACK_BLOCK_MAX_BYTES];   // Reading during flush
+
+// ---------------------------------------------------------------------------
+// Read cursor: position of the oldest unsent sample, so a reboot resumes
+// where the last flush stopped.
+// ---------------------------------------------------------------------------
+struct __attribute__((packed)) QueueCursor {
+    uint32_t segment;       // Head segment the cursor points into
+    uint32_t offset;        // Byte offset of the current block's length prefix
+    uint16_t index;         // Samples of the current block already sent
+    uint16_t openSkip;      // Records at the start of the staging file already sent
+};
+
+static QueueCursor _cursor = { 0, 0, 0, 0 };
+
+// ---------------------------------------------------------------------------
+// Queue metadata ("superblock"): everything needed to mount the queue
+// without reading it. Saved to QUEUE_META_FILE whenever segment state
+// changes; the staging file's share is derived from its size on mount.
+// ---------------------------------------------------------------------------
+#define QUEUE_META_MAGIC    0x4D515753UL    // "SWQM"
+#define QUEUE_META_VERSION  3
+
+struct __attribute__((packed)) QueueMeta {
+    uint32_t     magic;
+    uint8_t      version;
+    uint8_t      reserved;
+    uint16_t     segmentCount;      // QUEUE_SEGMENT_COUNT it was written with
+    uint32_t     generation;        // Incremented on every save
+    uint32_t     lastSeg;
+    uint32_t     tailBytes;
+    uint16_t     segTotal;          // Live entries in segs[]
+    QueueCursor  cursor;
+    QueueSegment segs[QUEUE_SEGMENT_COUNT];
+    uint32_t     crc;               // CRC32 of all preceding bytes
+};
+
+static uint32_t _metaGeneration = 0;
+static bool     _metaDirty      = false;
+
+// ---------------------------------------------------------------------------
+// Internal helper: build the file path of a segment from its sequence number
+// ---------------------------------------------------------------------------
+static void _segmentPath(uint32_t seq, char* buf, size_t len) {
+    snprintf(buf, len, "%s/%08lu.trk", QUEUE_DIR, (unsigned long)seq);
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: persist the queue metadata if it changed.
+// Written to a temp file and renamed over the old copy, so a power cut
+// leaves either the previous or the new metadata, never a torn one.
+// ---------------------------------------------------------------------------
+static void _saveMeta() {
+    if (!_metaDirty) return;
+
+    QueueMeta meta;
+    memset(&meta, 0, sizeof(meta));
+    meta.magic        = QUEUE_META_MAGIC;
+    meta.version      = QUEUE_META_VERSION;
+    meta.segmentCount = QUEUE_SEGMENT_COUNT;
+    meta.generation   = ++_metaGeneration;
+    meta.lastSeg      = _lastSeg;
+    meta.tailBytes    = _tailBytes;
+    meta.segTotal     = _segTotal;
+    meta.cursor       = _cursor;
+    memcpy(meta.segs, _segs, _segTotal * sizeof(QueueSegment));
+    meta.crc = trackCrc32((const uint8_t*)&meta, offsetof(QueueMeta, crc));
+
+    File f = LittleFS.open(QUEUE_META_TMP_FILE, "w");
+    if (!f) {
+        Serial.println(F("[STORAGE] ERROR: Failed to write queue metadata"));
+        return;
+    }
+    size_t written = f.write((const uint8_t*)&meta, sizeof(meta));
+    f.close();
+
+    if (written == sizeof(meta) && LittleFS.rename(QUEUE_META_TMP_FILE, QUEUE_META_FILE)) {
+        _metaDirty = false;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: check a file's existence and size with one open
+// ---------------------------------------------------------------------------
+static bool _fileSize(const char* path, size_t* size) {
+    File f = LittleFS.open(path, "r");
+    if (!f) return false;
+    *size = f.size();
+    f.close();
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: cut a file down to its first `len` bytes. The kept part
+// is copied to a new file that is then renamed over the original, so a
+// power cut leaves either the old or the new file, never a partial one.
+// ---------------------------------------------------------------------------
+static bool _truncateFile(const char* path, size_t len) {
+    File src = LittleFS.open(path, "r");
+    if (!src) return false;
+    File dst = LittleFS.open(QUEUE_REPAIR_TMP_FILE, "w");
+    if (!dst) {
+        src.close();
+        return false;
+    }
+
+    size_t copied = 0;
+    while (copied < len) {
+        size_t chunk = std::min(len - copied, sizeof(_frameBuf));
+        if (src.read(_frameBuf, chunk) != chunk || dst.write(_frameBuf, chunk) != chunk) break;
+        copied += chunk;
+    }
+    src.close();
+    dst.close();
+
+    if (copied != len || !LittleFS.rename(QUEUE_REPAIR_TMP_FILE, path)) {
+        LittleFS.remove(QUEUE_REPAIR_TMP_FILE);
+        return false;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Segment frames: [u16 length | FRAME_CRC][block][u32 CRC32 of block, LE].
+// A prefix without FRAME_CRC is not a frame: the rest of the file is
+// treated as torn.
+// ---------------------------------------------------------------------------
+#define FRAME_CRC           0x8000
+#define FRAME_LEN_MASK      0x7FFF
+#define FRAME_OVERHEAD      6       // Length prefix + CRC trailer
+
+enum FrameStatus {
+    FRAME_OK,           // Block is in _frameBuf
+    FRAME_CORRUPT,      // Whole frame present but fails its CRC: skip it
+    FRAME_END           // End of file, or a torn / garbage frame
+};
+
+static size_t _writeFrame(File& f, const uint8_t* block, size_t len) {
+    uint16_t prefix = len | FRAME_CRC;
+    uint32_t crc = trackCrc32(block, len);
+    uint8_t header[2]  = { (uint8_t)(prefix & 0xFF), (uint8_t)(prefix >> 8) };
+    uint8_t trailer[4] = { (uint8_t)crc, (uint8_t)(crc >> 8),
+                           (uint8_t)(crc >> 16), (uint8_t)(crc >> 24) };
+
+    size_t written = f.write(header, sizeof(header));
+    written += f.write(block, len);
+    written += f.write(trailer, sizeof(trailer));
+    return written;
+}
+
+// Read the frame at `pos` into _frameBuf. Sets the block length and the
+// number of bytes the whole frame occupies.
+static FrameStatus _readFrame(File& f, size_t pos, size_t size,
+                              size_t* len, size_t* frameBytes) {
+    uint8_t header[2];
+    if (pos + sizeof(header) > size || !f.seek(pos) ||
+        f.read(header, sizeof(header)) != sizeof(header)) {
+        return FRAME_END;
+    }
+
+    uint16_t prefix = header[0] | (header[1] << 8);
+    *len = prefix & FRAME_LEN_MASK;
+    *frameBytes = sizeof(header) + *len + 4;
+    if (!(prefix & FRAME_CRC) || *len > sizeof(_frameBuf) || pos + *frameBytes > size ||
+        f.read(_frameBuf, *len) != *len) {
+        return FRAME_END;
+    }
+
+    uint8_t t[4];
+    if (f.read(t, sizeof(t)) != sizeof(t)) return FRAME_END;
+    uint32_t crc = t[0] | (t[1] << 8) | ((uint32_t)t[2] << 16) | ((uint32_t)t[3] << 24);
+    if (crc != trackCrc32(_frameBuf, *len)) return FRAME_CORRUPT;
+    return FRAME_OK;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helpers: staging record CRC
+// ---------------------------------------------------------------------------
+static void _sealRecord(QueueRecord* rec) {
+    rec->crc = trackCrc32((const uint8_t*)rec, offsetof(QueueRecord, crc));
+}
+
+static bool _recordValid(const QueueRecord* rec) {
+    return rec->version == QUEUE_RECORD_VERSION &&
+           rec->crc == trackCrc32((const uint8_t*)rec, offsetof(QueueRecord, crc));
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: forget entry `i` of the segment table (file already
+// handled by the caller). Removing the head moves the cursor to the start
+// of the next segment.
+// ---------------------------------------------------------------------------
+static void _removeSegment(int i) {
+    _segTotal--;
+    memmove(&_segs[i], &_segs[i + 1], (_segTotal - i) * sizeof(QueueSegment));
+
+    if (i == 0) {
+        _cursor.segment = (_segTotal > 0) ? _segs[0].seq : 0;
+        _cursor.offset = 0;
+        _cursor.index = 0;
+    }
+    if (_segTotal == 0) {
+        _tailBytes = 0;
+    }
+    _metaDirty = true;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: delete the oldest segment (FIFO eviction).
+// ---------------------------------------------------------------------------
+static void _dropHeadSegment() {
+    char path[32];
+    _segmentPath(_segs[0].seq, path, sizeof(path));
+
+    int dropped = _segs[0].samples;
+    LittleFS.remove(path);
+    _queueCount -= dropped;
+    _removeSegment(0);
+    _headEpoch++;
+
+    Serial.print(F("[STORAGE] Queue full: discarded oldest segment ("));
+    Serial.print(dropped);
+    Serial.println(F(" records)"));
+}
+
+#if QUEUE_EVICT_POLICY != QUEUE_EVICT_DROP
+// ---------------------------------------------------------------------------
+// Eviction by thinning: two neighbouring segments are merged into one file
+// holding a simplified track, so a full queue keeps its whole time span
+// at lower resolution instead of losing its oldest hours.
+// ---------------------------------------------------------------------------
+static TrackPoint _thinWindow[QUEUE_THIN_WINDOW];
+static bool       _thinKeep[QUEUE_THIN_WINDOW];    // Preset: already thinned
+static uint8_t    _thinBuf[TRACK_BLOCK_MAX_BYTES];
+
+// Output of a merge: kept samples re-encoded into blocks. With no file
+// open this only measures, so a merge that won't fit writes nothing.
+struct ThinWriter {
+    File         file;
+    bool         dryRun;
+    TrackEncoder enc;
+    size_t       bytes;         // Segment bytes produced so far
+    int          samples;       // Samples produced so far
+    bool         ok;            // false once the output overflowed or failed
+};
+
+static void _thinWriteBlock(ThinWriter* w) {
+    if (!w->ok || w->enc.count == 0) return;
+
+    size_t len = w->enc.len;
+    if (w->bytes + FRAME_OVERHEAD + len > QUEUE_SEGMENT_BYTES) {
+        w->ok = false;
+        return;
+    }
+    if (!w->dryRun && _writeFrame(w->file, _thinBuf, len) != FRAME_OVERHEAD + len) {
+        w->ok = false;
+        return;
+    }
+    w->bytes += FRAME_OVERHEAD + len;
+    w->samples += w->enc.count;
+    trackEncoderBegin(&w->enc, _thinBuf);
+}
+
+static void _thinEmit(ThinWriter* w, const TrackPoint* point) {
+    if (!trackEncoderAdd(&w->enc, point)) {
+        _thinWriteBlock(w);
+        trackEncoderAdd(&w->enc, point);
+    }
+}
+
+// Thin the window and emit its kept samples. Unless this is the end of the
+// input, the last sample is held back as the first of the next window, so
+// consecutive windows share an endpoint and the error bound holds across.
+static void _thinFlushWindow(ThinWriter* w, int* fill, bool last) {
+    int n = *fill;
+    if (n == 0) return;
+
+#if QUEUE_EVICT_POLICY == QUEUE_EVICT_DOUGLAS_PEUCKER
+    trackSimplify(_thinWindow, n, QUEUE_THIN_TOLERANCE_M, _thinKeep);
+#else
+    for (int k = 0; k < n; k++) {
+        _thinKeep[k] = _thinKeep[k] || (k % QUEUE_THIN_DECIMATE) == 0 || k == n - 1;
+    }
+#endif
+
+    int end = last ? n : n - 1;
+    for (int k = 0; k < end; k++) {
+        if (_thinKeep[k]) _thinEmit(w, &_thinWindow[k]);
+    }
+
+    if (last) {
+        *fill = 0;
+    } else {
+        _thinWindow[0] = _thinWindow[n - 1];
+        _thinKeep[0] = true;
+        *fill = 1;
+    }
+}
+
+// Feed the unsent samples of segment entry `i` through the window.
+// Samples of an already thinned segment are passed through unchanged:
+// thinning them again would stack a second error on top of the first.
+static void _thinReadSegment(int i, ThinWriter* w, int* fill) {
+    bool fixed = (_segs[i].flags & SEG_THINNED) != 0;
+
+    char path[32];
+    _segmentPath(_segs[i].seq, path, sizeof(path));
+    File f = LittleFS.open(path, "r");
+    if (!f) return;
+
+    size_t size = f.size();
+    size_t pos = (i == 0) ? _cursor.offset : 0;
+    int skip = (i == 0) ? _cursor.index : 0;
+    size_t len, frameBytes;
+
+    while (w->ok) {
+        FrameStatus status = _readFrame(f, pos, size, &len, &frameBytes);
+        if (status == FRAME_END) break;
+        pos += frameBytes;
+
+        TrackDecoder dec;
+        TrackPoint point;
+        if (status != FRAME_OK || !trackDecoderBegin(&dec, _frameBuf, len)) continue;
+        while (trackDecoderNext(&dec, &point)) {
+            if (skip > 0) {
+                skip--;
+                continue;
+            }
+            _thinKeep[*fill] = fixed;
+            _thinWindow[(*fill)++] = point;
+            if (*fill == QUEUE_THIN_WINDOW) {
+                _thinFlushWindow(w, fill, false);
+            }
+        }
+    }
+    f.close();
+}
+
+// Run entries i and i+1 through the thinning filter into one output
+static void _thinRun(int i, ThinWriter* w) {
+    w->bytes = 0;
+    w->samples = 0;
+    w->ok = true;
+    trackEncoderBegin(&w->enc, _thinBuf);
+
+    int fill = 0;
+    _thinReadSegment(i, w, &fill);
+    _thinReadSegment(i + 1, w, &fill);
+    _thinFlushWindow(w, &fill, true);
+    _thinWriteBlock(w);
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: merge segment entries i and i+1 into one thinned file.
+// The result is written to a temp file and renamed over the newer segment
+// before the older one is deleted, so a power cut never loses samples.
+// @return false if the thinned pair does not fit in one segment
+// ---------------------------------------------------------------------------
+static bool _thinPair(int i) {
+    ThinWriter w;
+    w.dryRun = true;
+    _thinRun(i, &w);
+    if (!w.ok) return false;
+
+    w.dryRun = false;
+    w.file = LittleFS.open(QUEUE_THIN_TMP_FILE, "w");
+    if (!w.file) return false;
+    _thinRun(i, &w);
+    w.file.close();
+
+    char path[32];
+    _segmentPath(_segs[i + 1].seq, path, sizeof(path));
+    if (!w.ok || !LittleFS.rename(QUEUE_THIN_TMP_FILE, path)) {
+        LittleFS.remove(QUEUE_THIN_TMP_FILE);
+        return false;
+    }
+    _segmentPath(_segs[i].seq, path, sizeof(path));
+    LittleFS.remove(path);
+
+    int before = _segs[i].samples + _segs[i + 1].samples;
+    _queueCount -= before - w.samples;
+    _segs[i + 1].samples = w.samples;
+    _segs[i + 1].flags = SEG_THINNED;
+    _removeSegment(i);
+    _rewrites++;
+    _headEpoch++;
+    _saveMeta();
+
+    Serial.print(F("[STORAGE] Queue full: thinned 2 segments ("));
+    Serial.print(before);
+    Serial.print(F(" -> "));
+    Serial.print(w.samples);
+    Serial.println(F(" records)"));
+    return true;
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// Internal helper: free a segment slot by thinning the oldest pair of
+// neighbours that still has room (never the tail, which is being filled).
+// @return false if nothing could be thinned; the caller drops the head
+// ---------------------------------------------------------------------------
+static bool _thinSegments() {
+#if QUEUE_EVICT_POLICY != QUEUE_EVICT_DROP
+    int tries = 0;
+    for (int i = 0; i + 2 < _segTotal && tries < QUEUE_THIN_MAX_TRIES; i++) {
+        if ((_segs[i].flags & SEG_FULL) || (_segs[i + 1].flags & SEG_FULL)) continue;
+        tries++;
+        if (_thinPair(i)) return true;
+
+        // Doesn't fit: skip this one from now on
+        _segs[i].flags |= SEG_FULL;
+        _metaDirty = true;
+    }
+#endif
+    return false;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: start a new tail segment, evicting the head if needed.
+// ---------------------------------------------------------------------------
+static void _startSegment() {
+    if (_segTotal >= QUEUE_SEGMENT_COUNT && !_thinSegments()) {
+        _dropHeadSegment();
+    }
+
+    QueueSegment& seg = _segs[_segTotal++];
+    seg.seq = ++_lastSeg;
+    seg.samples = 0;
+    seg.flags = 0;
+    seg.reserved = 0;
+
+    if (_segTotal == 1) {
+        // A fresh queue is read from the start of its first segment
+        _cursor.segment = seg.seq;
+        _cursor.offset = 0;
+        _cursor.index = 0;
+    }
+    _tailBytes = 0;
+    _metaDirty = true;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: append one length-prefixed block to the tail segment.
+// ---------------------------------------------------------------------------
+static bool _appendFrame(const uint8_t* block, size_t len, int samples) {
+    if (_segTotal == 0 ||
+        (_tailBytes > 0 && _tailBytes + FRAME_OVERHEAD + len > QUEUE_SEGMENT_BYTES)) {
+        _startSegment();
+    }
+
+    QueueSegment& tail = _segs[_segTotal - 1];
+    char path[32];
+    _segmentPath(tail.seq, path, sizeof(path));
+
+    File f = LittleFS.open(path, "a");
+    if (!f) {
+        Serial.println(F("[STORAGE] ERROR: Failed to open queue segment for append"));
+        return false;
+    }
+
+    size_t written = _writeFrame(f, block, len);
+    f.close();
+    if (written != FRAME_OVERHEAD + len) {
+        // Cut the torn frame off again so later appends stay readable
+        _truncateFile(path, _tailBytes);
+        Serial.println(F("[STORAGE] ERROR: Short write to queue segment"));
+        return false;
+    }
+
+    _tailBytes += written;
+    tail.samples += samples;
+    _tailEpoch++;
+    _metaDirty = true;
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: encode the staging file into one block and append it
+// to the tail segment. The staging file is removed afterwards.
+// ---------------------------------------------------------------------------
+static void _sealOpenBlock() {
+    if (_openCount == 0) return;
+
+    TrackEncoder enc;
+    trackEncoderBegin(&enc, _blockBuf);
+
+    // Records before openSkip were already sent from the staging file
+    File f = LittleFS.open(QUEUE_OPEN_FILE, "r");
+    if (f) {
+        QueueRecord rec;
+        f.seek(_cursor.openSkip * sizeof(QueueRecord));
+        while (f.read((uint8_t*)&rec, sizeof(rec)) == sizeof(rec)) {
+            if (_recordValid(&rec)) {
+                trackEncoderAdd(&enc, &rec.point);
+            }
+        }
+        f.close();
+    }
+
+    // Staged samples that were unreadable are simply gone
+    int pending = _openCount - _cursor.openSkip;
+    _queueCount -= pending - enc.count;
+
+    if (enc.count == 0 || _appendFrame(_blockBuf, enc.len, enc.count)) {
+        LittleFS.remove(QUEUE_OPEN_FILE);
+        _openCount = 0;
+        if (_cursor.openSkip > 0) {
+            // The skip applied to the old staging file only
+            _cursor.openSkip = 0;
+            _metaDirty = true;
+        }
+        _saveMeta();
+    } else {
+        // Keep the staged samples; sealing is retried on the next append
+        _queueCount += pending - enc.count;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: append records to the staging file in one write.
+// ---------------------------------------------------------------------------
+static bool _appendRecords(const QueueRecord* recs, int count) {
+    File f = LittleFS.open(QUEUE_OPEN_FILE, "a");
+    if (!f) {
+        Serial.println(F("[STORAGE] ERROR: Failed to open staging file for append"));
+        return false;
+    }
+
+    size_t bytes = count * sizeof(QueueRecord);
+    size_t written = f.write((const uint8_t*)recs, bytes);
+    f.close();
+    if (written != bytes) {
+        // Cut a torn record off so later appends stay aligned
+        _truncateFile(QUEUE_OPEN_FILE, _openCount * sizeof(QueueRecord));
+        Serial.println(F("[STORAGE] ERROR: Short write to staging file"));
+        return false;
+    }
+
+    _openCount += count;
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: commit the RAM write-back buffer to flash.
+// Uses one append per commit, split only where the staging file reaches
+// TRACK_BLOCK_SAMPLES and is sealed into a block.
+// @return true if the buffer is now empty
+// ---------------------------------------------------------------------------
+static bool _commitBuffer() {
+    if (_ramCount == 0) return true;
+
+    // Retry a seal that failed during an earlier commit
+    if (_openCount >= TRACK_BLOCK_SAMPLES) _sealOpenBlock();
+
+    int done = 0;
+    while (done < _ramCount) {
+        int room = TRACK_BLOCK_SAMPLES - _openCount;
+        if (room <= 0) break;
+        int n = std::min(room, _ramCount - done);
+        if (!_appendRecords(&_ramRecords[done], n)) break;
+        done += n;
+        if (_openCount >= TRACK_BLOCK_SAMPLES) _sealOpenBlock();
+    }
+
+    // Anything not written stays buffered for the next attempt
+    if (done > 0) {
+        _ramCount -= done;
+        memmove(_ramRecords, &_ramRecords[done], _ramCount * sizeof(QueueRecord));
+        _ramSince = millis();
+    }
+    return _ramCount == 0;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: add one sample to the RAM buffer (no logging), and
+// commit once QUEUE_WRITEBACK_RECORDS are buffered.
+// ---------------------------------------------------------------------------
+static bool _bufferPoint(const TrackPoint* point) {
+    if (_ramCount >= QUEUE_WRITEBACK_RECORDS && !_commitBuffer()) {
+        return false;   // Flash is refusing writes and the buffer is full
+    }
+
+    QueueRecord& rec = _ramRecords[_ramCount++];
+    rec.version = QUEUE_RECORD_VERSION;
+    rec.point = *point;
+    _sealRecord(&rec);
+    _queueCount++;
+    if (_ramCount == 1) _ramSince = millis();
+
+    if (_ramCount >= QUEUE_WRITEBACK_RECORDS) {
+        _commitBuffer();
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: count the samples in a segment from offset `start`,
+// checking every frame's CRC (frames that fail it are not counted).
+// @param end   set to the offset just past the last whole frame
+// @param size  set to the file size (end < size means a torn tail)
+// ---------------------------------------------------------------------------
+static int _scanSegment(const char* path, size_t start, size_t* end, size_t* size) {
+    *end = start;
+    *size = 0;
+    File f = LittleFS.open(path, "r");
+    if (!f) return 0;
+
+    *size = f.size();
+    size_t pos = start;
+    size_t len, frameBytes;
+    int samples = 0;
+    FrameStatus status;
+
+    while ((status = _readFrame(f, pos, *size, &len, &frameBytes)) != FRAME_END) {
+        if (status == FRAME_OK && len >= 2 && _frameBuf[0] == TRACK_BLOCK_VERSION) {
+            samples += _frameBuf[1];
+        }
+        pos += frameBytes;
+    }
+    f.close();
+
+    *end = pos;
+    return samples;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: drop a torn frame from the end of the tail segment
+// (power cut mid-append) so that later appends remain readable.
+// ---------------------------------------------------------------------------
+static void _repairTail(const char* path, size_t end, size_t size) {
+    if (end >= size) return;
+    Serial.print(F("[STORAGE] Dropping "));
+    Serial.print(size - end);
+    Serial.println(F(" torn bytes from queue tail"));
+    _truncateFile(path, end);
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: staging records are fixed-width, so a torn final record
+// shows up as a size that is not a whole number of records.
+// ---------------------------------------------------------------------------
+static void _mountStaging() {
+    size_t size = 0;
+    if (!_fileSize(QUEUE_OPEN_FILE, &size)) {
+        _openCount = 0;
+        _cursor.openSkip = 0;
+        return;
+    }
+
+    _openCount = size / sizeof(QueueRecord);
+    if (size % sizeof(QueueRecord) != 0) {
+        Serial.println(F("[STORAGE] Dropping torn record from staging file"));
+        _truncateFile(QUEUE_OPEN_FILE, _openCount * sizeof(QueueRecord));
+    }
+    if (_cursor.openSkip > _openCount) _cursor.openSkip = _openCount;
+    _queueCount += _openCount - _cursor.openSkip;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: rebuild queue state from the segment files on flash
+// (fallback when the metadata cannot be trusted)
+// ---------------------------------------------------------------------------
+static void _scanSegments() {
+    _queueCount = 0;
+    _openCount  = 0;
+    _tailBytes  = 0;
+    _segTotal   = 0;
+
+    File dir = LittleFS.open(QUEUE_DIR);
+    if (!dir || !dir.isDirectory()) return;
+
+    std::vector<uint32_t> seqs;
+    File entry = dir.openNextFile();
+    while (entry) {
+        const char* name = entry.name();
+        uint32_t seq = strtoul(name, nullptr, 10);
+        bool isTrack = strstr(name, ".trk") != nullptr;
+        entry.close();
+        if (seq > 0 && isTrack) {
+            seqs.push_back(seq);
+        }
+        entry = dir.openNextFile();
+    }
+    dir.close();
+    std::sort(seqs.begin(), seqs.end());
+
+    if (!seqs.empty()) {
+        char path[32];
+        size_t end = 0;
+        size_t size = 0;
+
+        // Keep at most QUEUE_SEGMENT_COUNT segments (newest win)
+        size_t first = 0;
+        while (seqs.size() - first > QUEUE_SEGMENT_COUNT) {
+            _segmentPath(seqs[first++], path, sizeof(path));
+            LittleFS.remove(path);
+        }
+
+        // A cursor into a segment that no longer exists is stale
+        if (_cursor.segment != seqs[first]) {
+            _cursor.segment = seqs[first];
+            _cursor.offset = 0;
+            _cursor.index = 0;
+        }
+
+        // Thinning flags are not recoverable from the files, so after a
+        // rebuild a thinned segment may be thinned once more
+        for (size_t i = first; i < seqs.size(); i++) {
+            _segmentPath(seqs[i], path, sizeof(path));
+            size_t start = (i == first) ? _cursor.offset : 0;
+            int samples = _scanSegment(path, start, &end, &size);
+            if (i == first) {
+                samples = std::max(0, samples - (int)_cursor.index);
+            }
+            QueueSegment& seg = _segs[_segTotal++];
+            seg.seq = seqs[i];
+            seg.samples = samples;
+            seg.flags = 0;
+            seg.reserved = 0;
+            _queueCount += samples;
+        }
+
+        _lastSeg = std::max(_lastSeg, seqs.back());
+        _repairTail(path, end, size);
+        _tailBytes = end;
+    } else {
+        _cursor.offset = 0;
+        _cursor.index = 0;
+    }
+
+    _mountStaging();
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: mount the queue from QUEUE_META_FILE.
+// The metadata is only trusted if its CRC is good. A power cut between a
+// file operation and the next metadata save is then repaired cheaply:
+// listed head segments that are gone are dropped, and segments appended
+// to since (the tail, plus any newer one) are re-scanned — never the rest
+// of the queue. Anything odder falls back to a full scan, from the cursor
+// loaded here.
+// @return true if the in-memory queue state was restored
+// ---------------------------------------------------------------------------
+static bool _loadMeta() {
+    QueueMeta meta;
+    File f = LittleFS.open(QUEUE_META_FILE, "r");
+    if (!f) return false;
+    size_t got = f.read((uint8_t*)&meta, sizeof(meta));
+    f.close();
+
+    if (got != sizeof(meta) ||
+        meta.magic != QUEUE_META_MAGIC ||
+        meta.version != QUEUE_META_VERSION ||
+        meta.segmentCount != QUEUE_SEGMENT_COUNT ||
+        meta.segTotal > QUEUE_SEGMENT_COUNT ||
+        meta.crc != trackCrc32((const uint8_t*)&meta, offsetof(QueueMeta, crc))) {
+        Serial.println(F("[STORAGE] Queue metadata invalid"));
+        return false;
+    }
+
+    _segTotal       = meta.segTotal;
+    _lastSeg        = meta.lastSeg;
+    _tailBytes      = meta.tailBytes;
+    _cursor         = meta.cursor;
+    _metaGeneration = meta.generation;
+    memcpy(_segs, meta.segs, _segTotal * sizeof(QueueSegment));
+    _metaDirty = false;
+
+    // Head segments deleted (sent, evicted or thinned) but still listed
+    char path[32];
+    while (_segTotal > 0) {
+        _segmentPath(_segs[0].seq, path, sizeof(path));
+        if (LittleFS.exists(path)) break;
+        _removeSegment(0);
+    }
+    if (_segTotal > 0 && _cursor.segment != _segs[0].seq) {
+        _cursor.segment = _segs[0].seq;
+        _cursor.offset = 0;
+        _cursor.index = 0;
+        _metaDirty = true;
+    }
+
+    // Segments started after the metadata was saved
+    int firstDirty = _segTotal - 1;
+    size_t dirtyStart = _tailBytes;
+    _segmentPath(_lastSeg + 1, path, sizeof(path));
+    while (LittleFS.exists(path)) {
+        if (_segTotal >= QUEUE_SEGMENT_COUNT) return false;
+        QueueSegment& seg = _segs[_segTotal++];
+        seg.seq = ++_lastSeg;
+        seg.samples = 0;
+        seg.flags = 0;
+        seg.reserved = 0;
+        if (_segTotal == 1) {
+            _cursor.segment = seg.seq;
+            _cursor.offset = 0;
+            _cursor.index = 0;
+        }
+        _metaDirty = true;
+        _segmentPath(_lastSeg + 1, path, sizeof(path));
+    }
+
+    // Re-scan only what was appended to since: the old tail from its known
+    // size, any newer segment from the start
+    for (int i = std::max(firstDirty, 0); i < _segTotal; i++) {
+        size_t start = (i == firstDirty) ? dirtyStart : 0;
+        size_t end = 0;
+        size_t size = 0;
+        _segmentPath(_segs[i].seq, path, sizeof(path));
+        if (!_fileSize(path, &size) || size < start) return false;
+        if (size == start) continue;
+
+        _segs[i].samples += _scanSegment(path, start, &end, &size);
+        _repairTail(path, end, size);
+        if (i == _segTotal - 1) _tailBytes = end;
+        _metaDirty = true;
+    }
+
+    _queueCount = 0;
+    for (int i = 0; i < _segTotal; i++) {
+        _queueCount += _segs[i].samples;
+    }
+    _mountStaging();
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: convert one JSONL file into queue samples and remove it.
+// Streams line by line so the old file is never held in RAM.
+// ---------------------------------------------------------------------------
+static int _migrateJsonlFile(const char* path) {
+    File f = LittleFS.open(path, "r");
+    if (!f) return 0;
+
+    int imported = 0;
+    while (f.available()) {
+        String line = f.readStringUntil('\n');
+        line.trim();
+        if (line.length() == 0) continue;
+
+        TelemetryData data;
+        TrackPoint point;
+        if (gpsParsePayload(line.c_str(), &data)) {
+            trackPointFromTelemetry(&data, &point);
+            if (_bufferPoint(&point)) imported++;
+        }
+    }
+    f.close();
+    LittleFS.remove(path);
+    return imported;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: migrate the v2.0.0 single-file queue into track blocks.
+// ---------------------------------------------------------------------------
+static void _migrateLegacyQueue() {
+    int imported = 0;
+    if (LittleFS.exists(QUEUE_LEGACY_FILE)) {
+        imported += _migrateJsonlFile(QUEUE_LEGACY_FILE);
+    }
+
+    _commitBuffer();
+
+    if (imported > 0) {
+        Serial.print(F("[STORAGE] Migrated "));
+        Serial.print(imported);
+        Serial.println(F(" records to track block format"));
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: read the frame at the cursor into _frameBuf.
+// FRAME_END means the head segment has no more whole frames.
+// ---------------------------------------------------------------------------
+static FrameStatus _readCursorBlock(size_t* len, size_t* frameBytes) {
+    char path[32];
+    _segmentPath(_segs[0].seq, path, sizeof(path));
+
+    File f = LittleFS.open(path, "r");
+    if (!f) return FRAME_END;
+
+    FrameStatus status = _readFrame(f, _cursor.offset, f.size(), len, frameBytes);
+    f.close();
+    return status;
+}
 
 // ---------------------------------------------------------------------------
-// Internal helper: count lines in the queue file
+// Internal helper: move the cursor past a frame that cannot be used
+// (CRC mismatch or unknown block version).
 // ---------------------------------------------------------------------------
-static int _countLines() {
-    if (!LittleFS.exists(QUEUE_FILE)) {
-        return 0;
+static void _skipCursorBlock(size_t frameBytes) {
+    _cursor.offset += frameBytes;
+    _cursor.index = 0;
+    _metaDirty = true;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: the head segment is fully consumed — delete it and move
+// the cursor to the start of the next one.
+// ---------------------------------------------------------------------------
+static void _retireHeadSegment() {
+    char path[32];
+    _segmentPath(_segs[0].seq, path, sizeof(path));
+    LittleFS.remove(path);
+
+    // Anything still counted here was unreadable
+    _queueCount -= _segs[0].samples;
+    _removeSegment(0);
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: commit `samples` delivered samples of the current block.
+// Moves the cursor past the frame once it is done.
+// ---------------------------------------------------------------------------
+static void _advanceCursor(int samples, size_t frameBytes, bool blockDone) {
+    _cursor.index += samples;
+    _segs[0].samples -= samples;
+    _queueCount -= samples;
+
+    if (blockDone) {
+        _cursor.offset += frameBytes;
+        _cursor.index = 0;
     }
+    _metaDirty = true;
+}
 
-    File f = LittleFS.open(QUEUE_FILE, "r");
-    if (!f) return 0;
+// ---------------------------------------------------------------------------
+// Internal helper: re-encode the samples of _frameBuf from index `skip` on
+// into _blockBuf. Used when a block was already partly sent as records.
+// ---------------------------------------------------------------------------
+static size_t _reencodeTail(size_t len, int skip) {
+    TrackDecoder dec;
+    TrackEncoder enc;
+    TrackPoint point;
 
-    int count = 0;
-    while (f.available()) {
-        String line = f.readStringUntil('\n');
-        if (line.length() > 0) {
-            count++;
-        }
+    trackEncoderBegin(&enc, _blockBuf);
+    if (!trackDecoderBegin(&dec, _frameBuf, len)) return 0;
+
+    int index = 0;
+    while (trackDecoderNext(&dec, &point)) {
+        if (index++ >= skip) trackEncoderAdd(&enc, &point);
     }
-    f.close();
-    return count;
+    return enc.count > 0 ? enc.len : 0;
 }
 
 // ---------------------------------------------------------------------------
-// Internal helper: trim queue to keep only the newest maxKeep records
-// Discards the oldest records (FIFO eviction from the front of the file).
+// Internal helper: load the next sendable block at the cursor, retiring
+// consumed head segments and skipping unusable frames on the way.
+// A block partly sent as records is re-encoded from the cursor.
+// @return false if no sealed block is left
 // ---------------------------------------------------------------------------
-static void _trimQueue(int maxKeep) {
-    if (!LittleFS.exists(QUEUE_FILE)) return;
+static bool _loadCursorBlock(const uint8_t** body, size_t* bodyLen,
+                             int* samples, size_t* frameBytes) {
+    while (_segTotal > 0) {
+        size_t len;
+        FrameStatus status = _readCursorBlock(&len, frameBytes);
+        if (status == FRAME_END) {
+            _retireHeadSegment();
+            continue;
+        }
 
-    // Read all lines into memory
-    File f = LittleFS.open(QUEUE_FILE, "r");
-    if (!f) return;
+        if (status != FRAME_OK || len < 2 || _frameBuf[0] != TRACK_BLOCK_VERSION) {
+            _skipCursorBlock(*frameBytes);
+            continue;
+        }
 
-    // Collect all lines
-    std::vector<String> lines;
-    lines.reserve(maxKeep + 10);
-    while (f.available()) {
-        String line = f.readStringUntil('\n');
-        line.trim();
-        if (line.length() > 0) {
-            lines.push_back(line);
+        *samples = _frameBuf[1] - _cursor.index;
+        *body = _frameBuf;
+        *bodyLen = len;
+        if (_cursor.index > 0) {
+            *bodyLen = _reencodeTail(len, _cursor.index);
+            *body = _blockBuf;
         }
+        return true;
     }
-    f.close();
+    return false;
+}
 
-    // If within limits, no trimming needed
-    if ((int)lines.size() <= maxKeep) {
-        _queueCount = lines.size();
-        return;
+// ---------------------------------------------------------------------------
+// Internal helper: the last `max` unsent frames of the tail segment, as
+// byte offsets (oldest first). Frames before the cursor are already sent.
+// @return number of offsets stored
+// ---------------------------------------------------------------------------
+static int _tailFrames(size_t* starts, int max) {
+    int last = _segTotal - 1;
+    char path[32];
+    _segmentPath(_segs[last].seq, path, sizeof(path));
+    File f = LittleFS.open(path, "r");
+    if (!f) return 0;
+
+    size_t size = std::min((size_t)f.size(), _tailBytes);
+    size_t pos = (last == 0) ? _cursor.offset : 0;
+    int total = 0;
+    size_t len, frameBytes;
+    while (_readFrame(f, pos, size, &len, &frameBytes) != FRAME_END) {
+        if (total == max) memmove(starts, starts + 1, (max - 1) * sizeof(size_t));
+        starts[total < max ? total++ : max - 1] = pos;
+        pos += frameBytes;
     }
+    f.close();
+    return total;
+}
 
-    // Calculate how many to skip (oldest records to discard)
-    int skip = lines.size() - maxKeep;
-    Serial.print(F("[STORAGE] Trimming queue: discarding "));
-    Serial.print(skip);
-    Serial.println(F(" oldest records"));
+// ---------------------------------------------------------------------------
+// Internal helper: drop the tail segment's frames from byte `start` on,
+// holding `samples` unsent samples (unreadable frames count 0: they are
+// settled when the segment goes). A segment left with nothing unsent is
+// deleted and the one before it becomes the tail again.
+// ---------------------------------------------------------------------------
+static void _cutTail(size_t start, int samples) {
+    int last = _segTotal - 1;
+    char path[32];
+    _segmentPath(_segs[last].seq, path, sizeof(path));
 
-    // Rewrite file with only the newest records
-    f = LittleFS.open(QUEUE_FILE, "w");
-    if (!f) {
-        Serial.println(F("[STORAGE] ERROR: Failed to rewrite queue file"));
-        return;
-    }
+    samples = std::min(samples, (int)_segs[last].samples);
+    _segs[last].samples -= samples;
+    _queueCount -= samples;
 
-    for (int i = skip; i < (int)lines.size(); i++) {
-        f.println(lines[i]);
+    if (last == 0 && start <= _cursor.offset) {
+        _retireHeadSegment();
+    } else if (start == 0) {
+        LittleFS.remove(path);
+        _queueCount -= _segs[last].samples;     // Unreadable leftovers
+        _removeSegment(last);
+        _segmentPath(_segs[last - 1].seq, path, sizeof(path));
+        if (!_fileSize(path, &_tailBytes)) _tailBytes = 0;
+    } else if (_truncateFile(path, start)) {
+        _tailBytes = start;
+    } else {
+        Serial.println(F("[STORAGE] ERROR: Could not cut sent blocks off the tail segment"));
     }
+
+    _tailEpoch++;
+    _rewrites++;        // An offload listed before this must not commit
+    _metaDirty = true;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: record that numbers below `reserved` may be in use.
+// Temp file + rename, like the queue metadata.
+// ---------------------------------------------------------------------------
+static bool _saveSeq(uint32_t reserved) {
+    SeqState state = { SEQ_MAGIC, reserved, 0 };
+    state.crc = trackCrc32((const uint8_t*)&state, offsetof(SeqState, crc));
+
+    File f = LittleFS.open(SEQ_TMP_FILE, "w");
+    if (!f) return false;
+    size_t written = f.write((const uint8_t*)&state, sizeof(state));
     f.close();
+    return written == sizeof(state) && LittleFS.rename(SEQ_TMP_FILE, SEQ_FILE);
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: resume the sequence counter after the last reserved
+// block (numbers handed out before the reboot are never reused)
+// ---------------------------------------------------------------------------
+static void _loadSeq() {
+    SeqState state;
+    File f = LittleFS.open(SEQ_FILE, "r");
+    bool ok = f && f.read((uint8_t*)&state, sizeof(state)) == sizeof(state) &&
+              state.magic == SEQ_MAGIC &&
+              state.crc == trackCrc32((const uint8_t*)&state, offsetof(SeqState, crc));
+    if (f) f.close();
 
-    _queueCount = maxKeep;
+    _seqNext = (ok && state.reserved > 0) ? state.reserved : 1;
+    _seqReserved = _seqNext;
+    if (!ok && LittleFS.exists(SEQ_FILE)) {
+        Serial.println(F("[STORAGE] Sequence counter unreadable — restarting it"));
+    }
 }
 
 // ============================================================================
@@ -119,44 +1211,99 @@ bool storageInit() {
         return false;
     }
 
-    // Sync in-memory count with actual file contents
-    _queueCount = _countLines();
+    if (!LittleFS.exists(QUEUE_DIR)) {
+        LittleFS.mkdir(QUEUE_DIR);
+    }
+
+    // Anything still in RAM belongs to a previous mount
+    _ramCount = 0;
+    _lowSeq = 0;
+    memset(&_cursor, 0, sizeof(_cursor));
+    _loadSeq();
+
+    // Constant-time mount from the metadata; walk the files only if it
+    // is missing or stale (first boot after an upgrade, or a power cut
+    // between a segment write and its metadata update). Stale metadata
+    // that passed its CRC still leaves its cursor for the rebuild, so
+    // samples already sent from the head are not sent again.
+    if (_loadMeta()) {
+        if (LittleFS.exists(QUEUE_LEGACY_FILE)) {
+            _migrateLegacyQueue();
+        }
+    } else {
+        Serial.println(F("[STORAGE] Rebuilding queue state from segment files..."));
+        _scanSegments();
+        _migrateLegacyQueue();
+        _metaDirty = true;
+    }
+    _saveMeta();
 
     Serial.print(F("[STORAGE] LittleFS mounted. Queue contains "));
     Serial.print(_queueCount);
-    Serial.println(F(" records"));
+    Serial.print(F(" records in "));
+    Serial.print(_segTotal);
+    Serial.println(F(" segments"));
 
     return true;
 }
 
 /**
- * Append a JSON record to the offline queue.
- * Enforces the MAX_QUEUE_SIZE limit by discarding oldest records if needed.
+ * Append a telemetry sample to the offline queue.
+ * Samples collect in RAM and are committed to flash in one write every
+ * QUEUE_WRITEBACK_RECORDS samples (see storageUpdate() for the time limit).
+ * Once TRACK_BLOCK_SAMPLES are staged they are sealed into a block,
+ * discarding the oldest segment if the ring is full.
  */
-bool storageEnqueue(const String& jsonLine) {
-    // Enforce queue size limit before adding
-    if (_queueCount >= MAX_QUEUE_SIZE) {
-        // Keep (MAX_QUEUE_SIZE - 1) records to make room for the new one
-        _trimQueue(MAX_QUEUE_SIZE - 1);
+bool storageEnqueue(const TelemetryData* data) {
+    TrackPoint point;
+    trackPointFromTelemetry(data, &point);
+
+    // Lowest seq in the queue: exact from an empty queue on, unknown for
+    // a queue inherited from before the boot
+    if (_queueCount == 0) {
+        _lowSeq = point.seq;
+    } else if (point.seq != 0 && point.seq < _lowSeq) {
+        _lowSeq = point.seq;
     }
 
-    // Append the new record
-    File f = LittleFS.open(QUEUE_FILE, "a");
-    if (!f) {
-        Serial.println(F("[STORAGE] ERROR: Failed to open queue file for append"));
+    if (!_bufferPoint(&point)) {
+        Serial.println(F("[STORAGE] ERROR: Write-back buffer full, sample dropped"));
         return false;
     }
 
-    f.println(jsonLine);
-    f.close();
-    _queueCount++;
-
     Serial.print(F("[STORAGE] Enqueued record. Queue size: "));
     Serial.println(_queueCount);
 
     return true;
 }
 
+/**
+ * Commit the RAM write-back buffer once its oldest sample is
+ * QUEUE_WRITEBACK_MS old. Cheap enough to call every loop pass.
+ */
+void storageUpdate() {
+    if (_ramCount > 0 && millis() - _ramSince >= QUEUE_WRITEBACK_MS) {
+        _commitBuffer();
+    }
+}
+
+/**
+ * Commit the RAM write-back buffer to flash now.
+ */
+bool storageSync() {
+    int pending = _ramCount;
+    if (!_commitBuffer()) {
+        Serial.println(F("[STORAGE] ERROR: Failed to commit buffered records"));
+        return false;
+    }
+    if (pending > 0) {
+        Serial.print(F("[STORAGE] Committed "));
+        Serial.print(pending);
+        Serial.println(F(" buffered records to flash"));
+    }
+    return true;
+}
+
 /**
  * Get current queue depth.
  */
@@ -165,94 +1312,552 @@ int storageGetCount() {
 }
 
 /**
- * Flush the offline queue by attempting to send each record.
- * 
- * Records are sent oldest-first (FIFO). Successfully sent records are
- * removed; failed records remain in the queue for the next flush attempt.
- * 
- * @param sendFunc  Lambda/function: bool(const String& json) — returns true on success
+ * Flush up to maxRecords records from the offline queue.
+ *
+ * Records are sent oldest-first (FIFO): sealed blocks are decoded sample by
+ * sample from the cursor, then the staging file is sent. Each success
+ * advances the cursor; on the first failure the flush stops. The cursor is
+ * persisted once per call, so a reboot re-sends at most one batch.
+ *
+ * @param sendFunc    Lambda/function: bool(const TelemetryData*) — returns true on success
+ * @param maxRecords  Upper bound on records sent by this call
  * @return number of successfully sent records
  */
-int storageFlush(std::function<bool(const String&)> sendFunc) {
-    if (_queueCount == 0 || !LittleFS.exists(QUEUE_FILE)) {
+int storageFlush(std::function<bool(const TelemetryData*)> sendFunc, int maxRecords) {
+    if (_queueCount == 0) {
         return 0;
     }
 
-    Serial.print(F("[STORAGE] Flushing queue ("));
-    Serial.print(_queueCount);
-    Serial.println(F(" records)..."));
+    // The cursor only addresses flash, so buffered samples go there first
+    _commitBuffer();
 
-    // Read all records into memory
-    File f = LittleFS.open(QUEUE_FILE, "r");
-    if (!f) {
-        Serial.println(F("[STORAGE] ERROR: Failed to open queue for flush"));
-        return 0;
-    }
+    int sentCount = 0;
+    bool failed = false;
 
-    std::vector<String> lines;
-    lines.reserve(_queueCount);
-    while (f.available()) {
-        String line = f.readStringUntil('\n');
-        line.trim();
-        if (line.length() > 0) {
-            lines.push_back(line);
+    // Sealed blocks, oldest first
+    while (!failed && sentCount < maxRecords && _segTotal > 0) {
+        size_t len, frameBytes;
+        FrameStatus status = _readCursorBlock(&len, &frameBytes);
+        if (status == FRAME_END) {
+            _retireHeadSegment();
+            continue;
         }
-    }
-    f.close();
 
-    // Attempt to send each record
-    std::vector<String> failed;
-    int sentCount = 0;
+        TrackDecoder dec;
+        if (status != FRAME_OK || !trackDecoderBegin(&dec, _frameBuf, len)) {
+            _skipCursorBlock(frameBytes);
+            continue;
+        }
 
-    for (const auto& line : lines) {
-        if (sendFunc(line)) {
+        TrackPoint point;
+        TelemetryData data;
+        int index = 0;
+        int delivered = 0;
+        while (sentCount < maxRecords && trackDecoderNext(&dec, &point)) {
+            if (index++ < _cursor.index) continue;
+            trackPointToTelemetry(&point, &data);
+            if (!sendFunc(&data)) {
+                failed = true;
+                break;
+            }
+            delivered++;
             sentCount++;
-        } else {
-            // Keep failed records for retry
-            failed.push_back(line);
-            // Stop trying after first failure to avoid blocking too long
-            // Remaining unsent records are also kept
-            break;
         }
+
+        // Done unless we stopped early (an undecodable remainder is dropped)
+        bool blockDone = !failed && (sentCount < maxRecords || index >= dec.count);
+        _advanceCursor(delivered, frameBytes, blockDone);
     }
 
-    // Add remaining unsent records (after the break) to failed list
-    for (int i = sentCount + (int)failed.size(); i < (int)lines.size(); i++) {
-        failed.push_back(lines[i]);
+    // Then the samples still waiting in the staging file
+    if (!failed && sentCount < maxRecords && _openCount > _cursor.openSkip) {
+        File f = LittleFS.open(QUEUE_OPEN_FILE, "r");
+        if (f) {
+            QueueRecord rec;
+            f.seek(_cursor.openSkip * sizeof(QueueRecord));
+            while (sentCount < maxRecords &&
+                   f.read((uint8_t*)&rec, sizeof(rec)) == sizeof(rec)) {
+                if (_recordValid(&rec)) {
+                    TelemetryData data;
+                    trackPointToTelemetry(&rec.point, &data);
+                    if (!sendFunc(&data)) break;
+                    sentCount++;
+                }
+                _cursor.openSkip++;
+                _queueCount--;
+                _metaDirty = true;
+            }
+            f.close();
+        }
+
+        if (_cursor.openSkip >= _openCount) {
+            LittleFS.remove(QUEUE_OPEN_FILE);
+            _openCount = 0;
+            _cursor.openSkip = 0;
+        }
     }
 
-    // Rewrite the queue file with only failed/remaining records
-    if (failed.empty()) {
-        // All sent successfully — remove the file
-        LittleFS.remove(QUEUE_FILE);
-        _queueCount = 0;
-        Serial.println(F("[STORAGE] Queue fully flushed and cleared"));
-    } else {
-        // Write back only the failed records
-        f = LittleFS.open(QUEUE_FILE, "w");
+    _saveMeta();
+
+    if (sentCount > 0) {
+        Serial.print(F("[STORAGE] Flushed "));
+        Serial.print(sentCount);
+        Serial.print(F(" records, remaining="));
+        Serial.println(_queueCount);
+    }
+
+    return sentCount;
+}
+
+/**
+ * Read the oldest records without consuming them, in the order
+ * storageFlush() would deliver them. Used to build batch uploads: the
+ * records are consumed with storageFlush() once the server has them.
+ */
+int storagePeek(std::function<bool(const TelemetryData*)> peekFunc, int maxRecords) {
+    if (_queueCount == 0) {
+        return 0;
+    }
+
+    _commitBuffer();
+
+    int count = 0;
+    bool stopped = false;
+    TrackPoint point;
+    TelemetryData data;
+
+    // Sealed blocks from the cursor on, across segments
+    size_t offset = _cursor.offset;
+    int skip = _cursor.index;
+    for (int i = 0; i < _segTotal && !stopped && count < maxRecords; i++) {
+        char path[32];
+        _segmentPath(_segs[i].seq, path, sizeof(path));
+
+        File f = LittleFS.open(path, "r");
+        size_t size = f ? f.size() : 0;
+        while (f && !stopped && count < maxRecords) {
+            size_t len, frameBytes;
+            FrameStatus status = _readFrame(f, offset, size, &len, &frameBytes);
+            if (status == FRAME_END) break;
+            offset += frameBytes;
+
+            TrackDecoder dec;
+            if (status == FRAME_OK && trackDecoderBegin(&dec, _frameBuf, len)) {
+                int index = 0;
+                while (count < maxRecords && trackDecoderNext(&dec, &point)) {
+                    if (index++ < skip) continue;
+                    trackPointToTelemetry(&point, &data);
+                    if (!peekFunc(&data)) {
+                        stopped = true;
+                        break;
+                    }
+                    count++;
+                }
+            }
+            skip = 0;
+        }
+        if (f) f.close();
+        offset = 0;
+        skip = 0;
+    }
+
+    // Then the staging file
+    if (!stopped && count < maxRecords && _openCount > _cursor.openSkip) {
+        File f = LittleFS.open(QUEUE_OPEN_FILE, "r");
         if (f) {
-            for (const auto& line : failed) {
-                f.println(line);
+            QueueRecord rec;
+            f.seek(_cursor.openSkip * sizeof(QueueRecord));
+            while (count < maxRecords &&
+                   f.read((uint8_t*)&rec, sizeof(rec)) == sizeof(rec)) {
+                if (!_recordValid(&rec)) continue;
+                trackPointToTelemetry(&rec.point, &data);
+                if (!peekFunc(&data)) break;
+                count++;
             }
             f.close();
         }
-        _queueCount = failed.size();
-        Serial.print(F("[STORAGE] Flush partial: sent="));
+    }
+
+    return count;
+}
+
+/**
+ * Flush up to maxBlocks track blocks, uploading each as stored.
+ * Staged samples are sealed into a (possibly short) block first so the
+ * whole queue goes out in block form.
+ */
+int storageFlushBlocks(std::function<bool(const uint8_t*, size_t)> sendFunc, int maxBlocks) {
+    if (_queueCount == 0) {
+        return 0;
+    }
+
+    _commitBuffer();
+    _sealOpenBlock();
+
+    int sentCount = 0;
+    int blocks = 0;
+
+    while (blocks < maxBlocks) {
+        const uint8_t* body;
+        size_t bodyLen, frameBytes;
+        int samples;
+        if (!_loadCursorBlock(&body, &bodyLen, &samples, &frameBytes)) break;
+
+        if (bodyLen > 0 && !sendFunc(body, bodyLen)) break;
+
+        _advanceCursor(samples, frameBytes, true);
+        sentCount += samples;
+        blocks++;
+    }
+
+    _saveMeta();
+
+    if (sentCount > 0) {
+        Serial.print(F("[STORAGE] Flushed "));
         Serial.print(sentCount);
-        Serial.print(F(", remaining="));
+        Serial.print(F(" records in "));
+        Serial.print(blocks);
+        Serial.print(F(" blocks, remaining="));
         Serial.println(_queueCount);
     }
 
     return sentCount;
 }
 
+/**
+ * Get the oldest unsent block without consuming it, for an upload that
+ * completes later.
+ */
+int storagePeekBlock(const uint8_t** block, size_t* len) {
+    if (_queueCount == 0) {
+        return 0;
+    }
+
+    _commitBuffer();
+    _sealOpenBlock();
+
+    size_t frameBytes;
+    int samples = 0;
+    bool found;
+    while ((found = _loadCursorBlock(block, len, &samples, &frameBytes)) && *len == 0) {
+        _advanceCursor(samples, frameBytes, true);      // Nothing left to send
+    }
+    _saveMeta();
+    return found ? samples : 0;
+}
+
+/**
+ * The next blocks storageFlushBlocks() would send, without consuming
+ * them (pipelined uploads). Walks the segments from the cursor like
+ * storagePeek(); a partly sent first block is re-encoded from the cursor.
+ */
+int storagePeekBlocks(std::function<bool(const uint8_t*, size_t, int)> peekFunc, int maxBlocks) {
+    const uint8_t* block;
+    size_t len;
+    if (storagePeekBlock(&block, &len) == 0) {
+        return 0;       // Also drops a used-up block at the cursor
+    }
+
+    int blocks = 0;
+    bool stopped = false;
+    size_t offset = _cursor.offset;
+    int skip = _cursor.index;
+    for (int i = 0; i < _segTotal && !stopped && blocks < maxBlocks; i++) {
+        char path[32];
+        _segmentPath(_segs[i].seq, path, sizeof(path));
+
+        File f = LittleFS.open(path, "r");
+        size_t size = f ? f.size() : 0;
+        while (f && !stopped && blocks < maxBlocks) {
+            size_t frameBytes;
+            FrameStatus status = _readFrame(f, offset, size, &len, &frameBytes);
+            if (status == FRAME_END) break;
+            offset += frameBytes;
+
+            // Frames storageFlushBlocks() skips are skipped here too
+            if (status == FRAME_OK && len >= 2 && _frameBuf[0] == TRACK_BLOCK_VERSION) {
+                int samples = _frameBuf[1] - skip;
+                block = _frameBuf;
+                if (skip > 0) {
+                    len = _reencodeTail(len, skip);
+                    block = _blockBuf;
+                }
+                if (!peekFunc(block, len, samples)) {
+                    stopped = true;
+                    break;
+                }
+                blocks++;
+            }
+            skip = 0;
+        }
+        if (f) f.close();
+        offset = 0;
+        skip = 0;
+    }
+    return blocks;
+}
+
+/**
+ * The newest blocks of the queue, newest first, without consuming them.
+ * Tail segments without a readable block are dropped on the way.
+ */
+int storagePeekNewestBlocks(std::function<bool(const uint8_t*, size_t, int)> peekFunc, int maxBlocks) {
+    if (_queueCount == 0) {
+        return 0;
+    }
+
+    _commitBuffer();
+    _sealOpenBlock();
+
+    size_t starts[QUEUE_PIPELINE_DEPTH];
+    maxBlocks = std::min(maxBlocks, QUEUE_PIPELINE_DEPTH);
+    int blocks = 0;
+    while (_segTotal > 0 && blocks == 0) {
+        int last = _segTotal - 1;
+        int frames = _tailFrames(starts, QUEUE_PIPELINE_DEPTH);
+        char path[32];
+        _segmentPath(_segs[last].seq, path, sizeof(path));
+        File f = LittleFS.open(path, "r");
+        size_t size = f ? std::min((size_t)f.size(), _tailBytes) : 0;
+
+        bool readable = false;
+        for (int i = frames - 1; f && i >= 0 && blocks < maxBlocks; i--) {
+            size_t len, frameBytes;
+            FrameStatus status = _readFrame(f, starts[i], size, &len, &frameBytes);
+            if (status != FRAME_OK || len < 2 || _frameBuf[0] != TRACK_BLOCK_VERSION) {
+                continue;
+            }
+            readable = true;
+
+            // The cursor block may be partly sent already
+            int skip = (last == 0 && starts[i] == _cursor.offset) ? _cursor.index : 0;
+            const uint8_t* block = _frameBuf;
+            int samples = _frameBuf[1] - skip;
+            if (skip > 0) {
+                len = _reencodeTail(len, skip);
+                block = _blockBuf;
+            }
+            if (len == 0 || !peekFunc(block, len, samples)) break;
+            blocks++;
+        }
+        if (f) f.close();
+
+        if (!readable) {
+            // Nothing sendable at the tail (frames = 0: segment emptied)
+            _cutTail(frames > 0 ? starts[0] : (last == 0 ? _cursor.offset : 0), 0);
+        } else if (blocks == 0) {
+            break;      // Refused by peekFunc
+        }
+    }
+    _saveMeta();
+    return blocks;
+}
+
+/**
+ * Consume the `blocks` newest blocks sent from storagePeekNewestBlocks().
+ */
+int storageFlushNewestBlocks(int blocks) {
+    size_t starts[QUEUE_PIPELINE_DEPTH];
+    int sentCount = 0;
+    int cut = 0;
+
+    blocks = std::min(blocks, QUEUE_PIPELINE_DEPTH);
+    if (_segTotal > 0 && blocks > 0) {
+        int last = _segTotal - 1;
+        int frames = _tailFrames(starts, QUEUE_PIPELINE_DEPTH);
+        char path[32];
+        _segmentPath(_segs[last].seq, path, sizeof(path));
+        File f = LittleFS.open(path, "r");
+        size_t size = f ? std::min((size_t)f.size(), _tailBytes) : 0;
+
+        // Walk back over `blocks` readable frames (and the unreadable
+        // ones between them, which go as well)
+        int from = frames;
+        while (f && from > 0 && cut < blocks) {
+            size_t len, frameBytes;
+            from--;
+            if (_readFrame(f, starts[from], size, &len, &frameBytes) == FRAME_OK && len >= 2 &&
+                _frameBuf[0] == TRACK_BLOCK_VERSION) {
+                int skip = (last == 0 && starts[from] == _cursor.offset) ? _cursor.index : 0;
+                sentCount += _frameBuf[1] - skip;
+                cut++;
+            }
+        }
+        if (f) f.close();
+        if (from < frames) _cutTail(starts[from], sentCount);
+    }
+    _saveMeta();
+
+    if (sentCount > 0) {
+        Serial.print(F("[STORAGE] Flushed "));
+        Serial.print(sentCount);
+        Serial.print(F(" newest records in "));
+        Serial.print(cut);
+        Serial.print(F(" blocks, remaining="));
+        Serial.println(_queueCount);
+    }
+    return sentCount;
+}
+
+uint32_t storageGetReadMark() {
+    return _headEpoch;
+}
+
+/**
+ * Mark of the queue tail (see header). Sums counters that only count up.
+ */
+uint32_t storageGetTailMark() {
+    return _tailEpoch + _rewrites + _headEpoch;
+}
+
+/**
+ * Lowest seq the device may still send from the queue (see header).
+ */
+uint32_t storageGetSeqFloor() {
+    return _queueCount == 0 ? _seqNext : _lowSeq;
+}
+
 /**
  * Clear all records from the offline queue.
  */
 void storageClear() {
-    if (LittleFS.exists(QUEUE_FILE)) {
-        LittleFS.remove(QUEUE_FILE);
+    char path[32];
+    for (int i = 0; i < _segTotal; i++) {
+        _segmentPath(_segs[i].seq, path, sizeof(path));
+        if (LittleFS.exists(path)) {
+            LittleFS.remove(path);
+        }
     }
+    if (LittleFS.exists(QUEUE_OPEN_FILE)) {
+        LittleFS.remove(QUEUE_OPEN_FILE);
+    }
+    memset(&_cursor, 0, sizeof(_cursor));
+    _ramCount = 0;
     _queueCount = 0;
+    _openCount = 0;
+    _tailBytes = 0;
+    _segTotal = 0;
+    _headEpoch++;
+    _metaDirty = true;
+    _saveMeta();
     Serial.println(F("[STORAGE] Queue cleared"));
 }
+
+// ============================================================================
+// BULK OFFLOAD (USB serial, see offload_handler.cpp)
+// ============================================================================
+
+void storageListSegments(std::function<void(uint32_t, uint32_t, uint32_t, uint8_t)> fileFunc) {
+    // Everything queued goes out as whole blocks
+    _commitBuffer();
+    _sealOpenBlock();
+
+    char path[32];
+    for (int i = 0; i < _segTotal; i++) {
+        size_t size = _tailBytes;
+        if (i < _segTotal - 1) {
+            _segmentPath(_segs[i].seq, path, sizeof(path));
+            if (!_fileSize(path, &size)) continue;
+        }
+        if (i == 0) {
+            fileFunc(_segs[0].seq, size, _cursor.offset, _cursor.index);
+        } else {
+            fileFunc(_segs[i].seq, size, 0, 0);
+        }
+    }
+}
+
+uint32_t storageGetOffloadToken() {
+    return _rewrites;
+}
+
+int storageReadSegment(uint32_t seq, uint32_t offset, uint8_t* buf, size_t len) {
+    char path[32];
+    _segmentPath(seq, path, sizeof(path));
+
+    File f = LittleFS.open(path, "r");
+    if (!f) return -1;
+
+    // The tail segment may hold a torn frame past _tailBytes: never send it
+    size_t size = f.size();
+    if (_segTotal > 0 && seq == _segs[_segTotal - 1].seq) {
+        size = std::min(size, _tailBytes);
+    }
+
+    int n = 0;
+    if (offset < size && f.seek(offset)) {
+        n = f.read(buf, std::min(len, size - offset));
+    }
+    f.close();
+    return n;
+}
+
+bool storageCommitOffload(uint32_t seq, uint32_t offset, uint32_t token) {
+    if (token != _rewrites) return false;   // Segments were merged since LIST
+
+    while (_segTotal > 0 && _segs[0].seq < seq) {
+        _retireHeadSegment();
+    }
+
+    // Part of the head segment: step the cursor over whole frames up to
+    // `offset`. A fully consumed segment is retired by the next flush.
+    if (_segTotal > 0 && _segs[0].seq == seq && offset > _cursor.offset) {
+        char path[32];
+        _segmentPath(seq, path, sizeof(path));
+        File f = LittleFS.open(path, "r");
+        if (f) {
+            size_t size = (_segTotal == 1) ? std::min((size_t)f.size(), _tailBytes) : f.size();
+            size_t len, frameBytes;
+            while (_cursor.offset < offset) {
+                FrameStatus status = _readFrame(f, _cursor.offset, size, &len, &frameBytes);
+                if (status == FRAME_END || _cursor.offset + frameBytes > offset) break;
+
+                int samples = (status == FRAME_OK && len >= 2) ? _frameBuf[1] - _cursor.index : 0;
+                _advanceCursor(std::max(0, std::min(samples, (int)_segs[0].samples)), frameBytes, true);
+            }
+            f.close();
+        }
+    }
+
+    _headEpoch++;
+    _metaDirty = true;
+    _saveMeta();
+
+    Serial.print(F("[STORAGE] Offload committed, remaining="));
+    Serial.println(_queueCount);
+    return true;
+}
+
+// ============================================================================
+// SEQUENCE NUMBERS
+// ============================================================================
+
+/**
+ * Hand out the next sequence number, reserving a new block of
+ * SEQ_RESERVE numbers in SEQ_FILE when the current one is used up.
+ */
+uint32_t storageNextSeq() {
+    if (_seqNext >= _seqReserved) {
+        // On a write error the block is used anyway (logged once per
+        // block); only a reboot before the next save could reuse numbers
+        _seqReserved = _seqNext + SEQ_RESERVE;
+        if (!_saveSeq(_seqReserved)) {
+            Serial.println(F("[STORAGE] ERROR: Failed to save the sequence counter"));
+        }
+    }
+    return _seqNext++;
+}
+
+/**
+ * Move the counter past a number the server already holds. Only matters
+ * after the counter was lost (e.g. the partition was formatted): new
+ * fixes would otherwise reuse numbers and be dropped as duplicates.
+ */
+void storageSkipSeq(uint32_t seq) {
+    if (seq < _seqNext) return;
+
+    Serial.print(F("[STORAGE] Server already holds seq "));
+    Serial.print(seq);
+    Serial.println(F(" — sequence counter moved past it"));
+    _seqNext = seq + 1;
+}
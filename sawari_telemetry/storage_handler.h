@@ -13,22 +13,42 @@
 
 #include <Arduino.h>
 #include <functional>
+#include "gps_handler.h"
 
 /**
- * Initialize LittleFS filesystem.
- * Formats the partition on first use if mount fails.
+ * Initialize LittleFS filesystem and rebuild the queue state from the
+ * segment files. Formats the partition on first use if mount fails.
+ * Older queue formats (/queue.jsonl, JSONL or fixed-width segments) are
+ * converted to track blocks and removed.
  * @return true if filesystem mounted successfully
  */
 bool storageInit();
 
 /**
- * Add a JSON record to the offline queue.
- * If the queue exceeds MAX_QUEUE_SIZE, the oldest record is discarded.
+ * Add a telemetry sample to the offline queue.
+ * Samples are buffered in RAM and committed to flash as 32-byte staging
+ * records every QUEUE_WRITEBACK_RECORDS samples; the staging file is sealed
+ * into a compressed track block every TRACK_BLOCK_SAMPLES samples. If the
+ * queue is full, the oldest segment is discarded. This never rewrites
+ * existing records.
  * 
- * @param jsonLine  A single-line JSON string (no newlines within)
- * @return true if the record was successfully written
+ * @param data  pointer to the telemetry sample to store
+ * @return true if the record was accepted
  */
-bool storageEnqueue(const String& jsonLine);
+bool storageEnqueue(const TelemetryData* data);
+
+/**
+ * Commit buffered samples once the oldest is QUEUE_WRITEBACK_MS old.
+ * Call this every loop() pass.
+ */
+void storageUpdate();
+
+/**
+ * Commit buffered samples to flash immediately.
+ * Call before a planned restart or power-down to close the loss window.
+ * @return true if nothing is left in RAM
+ */
+bool storageSync();
 
 /**
  * Get the current number of records in the offline queue.
@@ -37,19 +57,156 @@ bool storageEnqueue(const String& jsonLine);
 int storageGetCount();
 
 /**
- * Flush the offline queue by sending each record via the provided callback.
+ * Flush up to maxRecords records of the offline queue, oldest first,
+ * via the provided callback. Records are decoded back into TelemetryData;
+ * the callback is responsible for formatting the wire payload.
  * 
- * Records that fail to send are kept in the queue for the next attempt.
- * Records that succeed are removed.
+ * Streams from a persisted read cursor: each success advances the cursor,
+ * nothing is rewritten, and RAM use is one block regardless of queue depth.
+ * The flush stops at the first failure; call again to continue.
  * 
- * @param sendFunc  Callback that takes a JSON string and returns true on success
+ * @param sendFunc    Callback that takes a telemetry sample and returns true on success
+ * @param maxRecords  Maximum number of records to send in this call
  * @return number of records successfully sent
  */
-int storageFlush(std::function<bool(const String&)> sendFunc);
+int storageFlush(std::function<bool(const TelemetryData*)> sendFunc, int maxRecords);
+
+/**
+ * Read up to maxRecords of the oldest records without removing them, in
+ * the order storageFlush() delivers them. For batch uploads: peek, send,
+ * then consume the delivered records with storageFlush().
+ *
+ * @param peekFunc    Callback per record; return false to stop before it
+ * @param maxRecords  Maximum number of records to read
+ * @return number of records passed to peekFunc (and accepted by it)
+ */
+int storagePeek(std::function<bool(const TelemetryData*)> peekFunc, int maxRecords);
+
+/**
+ * Flush up to maxBlocks track blocks (track_codec.h), sending each as-is
+ * without decoding it on the device. Staged samples are sealed into a
+ * block first. Uses the same persisted cursor as storageFlush().
+ * 
+ * @param sendFunc   Callback that takes an encoded block and returns true on success
+ * @param maxBlocks  Maximum number of blocks to send in this call
+ * @return number of records (samples) successfully sent
+ */
+int storageFlushBlocks(std::function<bool(const uint8_t*, size_t)> sendFunc, int maxBlocks);
+
+/**
+ * Get the block storageFlushBlocks() would send next, without consuming
+ * it. For uploads that complete later (sender task): peek, send, then
+ * consume it with storageFlushBlocks() if storageGetReadMark() is unchanged.
+ * The block stays valid until the next storage call.
+ *
+ * @param block  receives a pointer to the encoded block
+ * @param len    receives the block length in bytes
+ * @return number of samples in the block (0 = nothing to send)
+ */
+int storagePeekBlock(const uint8_t** block, size_t* len);
+
+/**
+ * Mark of the queue head. It changes when unsent data is dropped, thinned
+ * or committed by an offload, i.e. whenever records or blocks read with
+ * storagePeek() / storagePeekBlock() may no longer be the next ones to
+ * consume. Flushes do not change it.
+ */
+uint32_t storageGetReadMark();
+
+/**
+ * The next blocks storageFlushBlocks() would send, oldest first, without
+ * consuming them (pipelined uploads). Blocks are only valid during the
+ * callback; copy them out.
+ *
+ * @param peekFunc   called with (block, length, samples); return false to stop
+ * @param maxBlocks  maximum number of blocks to peek
+ * @return number of blocks passed to peekFunc and accepted
+ */
+int storagePeekBlocks(std::function<bool(const uint8_t*, size_t, int)> peekFunc, int maxBlocks);
+
+/**
+ * The newest blocks of the queue, newest first, without consuming them
+ * (newest-first backlog uploads). Staged samples are sealed into a block
+ * first. Only the tail segment is read: a window may hold fewer blocks
+ * than asked for. Blocks are only valid during the callback; copy them out.
+ *
+ * @param peekFunc   called with (block, length, samples); return false to stop
+ * @param maxBlocks  maximum number of blocks to peek (at most QUEUE_PIPELINE_DEPTH)
+ * @return number of blocks passed to peekFunc and accepted
+ */
+int storagePeekNewestBlocks(std::function<bool(const uint8_t*, size_t, int)> peekFunc, int maxBlocks);
+
+/**
+ * Consume the `blocks` leading blocks of the last storagePeekNewestBlocks()
+ * (the server accepted them). Only if storageGetTailMark() is unchanged
+ * since the peek: otherwise the tail is no longer what was sent.
+ * @return number of records (samples) consumed
+ */
+int storageFlushNewestBlocks(int blocks);
+
+/**
+ * Mark of the queue tail. It changes whenever a block is appended to or
+ * cut off the tail, or segments are rewritten or dropped, i.e. whenever
+ * blocks read with storagePeekNewestBlocks() may no longer be the newest.
+ */
+uint32_t storageGetTailMark();
 
 /**
  * Clear all records from the offline queue.
  */
 void storageClear();
 
+// --- Sequence numbers ---
+
+/**
+ * Next per-device sequence number (1, 2, 3, ...). Persisted across
+ * reboots in SEQ_FILE; never returns the same number twice.
+ */
+uint32_t storageNextSeq();
+
+/**
+ * Move the counter past `seq` if it is not already (the server reported
+ * holding it, e.g. after the counter file was lost).
+ */
+void storageSkipSeq(uint32_t seq);
+
+/**
+ * Lower bound on the seqs the offline queue may still send: everything
+ * below it was sent or dropped. Tracked on enqueue and only raised when
+ * the queue drains (then it is the next number to be handed out); 0 while
+ * unknown (queue inherited from before the boot).
+ */
+uint32_t storageGetSeqFloor();
+
+// --- Bulk offload (offload_handler.cpp) ---
+
+/**
+ * List the queue segment files for a bulk offload, oldest first. Staged
+ * samples are sealed into a block first, so everything queued is listed.
+ * @param fileFunc  called with (sequence number, bytes, first unsent byte,
+ *                  samples of the block at that byte already sent)
+ */
+void storageListSegments(std::function<void(uint32_t, uint32_t, uint32_t, uint8_t)> fileFunc);
+
+/**
+ * Token that changes whenever segment files are rewritten (thinning).
+ * An offload commit is only accepted with the token seen when listing.
+ */
+uint32_t storageGetOffloadToken();
+
+/**
+ * Read raw bytes of a queue segment file (whole frames only).
+ * @return bytes read, 0 at the end, -1 if the segment no longer exists
+ */
+int storageReadSegment(uint32_t seq, uint32_t offset, uint8_t* buf, size_t len);
+
+/**
+ * Drop queue data the host has kept: all segments before `seq`, and the
+ * frames of segment `seq` that end at or before `offset`. The read cursor
+ * moves as if the data had been uploaded.
+ * @param token  storageGetOffloadToken() from when the files were listed
+ * @return false if the queue was rewritten since (nothing is dropped)
+ */
+bool storageCommitOffload(uint32_t seq, uint32_t offset, uint32_t token);
+
 #endif // STORAGE_HANDLER_H
@@ -0,0 +1,355 @@
+/**
+ * ============================================================================
+ * SAWARI Bus Telemetry Device - TLS Client Implementation
+ * ============================================================================
+ *
+ * One mbedTLS context for the whole run, reset between connections, so
+ * its record buffers are allocated once instead of on every connect.
+ *
+ * Resumption: after each handshake the session (ID, master secret and
+ * the ticket if the server issued one) is copied out and offered on the
+ * next connect. A server that still knows it answers with an abbreviated
+ * handshake: one round trip, no certificate chain, no public-key
+ * operations. Whether a handshake was resumed is seen from the
+ * certificate check, which only runs in a full one.
+ *
+ * Trust: the chain must end in the certificate compiled in from
+ * server_cert.h, and the certificate must name the API host. The
+ * validity dates are checked against the system clock, which gpsUpdate()
+ * sets from GPS time at the first fix; until then they cannot be checked
+ * and are ignored, the pin still holds.
+ *
+ * Heap is sampled with ESP.getFreeHeap() between handshake steps, so a
+ * short-lived allocation inside one step may be missed.
+ * ============================================================================
+ */
+
+#include "tls_client.h"
+#include "config.h"
+#include "gps_handler.h"
+
+#if HTTP_TLS
+
+#include "server_cert.h"
+#include <mbedtls/ssl.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/x509_crt.h>
+#include <mbedtls/error.h>
+#include <time.h>
+
+#define TLS_RX_BUFFER       256             // Decrypted bytes held for byte-wise reads
+
+static mbedtls_entropy_context  _entropy;
+static mbedtls_ctr_drbg_context _drbg;
+static mbedtls_x509_crt         _pinned;
+static mbedtls_ssl_config       _conf;
+static mbedtls_ssl_context      _ssl;
+static mbedtls_ssl_session      _session;
+
+static bool        _ready        = false;   // Context set up
+static bool        _broken       = false;   // Setup failed: no TLS this boot
+static bool        _sessionValid = false;   // _session may be offered
+static bool        _open         = false;
+static WiFiClient* _tcp          = nullptr;
+static int         _verifyCalls  = 0;       // Certificates checked in this handshake
+
+static uint8_t _rx[TLS_RX_BUFFER];
+static size_t  _rxLen = 0;
+static size_t  _rxPos = 0;
+
+static TlsStats _stats;
+
+// ---------------------------------------------------------------------------
+// Internal helper: log an mbedTLS error with its description
+// ---------------------------------------------------------------------------
+static void _logError(const char* what, int err) {
+    char text[96];
+    mbedtls_strerror(err, text, sizeof(text));
+    Serial.print(F("[TLS] "));
+    Serial.print(what);
+    Serial.print(F(" failed: -0x"));
+    Serial.print(-err, HEX);
+    Serial.print(F(" "));
+    Serial.println(text);
+}
+
+// ---------------------------------------------------------------------------
+// Internal helpers: move TLS records over the WiFiClient. "Nothing yet"
+// becomes WANT_READ / WANT_WRITE, so the handshake and reads never block.
+// ---------------------------------------------------------------------------
+static int _bioSend(void* ctx, const unsigned char* buf, size_t len) {
+    WiFiClient* tcp = (WiFiClient*)ctx;
+    size_t n = tcp->write(buf, len);
+    if (n > 0) return (int)n;
+    return tcp->connected() ? MBEDTLS_ERR_SSL_WANT_WRITE : MBEDTLS_ERR_SSL_CONN_EOF;
+}
+
+static int _bioRecv(void* ctx, unsigned char* buf, size_t len) {
+    WiFiClient* tcp = (WiFiClient*)ctx;
+    int n = tcp->available() > 0 ? tcp->read(buf, len) : 0;
+    if (n > 0) return n;
+    return tcp->connected() ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_SSL_CONN_EOF;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: certificate check, called per certificate of the chain
+// (full handshakes only). mbedTLS has already checked the chain against
+// the pinned certificate and the host name; only the dates are let go
+// while the clock is unset (no GPS fix since boot).
+// ---------------------------------------------------------------------------
+static int _verifyCert(void*, mbedtls_x509_crt*, int, uint32_t* flags) {
+    _verifyCalls++;
+    if (time(nullptr) < (time_t)CLOCK_SET_EPOCH) {
+        *flags &= ~(MBEDTLS_X509_BADCERT_FUTURE | MBEDTLS_X509_BADCERT_EXPIRED);
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: set up the context once (RNG, pinned certificate,
+// client configuration, record buffers)
+// ---------------------------------------------------------------------------
+static bool _setup() {
+    if (_ready) return true;
+    if (_broken) return false;
+
+    uint32_t heapBefore = ESP.getFreeHeap();
+    mbedtls_entropy_init(&_entropy);
+    mbedtls_ctr_drbg_init(&_drbg);
+    mbedtls_x509_crt_init(&_pinned);
+    mbedtls_ssl_config_init(&_conf);
+    mbedtls_ssl_init(&_ssl);
+    mbedtls_ssl_session_init(&_session);
+
+    static const char pers[] = "sawari-tls";
+    int err = mbedtls_ctr_drbg_seed(&_drbg, mbedtls_entropy_func, &_entropy,
+                                    (const unsigned char*)pers, sizeof(pers) - 1);
+    if (err != 0) {
+        _logError("RNG seed", err);
+    } else if ((err = mbedtls_x509_crt_parse(&_pinned, (const unsigned char*)SERVER_CERT_PEM,
+                                             sizeof(SERVER_CERT_PEM))) != 0) {
+        _logError("Pinned certificate (server_cert.h)", err);
+    } else if ((err = mbedtls_ssl_config_defaults(&_conf, MBEDTLS_SSL_IS_CLIENT,
+                                                  MBEDTLS_SSL_TRANSPORT_STREAM,
+                                                  MBEDTLS_SSL_PRESET_DEFAULT)) != 0) {
+        _logError("TLS configuration", err);
+    } else {
+        mbedtls_ssl_conf_authmode(&_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+        mbedtls_ssl_conf_ca_chain(&_conf, &_pinned, nullptr);
+        mbedtls_ssl_conf_verify(&_conf, _verifyCert, nullptr);
+        mbedtls_ssl_conf_rng(&_conf, mbedtls_ctr_drbg_random, &_drbg);
+        mbedtls_ssl_conf_session_tickets(&_conf, HTTP_TLS_SESSION_REUSE ?
+                                         MBEDTLS_SSL_SESSION_TICKETS_ENABLED :
+                                         MBEDTLS_SSL_SESSION_TICKETS_DISABLED);
+        if ((err = mbedtls_ssl_setup(&_ssl, &_conf)) != 0) {
+            _logError("TLS context", err);
+        }
+    }
+    if (err != 0) {
+        Serial.println(F("[TLS] HTTPS unavailable until reboot"));
+        _broken = true;
+        return false;
+    }
+
+    _stats.heapContext = heapBefore - ESP.getFreeHeap();
+    _ready = true;
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Internal helper: decrypt the next record into _rx if it is used up.
+// @return true if decrypted bytes are waiting
+// ---------------------------------------------------------------------------
+static bool _fill() {
+    if (_rxPos < _rxLen) return true;
+    if (!_open) return false;
+
+    int n = mbedtls_ssl_read(&_ssl, _rx, sizeof(_rx));
+    if (n > 0) {
+        _rxPos = 0;
+        _rxLen = n;
+        return true;
+    }
+    if (n != MBEDTLS_ERR_SSL_WANT_READ && n != MBEDTLS_ERR_SSL_WANT_WRITE) {
+        _open = false;      // close_notify, EOF or a broken record
+    }
+    return false;
+}
+
+// ============================================================================
+// PUBLIC API
+// ============================================================================
+
+bool tlsConnect(WiFiClient* tcp, const char* host, unsigned long timeoutMs) {
+    if (!_setup()) return false;
+
+    mbedtls_ssl_session_reset(&_ssl);
+    mbedtls_ssl_set_hostname(&_ssl, host);
+    mbedtls_ssl_set_bio(&_ssl, tcp, _bioSend, _bioRecv, nullptr);
+#if HTTP_TLS_SESSION_REUSE
+    if (_sessionValid) mbedtls_ssl_set_session(&_ssl, &_session);
+#endif
+    _tcp = tcp;
+    _open = false;
+    _rxLen = _rxPos = 0;
+    _verifyCalls = 0;
+
+    uint32_t heapBefore = ESP.getFreeHeap();
+    uint32_t heapLow = heapBefore;
+    unsigned long start = millis();
+    int err;
+    while ((err = mbedtls_ssl_handshake(&_ssl)) != 0) {
+        uint32_t heap = ESP.getFreeHeap();
+        if (heap < heapLow) heapLow = heap;
+        if ((err != MBEDTLS_ERR_SSL_WANT_READ && err != MBEDTLS_ERR_SSL_WANT_WRITE) ||
+            millis() - start >= timeoutMs) {
+            break;
+        }
+        delay(1);
+    }
+    uint32_t heap = ESP.getFreeHeap();
+    if (heap < heapLow) heapLow = heap;
+    unsigned long elapsed = millis() - start;
+
+    if (heapBefore - heapLow > _stats.heapHandshake) _stats.heapHandshake = heapBefore - heapLow;
+    _stats.heapLowWater = ESP.getMinFreeHeap();
+
+    if (err != 0) {
+        _stats.failures++;
+        _sessionValid = false;      // Start over with a full handshake
+        uint32_t flags = mbedtls_ssl_get_verify_result(&_ssl);
+        if (flags != 0 && flags != (uint32_t)-1) {
+            Serial.print(F("[TLS] Server certificate not trusted (flags 0x"));
+            Serial.print(flags, HEX);
+            Serial.println(F(") — does it match server_cert.h?"));
+        } else if (err == MBEDTLS_ERR_SSL_WANT_READ || err == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            Serial.print(F("[TLS] Handshake timed out after "));
+            Serial.print(elapsed);
+            Serial.println(F(" ms"));
+        } else {
+            _logError("Handshake", err);
+        }
+        return false;
+    }
+
+    bool resumed = _verifyCalls == 0;
+    _stats.handshakes++;
+    _stats.lastMs = elapsed;
+    if (resumed) {
+        _stats.resumed++;
+        _stats.resumedMs += elapsed;
+    } else {
+        _stats.fullMs += elapsed;
+    }
+
+#if HTTP_TLS_SESSION_REUSE
+    // Keep the session for the next connect (a resumed one may come with a
+    // fresh ticket)
+    mbedtls_ssl_session_free(&_session);
+    mbedtls_ssl_session_init(&_session);
+    _sessionValid = mbedtls_ssl_get_session(&_ssl, &_session) == 0;
+#endif
+
+    Serial.print(resumed ? F("[TLS] Session resumed in ") : F("[TLS] Full handshake in "));
+    Serial.print(elapsed);
+    Serial.print(F(" ms ("));
+    Serial.print(mbedtls_ssl_get_version(&_ssl));
+    Serial.print(F(", "));
+    Serial.print(mbedtls_ssl_get_ciphersuite(&_ssl));
+    Serial.print(F("), heap -"));
+    Serial.print(heapBefore - heapLow);
+    Serial.println(F(" bytes"));
+
+    _open = true;
+    return true;
+}
+
+bool tlsConnected() {
+    return _rxPos < _rxLen || (_open && _tcp != nullptr && _tcp->connected());
+}
+
+int tlsAvailable() {
+    return _fill() ? (int)(_rxLen - _rxPos) : 0;
+}
+
+int tlsRead() {
+    return _fill() ? _rx[_rxPos++] : -1;
+}
+
+int tlsRead(uint8_t* buf, size_t len) {
+    if (!_fill()) return -1;
+    size_t n = _rxLen - _rxPos;
+    if (n > len) n = len;
+    memcpy(buf, _rx + _rxPos, n);
+    _rxPos += n;
+    return (int)n;
+}
+
+size_t tlsWrite(const uint8_t* buf, size_t len) {
+    size_t done = 0;
+    unsigned long start = millis();
+    while (_open && done < len) {
+        int n = mbedtls_ssl_write(&_ssl, buf + done, len - done);
+        if (n > 0) {
+            done += n;
+            continue;
+        }
+        if ((n != MBEDTLS_ERR_SSL_WANT_READ && n != MBEDTLS_ERR_SSL_WANT_WRITE) ||
+            millis() - start >= HTTP_TIMEOUT) {
+            _open = false;
+            break;
+        }
+        delay(1);
+    }
+    return done;
+}
+
+void tlsStop() {
+    if (_open) mbedtls_ssl_close_notify(&_ssl);     // Best effort
+    _open = false;
+    _rxLen = _rxPos = 0;
+}
+
+#else
+
+// HTTP_TLS off: nothing to connect; statistics stay zero
+bool tlsConnect(WiFiClient*, const char*, unsigned long) { return false; }
+bool tlsConnected() { return false; }
+int tlsAvailable() { return 0; }
+int tlsRead() { return -1; }
+int tlsRead(uint8_t*, size_t) { return -1; }
+size_t tlsWrite(const uint8_t*, size_t) { return 0; }
+void tlsStop() {}
+
+static TlsStats _stats;
+
+#endif
+
+void tlsGetStats(TlsStats* stats) {
+    *stats = _stats;
+}
+
+void tlsLogStats() {
+    Serial.print(F("[TLS] "));
+    Serial.print(_stats.handshakes);
+    Serial.print(F(" handshakes ("));
+    Serial.print(_stats.resumed);
+    Serial.print(F(" resumed), "));
+    Serial.print(_stats.failures);
+    Serial.println(F(" failed"));
+
+    uint32_t full = _stats.handshakes - _stats.resumed;
+    Serial.print(F("[TLS] Average: full "));
+    Serial.print(full > 0 ? _stats.fullMs / full : 0);
+    Serial.print(F(" ms, resumed "));
+    Serial.print(_stats.resumed > 0 ? _stats.resumedMs / _stats.resumed : 0);
+    Serial.println(F(" ms"));
+
+    Serial.print(F("[TLS] Heap: context "));
+    Serial.print(_stats.heapContext);
+    Serial.print(F(" bytes, handshake peak +"));
+    Serial.print(_stats.heapHandshake);
+    Serial.print(F(" bytes, lowest free "));
+    Serial.println(_stats.heapLowWater);
+}
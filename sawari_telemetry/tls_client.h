@@ -0,0 +1,90 @@
+/**
+ * ============================================================================
+ * SAWARI Bus Telemetry Device - TLS Client Header
+ * ============================================================================
+ * TLS (mbedTLS) on top of the keep-alive TCP connection to the API host,
+ * for HTTPS (HTTP_TLS in config.h). One connection at a time; the network
+ * handler opens the TCP connection and reads / writes through here.
+ *
+ * The server must present a chain that ends in the certificate pinned in
+ * server_cert.h. The session of the last handshake is kept in RAM and
+ * offered on the next connect, so reconnects resume it instead of running
+ * a full handshake.
+ * ============================================================================
+ */
+
+#ifndef TLS_CLIENT_H
+#define TLS_CLIENT_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+// Handshake counters and timings since boot (tlsGetStats)
+struct TlsStats {
+    uint32_t handshakes;        // Completed handshakes
+    uint32_t resumed;           // ... of those abbreviated (session resumed)
+    uint32_t failures;          // Handshakes that failed or timed out
+    uint32_t fullMs;            // Total time of the full handshakes
+    uint32_t resumedMs;         // Total time of the abbreviated ones
+    uint32_t lastMs;            // Time of the last handshake
+    uint32_t heapContext;       // Heap held by the TLS context (buffers, pinned certificate)
+    uint32_t heapHandshake;     // Most heap a handshake took on top (sampled)
+    uint32_t heapLowWater;      // Lowest free heap since boot
+};
+
+/**
+ * Run the TLS handshake on an open TCP connection, resuming the last
+ * session if there is one. Sets up the TLS context on first use.
+ * @param tcp        connected client; used until tlsStop()
+ * @param host       server name (SNI and certificate name check)
+ * @param timeoutMs  limit for the whole handshake
+ * @return true if the connection is encrypted and the server trusted
+ */
+bool tlsConnect(WiFiClient* tcp, const char* host, unsigned long timeoutMs);
+
+/**
+ * Check whether the TLS connection is open (decrypted bytes still
+ * unread count as open).
+ */
+bool tlsConnected();
+
+/**
+ * Decrypted bytes ready to read without waiting (0 if none yet).
+ */
+int tlsAvailable();
+
+/**
+ * Read one decrypted byte.
+ * @return the byte, or -1 if none is available
+ */
+int tlsRead();
+
+/**
+ * Read up to `len` decrypted bytes.
+ * @return bytes read, or -1 if none are available
+ */
+int tlsRead(uint8_t* buf, size_t len);
+
+/**
+ * Encrypt and send `len` bytes (waits up to HTTP_TIMEOUT for the socket).
+ * @return bytes sent; less than `len` means the connection failed
+ */
+size_t tlsWrite(const uint8_t* buf, size_t len);
+
+/**
+ * Close the TLS connection (close_notify). The TCP connection is left to
+ * the caller; the session is kept for the next tlsConnect().
+ */
+void tlsStop();
+
+/**
+ * Copy the handshake statistics.
+ */
+void tlsGetStats(TlsStats* stats);
+
+/**
+ * Print the handshake statistics (serial console).
+ */
+void tlsLogStats();
+
+#endif // TLS_CLIENT_H
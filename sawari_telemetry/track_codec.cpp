@@ -0,0 +1,330 @@
+/**
+ * ============================================================================
+ * SAWARI Bus Telemetry Device - Track Codec Implementation
+ * ============================================================================
+ *
+ * Keyframe + zig-zag varint delta encoding for GPS tracks.
+ *
+ * Consecutive fixes from a bus differ by a few metres and a few seconds,
+ * so after the keyframe most fields fit in one or two bytes, and fields
+ * that did not change (satellites, HDOP, a stopped bus) cost nothing but
+ * a bit in the mask byte. Sizes at a 5-second cadence:
+ *   - Route 1 trace (stops and traffic halts included, track_codec_test):
+ *     8.3 bytes per sample in framed blocks, vs a 32-byte staging record
+ *     (27-byte TrackPoint) and ~184 bytes as a JSON payload
+ *   - Stationary bus: 1 byte per sample
+ *
+ * Field order (varint order) and mask bit:
+ *   0 latitude, 1 longitude, 2 timestamp (delta-of-delta), 3 altitude,
+ *   4 speed, 5 direction (wrapped at 360°): bits 0-5
+ *   6 satellites, 7 hdop: bit 6, both written when either changed
+ *   8 seq (delta from previous + 1): bit 7
+ *
+ * All arithmetic is done on uint32 bit patterns, so deltas wrap
+ * consistently on both sides and no field can overflow the codec.
+ * ============================================================================
+ */
+
+#include "track_codec.h"
+
+static_assert(TRACK_BLOCK_SAMPLES >= 1 && TRACK_BLOCK_SAMPLES <= 255,
+              "TRACK_BLOCK_SAMPLES must fit in the block's count byte");
+
+// ---------------------------------------------------------------------------
+// Internal helpers: varint / zig-zag primitives
+// ---------------------------------------------------------------------------
+static size_t _putVarint(uint8_t* out, uint32_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+static bool _getVarint(TrackDecoder* dec, uint32_t* value) {
+    uint32_t result = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (dec->pos >= dec->len) return false;
+        uint8_t b = dec->buf[dec->pos++];
+        result |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;   // More than 5 bytes: malformed
+}
+
+static inline uint32_t _zigzag(int32_t v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t _unzigzag(uint32_t v) {
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+// ---------------------------------------------------------------------------
+// Internal helpers: TrackPoint <-> field array (uint32 bit patterns)
+// ---------------------------------------------------------------------------
+// Mask bit of each field
+static const uint8_t _maskBit[TRACK_FIELD_COUNT] = { 0, 1, 2, 3, 4, 5, 6, 6, 7 };
+
+static void _toFields(const TrackPoint* p, uint32_t f[TRACK_FIELD_COUNT]) {
+    f[0] = (uint32_t)p->latitude;
+    f[1] = (uint32_t)p->longitude;
+    f[2] = p->timestamp;
+    f[3] = (uint32_t)p->altitude;
+    f[4] = p->speed;
+    f[5] = p->direction;
+    f[6] = p->satellites;
+    f[7] = p->hdop;
+    f[8] = p->seq;
+}
+
+static void _fromFields(const uint32_t f[TRACK_FIELD_COUNT], TrackPoint* p) {
+    p->latitude   = (int32_t)f[0];
+    p->longitude  = (int32_t)f[1];
+    p->timestamp  = f[2];
+    p->altitude   = (int32_t)f[3];
+    p->speed      = (uint16_t)f[4];
+    p->direction  = (uint16_t)f[5];
+    p->satellites = (uint8_t)f[6];
+    p->hdop       = (uint16_t)f[7];
+    p->seq        = f[8];
+}
+
+// Shortest signed difference between two headings (tenths of a degree)
+static int32_t _headingDelta(uint32_t cur, uint32_t prev) {
+    int32_t d = (int32_t)cur - (int32_t)prev;
+    if (d > 1800)  d -= 3600;
+    if (d < -1800) d += 3600;
+    return d;
+}
+
+// ============================================================================
+// PUBLIC API
+// ============================================================================
+
+/**
+ * TelemetryData → TrackPoint (rounded, clamped to the field ranges).
+ */
+void trackPointFromTelemetry(const TelemetryData* data, TrackPoint* point) {
+    point->satellites = (uint8_t)constrain(data->satellites, 0, 255);
+    point->hdop       = (uint16_t)constrain(lround(data->hdop * 10.0), 0L, 65535L);
+    point->latitude   = (int32_t)lround(data->latitude * 1e6);
+    point->longitude  = (int32_t)lround(data->longitude * 1e6);
+    point->timestamp  = gpsTimestampToEpoch(data->timestamp);
+    point->altitude   = (int32_t)lround(data->altitude * 10.0);
+    point->speed      = (uint16_t)constrain(lround(data->speed * 10.0), 0L, 65535L);
+    point->direction  = (uint16_t)(lround(data->direction * 10.0) % 3600);
+    point->seq        = data->seq;
+}
+
+/**
+ * TrackPoint → TelemetryData.
+ */
+void trackPointToTelemetry(const TrackPoint* point, TelemetryData* data) {
+    data->latitude   = point->latitude / 1e6;
+    data->longitude  = point->longitude / 1e6;
+    data->speed      = point->speed / 10.0;
+    data->direction  = point->direction / 10.0;
+    data->altitude   = point->altitude / 10.0;
+    data->satellites = point->satellites;
+    data->hdop       = point->hdop / 10.0;
+    data->seq        = point->seq;
+    gpsEpochToTimestamp(point->timestamp, data->timestamp, sizeof(data->timestamp));
+}
+
+/**
+ * Reset the encoder and write the block header.
+ */
+void trackEncoderBegin(TrackEncoder* enc, uint8_t* buf) {
+    enc->buf = buf;
+    enc->buf[0] = TRACK_BLOCK_VERSION;
+    enc->buf[1] = 0;
+    enc->len = 2;
+    enc->count = 0;
+    enc->lastDelta = 0;
+}
+
+/**
+ * Append one sample: the first becomes the keyframe, the rest are deltas.
+ */
+bool trackEncoderAdd(TrackEncoder* enc, const TrackPoint* point) {
+    if (enc->count >= TRACK_BLOCK_SAMPLES) return false;
+
+    uint32_t cur[TRACK_FIELD_COUNT];
+    _toFields(point, cur);
+
+    if (enc->count == 0) {
+        // Keyframe: every field as an absolute value
+        for (int i = 0; i < TRACK_FIELD_COUNT; i++) {
+            enc->len += _putVarint(enc->buf + enc->len, _zigzag((int32_t)cur[i]));
+        }
+    } else {
+        uint32_t prev[TRACK_FIELD_COUNT];
+        _toFields(&enc->last, prev);
+
+        uint32_t delta = cur[2] - prev[2];
+        int32_t d[TRACK_FIELD_COUNT];
+        for (int i = 0; i < TRACK_FIELD_COUNT; i++) {
+            d[i] = (int32_t)(cur[i] - prev[i]);
+        }
+        d[2] = (int32_t)(delta - enc->lastDelta);
+        d[5] = _headingDelta(cur[5], prev[5]);
+        d[8] = (int32_t)(cur[8] - prev[8] - 1);
+        enc->lastDelta = delta;
+
+        uint8_t mask = 0;
+        for (int i = 0; i < TRACK_FIELD_COUNT; i++) {
+            if (d[i] != 0) mask |= (1 << _maskBit[i]);
+        }
+        enc->buf[enc->len++] = mask;
+        for (int i = 0; i < TRACK_FIELD_COUNT; i++) {
+            if (mask & (1 << _maskBit[i])) {
+                enc->len += _putVarint(enc->buf + enc->len, _zigzag(d[i]));
+            }
+        }
+    }
+
+    enc->last = *point;
+    enc->count++;
+    enc->buf[1] = enc->count;
+    return true;
+}
+
+/**
+ * Validate the block header and prepare to decode.
+ */
+bool trackDecoderBegin(TrackDecoder* dec, const uint8_t* block, size_t len) {
+    if (len < 2 || block[0] != TRACK_BLOCK_VERSION || block[1] == 0) {
+        return false;
+    }
+    dec->buf = block;
+    dec->len = len;
+    dec->pos = 2;
+    dec->count = block[1];
+    dec->index = 0;
+    dec->lastDelta = 0;
+    return true;
+}
+
+/**
+ * Decode the next sample (keyframe first, then deltas).
+ */
+bool trackDecoderNext(TrackDecoder* dec, TrackPoint* point) {
+    if (dec->index >= dec->count) return false;
+
+    uint32_t f[TRACK_FIELD_COUNT] = {0};
+    uint32_t v;
+
+    if (dec->index == 0) {
+        for (int i = 0; i < TRACK_FIELD_COUNT; i++) {
+            if (!_getVarint(dec, &v)) return false;
+            f[i] = (uint32_t)_unzigzag(v);
+        }
+    } else {
+        if (dec->pos >= dec->len) return false;
+        uint8_t mask = dec->buf[dec->pos++];
+
+        int32_t d[TRACK_FIELD_COUNT] = {0};
+        for (int i = 0; i < TRACK_FIELD_COUNT; i++) {
+            if (mask & (1 << _maskBit[i])) {
+                if (!_getVarint(dec, &v)) return false;
+                d[i] = _unzigzag(v);
+            }
+        }
+
+        _toFields(&dec->last, f);
+        dec->lastDelta += (uint32_t)d[2];
+        f[2] += dec->lastDelta;
+        for (int i = 0; i < TRACK_FIELD_COUNT; i++) {
+            if (i != 2 && i != 5) f[i] += (uint32_t)d[i];
+        }
+        f[5] = (uint32_t)(((int32_t)f[5] + d[5] + 3600) % 3600);
+        f[8] += 1;
+    }
+
+    _fromFields(f, point);
+    dec->last = *point;
+    dec->index++;
+    return true;
+}
+
+/**
+ * CRC32 (IEEE 802.3, reflected) used to check blocks and records on flash.
+ */
+uint32_t trackCrc32(const uint8_t* data, size_t len) {
+    uint32_t crc = 0xFFFFFFFFUL;
+    while (len--) {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320UL & (0UL - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+// ============================================================================
+// TRACK THINNING
+// ============================================================================
+
+// Metres per 1e-6 degree of latitude
+#define TRACK_METRES_PER_E6     0.11132f
+
+// ---------------------------------------------------------------------------
+// Internal helper: synchronized Euclidean distance of p from the segment
+// a→b, i.e. the distance to where a bus moving steadily from a to b would
+// have been at p's timestamp. Uses a flat projection (fine over a few km).
+// ---------------------------------------------------------------------------
+static float _sedMetres(const TrackPoint* a, const TrackPoint* b,
+                        const TrackPoint* p, float lonScale) {
+    float span = (float)(int32_t)(b->timestamp - a->timestamp);
+    float r = 0.0f;
+    if (span > 0.0f) {
+        r = (float)(int32_t)(p->timestamp - a->timestamp) / span;
+        r = constrain(r, 0.0f, 1.0f);
+    }
+    float dx = (float)(p->longitude - a->longitude) - r * (float)(b->longitude - a->longitude);
+    float dy = (float)(p->latitude - a->latitude) - r * (float)(b->latitude - a->latitude);
+    dx *= lonScale;
+    dy *= TRACK_METRES_PER_E6;
+    return sqrtf(dx * dx + dy * dy);
+}
+
+void trackSimplify(const TrackPoint* points, int count, float toleranceM, bool* keep) {
+    if (count == 0) return;
+    keep[0] = true;
+    keep[count - 1] = true;
+
+    float lonScale = TRACK_METRES_PER_E6 * cosf(points[0].latitude * 1e-6f * DEG_TO_RAD);
+
+    // Douglas-Peucker without recursion: each pass splits every span
+    // between kept samples at its worst sample until all are in tolerance
+    bool split = true;
+    while (split) {
+        split = false;
+        int a = 0;
+        while (a < count - 1) {
+            int b = a + 1;
+            while (!keep[b]) b++;
+
+            float worst = toleranceM;
+            int worstIndex = -1;
+            for (int k = a + 1; k < b; k++) {
+                float d = _sedMetres(&points[a], &points[b], &points[k], lonScale);
+                if (d > worst) {
+                    worst = d;
+                    worstIndex = k;
+                }
+            }
+            if (worstIndex >= 0) {
+                keep[worstIndex] = true;
+                split = true;
+            }
+            a = b;
+        }
+    }
+}
@@ -0,0 +1,134 @@
+/**
+ * ============================================================================
+ * SAWARI Bus Telemetry Device - Track Codec Header
+ * ============================================================================
+ * Compact encoding of GPS fixes for the offline queue and block uploads.
+ *
+ * A track block is a keyframe (one full sample) followed by delta-encoded
+ * samples. Each delta sample starts with a field mask byte; only fields
+ * that changed are written, as zig-zag varints. Timestamps are stored as
+ * delta-of-delta, so a steady 5-second cadence costs nothing, and the
+ * sequence number is stored relative to "previous + 1", so consecutive
+ * fixes cost nothing either.
+ *
+ * Block layout:
+ *   [0]     TRACK_BLOCK_VERSION
+ *   [1]     sample count (1..TRACK_BLOCK_SAMPLES)
+ *   [2..]   keyframe: 9 varints (all fields, absolute values)
+ *   [...]   per sample: mask byte + one varint per field of a set bit
+ * ============================================================================
+ */
+
+#ifndef TRACK_CODEC_H
+#define TRACK_CODEC_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "gps_handler.h"
+
+// Block format version (first byte of every encoded block)
+#define TRACK_BLOCK_VERSION     4
+
+// Number of varint fields in a TrackPoint (satellites and hdop share a
+// mask bit)
+#define TRACK_FIELD_COUNT       9
+
+// Worst-case encoded size of a block holding TRACK_BLOCK_SAMPLES samples:
+// header + keyframe + (mask + every field as a 5-byte varint) per sample
+#define TRACK_BLOCK_MAX_BYTES   (2 + TRACK_FIELD_COUNT * 5 + \
+                                 (TRACK_BLOCK_SAMPLES - 1) * (1 + TRACK_FIELD_COUNT * 5))
+
+/**
+ * One GPS fix as scaled integers (same precision as the JSON payload).
+ * Packed so it can also be stored verbatim as a fixed-width record.
+ */
+struct __attribute__((packed)) TrackPoint {
+    uint8_t  satellites;
+    uint16_t hdop;          // x10
+    int32_t  latitude;      // degrees x1e6
+    int32_t  longitude;     // degrees x1e6
+    uint32_t timestamp;     // Unix time (UTC seconds)
+    int32_t  altitude;      // meters x10
+    uint16_t speed;         // km/h x10
+    uint16_t direction;     // degrees x10 (0-3599)
+    uint32_t seq;           // Per-device sequence number (0 = none)
+};
+
+/**
+ * Incremental block encoder. Samples are appended until the block is full.
+ */
+struct TrackEncoder {
+    uint8_t*   buf;         // Output buffer (TRACK_BLOCK_MAX_BYTES)
+    size_t     len;         // Bytes used so far
+    uint8_t    count;       // Samples in the block
+    TrackPoint last;        // Previous sample (delta base)
+    uint32_t   lastDelta;   // Previous timestamp delta
+};
+
+/**
+ * Sequential block decoder.
+ */
+struct TrackDecoder {
+    const uint8_t* buf;
+    size_t     len;
+    size_t     pos;
+    uint8_t    count;       // Samples in the block
+    uint8_t    index;       // Next sample to decode
+    TrackPoint last;
+    uint32_t   lastDelta;
+};
+
+/** Convert a TelemetryData sample to scaled integers. */
+void trackPointFromTelemetry(const TelemetryData* data, TrackPoint* point);
+
+/** Convert scaled integers back to a TelemetryData sample. */
+void trackPointToTelemetry(const TrackPoint* point, TelemetryData* data);
+
+/**
+ * Start a new block in the given buffer.
+ * @param enc  encoder state
+ * @param buf  output buffer of at least TRACK_BLOCK_MAX_BYTES bytes
+ */
+void trackEncoderBegin(TrackEncoder* enc, uint8_t* buf);
+
+/**
+ * Append one sample to the block.
+ * @return false if the block already holds TRACK_BLOCK_SAMPLES samples
+ */
+bool trackEncoderAdd(TrackEncoder* enc, const TrackPoint* point);
+
+/**
+ * Choose which samples to keep when thinning a track (Douglas-Peucker on
+ * the synchronized Euclidean distance). Every dropped sample lies within
+ * toleranceM metres of the position interpolated in time between the kept
+ * samples around it, so turns, stops and speed changes survive and the
+ * original track can be rebuilt within that bound. The first and last
+ * samples are always kept.
+ *
+ * @param points      samples in time order
+ * @param count       number of samples
+ * @param toleranceM  maximum position error in metres
+ * @param keep        in: true for samples that must be kept;
+ *                    out: true for each sample to keep
+ */
+void trackSimplify(const TrackPoint* points, int count, float toleranceM, bool* keep);
+
+/**
+ * Start decoding a block.
+ * @return false if the header is invalid (wrong version, empty, truncated)
+ */
+bool trackDecoderBegin(TrackDecoder* dec, const uint8_t* block, size_t len);
+
+/**
+ * Decode the next sample.
+ * @return false when the block is exhausted or malformed
+ */
+bool trackDecoderNext(TrackDecoder* dec, TrackPoint* point);
+
+/**
+ * CRC32 (IEEE 802.3) of a byte range. Guards blocks and records stored on
+ * flash (offline queue frames, staging records, archive frames).
+ */
+uint32_t trackCrc32(const uint8_t* data, size_t len);
+
+#endif // TRACK_CODEC_H
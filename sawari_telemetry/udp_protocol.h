@@ -0,0 +1,63 @@
+/**
+ * ============================================================================
+ * SAWARI Bus Telemetry Device - UDP Telemetry Protocol
+ * ============================================================================
+ * Datagram format shared by the firmware (network_handler.cpp, UDP_TELEMETRY)
+ * and the receiver (tools/sawari-udp-receiver.cpp). Plain C types only, no
+ * Arduino dependencies, so the host tool can include it as-is.
+ *
+ * Every live fix gets the next sequence number of the session. A session
+ * is one boot of the device (random id), so numbers restart safely.
+ *
+ * DATA (device -> receiver):
+ *   [UdpHeader][first seq u32][track block][CRC32]
+ *   The track block (track_codec.h) holds fixes first..first+count-1.
+ *   Each datagram repeats every fix still unacknowledged (oldest first,
+ *   at most UDP_WINDOW), so one lost datagram costs no round trip: the
+ *   next one carries its fixes again.
+ *
+ * ACK (receiver -> device, one per DATA):
+ *   [UdpHeader][range count u8][UdpRange x count][CRC32]
+ *   Ranges of sequence numbers the receiver holds, newest first. The
+ *   device drops acknowledged fixes from its window; fixes never
+ *   acknowledged go to the offline queue (HTTP) after UDP_ACK_TIMEOUT_MS.
+ *
+ * All integers little-endian. The CRC32 (IEEE 802.3, trackCrc32) covers
+ * every byte before it.
+ * ============================================================================
+ */
+
+#ifndef UDP_PROTOCOL_H
+#define UDP_PROTOCOL_H
+
+#include <stdint.h>
+
+#define UDP_PROTOCOL_VERSION    1
+
+// --- Datagram types ---
+#define UDP_DATA                'D'
+#define UDP_ACK                 'A'
+
+// Ranges per ACK (8 bytes each)
+#define UDP_MAX_ACK_RANGES      16
+
+// Largest datagram either side sends or accepts
+#define UDP_MAX_DATAGRAM        512
+
+#define UDP_TRAILER_BYTES       4       // CRC32
+
+/** Start of every datagram. */
+struct __attribute__((packed)) UdpHeader {
+    uint8_t  version;       // UDP_PROTOCOL_VERSION
+    uint8_t  type;          // UDP_DATA / UDP_ACK
+    uint32_t busId;
+    uint32_t session;       // Random per boot
+};
+
+/** ACK: inclusive range of received sequence numbers. */
+struct __attribute__((packed)) UdpRange {
+    uint32_t first;
+    uint32_t last;
+};
+
+#endif // UDP_PROTOCOL_H
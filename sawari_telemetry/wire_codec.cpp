@@ -0,0 +1,228 @@
+/**
+ * ============================================================================
+ * SAWARI Bus Telemetry Device - Wire Codec Implementation
+ * ============================================================================
+ *
+ * Binary batch layout (both formats): a 16-bit array header whose count
+ * is filled in by wireBatchEnd(), followed by the records:
+ *   CBOR:         99 nn nn  <record> ...
+ *   MessagePack:  DC nn nn  <record> ...
+ *
+ * Record, CBOR:         8A  <8 integers>  C1 <uint>        (or F6 = null)  <seq>
+ * Record, MessagePack:  9A  <8 integers>  D6 FF <4 bytes>  (or C0 = nil)  <seq>
+ *
+ * Multi-byte values are big-endian in both formats.
+ * ============================================================================
+ */
+
+#include "wire_codec.h"
+#include "track_codec.h"
+
+#if WIRE_FORMAT == WIRE_FORMAT_JSON
+
+// Batch framing: {"data":[ ... ]} and a NUL terminator
+#define BATCH_HEAD      "{\"data\":["
+#define BATCH_HEAD_LEN  9
+#define BATCH_TAIL_LEN  3
+
+#else
+
+#define BATCH_HEAD_LEN  3
+#define BATCH_TAIL_LEN  0
+
+static uint8_t* _putBE16(uint8_t* p, uint16_t v) {
+    *p++ = (uint8_t)(v >> 8);
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static uint8_t* _putBE32(uint8_t* p, uint32_t v) {
+    p = _putBE16(p, (uint16_t)(v >> 16));
+    return _putBE16(p, (uint16_t)v);
+}
+
+#endif
+
+#if WIRE_FORMAT == WIRE_FORMAT_CBOR
+
+#define ARRAY_16        0x99        // Array, 16-bit length follows
+#define RECORD_HEAD     0x8A        // Array of 10
+#define TAG_EPOCH       0xC1        // Tag 1: epoch-based date/time
+#define NULL_VALUE      0xF6
+
+// ---------------------------------------------------------------------------
+// Internal helper: initial byte + argument, shortest form (RFC 8949 §3)
+// ---------------------------------------------------------------------------
+static uint8_t* _putHead(uint8_t* p, uint8_t major, uint32_t v) {
+    if (v < 24) {
+        *p++ = major | (uint8_t)v;
+    } else if (v <= 0xFF) {
+        *p++ = major | 24;
+        *p++ = (uint8_t)v;
+    } else if (v <= 0xFFFF) {
+        *p++ = major | 25;
+        p = _putBE16(p, (uint16_t)v);
+    } else {
+        *p++ = major | 26;
+        p = _putBE32(p, v);
+    }
+    return p;
+}
+
+static uint8_t* _putInt(uint8_t* p, int32_t v) {
+    // Major type 0 (unsigned) or 1 (negative, argument = -1 - v)
+    return v >= 0 ? _putHead(p, 0x00, (uint32_t)v)
+                  : _putHead(p, 0x20, (uint32_t)(-1 - v));
+}
+
+static uint8_t* _putTime(uint8_t* p, uint32_t epoch) {
+    if (epoch == 0) {
+        *p++ = NULL_VALUE;
+        return p;
+    }
+    *p++ = TAG_EPOCH;
+    return _putHead(p, 0x00, epoch);
+}
+
+static uint8_t* _putSeq(uint8_t* p, uint32_t seq) {
+    return _putHead(p, 0x00, seq);
+}
+
+#elif WIRE_FORMAT == WIRE_FORMAT_MSGPACK
+
+#define ARRAY_16        0xDC
+#define RECORD_HEAD     0x9A        // fixarray of 10
+#define NULL_VALUE      0xC0
+
+// ---------------------------------------------------------------------------
+// Internal helper: integer, shortest form
+// ---------------------------------------------------------------------------
+static uint8_t* _putInt(uint8_t* p, int32_t v) {
+    if (v >= 0) {
+        if (v < 0x80) {
+            *p++ = (uint8_t)v;                  // positive fixint
+        } else if (v <= 0xFF) {
+            *p++ = 0xCC;
+            *p++ = (uint8_t)v;
+        } else if (v <= 0xFFFF) {
+            *p++ = 0xCD;
+            p = _putBE16(p, (uint16_t)v);
+        } else {
+            *p++ = 0xCE;
+            p = _putBE32(p, (uint32_t)v);
+        }
+    } else if (v >= -32) {
+        *p++ = (uint8_t)v;                      // negative fixint
+    } else if (v >= -128) {
+        *p++ = 0xD0;
+        *p++ = (uint8_t)v;
+    } else if (v >= -32768) {
+        *p++ = 0xD1;
+        p = _putBE16(p, (uint16_t)v);
+    } else {
+        *p++ = 0xD2;
+        p = _putBE32(p, (uint32_t)v);
+    }
+    return p;
+}
+
+static uint8_t* _putTime(uint8_t* p, uint32_t epoch) {
+    if (epoch == 0) {
+        *p++ = NULL_VALUE;
+        return p;
+    }
+    *p++ = 0xD6;            // fixext 4
+    *p++ = 0xFF;            // type -1: timestamp
+    return _putBE32(p, epoch);
+}
+
+static uint8_t* _putSeq(uint8_t* p, uint32_t seq) {
+    if (seq <= 0x7FFFFFFF) return _putInt(p, (int32_t)seq);
+    *p++ = 0xCE;            // uint 32
+    return _putBE32(p, seq);
+}
+
+#endif
+
+#if WIRE_FORMAT != WIRE_FORMAT_JSON
+
+// ---------------------------------------------------------------------------
+// Internal helper: one fix as a 10-element array (at most
+// WIRE_RECORD_MAX_BYTES)
+// ---------------------------------------------------------------------------
+static size_t _encodeRecord(const TelemetryData* data, uint8_t* out) {
+    TrackPoint pt;
+    trackPointFromTelemetry(data, &pt);
+
+    uint8_t* p = out;
+    *p++ = RECORD_HEAD;
+    p = _putInt(p, BUS_ID);
+    p = _putInt(p, pt.latitude);
+    p = _putInt(p, pt.longitude);
+    p = _putInt(p, pt.speed);
+    p = _putInt(p, pt.direction);
+    p = _putInt(p, pt.altitude);
+    p = _putInt(p, pt.satellites);
+    p = _putInt(p, pt.hdop);
+    p = _putTime(p, pt.timestamp);
+    p = _putSeq(p, pt.seq);
+    return p - out;
+}
+
+#endif
+
+// ============================================================================
+// PUBLIC API
+// ============================================================================
+
+size_t wireEncodePayload(const TelemetryData* data, uint8_t* buf, size_t len) {
+#if WIRE_FORMAT == WIRE_FORMAT_JSON
+    return gpsFormatPayload(data, (char*)buf, len);
+#else
+    if (len < WIRE_RECORD_MAX_BYTES) return 0;
+    return _encodeRecord(data, buf);
+#endif
+}
+
+void wireBatchBegin(WireBatch* batch, uint8_t* buf, size_t max) {
+    batch->buf = buf;
+    batch->max = max;
+    batch->len = BATCH_HEAD_LEN;
+    batch->count = 0;
+#if WIRE_FORMAT == WIRE_FORMAT_JSON
+    memcpy(buf, BATCH_HEAD, BATCH_HEAD_LEN);
+#else
+    buf[0] = ARRAY_16;
+#endif
+}
+
+bool wireBatchAdd(WireBatch* batch, const TelemetryData* data) {
+#if WIRE_FORMAT == WIRE_FORMAT_JSON
+    char json[400];
+    size_t n = gpsFormatRecord(data, json, sizeof(json));
+    size_t sep = batch->count > 0 ? 1 : 0;
+    if (batch->len + sep + n + BATCH_TAIL_LEN > batch->max) return false;
+    if (sep) batch->buf[batch->len++] = ',';
+    memcpy(batch->buf + batch->len, json, n);
+    batch->len += n;
+#else
+    if (batch->count == 0xFFFF) return false;
+    uint8_t record[WIRE_RECORD_MAX_BYTES];
+    size_t n = _encodeRecord(data, record);
+    if (batch->len + n > batch->max) return false;
+    memcpy(batch->buf + batch->len, record, n);
+    batch->len += n;
+#endif
+    batch->count++;
+    return true;
+}
+
+size_t wireBatchEnd(WireBatch* batch) {
+#if WIRE_FORMAT == WIRE_FORMAT_JSON
+    memcpy(batch->buf + batch->len, "]}", 3);
+    batch->len += 2;
+#else
+    _putBE16(batch->buf + 1, (uint16_t)batch->count);
+#endif
+    return batch->len;
+}
@@ -0,0 +1,84 @@
+/**
+ * ============================================================================
+ * SAWARI Bus Telemetry Device - Wire Codec Header
+ * ============================================================================
+ * Request bodies for live fixes and offline queue batches, in the format
+ * chosen with WIRE_FORMAT (config.h):
+ *
+ *   WIRE_FORMAT_JSON     {"data":{...}} / {"data":[{...},...]}, as built by
+ *                        gpsFormatPayload() (any gps-device.php)
+ *   WIRE_FORMAT_CBOR     RFC 8949, Content-Type: application/cbor
+ *   WIRE_FORMAT_MSGPACK  MessagePack, Content-Type: application/msgpack
+ *
+ * In the binary formats a fix is an array of 10 integers, the scaled
+ * TrackPoint fields (same precision as the JSON payload):
+ *
+ *   [bus_id, latitude x1e6, longitude x1e6, speed x10, direction x10,
+ *    altitude x10, satellites, hdop x10, timestamp, seq]
+ *
+ * The timestamp is Unix time as the format's own date type: CBOR tag 1
+ * (epoch-based date/time) or the MessagePack timestamp extension (type
+ * -1, 32-bit seconds); null if the fix has no valid time. seq is the
+ * per-device sequence number (0 = none). A live fix is one such array;
+ * a batch is an array of them. Integers use the shortest encoding, so a
+ * fix is ~35 bytes instead of ~200.
+ * ============================================================================
+ */
+
+#ifndef WIRE_CODEC_H
+#define WIRE_CODEC_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "gps_handler.h"
+
+#if WIRE_FORMAT == WIRE_FORMAT_CBOR
+#define WIRE_CONTENT_TYPE       "application/cbor"
+#elif WIRE_FORMAT == WIRE_FORMAT_MSGPACK
+#define WIRE_CONTENT_TYPE       "application/msgpack"
+#else
+#define WIRE_CONTENT_TYPE       "application/json"
+#endif
+
+// Largest encoded binary fix: array head + 9 integers and a timestamp of
+// at most 5 bytes each, plus the timestamp tag / extension header
+#define WIRE_RECORD_MAX_BYTES   53
+
+/**
+ * Batch under construction (offline queue upload).
+ */
+struct WireBatch {
+    uint8_t* buf;           // Output buffer
+    size_t   max;           // Buffer size
+    size_t   len;           // Bytes used so far
+    int      count;         // Records in the batch
+};
+
+/**
+ * Encode one fix as a complete request body.
+ * @param data  telemetry sample
+ * @param buf   output buffer (JSON: at least 400 bytes; binary: at least
+ *              WIRE_RECORD_MAX_BYTES)
+ * @param len   buffer size
+ * @return body length in bytes, 0 if it did not fit
+ */
+size_t wireEncodePayload(const TelemetryData* data, uint8_t* buf, size_t len);
+
+/**
+ * Start a batch body in the given buffer.
+ */
+void wireBatchBegin(WireBatch* batch, uint8_t* buf, size_t max);
+
+/**
+ * Append one fix to the batch.
+ * @return false if it does not fit (the batch is left as it was)
+ */
+bool wireBatchAdd(WireBatch* batch, const TelemetryData* data);
+
+/**
+ * Close the batch.
+ * @return body length in bytes
+ */
+size_t wireBatchEnd(WireBatch* batch);
+
+#endif // WIRE_CODEC_H
@@ -228,6 +228,40 @@ CREATE TABLE suggestions (
     INDEX idx_suggestion_type (type)
 ) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4;
 
+-- =============================================
+-- 10. GPS SAMPLES
+-- Every fix received from GPS devices (live, offline backlog, backfill)
+-- =============================================
+CREATE TABLE gps_samples (
+    sample_id       BIGINT AUTO_INCREMENT PRIMARY KEY,
+    vehicle_id      INT NOT NULL,
+    latitude        DECIMAL(10,6) NOT NULL,
+    longitude       DECIMAL(10,6) NOT NULL,
+    speed           DECIMAL(6,1) DEFAULT NULL,        -- km/h
+    direction       DECIMAL(4,1) DEFAULT NULL,        -- degrees
+    altitude        DECIMAL(7,1) DEFAULT NULL,        -- metres
+    satellites      TINYINT UNSIGNED DEFAULT NULL,
+    hdop            DECIMAL(5,1) DEFAULT NULL,
+    device_ts       DATETIME DEFAULT NULL,            -- fix time (UTC) reported by the device
+    seq             INT UNSIGNED DEFAULT NULL,        -- per-device sequence number (NULL: older firmware)
+    received_at     DATETIME NOT NULL DEFAULT CURRENT_TIMESTAMP,
+    backfill        TINYINT(1) NOT NULL DEFAULT 0,    -- re-sent from the device archive
+    FOREIGN KEY (vehicle_id) REFERENCES vehicles(vehicle_id) ON DELETE CASCADE,
+    INDEX idx_gps_vehicle_time (vehicle_id, device_ts),
+    UNIQUE KEY uq_gps_vehicle_seq (vehicle_id, seq)   -- resends are dropped as duplicates
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4;
+
+-- =============================================
+-- 11. GPS DEVICE SEQUENCE WATERMARK
+-- Highest seq up to which every sample of a device is stored
+-- =============================================
+CREATE TABLE gps_device_seq (
+    vehicle_id      INT PRIMARY KEY,
+    acked_seq       INT UNSIGNED NOT NULL DEFAULT 0,
+    updated_at      DATETIME NOT NULL DEFAULT CURRENT_TIMESTAMP ON UPDATE CURRENT_TIMESTAMP,
+    FOREIGN KEY (vehicle_id) REFERENCES vehicles(vehicle_id) ON DELETE CASCADE
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4;
+
 -- =============================================
 -- DEFAULT ADMIN SEED (password: admin123)
 -- Change this password immediately after first login!
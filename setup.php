@@ -294,6 +294,34 @@ if ($_SERVER['REQUEST_METHOD'] === 'POST' && isset($_POST['run_setup'])) {
                 INDEX idx_suggestion_status (status),
                 INDEX idx_suggestion_type (type)
             ) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4",
+
+            // 10. GPS samples
+            "CREATE TABLE IF NOT EXISTS gps_samples (
+                sample_id       BIGINT AUTO_INCREMENT PRIMARY KEY,
+                vehicle_id      INT NOT NULL,
+                latitude        DECIMAL(10,6) NOT NULL,
+                longitude       DECIMAL(10,6) NOT NULL,
+                speed           DECIMAL(6,1) DEFAULT NULL,
+                direction       DECIMAL(4,1) DEFAULT NULL,
+                altitude        DECIMAL(7,1) DEFAULT NULL,
+                satellites      TINYINT UNSIGNED DEFAULT NULL,
+                hdop            DECIMAL(5,1) DEFAULT NULL,
+                device_ts       DATETIME DEFAULT NULL,
+                seq             INT UNSIGNED DEFAULT NULL,
+                received_at     DATETIME NOT NULL DEFAULT CURRENT_TIMESTAMP,
+                backfill        TINYINT(1) NOT NULL DEFAULT 0,
+                FOREIGN KEY (vehicle_id) REFERENCES vehicles(vehicle_id) ON DELETE CASCADE,
+                INDEX idx_gps_vehicle_time (vehicle_id, device_ts),
+                UNIQUE KEY uq_gps_vehicle_seq (vehicle_id, seq)
+            ) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4",
+
+            // 11. GPS device sequence watermark
+            "CREATE TABLE IF NOT EXISTS gps_device_seq (
+                vehicle_id      INT PRIMARY KEY,
+                acked_seq       INT UNSIGNED NOT NULL DEFAULT 0,
+                updated_at      DATETIME NOT NULL DEFAULT CURRENT_TIMESTAMP ON UPDATE CURRENT_TIMESTAMP,
+                FOREIGN KEY (vehicle_id) REFERENCES vehicles(vehicle_id) ON DELETE CASCADE
+            ) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4",
         ];
 
         // Extra indexes (safe with IF NOT EXISTS on tables, but indexes
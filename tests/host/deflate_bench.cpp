@@ -0,0 +1,158 @@
+/**
+ * SAWARI — Upload Compression Benchmark (host)
+ *
+ * Packs a recorded trace the two ways the offline queue uploads it and
+ * runs deflate_codec.cpp over each body:
+ *
+ *   - JSON batches (wireBatchAdd, QUEUE_FLUSH_BATCH_RECORDS records up to
+ *     QUEUE_BATCH_MAX_BYTES), gzipped as the device does once the server
+ *     takes it (HTTP_COMPRESS_MIN_BYTES and up, only if it saves bytes)
+ *   - track blocks (TRACK_BLOCK_SAMPLES per block), which the device
+ *     sends as they are; their gzip size shows why
+ *
+ * For each it reports the compression ratio, encode time per KB of input
+ * and the body bytes on the wire per sample, next to zlib level 6 as a
+ * reference. Every gzip member is inflated with zlib and must give back
+ * the body it was made from.
+ *
+ * Encode time is host CPU time, so only the ratio between the two
+ * formats carries over to the ESP32; the byte counts are exact.
+ *
+ * Build (from the repository root):
+ *   g++ -std=gnu++17 -O2 -Itests/host/shim -Isawari_telemetry \
+ *       -o deflate_bench tests/host/deflate_bench.cpp tests/host/shim/shim.cpp \
+ *       sawari_telemetry/deflate_codec.cpp sawari_telemetry/wire_codec.cpp \
+ *       sawari_telemetry/track_codec.cpp sawari_telemetry/gps_handler.cpp -lz
+ *
+ * Usage:
+ *   ./deflate_bench [trace.jsonl]   (exit status 0 when every body inflates back)
+ */
+
+#include "config.h"
+#include "deflate_codec.h"
+#include "track_codec.h"
+#include "wire_codec.h"
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+static const int kRounds = 50;      // Encodes per body, for a stable time
+
+typedef std::vector<uint8_t> Body;
+
+static int _failures = 0;
+
+// JSON batch bodies, as the flush builds them
+static std::vector<Body> _jsonBatches(const std::vector<TelemetryData>& fixes) {
+    std::vector<Body> bodies;
+    uint8_t buf[QUEUE_BATCH_MAX_BYTES];
+    size_t i = 0;
+    while (i < fixes.size()) {
+        WireBatch batch;
+        wireBatchBegin(&batch, buf, sizeof(buf));
+        while (i < fixes.size() && batch.count < QUEUE_FLUSH_BATCH_RECORDS &&
+               wireBatchAdd(&batch, &fixes[i])) {
+            i++;
+        }
+        size_t len = wireBatchEnd(&batch);
+        bodies.emplace_back(buf, buf + len);
+    }
+    return bodies;
+}
+
+static std::vector<Body> _trackBlocks(const std::vector<TelemetryData>& fixes) {
+    std::vector<Body> bodies;
+    uint8_t buf[TRACK_BLOCK_MAX_BYTES];
+    size_t i = 0;
+    while (i < fixes.size()) {
+        TrackEncoder enc;
+        trackEncoderBegin(&enc, buf);
+        TrackPoint point;
+        for (int n = 0; n < TRACK_BLOCK_SAMPLES && i < fixes.size(); n++, i++) {
+            trackPointFromTelemetry(&fixes[i], &point);
+            trackEncoderAdd(&enc, &point);
+        }
+        bodies.emplace_back(buf, buf + enc.len);
+    }
+    return bodies;
+}
+
+// Inflate a gzip member with zlib; true if it gives back `expect`
+static bool _inflatesTo(const uint8_t* gz, size_t len, const Body& expect) {
+    Body out(expect.size() + 1);
+    z_stream zs = {};
+    if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK) return false;
+    zs.next_in = (Bytef*)gz;
+    zs.avail_in = (uInt)len;
+    zs.next_out = out.data();
+    zs.avail_out = (uInt)out.size();
+    int rc = inflate(&zs, Z_FINISH);
+    size_t got = zs.total_out;
+    inflateEnd(&zs);
+    return rc == Z_STREAM_END && zs.avail_in == 0 && got == expect.size() &&
+           memcmp(out.data(), expect.data(), got) == 0;
+}
+
+static void _report(const char* label, const std::vector<Body>& bodies, size_t samples,
+                    bool deviceGzips) {
+    size_t raw = 0, packed = 0, zlib6 = 0, wire = 0;
+    double us = 0;
+    std::vector<uint8_t> out(QUEUE_BATCH_MAX_BYTES + DEFLATE_GZIP_OVERHEAD + 64);
+
+    for (const Body& body : bodies) {
+        size_t n = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int r = 0; r < kRounds; r++) {
+            n = deflateGzip(body.data(), body.size(), out.data(), out.size());
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        us += std::chrono::duration<double, std::micro>(t1 - t0).count() / kRounds;
+
+        if (n == 0 || !_inflatesTo(out.data(), n, body)) {
+            printf("FAIL %s: a %zu-byte body does not inflate back\n", label, body.size());
+            _failures++;
+        }
+
+        uLongf zlen = compressBound(body.size());
+        std::vector<uint8_t> z(zlen);
+        compress2(z.data(), &zlen, body.data(), body.size(), 6);
+
+        raw += body.size();
+        packed += n;
+        zlib6 += zlen + DEFLATE_GZIP_OVERHEAD - 6;     // zlib wrapper -> gzip wrapper
+        bool gzip = deviceGzips && body.size() >= HTTP_COMPRESS_MIN_BYTES && n < body.size();
+        wire += gzip ? n : body.size();
+    }
+
+    printf("  %-14s %5zu %9zu %9zu %7.2f %9zu %7.2f %8.1f %10.1f\n", label, bodies.size(),
+           raw, packed, (double)raw / packed, zlib6, (double)raw / zlib6,
+           us / (raw / 1024.0), (double)wire / samples);
+}
+
+int main(int argc, char** argv) {
+    const char* path = argc > 1 ? argv[1] : "tests/host/data/route1_trace.jsonl";
+
+    std::vector<TelemetryData> fixes;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        TelemetryData data;
+        if (gpsParsePayload(line.c_str(), &data)) fixes.push_back(data);
+    }
+    if (fixes.empty()) {
+        printf("No samples in %s\n", path);
+        return 1;
+    }
+
+    printf("Trace: %s, %zu samples; deflate window %d bytes, chain %d\n", path,
+           fixes.size(), 1 << DEFLATE_WINDOW_BITS, DEFLATE_MAX_CHAIN);
+    printf("  %-14s %5s %9s %9s %7s %9s %7s %8s %10s\n", "body", "n", "raw B", "gzip B",
+           "ratio", "zlib-6 B", "ratio", "us/KB", "wire B/smp");
+    _report("JSON batches", _jsonBatches(fixes), fixes.size(), true);
+    _report("track blocks", _trackBlocks(fixes), fixes.size(), false);
+
+    printf("%s\n", _failures ? "FAIL" : "PASS");
+    return _failures ? 1 : 0;
+}
@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+"""
+SAWARI — Ingest Endpoint Stub (host)
+
+Stands in for api/gps-device.php in mqtt_e2e.sh: takes the bodies the
+bridge forwards (JSON live fixes and batches, track blocks), drops samples
+it already holds by (bus_id, seq) as the API does, and writes one JSONL
+row per new sample: {"bus_id", "seq", "t"} (t: seconds since start).
+
+--refuse BUS:SEC answers 503 (Retry-After: 1) to every POST for BUS during
+the SEC seconds after its first one, the way a loaded server sheds.
+
+Usage:
+  python3 tests/host/ingest_stub.py --port 18080 --out rows.jsonl
+                                    [--refuse BUS:SEC]
+"""
+
+import argparse
+import json
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+BLOCK_VERSION = 4
+FIELD_COUNT = 9
+MASK_BIT = [0, 1, 2, 3, 4, 5, 6, 6, 7]     # satellites and hdop share bit 6
+
+
+def unzigzag(v):
+    return (v >> 1) ^ -(v & 1)
+
+
+def track_seqs(block):
+    """Sequence numbers in a track block (sawari_telemetry/track_codec.h)."""
+    if len(block) < 2 or block[0] != BLOCK_VERSION or block[1] == 0:
+        raise ValueError("bad block header")
+    pos = 2
+
+    def varint():
+        nonlocal pos
+        v = shift = 0
+        while True:
+            c = block[pos]
+            pos += 1
+            v |= (c & 0x7F) << shift
+            if not c & 0x80:
+                return v
+            shift += 7
+
+    seqs = []
+    seq = 0
+    for n in range(block[1]):
+        if n == 0:
+            fields = [unzigzag(varint()) for _ in range(FIELD_COUNT)]
+            seq = fields[8] & 0xFFFFFFFF
+        else:
+            mask = block[pos]
+            pos += 1
+            d = [unzigzag(varint()) if mask & (1 << MASK_BIT[i]) else 0
+                 for i in range(FIELD_COUNT)]
+            seq = (seq + d[8] + 1) & 0xFFFFFFFF
+        seqs.append(seq)
+    if pos != len(block):
+        raise ValueError("trailing bytes")
+    return seqs
+
+
+def json_seqs(body):
+    data = json.loads(body)["data"]
+    return [r.get("seq", 0) for r in (data if isinstance(data, list) else [data])]
+
+
+class Ingest:
+    def __init__(self, out, refuse_bus, refuse_for):
+        self.out = out
+        self.refuse_bus = refuse_bus
+        self.refuse_for = refuse_for
+        self.lock = threading.Lock()
+        self.started = time.monotonic()
+        self.first_post = {}
+        self.stored = set()
+
+    def refused(self, bus):
+        now = time.monotonic()
+        first = self.first_post.setdefault(bus, now)
+        return bus == self.refuse_bus and now - first < self.refuse_for
+
+    def store(self, bus, seqs):
+        t = round(time.monotonic() - self.started, 3)
+        for seq in seqs:
+            if (bus, seq) in self.stored:
+                continue
+            self.stored.add((bus, seq))
+            self.out.write(json.dumps({"bus_id": bus, "seq": seq, "t": t}) + "\n")
+        self.out.flush()
+
+
+def handler(ingest):
+    class Handler(BaseHTTPRequestHandler):
+        def reply(self, status, result, extra=()):
+            body = json.dumps(result).encode()
+            self.send_response(status)
+            self.send_header("Content-Type", "application/json")
+            for name, value in extra:
+                self.send_header(name, value)
+            self.end_headers()
+            self.wfile.write(body)
+
+        def do_POST(self):
+            body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+            bus = int(self.headers.get("X-Bus-Id", 0))
+            kind = self.headers.get("Content-Type", "")
+            with ingest.lock:
+                if ingest.refused(bus):
+                    self.reply(503, {"status": "error", "message": "Server busy",
+                                     "control": {"interval_ms": 10000}},
+                               [("Retry-After", "1")])
+                    return
+                try:
+                    if kind == "application/x-sawari-track":
+                        seqs = track_seqs(body)
+                    elif kind == "application/json":
+                        seqs = json_seqs(body)
+                    else:
+                        self.reply(415, {"status": "error", "message": "Unsupported " + kind})
+                        return
+                except (ValueError, KeyError, IndexError):
+                    self.reply(400, {"status": "error", "message": "Malformed body"})
+                    return
+                ingest.store(bus, seqs)
+            self.reply(200, {"status": "success", "acked_seq": max(seqs)})
+
+        def log_message(self, *args):
+            pass
+
+    return Handler
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--port", type=int, default=18080)
+    parser.add_argument("--out", required=True)
+    parser.add_argument("--refuse", default="0:0")
+    args = parser.parse_args()
+    refuse_bus, refuse_for = (int(x) for x in args.refuse.split(":"))
+
+    with open(args.out, "a") as out:
+        ingest = Ingest(out, refuse_bus, refuse_for)
+        server = ThreadingHTTPServer(("127.0.0.1", args.port), handler(ingest))
+        try:
+            server.serve_forever()
+        except KeyboardInterrupt:
+            pass
+
+
+if __name__ == "__main__":
+    main()
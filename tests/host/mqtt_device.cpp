@@ -0,0 +1,118 @@
+/**
+ * SAWARI — MQTT Device (host)
+ *
+ * Runs the firmware's MQTT client (network_handler.cpp built with
+ * MQTT_TRANSPORT) against a broker on the host, the way the sender task
+ * drives it: the first fixes of a trace are published live
+ * (networkMqttPublish / networkMqttPoll, MQTT_MAX_INFLIGHT in flight),
+ * the rest go out as offline queue track blocks (networkSendUpload,
+ * "track"). Exits once the broker acknowledged every fix. mqtt_e2e.sh
+ * runs it against mosquitto and the bridge.
+ *
+ * The bus id and broker port are set at build time (HOST_BUS_ID,
+ * HOST_MQTT_PORT); the broker is 127.0.0.1.
+ *
+ * Build (from the repository root):
+ *   g++ -std=gnu++17 -O1 -Itests/host/shim -Isawari_telemetry \
+ *       -DHOST_BUS_ID=1 -DHOST_MQTT_PORT=18830 \
+ *       -o mqtt_device tests/host/mqtt_device.cpp tests/host/shim/shim.cpp \
+ *       tests/host/shim/wifi_shim.cpp sawari_telemetry/track_codec.cpp \
+ *       sawari_telemetry/deflate_codec.cpp
+ *
+ * Usage:
+ *   ./mqtt_device [trace.jsonl] [live-count]
+ *   (defaults: tests/host/data/route1_trace.jsonl, 400 live fixes)
+ */
+
+#include "config.h"
+
+#ifndef HOST_BUS_ID
+#define HOST_BUS_ID     1
+#endif
+#ifndef HOST_MQTT_PORT
+#define HOST_MQTT_PORT  18830
+#endif
+
+#undef BUS_ID
+#define BUS_ID          HOST_BUS_ID
+#undef MQTT_TRANSPORT
+#define MQTT_TRANSPORT  1
+#undef MQTT_HOST
+#define MQTT_HOST       "127.0.0.1"
+#undef MQTT_PORT
+#define MQTT_PORT       HOST_MQTT_PORT
+
+// One translation unit, so the overrides reach every module that uses them
+#include "network_handler.cpp"
+#include "gps_handler.cpp"
+#include "wire_codec.cpp"
+
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+static const unsigned long kTimeoutMs = 60000;
+
+int main(int argc, char** argv) {
+    const char* path = argc > 1 ? argv[1] : "tests/host/data/route1_trace.jsonl";
+    size_t liveCount = argc > 2 ? (size_t)atoi(argv[2]) : 400;
+
+    std::vector<TelemetryData> fixes;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        TelemetryData data;
+        if (gpsParsePayload(line.c_str(), &data)) fixes.push_back(data);
+    }
+    if (fixes.empty()) {
+        fprintf(stderr, "mqtt_device: no fixes in %s\n", path);
+        return 1;
+    }
+    liveCount = std::min(liveCount, fixes.size());
+
+    // Live fixes: publish while the window has room, hand back PUBACKed ones
+    unsigned long started = millis();
+    size_t next = 0, acked = 0;
+    while (acked < liveCount) {
+        while (next < liveCount && networkMqttPublish(&fixes[next])) next++;
+        acked += networkMqttPoll([](const TelemetryData*, bool) { return true; });
+        if (millis() - started > kTimeoutMs) {
+            fprintf(stderr, "mqtt_device: bus %d: %zu of %zu live fixes acknowledged\n",
+                    BUS_ID, acked, liveCount);
+            return 1;
+        }
+        usleep(MQTT_POLL_MS * 1000);
+    }
+
+    // The rest: track blocks, retried until the broker takes each one
+    size_t blocks = 0;
+    uint8_t buf[TRACK_BLOCK_MAX_BYTES];
+    for (size_t i = liveCount; i < fixes.size(); ) {
+        TrackEncoder enc;
+        trackEncoderBegin(&enc, buf);
+        size_t end = i;
+        TrackPoint point;
+        while (end < fixes.size() && end - i < TRACK_BLOCK_SAMPLES) {
+            trackPointFromTelemetry(&fixes[end], &point);
+            if (!trackEncoderAdd(&enc, &point)) break;
+            end++;
+        }
+        UploadPart part = { buf, enc.len, (int)(end - i), nullptr };
+        while (networkSendUpload(&part, 1, true) != 1) {
+            if (millis() - started > kTimeoutMs) {
+                fprintf(stderr, "mqtt_device: bus %d: track block at fix %zu not acknowledged\n",
+                        BUS_ID, i);
+                return 1;
+            }
+            usleep(MQTT_RECONNECT_MS * 1000);
+        }
+        blocks++;
+        i = end;
+    }
+
+    printf("mqtt_device: bus %d: %zu live fixes and %zu track blocks (%zu fixes) "
+           "acknowledged in %lu ms\n", BUS_ID, liveCount, blocks, fixes.size() - liveCount,
+           millis() - started);
+    return 0;
+}
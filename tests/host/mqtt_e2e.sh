@@ -0,0 +1,129 @@
+#!/bin/sh
+# SAWARI — MQTT End-to-End Test (host)
+#
+# Runs the whole MQTT path on loopback: two device builds (mqtt_device.cpp,
+# buses 1 and 2) publish route1_trace.jsonl to mosquitto, the bridge
+# (tools/sawari-mqtt-bridge.cpp) forwards it to ingest_stub.py standing in
+# for api/gps-device.php. The stub refuses bus 2 with 503 for its first
+# REFUSE_S seconds, and the bridge is killed (SIGKILL) and restarted while
+# it holds bus 2's messages. Checks:
+#
+#   1. every fix of both buses is stored: nothing the broker acknowledged
+#      to a device was lost with the killed bridge
+#   2. bus 1 was fully stored before bus 2's refusal ended: a bus the API
+#      refuses does not hold up the others
+#
+# Needs mosquitto (not started if it is missing: the test is skipped,
+# exit 77), g++ and python3. Run from the repository root:
+#   sh tests/host/mqtt_e2e.sh
+
+set -u
+
+MQTT_PORT=18830
+HTTP_PORT=18080
+REFUSE_S=6
+TRACE=tests/host/data/route1_trace.jsonl
+WORK=/tmp/sawari-mqtt-e2e
+MOSQUITTO=${MOSQUITTO:-mosquitto}
+
+if ! command -v "$MOSQUITTO" >/dev/null 2>&1; then
+    echo "SKIP: mosquitto not found"
+    exit 77
+fi
+
+rm -rf "$WORK"
+mkdir -p "$WORK"
+PIDS=""
+cleanup() {
+    for pid in $PIDS; do kill "$pid" 2>/dev/null; done
+    wait 2>/dev/null
+}
+trap cleanup EXIT
+
+fail() {
+    echo "FAIL: $*"
+    exit 1
+}
+
+# ── Build ────────────────────────────────────────────────────
+g++ -O2 -std=c++17 -o "$WORK/bridge" tools/sawari-mqtt-bridge.cpp || fail "bridge build"
+for bus in 1 2; do
+    g++ -std=gnu++17 -O1 -Itests/host/shim -Isawari_telemetry \
+        -DHOST_BUS_ID=$bus -DHOST_MQTT_PORT=$MQTT_PORT \
+        -o "$WORK/device$bus" tests/host/mqtt_device.cpp tests/host/shim/shim.cpp \
+        tests/host/shim/wifi_shim.cpp sawari_telemetry/track_codec.cpp \
+        sawari_telemetry/deflate_codec.cpp || fail "device build"
+done
+
+# ── Broker and ingest stub ───────────────────────────────────
+cat > "$WORK/mosquitto.conf" <<EOF
+listener $MQTT_PORT 127.0.0.1
+allow_anonymous true
+persistence false
+max_inflight_messages 0
+max_queued_messages 0
+EOF
+"$MOSQUITTO" -c "$WORK/mosquitto.conf" > "$WORK/mosquitto.log" 2>&1 &
+PIDS="$PIDS $!"
+
+python3 tests/host/ingest_stub.py --port $HTTP_PORT --out "$WORK/rows.jsonl" \
+    --refuse 2:$REFUSE_S &
+PIDS="$PIDS $!"
+sleep 1
+
+start_bridge() {
+    "$WORK/bridge" --port $MQTT_PORT --forward "http://127.0.0.1:$HTTP_PORT/api/gps-device.php" \
+        --max-backoff 2 --stats 5 >> "$WORK/bridge.log" 2>&1 &
+    BRIDGE=$!
+}
+start_bridge
+sleep 1             # Subscribed before the first publish
+
+# ── Devices; kill the bridge while bus 2 is refused ──────────
+"$WORK/device1" "$TRACE" > "$WORK/device1.log" 2>&1 &
+DEV1=$!
+"$WORK/device2" "$TRACE" > "$WORK/device2.log" 2>&1 &
+DEV2=$!
+
+sleep 3
+kill -9 $BRIDGE
+wait $BRIDGE 2>/dev/null
+echo "bridge killed, restarting" >> "$WORK/bridge.log"
+start_bridge
+PIDS="$PIDS $BRIDGE"
+
+wait $DEV1 || fail "device 1: $(cat "$WORK/device1.log")"
+wait $DEV2 || fail "device 2: $(cat "$WORK/device2.log")"
+cat "$WORK/device1.log" "$WORK/device2.log"
+
+# ── Wait for every fix to be stored ──────────────────────────
+FIXES=$(wc -l < "$TRACE")
+for i in $(seq 1 60); do
+    [ "$(wc -l < "$WORK/rows.jsonl")" -ge $((FIXES * 2)) ] && break
+    sleep 1
+done
+kill $BRIDGE 2>/dev/null
+sleep 1
+tail -n 3 "$WORK/bridge.log"
+
+python3 - "$WORK/rows.jsonl" "$FIXES" "$REFUSE_S" <<'EOF' || exit 1
+import json, sys
+rows = [json.loads(l) for l in open(sys.argv[1])]
+fixes, refuse = int(sys.argv[2]), float(sys.argv[3])
+ok = True
+for bus in (1, 2):
+    seqs = {r["seq"] for r in rows if r["bus_id"] == bus}
+    missing = sorted(set(range(1, fixes + 1)) - seqs)
+    print(f"bus {bus}: {len(seqs)} of {fixes} fixes stored")
+    if missing:
+        print(f"FAIL: bus {bus} missing seq {missing[:10]}{' ...' if len(missing) > 10 else ''}")
+        ok = False
+t1 = max((r["t"] for r in rows if r["bus_id"] == 1), default=0)
+t2 = min((r["t"] for r in rows if r["bus_id"] == 2), default=float("inf"))
+print(f"bus 1 complete at {t1:.1f} s, bus 2 first stored at {t2:.1f} s")
+if t1 >= t2:
+    print("FAIL: bus 1 was held up by bus 2")
+    ok = False
+print("PASS" if ok else "FAIL")
+sys.exit(0 if ok else 1)
+EOF
@@ -0,0 +1,117 @@
+/**
+ * SAWARI — Offline Queue Enqueue Benchmark (host)
+ *
+ * Measures what one storageEnqueue() costs with the queue empty, half
+ * full and full (QUEUE_SEGMENT_COUNT segments, so every new segment
+ * evicts or thins old data):
+ *
+ *   - latency per call: mean, 99th percentile and worst case
+ *   - bytes written to the filesystem per sample, metadata and
+ *     eviction rewrites included
+ *
+ * Latency is host CPU time plus host file I/O, so only the ratios
+ * between fill levels carry over to the ESP32; the bytes written are
+ * exactly what the device would write to flash.
+ *
+ * Build (from the repository root):
+ *   g++ -std=gnu++17 -O2 -Itests/host/shim -Isawari_telemetry \
+ *       -o queue_bench tests/host/queue_bench.cpp tests/host/shim/shim.cpp \
+ *       sawari_telemetry/storage_handler.cpp sawari_telemetry/track_codec.cpp \
+ *       sawari_telemetry/gps_handler.cpp
+ *
+ * Usage:
+ *   ./queue_bench [samples per fill level, default 2000]
+ */
+
+#include "storage_handler.h"
+#include "track_codec.h"
+#include <LittleFS.h>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <vector>
+
+static const char*    kWorkDir    = "/tmp/sawari-queue-bench";
+static const uint32_t kStartEpoch = 1771495553;
+
+static int _next = 0;   // Index of the next sample of the trace
+
+// A bus driving a city loop: ~10 m/s with heading changes and a little
+// GPS noise, one fix every 5 s.
+static void _sample(int i, TelemetryData* d) {
+    memset(d, 0, sizeof(*d));
+    double t = i * 0.01;
+    d->latitude = 27.7 + 0.02 * sin(t) + ((i * 7919) % 11 - 5) * 2e-6;
+    d->longitude = 85.3 + 0.02 * sin(2 * t) + ((i * 104729) % 11 - 5) * 2e-6;
+    d->speed = 30 + (i % 17);
+    d->direction = fmod(i * 1.7, 360.0);
+    d->altitude = 1300 + (i % 9);
+    d->satellites = 7 + (i % 3);
+    d->hdop = 0.9;
+    d->seq = i + 1;
+    gpsEpochToTimestamp(kStartEpoch + i * 5, d->timestamp, sizeof(d->timestamp));
+}
+
+static int _segments() {
+    int n = 0;
+    storageListSegments([&](uint32_t, uint32_t, uint32_t, uint8_t) { n++; });
+    return n;
+}
+
+// Enqueue until the queue holds `segments` segment files
+static void _fillTo(int segments) {
+    while (_segments() < segments) {
+        for (int k = 0; k < TRACK_BLOCK_SAMPLES; k++) {
+            TelemetryData d;
+            _sample(_next++, &d);
+            storageEnqueue(&d);
+        }
+    }
+    storageSync();
+}
+
+static void _measure(const char* label, int samples) {
+    std::vector<double> us;
+    us.reserve(samples);
+    size_t written = shimFsBytesWritten;
+
+    for (int k = 0; k < samples; k++) {
+        TelemetryData d;
+        _sample(_next++, &d);
+        auto t0 = std::chrono::steady_clock::now();
+        storageEnqueue(&d);
+        auto t1 = std::chrono::steady_clock::now();
+        us.push_back(std::chrono::duration<double, std::micro>(t1 - t0).count());
+    }
+    storageSync();
+    written = shimFsBytesWritten - written;
+
+    std::sort(us.begin(), us.end());
+    double sum = 0;
+    for (double v : us) sum += v;
+    printf("%-6s %6d %9.1f %9.1f %10.1f %11.1f %9d\n", label, samples,
+           sum / samples, us[samples * 99 / 100], us.back(),
+           (double)written / samples, storageGetCount());
+}
+
+int main(int argc, char** argv) {
+    int samples = argc > 1 ? atoi(argv[1]) : 2000;
+    shimFsRoot = std::string(kWorkDir) + "/fs";
+    std::filesystem::remove_all(kWorkDir);
+    LittleFS.format();
+    storageInit();
+
+    printf("Queue: %d segments of %d bytes, %d samples per block, eviction policy %d\n",
+           QUEUE_SEGMENT_COUNT, QUEUE_SEGMENT_BYTES, TRACK_BLOCK_SAMPLES, QUEUE_EVICT_POLICY);
+    printf("%-6s %6s %9s %9s %10s %11s %9s\n",
+           "fill", "n", "mean us", "p99 us", "worst us", "bytes/rec", "queued");
+
+    _measure("0%", samples);
+    _fillTo(QUEUE_SEGMENT_COUNT / 2);
+    _measure("50%", samples);
+    _fillTo(QUEUE_SEGMENT_COUNT);
+    _measure("100%", samples);
+
+    std::filesystem::remove_all(kWorkDir);
+    return 0;
+}
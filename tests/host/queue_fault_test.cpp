@@ -0,0 +1,233 @@
+/**
+ * SAWARI — Offline Queue Fault Injection Test (host)
+ *
+ * Builds a queue whose metadata lags the files behind it (the state a
+ * power cut between a segment write and its metadata commit leaves), then
+ * damages it in every way a torn or worn flash write can, reboots the
+ * queue (storageInit) and drains it:
+ *
+ *   1. tail segment truncated at every byte offset
+ *   2. staging file truncated at every byte offset
+ *   3. one byte flipped at every offset of the tail segment
+ *   4. one byte flipped at every offset of the staging file
+ *   5. samples appended after a repaired tail (every 7th offset)
+ *
+ * Every delivered sample must be one that was enqueued, unchanged and in
+ * order; a truncation must never lose more than the torn frame / record
+ * and must leave the count equal to what is delivered.
+ *
+ * Build (from the repository root):
+ *   g++ -std=gnu++17 -O1 -Itests/host/shim -Isawari_telemetry \
+ *       -o queue_fault_test tests/host/queue_fault_test.cpp \
+ *       tests/host/shim/shim.cpp sawari_telemetry/storage_handler.cpp \
+ *       sawari_telemetry/track_codec.cpp sawari_telemetry/gps_handler.cpp
+ *
+ * Usage:
+ *   ./queue_fault_test        (exit status 0 and "PASS" when all cases hold)
+ */
+
+#include "storage_handler.h"
+#include "track_codec.h"
+#include <LittleFS.h>
+#include <cmath>
+#include <filesystem>
+
+namespace hfs = std::filesystem;
+
+static const char*    kWorkDir    = "/tmp/sawari-queue-fault";
+static const uint32_t kStartEpoch = 1771495553;
+static const int      kCommitted  = 1000;   // Samples covered by the metadata
+static const int      kTotal      = 1077;   // ... plus samples written after it
+static const size_t   kRecordSize = 32;     // Staging record (QueueRecord)
+
+static std::string _fsDir, _baseDir;
+static int _failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        _failures++; \
+    } \
+} while (0)
+
+// Sample i of a synthetic trace; seq is i + 1 so a delivered sample can be
+// traced back to the one that was enqueued.
+static void _sample(int i, TelemetryData* d) {
+    memset(d, 0, sizeof(*d));
+    d->latitude = 27.7 + i * 1e-5;
+    d->longitude = 85.3 + (i % 7) * 1e-5;
+    d->speed = i % 40;
+    d->direction = (i * 13) % 360;
+    d->altitude = 1300;
+    d->satellites = 8;
+    d->hdop = 0.9;
+    d->seq = i + 1;
+    gpsEpochToTimestamp(kStartEpoch + i * 5, d->timestamp, sizeof(d->timestamp));
+}
+
+static void _enqueue(int from, int to) {
+    for (int i = from; i < to; i++) {
+        TelemetryData d;
+        _sample(i, &d);
+        storageEnqueue(&d);
+    }
+    storageSync();
+}
+
+static std::string _tailSegment() {
+    std::string tail;
+    for (auto& e : hfs::directory_iterator(_fsDir + "/queue")) {
+        std::string name = e.path().filename();
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".trk") == 0 && name > tail) {
+            tail = name;
+        }
+    }
+    return _fsDir + "/queue/" + tail;
+}
+
+static std::string _stagingFile() { return _fsDir + QUEUE_OPEN_FILE; }
+
+static void _restore() {
+    hfs::remove_all(_fsDir);
+    hfs::copy(_baseDir, _fsDir, hfs::copy_options::recursive);
+}
+
+static void _flipByte(const std::string& path, size_t pos) {
+    FILE* f = fopen(path.c_str(), "r+b");
+    fseek(f, pos, SEEK_SET);
+    int b = fgetc(f);
+    fseek(f, pos, SEEK_SET);
+    fputc(b ^ 0x5A, f);
+    fclose(f);
+}
+
+// Reboot the queue and drain it, checking every sample. Returns the
+// number delivered; *count receives the count the queue reported on boot.
+static int _rebootAndDrain(int* count) {
+    storageInit();
+    *count = storageGetCount();
+
+    int delivered = 0;
+    int last = -1;
+    bool ok = true;
+    while (storageGetCount() > 0) {
+        int sent = storageFlush([&](const TelemetryData* r) {
+            int i = (int)r->seq - 1;
+            TelemetryData want;
+            _sample(i < 0 ? 0 : i, &want);
+            if (i <= last || i >= kTotal + 200 ||
+                fabs(r->latitude - want.latitude) > 2e-6 ||
+                fabs(r->longitude - want.longitude) > 2e-6 ||
+                r->speed != want.speed || strcmp(r->timestamp, want.timestamp) != 0) {
+                ok = false;
+            }
+            last = i;
+            delivered++;
+            return true;
+        }, 1000);
+        if (sent == 0) break;
+    }
+    CHECK(ok, "a delivered sample is out of order or altered");
+    CHECK(storageGetCount() == 0, "%d samples left after the drain", storageGetCount());
+    return delivered;
+}
+
+int main() {
+    _fsDir = std::string(kWorkDir) + "/fs";
+    _baseDir = std::string(kWorkDir) + "/base";
+    shimFsRoot = _fsDir;
+    hfs::remove_all(kWorkDir);
+
+    // Queue with metadata that lags the files by kTotal - kCommitted samples
+    LittleFS.format();
+    storageInit();
+    _enqueue(0, kCommitted);
+    std::string meta = _fsDir + QUEUE_META_FILE;
+    std::string metaKeep = std::string(kWorkDir) + "/meta.keep";
+    hfs::copy_file(meta, metaKeep);
+    _enqueue(kCommitted, kTotal);
+    hfs::copy_file(metaKeep, meta, hfs::copy_options::overwrite_existing);
+    hfs::copy(_fsDir, _baseDir, hfs::copy_options::recursive);
+
+    size_t segSize = hfs::file_size(_tailSegment());
+    size_t stgSize = hfs::file_size(_stagingFile());
+    int count, got;
+    int cases = 0;
+
+    _restore();
+    got = _rebootAndDrain(&count);
+    CHECK(count == kTotal && got == kTotal, "undamaged: count %d, delivered %d", count, got);
+    printf("Queue: %d samples, tail segment %zu bytes, staging %zu bytes\n",
+           kTotal, segSize, stgSize);
+
+    // 1. Torn tail segment
+    int worst = kTotal;
+    for (size_t len = 0; len < segSize; len++) {
+        _restore();
+        hfs::resize_file(_tailSegment(), len);
+        got = _rebootAndDrain(&count);
+        CHECK(count == got, "segment cut at %zu: count %d, delivered %d", len, count, got);
+        worst = std::min(worst, got);
+        cases++;
+    }
+    printf("Torn tail segment:   %zu offsets, at least %d of %d delivered\n",
+           segSize, worst, kTotal);
+
+    // 2. Torn staging file: only the torn record may go
+    int staged = stgSize / kRecordSize;
+    for (size_t len = 0; len < stgSize; len++) {
+        _restore();
+        hfs::resize_file(_stagingFile(), len);
+        got = _rebootAndDrain(&count);
+        int want = kTotal - staged + (int)(len / kRecordSize);
+        CHECK(count == got && got == want, "staging cut at %zu: count %d, delivered %d, want %d",
+              len, count, got, want);
+        cases++;
+    }
+    printf("Torn staging file:   %zu offsets\n", stgSize);
+
+    // 3. Flipped byte in the tail segment: the damaged frame (or the rest
+    // of the segment, for a length prefix) is lost, nothing else
+    worst = kTotal;
+    for (size_t pos = 0; pos < segSize; pos++) {
+        _restore();
+        _flipByte(_tailSegment(), pos);
+        got = _rebootAndDrain(&count);
+        CHECK(got <= count, "segment flip at %zu: count %d, delivered %d", pos, count, got);
+        worst = std::min(worst, got);
+        cases++;
+    }
+    printf("Flipped segment byte: %zu offsets, at least %d of %d delivered\n",
+           segSize, worst, kTotal);
+
+    // 4. Flipped byte in the staging file: exactly that record is lost
+    for (size_t pos = 0; pos < stgSize; pos++) {
+        _restore();
+        _flipByte(_stagingFile(), pos);
+        got = _rebootAndDrain(&count);
+        CHECK(got == kTotal - 1, "staging flip at %zu: delivered %d", pos, got);
+        cases++;
+    }
+    printf("Flipped staging byte: %zu offsets\n", stgSize);
+
+    // 5. A repaired tail must stay readable after more appends
+    for (size_t len = 0; len < segSize; len += 7) {
+        _restore();
+        hfs::resize_file(_tailSegment(), len);
+        hfs::resize_file(_stagingFile(), stgSize - 5);
+        storageInit();
+        int before = storageGetCount();
+        _enqueue(kTotal, kTotal + 136);
+        got = _rebootAndDrain(&count);
+        CHECK(count == got && got == before + 136, "append after cut at %zu: count %d, "
+              "delivered %d, want %d", len, count, got, before + 136);
+        cases++;
+    }
+
+    printf("%d cases, %d failures\n", cases, _failures);
+    hfs::remove_all(kWorkDir);
+    puts(_failures == 0 ? "PASS" : "FAIL");
+    return _failures == 0 ? 0 : 1;
+}
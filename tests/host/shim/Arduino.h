@@ -0,0 +1,163 @@
+/**
+ * Arduino core subset for building sketch modules on a Linux host
+ * (tests/host). Only what the queue, codec, GPS and network modules use.
+ */
+
+#ifndef SHIM_ARDUINO_H
+#define SHIM_ARDUINO_H
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+#define F(x) (x)
+#define IRAM_ATTR
+#define SERIAL_8N1 0
+#define DEG_TO_RAD 0.017453292519943295769236907684886
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+typedef bool boolean;
+
+// FreeRTOS critical sections (the ESP32 core includes FreeRTOS)
+struct portMUX_TYPE {
+    std::mutex m;
+};
+#define portMUX_INITIALIZER_UNLOCKED {}
+#define portENTER_CRITICAL(mux) (mux)->m.lock()
+#define portEXIT_CRITICAL(mux) (mux)->m.unlock()
+
+uint32_t esp_random();
+
+// Clock: real time, unless a test sets shimFakeClock and drives shimMillis
+extern bool          shimFakeClock;
+extern unsigned long shimMillis;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+long random(long lo, long hi);
+long random(long hi);
+
+class String {
+public:
+    String() {}
+    String(const char* c) : _s(c ? c : "") {}
+    String(const std::string& s) : _s(s) {}
+    String(int v) : _s(std::to_string(v)) {}
+    String(unsigned v) : _s(std::to_string(v)) {}
+    String(long v) : _s(std::to_string(v)) {}
+    String(unsigned long v) : _s(std::to_string(v)) {}
+
+    unsigned length() const { return _s.size(); }
+    const char* c_str() const { return _s.c_str(); }
+    bool reserve(unsigned n) { _s.reserve(n); return true; }
+    void clear() { _s.clear(); }
+    int toInt() const { return atoi(_s.c_str()); }
+    char operator[](unsigned i) const { return _s[i]; }
+    bool operator==(const String& o) const { return _s == o._s; }
+    bool operator==(const char* o) const { return _s == o; }
+    String& operator+=(const String& o) { _s += o._s; return *this; }
+    String& operator+=(const char* o) { _s += o; return *this; }
+    String& operator+=(char c) { _s += c; return *this; }
+
+    void trim() {
+        while (!_s.empty() && isspace((unsigned char)_s.back())) _s.pop_back();
+        size_t i = 0;
+        while (i < _s.size() && isspace((unsigned char)_s[i])) i++;
+        _s.erase(0, i);
+    }
+    bool startsWith(const char* p) const { return _s.rfind(p, 0) == 0; }
+    int indexOf(const char* p, unsigned from = 0) const {
+        size_t i = _s.find(p, from);
+        return i == std::string::npos ? -1 : (int)i;
+    }
+    String substring(unsigned from, unsigned to) const {
+        if (from > _s.size()) return String();
+        return String(_s.substr(from, std::min<size_t>(to, _s.size()) - from));
+    }
+    String substring(unsigned from) const {
+        return from > _s.size() ? String() : String(_s.substr(from));
+    }
+
+private:
+    std::string _s;
+};
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(const uint8_t* buf, size_t len) = 0;
+    virtual size_t write(uint8_t c) { return write(&c, 1); }
+
+    size_t print(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+    size_t print(const String& s) { return print(s.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int v) { return print(std::to_string(v).c_str()); }
+    size_t print(unsigned v) { return print(std::to_string(v).c_str()); }
+    size_t print(long v) { return print(std::to_string(v).c_str()); }
+    size_t print(unsigned long v) { return print(std::to_string(v).c_str()); }
+    size_t print(long long v) { return print(std::to_string(v).c_str()); }
+    size_t print(unsigned long long v) { return print(std::to_string(v).c_str()); }
+    size_t print(double v, int digits = 2) {
+        char b[64];
+        snprintf(b, sizeof(b), "%.*f", digits, v);
+        return print(b);
+    }
+    template <class T> size_t println(T v) { return print(v) + print("\n"); }
+    size_t println(double v, int digits) { return print(v, digits) + print("\n"); }
+    size_t println() { return print("\n"); }
+    size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+        char b[512];
+        va_list a;
+        va_start(a, fmt);
+        vsnprintf(b, sizeof(b), fmt, a);
+        va_end(a);
+        return print(b);
+    }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() { return -1; }
+    void setTimeout(unsigned long) {}
+
+    String readStringUntil(char end) {
+        std::string s;
+        int c;
+        while ((c = read()) >= 0 && c != end) s += (char)c;
+        return String(s);
+    }
+};
+
+// Console output is dropped unless a test sets Serial.quiet = false;
+// there is never any input.
+class HardwareSerial : public Stream {
+public:
+    bool quiet = true;
+
+    HardwareSerial(int uart = 0) { (void)uart; }
+    void begin(unsigned long, int = 0, int = 0, int = 0) {}
+    size_t write(const uint8_t* buf, size_t len) override {
+        if (!quiet) fwrite(buf, 1, len, stdout);
+        return len;
+    }
+    int available() override { return 0; }
+    int read() override { return -1; }
+    void flush() {}
+    operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif // SHIM_ARDUINO_H
@@ -0,0 +1,69 @@
+/**
+ * LittleFS on a host directory (tests/host). Paths map below shimFsRoot;
+ * every byte written through a File is counted in shimFsBytesWritten.
+ */
+
+#ifndef SHIM_FS_H
+#define SHIM_FS_H
+
+#include "Arduino.h"
+#include <string>
+#include <vector>
+
+extern std::string shimFsRoot;          // Host directory that stands for "/"
+extern size_t      shimFsBytesWritten;  // Bytes written since start
+
+namespace fs {
+
+class File : public Stream {
+public:
+    File() {}
+    File(FILE* fp, const std::string& path) : _fp(fp), _path(path) {}
+
+    operator bool() const { return _fp || _dir; }
+    size_t write(const uint8_t* buf, size_t len) override;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    int available() override;
+    int read() override {
+        uint8_t c;
+        return read(&c, 1) == 1 ? c : -1;
+    }
+    size_t read(uint8_t* buf, size_t len);
+    bool seek(uint32_t pos);
+    size_t position() const;
+    size_t size() const;
+    void flush();
+    void close();
+    const char* name() const;
+    bool isDirectory() const { return _dir; }
+    File openNextFile();
+
+private:
+    friend class LittleFSFS;
+    FILE*       _fp = nullptr;
+    std::string _path;
+    bool        _dir = false;
+    std::vector<std::string> _entries;
+    size_t      _next = 0;
+};
+
+class LittleFSFS {
+public:
+    bool begin(bool formatOnFail = false, const char* base = "/littlefs",
+               uint8_t maxOpen = 10, const char* label = nullptr);
+    bool format();
+    bool exists(const char* path);
+    bool remove(const char* path);
+    bool rename(const char* from, const char* to);
+    bool mkdir(const char* path);
+    bool rmdir(const char* path);
+    File open(const char* path, const char* mode = "r", bool create = false);
+    size_t totalBytes();
+    size_t usedBytes();
+};
+
+} // namespace fs
+
+using fs::File;
+
+#endif // SHIM_FS_H
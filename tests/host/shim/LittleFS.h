@@ -0,0 +1,8 @@
+#ifndef SHIM_LITTLEFS_H
+#define SHIM_LITTLEFS_H
+
+#include "FS.h"
+
+extern fs::LittleFSFS LittleFS;
+
+#endif // SHIM_LITTLEFS_H
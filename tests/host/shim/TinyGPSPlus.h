@@ -0,0 +1,35 @@
+/**
+ * TinyGPSPlus stand-in (tests/host): gps_handler.cpp links, but no fix is
+ * ever parsed. Tests build their samples directly.
+ */
+
+#ifndef SHIM_TINYGPSPLUS_H
+#define SHIM_TINYGPSPLUS_H
+
+#include "Arduino.h"
+
+struct TinyGPSValue {
+    bool isValid() { return false; }
+    unsigned long age() { return 0xFFFFFFFF; }
+    unsigned long value() { return 0; }
+    double lat() { return 0; }
+    double lng() { return 0; }
+    double kmph() { return 0; }
+    double deg() { return 0; }
+    double meters() { return 0; }
+    double hdop() { return 0; }
+    int year() { return 0; }
+    int month() { return 0; }
+    int day() { return 0; }
+    int hour() { return 0; }
+    int minute() { return 0; }
+    int second() { return 0; }
+};
+
+class TinyGPSPlus {
+public:
+    TinyGPSValue location, speed, course, altitude, satellites, hdop, date, time;
+    bool encode(char) { return false; }
+};
+
+#endif // SHIM_TINYGPSPLUS_H
@@ -0,0 +1,111 @@
+/**
+ * ESP32 WiFi subset for building the network module on a Linux host
+ * (tests/host). The station is always connected; WiFiClient is a plain
+ * non-blocking TCP socket and hostByName() resolves with getaddrinfo(),
+ * so the module talks to real servers and brokers on the host.
+ */
+
+#ifndef SHIM_WIFI_H
+#define SHIM_WIFI_H
+
+#include <Arduino.h>
+
+#define WL_CONNECTED        3
+#define WL_DISCONNECTED     6
+#define WIFI_STA            1
+#define WIFI_SCAN_RUNNING   (-1)
+#define WIFI_SCAN_FAILED    (-2)
+
+class IPAddress {
+public:
+    IPAddress() {}
+    IPAddress(uint32_t addr) : _addr(addr) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+        : _addr(a | (b << 8) | (c << 16) | ((uint32_t)d << 24)) {}
+
+    operator uint32_t() const { return _addr; }
+    bool operator==(const IPAddress& o) const { return _addr == o._addr; }
+    String toString() const {
+        char b[16];
+        snprintf(b, sizeof(b), "%u.%u.%u.%u", _addr & 0xFF, (_addr >> 8) & 0xFF,
+                 (_addr >> 16) & 0xFF, _addr >> 24);
+        return String(b);
+    }
+
+private:
+    uint32_t _addr = 0;     // Network byte order, as on the ESP32
+};
+
+#define INADDR_NONE IPAddress((uint32_t)0)
+
+class WiFiClient {
+public:
+    ~WiFiClient() { stop(); }
+
+    int connect(IPAddress ip, uint16_t port, int32_t timeoutMs = 0);
+    int connect(const char* host, uint16_t port, int32_t timeoutMs = 0);
+    uint8_t connected();
+    int available();
+    int read();
+    int read(uint8_t* buf, size_t len);
+    size_t write(const uint8_t* buf, size_t len);
+    size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+    int setNoDelay(bool on);
+    void setTimeout(uint32_t) {}
+    void flush() {}
+    void stop();
+    operator bool() { return connected(); }
+
+private:
+    int     _fd = -1;
+    int     _peeked = -1;       // Byte read ahead by available()
+};
+
+enum arduino_event_id_t {
+    ARDUINO_EVENT_WIFI_STA_DISCONNECTED = 5,
+    ARDUINO_EVENT_WIFI_STA_GOT_IP       = 7,
+    ARDUINO_EVENT_WIFI_STA_LOST_IP      = 8,
+};
+struct arduino_event_info_t {};
+typedef void (*WiFiEventCb)(arduino_event_id_t, arduino_event_info_t);
+
+class WiFiClass {
+public:
+    int status() { return WL_CONNECTED; }
+    void onEvent(WiFiEventCb) {}
+    void mode(int) {}
+    void persistent(bool) {}
+    void setAutoReconnect(bool) {}
+    bool setSleep(bool) { return true; }
+    void begin(const char*, const char*, int32_t = 0, const uint8_t* = nullptr) {}
+    void disconnect() {}
+    void reconnect() {}
+    bool config(IPAddress, IPAddress, IPAddress, IPAddress = IPAddress()) { return true; }
+
+    int16_t scanNetworks(bool = false, bool = false, bool = false, uint32_t = 0) { return 0; }
+    int16_t scanComplete() { return 0; }
+    void scanDelete() {}
+    String SSID(uint8_t) { return String(); }
+    int32_t RSSI(uint8_t) { return 0; }
+    const uint8_t* BSSID(uint8_t) { return _bssid; }
+    int32_t channel(uint8_t) { return 1; }
+
+    String SSID() { return String("host"); }
+    String psk() { return String(); }
+    int RSSI() { return -50; }
+    const uint8_t* BSSID() { return _bssid; }
+    int32_t channel() { return 1; }
+    IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+    IPAddress gatewayIP() { return IPAddress(127, 0, 0, 1); }
+    IPAddress subnetMask() { return IPAddress(255, 0, 0, 0); }
+    IPAddress dnsIP(uint8_t = 0) { return IPAddress(127, 0, 0, 1); }
+
+    int hostByName(const char* host, IPAddress& ip);
+
+private:
+    uint8_t _bssid[6] = { 0x02, 0, 0, 0, 0, 1 };
+};
+
+extern WiFiClass WiFi;
+
+#endif // SHIM_WIFI_H
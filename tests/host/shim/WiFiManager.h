@@ -0,0 +1,24 @@
+/**
+ * WiFiManager stand-in (tests/host): the station is always connected, so
+ * the portal never opens.
+ */
+
+#ifndef SHIM_WIFIMANAGER_H
+#define SHIM_WIFIMANAGER_H
+
+#include "WiFi.h"
+
+class WiFiManager {
+public:
+    void setConfigPortalTimeout(int) {}
+    void setConnectTimeout(int) {}
+    void setCleanConnect(bool) {}
+    void setConfigPortalBlocking(bool) {}
+    bool autoConnect(const char*) { return true; }
+    void startConfigPortal(const char*) {}
+    bool process() { return false; }
+    void stopConfigPortal() {}
+    bool getConfigPortalActive() { return false; }
+};
+
+#endif // SHIM_WIFIMANAGER_H
@@ -0,0 +1,28 @@
+/**
+ * WiFiUDP subset (tests/host): a non-blocking UDP socket.
+ */
+
+#ifndef SHIM_WIFIUDP_H
+#define SHIM_WIFIUDP_H
+
+#include "WiFi.h"
+#include <vector>
+
+class WiFiUDP {
+public:
+    uint8_t begin(uint16_t port);
+    int beginPacket(IPAddress ip, uint16_t port);
+    size_t write(const uint8_t* buf, size_t len);
+    int endPacket();
+    int parsePacket();
+    int read(uint8_t* buf, size_t len);
+
+private:
+    int                  _fd = -1;
+    std::vector<uint8_t> _tx, _rx;
+    size_t               _rxPos = 0;
+    IPAddress            _dst;
+    uint16_t             _dstPort = 0;
+};
+
+#endif // SHIM_WIFIUDP_H
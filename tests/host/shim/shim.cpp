@@ -0,0 +1,134 @@
+/**
+ * Arduino / LittleFS shim implementation (tests/host).
+ */
+
+#include "Arduino.h"
+#include "LittleFS.h"
+#include <chrono>
+#include <filesystem>
+#include <unistd.h>
+
+namespace hfs = std::filesystem;
+
+HardwareSerial Serial;
+fs::LittleFSFS LittleFS;
+
+bool          shimFakeClock = false;
+unsigned long shimMillis = 0;
+std::string   shimFsRoot = "/tmp/sawari-host-fs";
+size_t        shimFsBytesWritten = 0;
+
+static const auto _start = std::chrono::steady_clock::now();
+
+unsigned long millis() {
+    if (shimFakeClock) return shimMillis;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - _start).count();
+}
+
+unsigned long micros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - _start).count();
+}
+
+void delay(unsigned long) {}
+void yield() {}
+long random(long lo, long hi) { return lo + rand() % (hi - lo); }
+long random(long hi) { return rand() % hi; }
+
+static std::string _hostPath(const char* path) { return shimFsRoot + path; }
+
+namespace fs {
+
+size_t File::write(const uint8_t* buf, size_t len) {
+    if (!_fp) return 0;
+    shimFsBytesWritten += len;
+    return fwrite(buf, 1, len, _fp);
+}
+
+int File::available() { return _fp ? (int)(size() - position()) : 0; }
+size_t File::read(uint8_t* buf, size_t len) { return _fp ? fread(buf, 1, len, _fp) : 0; }
+bool File::seek(uint32_t pos) { return _fp && fseek(_fp, pos, SEEK_SET) == 0; }
+size_t File::position() const { return _fp ? ftell(_fp) : 0; }
+void File::flush() { if (_fp) fflush(_fp); }
+
+size_t File::size() const {
+    if (!_fp) return 0;
+    long at = ftell(_fp);
+    fseek(_fp, 0, SEEK_END);
+    long end = ftell(_fp);
+    fseek(_fp, at, SEEK_SET);
+    return end;
+}
+
+void File::close() {
+    if (_fp) fclose(_fp);
+    _fp = nullptr;
+    _dir = false;
+}
+
+const char* File::name() const {
+    size_t slash = _path.rfind('/');
+    return _path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+}
+
+File File::openNextFile() {
+    if (_next >= _entries.size()) return File();
+    std::string path = _path + (_path == "/" ? "" : "/") + _entries[_next++];
+    return LittleFS.open(path.c_str(), "r");
+}
+
+bool LittleFSFS::begin(bool, const char*, uint8_t, const char*) {
+    hfs::create_directories(shimFsRoot);
+    return true;
+}
+
+bool LittleFSFS::format() {
+    hfs::remove_all(shimFsRoot);
+    hfs::create_directories(shimFsRoot);
+    return true;
+}
+
+bool LittleFSFS::exists(const char* path) { return hfs::exists(_hostPath(path)); }
+bool LittleFSFS::remove(const char* path) { return ::remove(_hostPath(path).c_str()) == 0; }
+bool LittleFSFS::rmdir(const char* path) { return ::rmdir(_hostPath(path).c_str()) == 0; }
+
+bool LittleFSFS::rename(const char* from, const char* to) {
+    return ::rename(_hostPath(from).c_str(), _hostPath(to).c_str()) == 0;
+}
+
+bool LittleFSFS::mkdir(const char* path) {
+    hfs::create_directories(_hostPath(path));
+    return true;
+}
+
+File LittleFSFS::open(const char* path, const char* mode, bool) {
+    std::string host = _hostPath(path);
+    if (hfs::is_directory(host)) {
+        File dir;
+        dir._dir = true;
+        dir._path = path;
+        for (auto& e : hfs::directory_iterator(host)) {
+            dir._entries.push_back(e.path().filename());
+        }
+        std::sort(dir._entries.begin(), dir._entries.end());
+        return dir;
+    }
+
+    const char* m = mode[0] == 'r' ? (mode[1] == '+' ? "r+b" : "rb")
+                  : mode[0] == 'w' ? "wb" : "ab";
+    FILE* fp = fopen(host.c_str(), m);
+    return fp ? File(fp, path) : File();
+}
+
+size_t LittleFSFS::totalBytes() { return 1536 * 1024; }
+
+size_t LittleFSFS::usedBytes() {
+    size_t used = 0;
+    for (auto& e : hfs::recursive_directory_iterator(shimFsRoot)) {
+        if (e.is_regular_file()) used += e.file_size();
+    }
+    return used;
+}
+
+} // namespace fs
@@ -0,0 +1,165 @@
+/**
+ * WiFi shim implementation (tests/host): sockets on the host network.
+ */
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <random>
+#include <sys/socket.h>
+#include <unistd.h>
+#undef INADDR_NONE          // WiFi.h has the Arduino one
+
+#include "WiFi.h"
+#include "WiFiUdp.h"
+
+WiFiClass WiFi;
+
+uint32_t esp_random() {
+    static std::mt19937 rng(std::random_device{}());
+    return rng();
+}
+
+int WiFiClass::hostByName(const char* host, IPAddress& ip) {
+    struct addrinfo hints = {}, *res = nullptr;
+    hints.ai_family = AF_INET;
+    if (getaddrinfo(host, nullptr, &hints, &res) != 0) return 0;
+    ip = IPAddress(((sockaddr_in*)res->ai_addr)->sin_addr.s_addr);
+    freeaddrinfo(res);
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+// WiFiClient
+// ---------------------------------------------------------------------------
+int WiFiClient::connect(IPAddress ip, uint16_t port, int32_t) {
+    stop();
+    _fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = (uint32_t)ip;
+    if (_fd < 0 || ::connect(_fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        stop();
+        return 0;
+    }
+    fcntl(_fd, F_SETFL, O_NONBLOCK);
+    return 1;
+}
+
+int WiFiClient::connect(const char* host, uint16_t port, int32_t timeoutMs) {
+    IPAddress ip;
+    return WiFi.hostByName(host, ip) ? connect(ip, port, timeoutMs) : 0;
+}
+
+uint8_t WiFiClient::connected() {
+    if (_fd < 0) return 0;
+    if (_peeked >= 0) return 1;
+    char c;
+    ssize_t n = recv(_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+int WiFiClient::available() {
+    if (_peeked < 0) _peeked = read();
+    return _peeked >= 0 ? 1 : 0;
+}
+
+int WiFiClient::read() {
+    if (_peeked >= 0) {
+        int c = _peeked;
+        _peeked = -1;
+        return c;
+    }
+    uint8_t c;
+    return _fd >= 0 && recv(_fd, &c, 1, MSG_DONTWAIT) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t* buf, size_t len) {
+    size_t got = 0;
+    if (len > 0 && _peeked >= 0) buf[got++] = (uint8_t)read();
+    if (_fd >= 0 && got < len) {
+        ssize_t n = recv(_fd, buf + got, len - got, MSG_DONTWAIT);
+        if (n > 0) got += n;
+    }
+    return got > 0 ? (int)got : -1;
+}
+
+size_t WiFiClient::write(const uint8_t* buf, size_t len) {
+    size_t sent = 0;
+    while (_fd >= 0 && sent < len) {
+        ssize_t n = send(_fd, buf + sent, len - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd pfd = { _fd, POLLOUT, 0 };
+            poll(&pfd, 1, 100);
+        } else {
+            break;
+        }
+    }
+    return sent;
+}
+
+int WiFiClient::setNoDelay(bool on) {
+    int v = on;
+    return _fd >= 0 ? setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &v, sizeof(v)) : -1;
+}
+
+void WiFiClient::stop() {
+    if (_fd >= 0) close(_fd);
+    _fd = -1;
+    _peeked = -1;
+}
+
+// ---------------------------------------------------------------------------
+// WiFiUDP
+// ---------------------------------------------------------------------------
+uint8_t WiFiUDP::begin(uint16_t port) {
+    _fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (_fd < 0 || bind(_fd, (sockaddr*)&addr, sizeof(addr)) < 0) return 0;
+    fcntl(_fd, F_SETFL, O_NONBLOCK);
+    return 1;
+}
+
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t port) {
+    _dst = ip;
+    _dstPort = port;
+    _tx.clear();
+    return 1;
+}
+
+size_t WiFiUDP::write(const uint8_t* buf, size_t len) {
+    _tx.insert(_tx.end(), buf, buf + len);
+    return len;
+}
+
+int WiFiUDP::endPacket() {
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(_dstPort);
+    addr.sin_addr.s_addr = (uint32_t)_dst;
+    return sendto(_fd, _tx.data(), _tx.size(), 0, (sockaddr*)&addr, sizeof(addr)) >= 0;
+}
+
+int WiFiUDP::parsePacket() {
+    _rx.resize(2048);
+    ssize_t n = _fd >= 0 ? recv(_fd, _rx.data(), _rx.size(), MSG_DONTWAIT) : -1;
+    _rx.resize(n > 0 ? n : 0);
+    _rxPos = 0;
+    return (int)_rx.size();
+}
+
+int WiFiUDP::read(uint8_t* buf, size_t len) {
+    size_t n = std::min(len, _rx.size() - _rxPos);
+    memcpy(buf, _rx.data() + _rxPos, n);
+    _rxPos += n;
+    return (int)n;
+}
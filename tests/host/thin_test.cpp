@@ -0,0 +1,158 @@
+/**
+ * SAWARI — Queue Thinning Test (host)
+ *
+ * Drives the offline queue far past full so _thinSegments() merges and
+ * thins old segments again and again, then drains it and measures how far
+ * the kept track strays from the original one: every original fix is
+ * compared with the position interpolated in time between the kept fixes
+ * around it.
+ *
+ *   - every delivered fix is an original one, unchanged and in order
+ *   - Douglas-Peucker: the largest error stays within
+ *     QUEUE_THIN_TOLERANCE_M (plus the 1e-6 degree quantization)
+ *   - decimation: the error is reported; it has no bound
+ *
+ * storage_handler.cpp is compiled into this file so the eviction policy
+ * can be picked at build time (THIN_POLICY, default: config.h).
+ *
+ * Build (from the repository root), Douglas-Peucker and decimation:
+ *   g++ -std=gnu++17 -O2 -Itests/host/shim -Isawari_telemetry \
+ *       -o thin_test tests/host/thin_test.cpp tests/host/shim/shim.cpp \
+ *       sawari_telemetry/track_codec.cpp sawari_telemetry/gps_handler.cpp
+ *   g++ -std=gnu++17 -O2 -Itests/host/shim -Isawari_telemetry \
+ *       -DTHIN_POLICY=QUEUE_EVICT_DECIMATE \
+ *       -o thin_test_decimate tests/host/thin_test.cpp tests/host/shim/shim.cpp \
+ *       sawari_telemetry/track_codec.cpp sawari_telemetry/gps_handler.cpp
+ *
+ * Usage:
+ *   ./thin_test [fixes, default 150000]
+ */
+
+#include "config.h"
+#ifdef THIN_POLICY
+#undef  QUEUE_EVICT_POLICY
+#define QUEUE_EVICT_POLICY THIN_POLICY
+#endif
+#include "storage_handler.cpp"
+
+#include <cmath>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+static const char*    kWorkDir    = "/tmp/sawari-thin-test";
+static const uint32_t kStartEpoch = 1771495553;
+
+struct Fix {
+    int32_t  lat, lon;      // degrees x1e6, as stored
+    uint32_t t;
+};
+
+static double _metres(double lat1, double lon1, double lat2, double lon2) {
+    double dy = (lat1 - lat2) * 110540.0;
+    double dx = (lon1 - lon2) * 111320.0 * cos(lat1 * M_PI / 180.0);
+    return sqrt(dx * dx + dy * dy);
+}
+
+int main(int argc, char** argv) {
+    int total = argc > 1 ? atoi(argv[1]) : 150000;
+    shimFsRoot = std::string(kWorkDir) + "/fs";
+    std::filesystem::remove_all(kWorkDir);
+    LittleFS.format();
+    storageInit();
+
+    // A bus in 5-minute cycles of halts, cruising and a long bend, with a
+    // sharp turn now and then and ~2 m GPS noise while moving
+    std::mt19937 rng(1);
+    std::normal_distribution<double> noise(0, 2.0);
+    std::vector<Fix> orig;
+    orig.reserve(total);
+    double lat = 27.70, lon = 85.30, heading = 0, v = 0;
+    for (int i = 0; i < total; i++) {
+        int phase = (i / 60) % 10;
+        double target = phase == 0 ? 0 : (phase < 5 ? 8.0 : 12.0);     // m/s
+        v += (target - v) * 0.3;
+        if (phase == 7) heading += 0.15;
+        if (i % 997 == 0) heading += 1.3;
+        lat += v * 5 * cos(heading) / 110540.0;
+        lon += v * 5 * sin(heading) / (111320.0 * cos(lat * M_PI / 180.0));
+
+        TelemetryData d;
+        memset(&d, 0, sizeof(d));
+        bool moving = v > 0.5;
+        d.latitude = lat + (moving ? noise(rng) / 110540.0 : 0);
+        d.longitude = lon + (moving ? noise(rng) / 94000.0 : 0);
+        d.speed = v * 3.6;
+        d.direction = fmod(heading * 180.0 / M_PI + 3600.0, 360.0);
+        d.altitude = 1300;
+        d.satellites = 8;
+        d.hdop = 0.9;
+        d.seq = i + 1;
+        gpsEpochToTimestamp(kStartEpoch + i * 5, d.timestamp, sizeof(d.timestamp));
+
+        TrackPoint p;
+        trackPointFromTelemetry(&d, &p);
+        orig.push_back({ p.latitude, p.longitude, p.timestamp });
+        storageEnqueue(&d);
+    }
+    storageSync();
+    int queued = storageGetCount();
+
+    // Drain: every kept fix must be an original, in order
+    std::vector<Fix> kept;
+    bool exact = true;
+    while (storageGetCount() > 0) {
+        int sent = storageFlush([&](const TelemetryData* r) {
+            TrackPoint p;
+            trackPointFromTelemetry(r, &p);
+            int i = (int)r->seq - 1;
+            if (i < 0 || i >= total || orig[i].lat != p.latitude || orig[i].lon != p.longitude ||
+                orig[i].t != p.timestamp || (!kept.empty() && p.timestamp <= kept.back().t)) {
+                exact = false;
+            }
+            kept.push_back({ p.latitude, p.longitude, p.timestamp });
+            return true;
+        }, 1000);
+        if (sent == 0) break;
+    }
+
+    // Error of every original fix the kept track still spans
+    double maxErr = 0, sumErr = 0;
+    int covered = 0;
+    size_t j = 0;
+    for (const Fix& o : orig) {
+        if (kept.empty() || o.t < kept.front().t) continue;
+        while (j + 1 < kept.size() && kept[j + 1].t <= o.t) j++;
+        double la = kept[j].lat, lo = kept[j].lon;
+        if (j + 1 < kept.size() && kept[j].t != o.t) {
+            double r = double(o.t - kept[j].t) / (kept[j + 1].t - kept[j].t);
+            la += r * (kept[j + 1].lat - kept[j].lat);
+            lo += r * (kept[j + 1].lon - kept[j].lon);
+        }
+        double err = _metres(o.lat * 1e-6, o.lon * 1e-6, la * 1e-6, lo * 1e-6);
+        maxErr = std::max(maxErr, err);
+        sumErr += err;
+        covered++;
+    }
+
+    const char* policy = QUEUE_EVICT_POLICY == QUEUE_EVICT_DOUGLAS_PEUCKER ? "Douglas-Peucker"
+                       : QUEUE_EVICT_POLICY == QUEUE_EVICT_DECIMATE ? "decimate" : "drop";
+    printf("Policy %s: %d fixes enqueued, %d queued, %zu delivered\n",
+           policy, total, queued, kept.size());
+    printf("  span %.1f h of %.1f h, max error %.2f m, mean error %.2f m\n",
+           covered * 5 / 3600.0, total * 5 / 3600.0, maxErr, covered ? sumErr / covered : 0.0);
+
+    int failures = 0;
+    if (!exact || (int)kept.size() != queued) {
+        printf("FAIL: delivered fixes are not the queued originals in order\n");
+        failures++;
+    }
+    if (QUEUE_EVICT_POLICY == QUEUE_EVICT_DOUGLAS_PEUCKER && maxErr > QUEUE_THIN_TOLERANCE_M + 0.2) {
+        printf("FAIL: max error %.2f m over the %.1f m tolerance\n", maxErr, QUEUE_THIN_TOLERANCE_M);
+        failures++;
+    }
+
+    std::filesystem::remove_all(kWorkDir);
+    puts(failures == 0 ? "PASS" : "FAIL");
+    return failures == 0 ? 0 : 1;
+}
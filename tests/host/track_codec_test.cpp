@@ -0,0 +1,201 @@
+/**
+ * SAWARI — Track Block Codec Test (host)
+ *
+ * Round-trips a recorded trace through track_codec.cpp and reports the
+ * compression ratio against the earlier queue formats:
+ *
+ *   - every sample decodes to exactly the TrackPoint that was encoded,
+ *     and to the same JSON record the device would have sent
+ *   - edge cases: direction wrap, signed extremes, timestamp and seq jumps,
+ *     one-sample blocks
+ *   - a truncated block or one with another version byte is rejected,
+ *     never read past its end
+ *
+ * The trace is a JSONL file of device records (gpsFormatRecord, one per
+ * line), by default tests/host/data/route1_trace.jsonl.
+ *
+ * Build (from the repository root):
+ *   g++ -std=gnu++17 -O1 -Itests/host/shim -Isawari_telemetry \
+ *       -o track_codec_test tests/host/track_codec_test.cpp \
+ *       tests/host/shim/shim.cpp sawari_telemetry/track_codec.cpp \
+ *       sawari_telemetry/gps_handler.cpp
+ *
+ * Usage:
+ *   ./track_codec_test [trace.jsonl]
+ */
+
+#include "track_codec.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+static int _failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        _failures++; \
+    } \
+} while (0)
+
+// Encode `points` into blocks of up to TRACK_BLOCK_SAMPLES
+static std::vector<std::vector<uint8_t>> _encode(const std::vector<TrackPoint>& points,
+                                                  int perBlock = TRACK_BLOCK_SAMPLES) {
+    std::vector<std::vector<uint8_t>> blocks;
+    uint8_t buf[TRACK_BLOCK_MAX_BYTES];
+    TrackEncoder enc;
+    size_t i = 0;
+    while (i < points.size()) {
+        trackEncoderBegin(&enc, buf);
+        for (int n = 0; n < perBlock && i < points.size(); n++) {
+            CHECK(trackEncoderAdd(&enc, &points[i]), "sample %zu not added", i);
+            i++;
+        }
+        blocks.emplace_back(buf, buf + enc.len);
+    }
+    return blocks;
+}
+
+static std::vector<TrackPoint> _decode(const std::vector<std::vector<uint8_t>>& blocks) {
+    std::vector<TrackPoint> points;
+    for (auto& b : blocks) {
+        TrackDecoder dec;
+        CHECK(trackDecoderBegin(&dec, b.data(), b.size()), "block header rejected");
+        TrackPoint p;
+        while (trackDecoderNext(&dec, &p)) points.push_back(p);
+    }
+    return points;
+}
+
+static bool _samePoint(const TrackPoint& a, const TrackPoint& b) {
+    return memcmp(&a, &b, sizeof(TrackPoint)) == 0;
+}
+
+static void _checkRoundTrip(const char* what, const std::vector<TrackPoint>& points,
+                            int perBlock = TRACK_BLOCK_SAMPLES) {
+    std::vector<TrackPoint> out = _decode(_encode(points, perBlock));
+    CHECK(out.size() == points.size(), "%s: %zu of %zu samples decoded",
+          what, out.size(), points.size());
+    for (size_t i = 0; i < points.size() && i < out.size(); i++) {
+        CHECK(_samePoint(points[i], out[i]), "%s: sample %zu differs", what, i);
+    }
+}
+
+static TrackPoint _point(int32_t lat, int32_t lon, uint32_t ts, int32_t alt, uint16_t speed,
+                         uint16_t dir, uint8_t sats, uint16_t hdop, uint32_t seq) {
+    TrackPoint p;
+    p.latitude = lat;
+    p.longitude = lon;
+    p.timestamp = ts;
+    p.altitude = alt;
+    p.speed = speed;
+    p.direction = dir;
+    p.satellites = sats;
+    p.hdop = hdop;
+    p.seq = seq;
+    return p;
+}
+
+static void _edgeCases() {
+    std::vector<TrackPoint> p;
+    p.push_back(_point(27693500, 85281400, 1771495553, 12900, 0, 3590, 8, 9, 1));
+    p.push_back(_point(27693510, 85281410, 1771495558, 12901, 50, 10, 8, 9, 2));       // 359.0 -> 1.0
+    p.push_back(_point(27693520, 85281420, 1771495563, 12902, 50, 3599, 7, 12, 3));    // 1.0 -> 359.9
+    p.push_back(_point(-90000000, -180000000, 1771495564, -4300, 0, 0, 0, 999, 4));    // Signed extremes
+    p.push_back(_point(90000000, 180000000, 1771499999, 88480, 65535, 1800, 255, 0, 5));
+    p.push_back(_point(90000000, 180000000, 1771400000, 88480, 65535, 1800, 255, 0, 4000000000u)); // Backwards time, seq jump
+    p.push_back(_point(0, 0, 0, 0, 0, 0, 0, 0, 0));
+    p.push_back(_point(0, 0, 0xFFFFFFFF, INT32_MAX, 0, 0, 0, 0, 0xFFFFFFFF));
+    p.push_back(_point(INT32_MIN, INT32_MAX, 1, INT32_MIN, 1, 1, 1, 1, 1));
+    _checkRoundTrip("edge cases", p);
+    _checkRoundTrip("edge cases, one sample per block", p, 1);
+}
+
+// Every truncation of a valid block must be rejected or end early; a block
+// with another version byte must be rejected outright.
+static void _malformed(const std::vector<TrackPoint>& points) {
+    std::vector<TrackPoint> first(points.begin(), points.begin() + std::min<size_t>(points.size(), TRACK_BLOCK_SAMPLES));
+    std::vector<uint8_t> block = _encode(first)[0];
+
+    for (size_t len = 0; len < block.size(); len++) {
+        std::vector<uint8_t> cut(block.begin(), block.begin() + len);   // Exact size: ASan catches overreads
+        TrackDecoder dec;
+        int decoded = 0;
+        if (trackDecoderBegin(&dec, cut.data(), cut.size())) {
+            TrackPoint p;
+            while (trackDecoderNext(&dec, &p)) decoded++;
+        }
+        CHECK(decoded < (int)first.size(), "block cut to %zu bytes decoded in full", len);
+    }
+
+    for (int version = 0; version < 256; version++) {
+        if (version == TRACK_BLOCK_VERSION) continue;
+        block[0] = version;
+        TrackDecoder dec;
+        CHECK(!trackDecoderBegin(&dec, block.data(), block.size()), "version %d accepted", version);
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* path = argc > 1 ? argv[1] : "tests/host/data/route1_trace.jsonl";
+    std::ifstream in(path);
+    if (!in) {
+        printf("Cannot open %s\n", path);
+        return 2;
+    }
+
+    // Trace: device records, and the JSON payload line of each
+    std::vector<TrackPoint> points;
+    std::vector<std::string> records;
+    size_t jsonBytes = 0;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty()) continue;
+        TelemetryData data;
+        if (!gpsParsePayload(line.c_str(), &data)) continue;
+        TrackPoint p;
+        trackPointFromTelemetry(&data, &p);
+        points.push_back(p);
+
+        char json[400];
+        jsonBytes += gpsFormatPayload(&data, json, sizeof(json)) + 1;   // + newline
+        gpsFormatRecord(&data, json, sizeof(json));
+        records.push_back(json);
+    }
+    CHECK(points.size() > 0, "no samples in %s", path);
+
+    // Round trip: same TrackPoints, and the same JSON record as before
+    std::vector<std::vector<uint8_t>> blocks = _encode(points);
+    std::vector<TrackPoint> out = _decode(blocks);
+    CHECK(out.size() == points.size(), "%zu of %zu samples decoded", out.size(), points.size());
+    for (size_t i = 0; i < points.size() && i < out.size(); i++) {
+        TelemetryData data;
+        char json[400];
+        trackPointToTelemetry(&out[i], &data);
+        gpsFormatRecord(&data, json, sizeof(json));
+        CHECK(_samePoint(points[i], out[i]) && records[i] == json,
+              "sample %zu differs:\n  %s\n  %s", i, records[i].c_str(), json);
+    }
+
+    _edgeCases();
+    _malformed(points);
+
+    // Compression report (queue frames add 6 bytes per block)
+    size_t blockBytes = 0;
+    for (auto& b : blocks) blockBytes += b.size() + 6;
+    size_t n = points.size();
+    printf("Trace: %s, %zu samples in %zu blocks\n", path, n, blocks.size());
+    printf("  %-28s %8s %10s %7s\n", "format", "bytes", "bytes/rec", "ratio");
+    printf("  %-28s %8zu %10.1f %7.2f\n", "JSONL payloads", jsonBytes,
+           (double)jsonBytes / n, 1.0);
+    printf("  %-28s %8zu %10.1f %7.2f\n", "fixed-width TrackPoint", n * sizeof(TrackPoint),
+           (double)sizeof(TrackPoint), (double)jsonBytes / (n * sizeof(TrackPoint)));
+    printf("  %-28s %8zu %10.1f %7.2f\n", "track blocks (framed)", blockBytes,
+           (double)blockBytes / n, (double)jsonBytes / blockBytes);
+
+    printf("%d failures\n", _failures);
+    puts(_failures == 0 ? "PASS" : "FAIL");
+    return _failures == 0 ? 0 : 1;
+}
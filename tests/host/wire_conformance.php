@@ -0,0 +1,94 @@
+<?php
+/**
+ * SAWARI — Wire Format Conformance Test
+ *
+ * Decodes the firmware-encoded CBOR and MessagePack fixtures in
+ * tests/host/data/wire/ (written by wire_fixtures.cpp) with the server's
+ * decoders (api/gps-decode.php) and checks that every record matches the
+ * JSON body the device sends for the same fixes.
+ *
+ * Usage (from the repository root):
+ *   php tests/host/wire_conformance.php
+ *
+ * Exit status 0 and "PASS" when every fixture matches.
+ */
+
+require_once __DIR__ . '/../../api/gps-decode.php';
+
+$dir = __DIR__ . '/data/wire';
+$failures = 0;
+$checked = 0;
+
+/**
+ * Compare one decoded binary record with its JSON record.
+ *
+ * @return string|null  first difference, or null if they match
+ */
+function compareRecord($got, $want): ?string
+{
+    if (!is_array($got)) {
+        return "record rejected by the decoder";
+    }
+    foreach ($want as $key => $value) {
+        if (!array_key_exists($key, $got)) {
+            return "$key missing";
+        }
+        $actual = $got[$key];
+        if ($key === 'timestamp') {
+            // The JSON body has "" for a fix without time, the binary one null
+            $expected = $value === '' ? null : $value;
+            if ($actual !== $expected) {
+                return "timestamp " . var_export($actual, true) . " != " . var_export($expected, true);
+            }
+        } elseif (abs((float) $actual - (float) $value) > 1e-9) {
+            return "$key $actual != $value";
+        }
+    }
+    return null;
+}
+
+foreach (glob("$dir/*.json") as $jsonFile) {
+    $name = basename($jsonFile, '.json');
+    $want = json_decode(file_get_contents($jsonFile), true);
+    $wantRecords = isset($want['data'][0]) ? $want['data'] : [$want['data']];
+
+    foreach (['cbor' => false, 'msgpack' => true] as $ext => $msgpack) {
+        $binFile = "$dir/$name.$ext";
+        if (!is_file($binFile)) {
+            echo "FAIL $name.$ext: missing\n";
+            $failures++;
+            continue;
+        }
+
+        $decoded = decodeWireBody(file_get_contents($binFile), $msgpack);
+        if ($decoded === null) {
+            echo "FAIL $name.$ext: body rejected\n";
+            $failures++;
+            continue;
+        }
+        $gotRecords = isset($decoded['data'][0]) ? $decoded['data'] : [$decoded['data']];
+        if (count($gotRecords) !== count($wantRecords)) {
+            echo "FAIL $name.$ext: " . count($gotRecords) . " records, want " . count($wantRecords) . "\n";
+            $failures++;
+            continue;
+        }
+
+        foreach ($wantRecords as $i => $record) {
+            $diff = compareRecord($gotRecords[$i], $record);
+            if ($diff !== null) {
+                echo "FAIL $name.$ext record $i: $diff\n";
+                $failures++;
+            }
+            $checked++;
+        }
+    }
+}
+
+if ($checked === 0) {
+    echo "No fixtures in $dir\n";
+    $failures++;
+}
+
+echo "$checked records checked, $failures failures\n";
+echo $failures === 0 ? "PASS\n" : "FAIL\n";
+exit($failures === 0 ? 0 : 1);
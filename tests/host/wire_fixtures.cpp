@@ -0,0 +1,133 @@
+/**
+ * SAWARI — Wire Format Fixture Generator (host)
+ *
+ * Encodes fixes with the firmware's wire_codec.cpp and writes them to
+ * tests/host/data/wire/, next to the JSON body the device would send for
+ * the same fixes with WIRE_FORMAT_JSON:
+ *
+ *   <name>.cbor / <name>.msgpack   body as the device sends it
+ *   <name>.json                    the same fixes as a JSON body
+ *
+ * Fixtures: single fixes from the route trace, one without a time, one
+ * with negative and extreme values, one with a seq above 2^31, and a
+ * batch of the first 64 trace fixes. wire_conformance.php decodes the
+ * binary bodies with the server code and compares them with the JSON.
+ *
+ * wire_codec.cpp is compiled into this file so the format can be picked
+ * at build time (WIRE_FIXTURE_FORMAT); build and run once per format.
+ *
+ * Build (from the repository root):
+ *   g++ -std=gnu++17 -O1 -Itests/host/shim -Isawari_telemetry \
+ *       -DWIRE_FIXTURE_FORMAT=WIRE_FORMAT_CBOR -o wire_fixtures_cbor \
+ *       tests/host/wire_fixtures.cpp tests/host/shim/shim.cpp \
+ *       sawari_telemetry/track_codec.cpp sawari_telemetry/gps_handler.cpp
+ *   (and -DWIRE_FIXTURE_FORMAT=WIRE_FORMAT_MSGPACK -o wire_fixtures_msgpack)
+ *
+ * Usage:
+ *   ./wire_fixtures_cbor && ./wire_fixtures_msgpack
+ */
+
+#include "config.h"
+#undef  WIRE_FORMAT
+#define WIRE_FORMAT WIRE_FIXTURE_FORMAT
+#include "wire_codec.cpp"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if WIRE_FORMAT == WIRE_FORMAT_CBOR
+static const char* kExtension = ".cbor";
+#elif WIRE_FORMAT == WIRE_FORMAT_MSGPACK
+static const char* kExtension = ".msgpack";
+#else
+#error "WIRE_FIXTURE_FORMAT must be WIRE_FORMAT_CBOR or WIRE_FORMAT_MSGPACK"
+#endif
+
+static const char* kTrace  = "tests/host/data/route1_trace.jsonl";
+static const char* kOutDir = "tests/host/data/wire/";
+
+static void _write(const std::string& path, const void* data, size_t len) {
+    std::ofstream out(path, std::ios::binary);
+    out.write((const char*)data, len);
+    if (!out) {
+        printf("Cannot write %s\n", path.c_str());
+        exit(1);
+    }
+}
+
+static void _fix(const char* name, const TelemetryData* data) {
+    uint8_t body[WIRE_RECORD_MAX_BYTES];
+    size_t len = wireEncodePayload(data, body, sizeof(body));
+    _write(std::string(kOutDir) + name + kExtension, body, len);
+
+    char json[400];
+    size_t n = gpsFormatPayload(data, json, sizeof(json));
+    json[n++] = '\n';
+    _write(std::string(kOutDir) + name + ".json", json, n);
+}
+
+static void _batch(const char* name, const std::vector<TelemetryData>& fixes) {
+    static uint8_t body[QUEUE_BATCH_MAX_BYTES];
+    WireBatch batch;
+    wireBatchBegin(&batch, body, sizeof(body));
+    std::string json = "{\"data\":[";
+    for (size_t i = 0; i < fixes.size(); i++) {
+        if (!wireBatchAdd(&batch, &fixes[i])) {
+            printf("Batch %s: fix %zu does not fit\n", name, i);
+            exit(1);
+        }
+        char record[400];
+        gpsFormatRecord(&fixes[i], record, sizeof(record));
+        json += (i > 0 ? "," : "") + std::string(record);
+    }
+    size_t len = wireBatchEnd(&batch);
+    json += "]}\n";
+    _write(std::string(kOutDir) + name + kExtension, body, len);
+    _write(std::string(kOutDir) + name + ".json", json.data(), json.size());
+}
+
+int main() {
+    std::ifstream in(kTrace);
+    if (!in) {
+        printf("Cannot open %s (run from the repository root)\n", kTrace);
+        return 2;
+    }
+    std::vector<TelemetryData> trace;
+    std::string line;
+    while (std::getline(in, line)) {
+        TelemetryData data;
+        if (gpsParsePayload(line.c_str(), &data)) trace.push_back(data);
+    }
+    if (trace.size() < 64) {
+        printf("%s holds %zu fixes, need 64\n", kTrace, trace.size());
+        return 2;
+    }
+
+    _fix("fix-first", &trace[0]);
+    _fix("fix-moving", &trace[40]);
+
+    TelemetryData d = trace[1];
+    d.timestamp[0] = '\0';
+    _fix("fix-no-time", &d);
+
+    d = trace[2];
+    d.latitude = -33.868820;
+    d.longitude = -151.209296;
+    d.altitude = -412.5;
+    d.speed = 6553.5;
+    d.direction = 359.9;
+    d.satellites = 0;
+    d.hdop = 99.9;
+    d.seq = 0;
+    _fix("fix-extremes", &d);
+
+    d = trace[3];
+    d.seq = 0x80000001u;
+    _fix("fix-seq-high", &d);
+
+    _batch("batch", std::vector<TelemetryData>(trace.begin(), trace.begin() + 64));
+
+    printf("Wrote %s fixtures to %s\n", kExtension + 1, kOutDir);
+    return 0;
+}
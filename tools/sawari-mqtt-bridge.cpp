@@ -0,0 +1,686 @@
+/**
+ * SAWARI — MQTT Ingest Bridge
+ *
+ * Forwards everything SAWARI telemetry devices built with MQTT_TRANSPORT
+ * publish to the broker into api/gps-device.php, so MQTT fixes end up in
+ * gps_samples and move the vehicles exactly like HTTP ones. Without it
+ * nothing published over MQTT is stored.
+ *
+ * Devices count the broker's PUBACK as delivered, so the broker has to
+ * keep every message until the API has it. The bridge is an MQTT 3.1.1
+ * client with a persistent session (clean session off, client id
+ * sawari-mqtt-bridge, subscriptions at QoS 1) that acknowledges a message
+ * only after the API answered 2xx, or 400 / 404 / 413 / 415 for a message
+ * it can never take (logged and dropped). Until then the broker holds it
+ * as in flight: if the bridge dies or loses the broker, the broker sends
+ * it again on the next connect (DUP) and the API drops the repeat by
+ * (bus_id, seq).
+ *
+ * Messages wait in one queue per bus, forwarded in order. Each pass POSTs
+ * at most one message per bus, and a bus whose POSTs fail backs off on
+ * its own (Retry-After, or 1 s doubling up to --max-backoff), so a bus the
+ * API keeps refusing never holds up the others. PUBACKs therefore go out
+ * in a different order than the messages came in across buses; MQTT
+ * 3.1.1 asks for arrival order, mosquitto accepts either.
+ *
+ * Broker settings (mosquitto.conf):
+ *   max_inflight_messages 0   held messages count as in flight: with the
+ *                             default limit (20) a bus the API refuses
+ *                             would stop delivery for every bus
+ *   persistence true          messages held for the bridge survive a
+ *                             broker restart
+ *
+ * Topics (sawari_telemetry/config.h, MQTT TRANSPORT):
+ *   <prefix><bus>/live, /batch   wire_codec.h body in --format (the
+ *                                devices' WIRE_FORMAT)
+ *   <prefix><bus>/track          offline queue track block
+ *   <prefix><bus>/backfill       archived track block (X-Backfill: 1)
+ * "backfill" and "control" objects in a response (on errors too: a 503
+ * carries control) go back to the bus as a command on <prefix><bus>/cmd.
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -o sawari-mqtt-bridge tools/sawari-mqtt-bridge.cpp
+ *
+ * Usage:
+ *   sawari-mqtt-bridge --forward URL [--host localhost] [--port 1883]
+ *                      [--user U --password P] [--prefix sawari/bus/]
+ *                      [--format json|cbor|msgpack] [--max-backoff SEC]
+ *                      [--stats SEC]
+ *
+ *   --forward takes a plain http:// URL, e.g.
+ *   http://zenithkandel.com.np/sawari/api/gps-device.php
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Control packet types (first byte)
+static const uint8_t kConnect   = 0x10;
+static const uint8_t kConnack   = 0x20;
+static const uint8_t kPublish   = 0x30;
+static const uint8_t kPuback    = 0x40;
+static const uint8_t kSubscribe = 0x82;     // Flags 0010 are mandatory
+static const uint8_t kSuback    = 0x90;
+static const uint8_t kPingreq   = 0xC0;
+
+static const char*    kClientId    = "sawari-mqtt-bridge";
+static const int      kKeepAliveS  = 60;
+static const int      kReconnectMs = 2000;
+
+// A forward POST taking longer than this counts as failed
+static const int kForwardTimeoutMs = 10000;
+
+// Statuses for a message the API will never take: acknowledged and dropped
+static const int kPermanent[] = { 400, 404, 413, 415 };
+
+static volatile sig_atomic_t gStop = 0;
+
+static double nowSeconds()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string timeOfDay()
+{
+    char buf[16];
+    time_t t = time(nullptr);
+    struct tm tm;
+    localtime_r(&t, &tm);
+    strftime(buf, sizeof(buf), "%H:%M:%S", &tm);
+    return buf;
+}
+
+/** Wait for `fd` to be ready for `events`. False on timeout / error. */
+static bool waitFd(int fd, short events, double deadline)
+{
+    int wait = (int)((deadline - nowSeconds()) * 1000);
+    if (wait <= 0) return false;
+    struct pollfd pfd = { fd, events, 0 };
+    return poll(&pfd, 1, wait) > 0;
+}
+
+/** TCP connection to host:port, or -1. */
+static int connectTcp(const std::string& host, const std::string& port)
+{
+    struct addrinfo hints = {}, *res = nullptr;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) return -1;
+    int sock = -1;
+    for (struct addrinfo* a = res; a; a = a->ai_next) {
+        sock = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (sock >= 0 && connect(sock, a->ai_addr, a->ai_addrlen) == 0) break;
+        if (sock >= 0) close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+    return sock;
+}
+
+// ── API Forwarding ───────────────────────────────────────────
+
+struct HttpResponse {
+    int status = -1;            // -1: no response
+    int retryAfter = 0;         // Seconds, 0 = not given
+    std::string body;
+};
+
+/**
+ * Minimal POST (plain http:// only). Sent as HTTP/1.0 so the response is
+ * never chunked: the body is everything up to the close.
+ */
+static HttpResponse httpPost(const std::string& url, const std::vector<uint8_t>& body,
+                             const std::vector<std::string>& headers)
+{
+    HttpResponse res;
+    std::string rest = url.substr(7);
+    size_t slash = rest.find('/');
+    std::string hostPort = rest.substr(0, slash);
+    std::string path = slash == std::string::npos ? "/" : rest.substr(slash);
+    std::string host = hostPort, port = "80";
+    size_t colon = hostPort.find(':');
+    if (colon != std::string::npos) {
+        host = hostPort.substr(0, colon);
+        port = hostPort.substr(colon + 1);
+    }
+
+    int sock = connectTcp(host, port);
+    if (sock < 0) return res;
+
+    std::string req = "POST " + path + " HTTP/1.0\r\nHost: " + host + "\r\n";
+    for (const auto& h : headers) req += h + "\r\n";
+    req += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+    req.append((const char*)body.data(), body.size());
+
+    double deadline = nowSeconds() + kForwardTimeoutMs / 1000.0;
+    size_t sent = 0;
+    while (sent < req.size() && waitFd(sock, POLLOUT, deadline)) {
+        ssize_t n = send(sock, req.data() + sent, req.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) break;
+        sent += n;
+    }
+
+    std::string raw;
+    char buf[1024];
+    ssize_t n = 0;
+    while (sent == req.size() && waitFd(sock, POLLIN, deadline) &&
+           (n = recv(sock, buf, sizeof(buf), 0)) > 0) {
+        raw.append(buf, n);
+    }
+    close(sock);
+    if (n != 0) return res;                 // Timed out or reset: no response
+
+    // "HTTP/1.1 200 OK", headers, blank line, body
+    size_t headEnd = raw.find("\r\n\r\n");
+    size_t sp = raw.find(' ');
+    if (raw.compare(0, 5, "HTTP/") != 0 || headEnd == std::string::npos ||
+        sp == std::string::npos) {
+        return res;
+    }
+    res.status = atoi(raw.c_str() + sp + 1);
+    for (size_t at = raw.find("\r\n") + 2; at < headEnd; ) {
+        size_t eol = raw.find("\r\n", at);
+        if (strncasecmp(raw.c_str() + at, "Retry-After:", 12) == 0) {
+            res.retryAfter = atoi(raw.c_str() + at + 12);
+        }
+        at = eol + 2;
+    }
+    res.body = raw.substr(headEnd + 4);
+    return res;
+}
+
+/**
+ * The raw JSON value of a top-level `key` in a response, or "" if absent
+ * or null. Enough for the flat objects gps-device.php sends back.
+ */
+static std::string jsonMember(const std::string& json, const std::string& key)
+{
+    size_t at = json.find("\"" + key + "\"");
+    if (at == std::string::npos) return "";
+    at = json.find(':', at + key.size() + 2);
+    if (at == std::string::npos) return "";
+    at = json.find_first_not_of(" \t\r\n", at + 1);
+    if (at == std::string::npos || json.compare(at, 4, "null") == 0) return "";
+
+    int depth = 0;
+    bool inString = false;
+    for (size_t i = at; i < json.size(); i++) {
+        char c = json[i];
+        if (inString) {
+            if (c == '\\') i++;
+            else if (c == '"') inString = false;
+        } else if (c == '"') {
+            inString = true;
+        } else if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']' || c == ',') {
+            if (depth == 0) return json.substr(at, i - at);
+            if (c != ',' && --depth == 0) return json.substr(at, i + 1 - at);
+        }
+    }
+    return "";
+}
+
+// ── MQTT Session ─────────────────────────────────────────────
+
+/** One PUBLISH received, waiting for the API. */
+struct Message {
+    uint16_t packetId;          // 0: QoS 0, nothing to acknowledge
+    std::string kind;           // live, batch, track, backfill
+    std::vector<uint8_t> body;
+    double received;            // nowSeconds()
+};
+
+/** A minimal MQTT 3.1.1 client, blocking writes, polled reads. */
+class Broker {
+public:
+    bool up() const { return fd_ >= 0; }
+
+    /** Connect, resume the session and subscribe. */
+    bool connect(const std::string& host, int port, const std::string& user,
+                 const std::string& password, const std::string& prefix)
+    {
+        close();
+        fd_ = connectTcp(host, std::to_string(port));
+        if (fd_ < 0) return false;
+
+        std::vector<uint8_t> body;
+        putString(body, "MQTT");
+        body.push_back(4);                                  // Protocol level: 3.1.1
+        body.push_back(user.empty() ? 0 : 0xC0);            // Username + password, clean session off
+        body.push_back((uint8_t)(kKeepAliveS >> 8));
+        body.push_back((uint8_t)kKeepAliveS);
+        putString(body, kClientId);
+        if (!user.empty()) {
+            putString(body, user);
+            putString(body, password);
+        }
+        if (!send(kConnect, body)) return false;
+
+        // CONNACK before anything else
+        double deadline = nowSeconds() + kForwardTimeoutMs / 1000.0;
+        uint8_t type;
+        std::vector<uint8_t> packet;
+        while (up() && !next(type, packet)) {
+            if (!waitFd(fd_, POLLIN, deadline) || !fill()) close();
+        }
+        if (!up() || type != kConnack || packet.size() != 2 || packet[1] != 0) {
+            fprintf(stderr, "mqtt: connection refused (code %d)\n",
+                    up() && type == kConnack && packet.size() == 2 ? packet[1] : -1);
+            close();
+            return false;
+        }
+        fprintf(stderr, "mqtt: connected to %s:%d (%s session)\n", host.c_str(), port,
+                packet[0] & 0x01 ? "resumed" : "new");
+
+        // Subscribing again is harmless on a resumed session
+        body.clear();
+        body.push_back(0);
+        body.push_back(1);                                  // Packet id
+        for (const char* kind : { "live", "batch", "track", "backfill" }) {
+            putString(body, prefix + "+/" + kind);
+            body.push_back(1);                              // Requested QoS
+        }
+        return send(kSubscribe, body);
+    }
+
+    void close()
+    {
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+        rx_.clear();
+        pingOut_ = false;
+    }
+
+    /**
+     * Wait up to `waitMs` for data and append every PUBLISH received to
+     * `out` as (topic, message). Pings when idle; closes on a dead link.
+     */
+    void poll(int waitMs, std::vector<std::pair<std::string, Message>>& out)
+    {
+        if (!up()) return;
+        double now = nowSeconds();
+        if (pingOut_ && now - pingAt_ > kKeepAliveS / 2.0) {
+            fprintf(stderr, "mqtt: broker stopped answering\n");
+            close();
+            return;
+        }
+        if (!pingOut_ && now - lastTx_ >= kKeepAliveS / 2.0) {
+            if (!send(kPingreq, {})) return;
+            pingOut_ = true;
+            pingAt_ = now;
+        }
+
+        struct pollfd pfd = { fd_, POLLIN, 0 };
+        if (::poll(&pfd, 1, std::max(0, waitMs)) > 0 && !fill()) {
+            fprintf(stderr, "mqtt: connection lost\n");
+            close();
+            return;
+        }
+
+        uint8_t type;
+        std::vector<uint8_t> packet;
+        while (up() && next(type, packet)) {
+            pingOut_ = false;                               // The broker is alive
+            if ((type & 0xF0) == kPublish) {
+                int qos = (type >> 1) & 0x03;
+                if (packet.size() < 2) continue;
+                size_t at = 2 + ((packet[0] << 8) | packet[1]);
+                if (at + (qos ? 2 : 0) > packet.size()) continue;
+                std::string topic((const char*)packet.data() + 2, at - 2);
+                Message m;
+                m.packetId = qos ? (uint16_t)((packet[at] << 8) | packet[at + 1]) : 0;
+                at += qos ? 2 : 0;
+                m.body.assign(packet.begin() + at, packet.end());
+                m.received = nowSeconds();
+                out.emplace_back(topic, std::move(m));
+            } else if (type == kSuback && packet.size() > 2 &&
+                       std::find(packet.begin() + 2, packet.end(), 0x80) != packet.end()) {
+                fprintf(stderr, "mqtt: broker refused a subscription\n");
+            }
+            // PUBACK (for commands), PINGRESP: being heard from is enough
+        }
+    }
+
+    bool puback(uint16_t packetId)
+    {
+        return send(kPuback, { (uint8_t)(packetId >> 8), (uint8_t)packetId });
+    }
+
+    /** QoS 1 PUBLISH (its PUBACK is not waited for). */
+    bool publish(const std::string& topic, const std::string& payload)
+    {
+        if (++nextId_ == 0) nextId_ = 2;                    // 0 is invalid, 1 is the SUBSCRIBE
+        std::vector<uint8_t> body;
+        putString(body, topic);
+        body.push_back((uint8_t)(nextId_ >> 8));
+        body.push_back((uint8_t)nextId_);
+        body.insert(body.end(), payload.begin(), payload.end());
+        return send(kPublish | 0x02, body);
+    }
+
+private:
+    static void putString(std::vector<uint8_t>& out, const std::string& s)
+    {
+        out.push_back((uint8_t)(s.size() >> 8));
+        out.push_back((uint8_t)s.size());
+        out.insert(out.end(), s.begin(), s.end());
+    }
+
+    bool send(uint8_t type, const std::vector<uint8_t>& body)
+    {
+        if (!up()) return false;
+        std::vector<uint8_t> packet = { type };
+        size_t len = body.size();
+        do {
+            uint8_t b = len % 128;
+            len /= 128;
+            packet.push_back(len > 0 ? b | 0x80 : b);
+        } while (len > 0);
+        packet.insert(packet.end(), body.begin(), body.end());
+
+        size_t sent = 0;
+        while (sent < packet.size()) {
+            ssize_t n = ::send(fd_, packet.data() + sent, packet.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                fprintf(stderr, "mqtt: write failed: %s\n", strerror(errno));
+                close();
+                return false;
+            }
+            sent += n;
+        }
+        lastTx_ = nowSeconds();
+        return true;
+    }
+
+    /** Read what is waiting. False once the connection is gone. */
+    bool fill()
+    {
+        uint8_t buf[4096];
+        ssize_t n = recv(fd_, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n > 0) {
+            rx_.insert(rx_.end(), buf, buf + n);
+            return true;
+        }
+        return n < 0 && (errno == EAGAIN || errno == EINTR);
+    }
+
+    /** Take one complete packet off the receive buffer. */
+    bool next(uint8_t& type, std::vector<uint8_t>& packet)
+    {
+        size_t len = 0, at = 1;
+        for (int shift = 0; ; shift += 7) {
+            if (at >= rx_.size()) return false;
+            if (shift > 21) {
+                close();                                    // Malformed length
+                return false;
+            }
+            uint8_t b = rx_[at++];
+            len |= (size_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) break;
+        }
+        if (rx_.size() < at + len) return false;
+        type = rx_[0];
+        packet.assign(rx_.begin() + at, rx_.begin() + at + len);
+        rx_.erase(rx_.begin(), rx_.begin() + at + len);
+        return true;
+    }
+
+    int fd_ = -1;
+    std::vector<uint8_t> rx_;
+    double lastTx_ = 0;
+    bool pingOut_ = false;
+    double pingAt_ = 0;
+    uint16_t nextId_ = 1;
+};
+
+// ── Bridge ───────────────────────────────────────────────────
+
+/** Messages of one bus, forwarded in order. */
+struct Bus {
+    std::deque<Message> queue;
+    double nextTry = 0;         // nowSeconds() of the next POST
+    double backoff = 0;         // Current retry delay, 0 after a success
+};
+
+struct Stats {
+    size_t received = 0;        // PUBLISHes taken in (redeliveries included)
+    size_t forwarded = 0;       // Acknowledged after 2xx
+    size_t refused = 0;         // Acknowledged after a permanent error
+    size_t retries = 0;         // POSTs that failed and will be repeated
+    size_t commands = 0;        // Published on <bus>/cmd
+    double latencySum = 0;      // Received -> acknowledged
+    double latencyMax = 0;
+};
+
+static void printStats(const Stats& s, const std::map<int, Bus>& buses)
+{
+    size_t held = 0;
+    for (const auto& b : buses) held += b.second.queue.size();
+    size_t done = s.forwarded + s.refused;
+    fprintf(stderr, "bridge: %zu received, %zu forwarded, %zu refused, %zu retries, "
+            "%zu commands, %zu held; received to acknowledged mean %.2f s max %.1f s\n",
+            s.received, s.forwarded, s.refused, s.retries, s.commands, held,
+            done ? s.latencySum / done : 0.0, s.latencyMax);
+}
+
+struct Options {
+    std::string host = "localhost";
+    int port = 1883;
+    std::string user, password;
+    std::string prefix = "sawari/bus/";
+    std::string forwardUrl;
+    std::string contentType = "application/json";
+    double maxBackoff = 60;
+};
+
+/**
+ * POST the oldest message of `bus`; acknowledge and drop it once the API
+ * took or refused it, otherwise back the bus off.
+ */
+static void forward(int busId, Bus& bus, Broker& broker, const Options& opt, Stats& stats)
+{
+    Message& m = bus.queue.front();
+    std::vector<std::string> headers = { "X-Bus-Id: " + std::to_string(busId) };
+    if (m.kind == "track" || m.kind == "backfill") {
+        headers.push_back("Content-Type: application/x-sawari-track");
+        if (m.kind == "backfill") headers.push_back("X-Backfill: 1");
+    } else {
+        headers.push_back("Content-Type: " + opt.contentType);
+    }
+
+    HttpResponse res = httpPost(opt.forwardUrl, m.body, headers);
+
+    // Hand backfill / control back to the bus
+    std::string command;
+    for (const char* key : { "backfill", "control" }) {
+        std::string value = jsonMember(res.body, key);
+        if (value.empty()) continue;
+        command += (command.empty() ? "{\"" : ",\"") + std::string(key) + "\":" + value;
+    }
+    if (!command.empty() && broker.publish(opt.prefix + std::to_string(busId) + "/cmd",
+                                           command + "}")) {
+        stats.commands++;
+    }
+
+    bool ok = res.status >= 200 && res.status < 300;
+    bool permanent = std::find(std::begin(kPermanent), std::end(kPermanent), res.status) !=
+                     std::end(kPermanent);
+    if (!ok && !permanent) {
+        stats.retries++;
+        bus.backoff = bus.backoff > 0 ? std::min(bus.backoff * 2, opt.maxBackoff) : 1;
+        double wait = res.retryAfter > 0 ? res.retryAfter : bus.backoff;
+        bus.nextTry = nowSeconds() + wait;
+        fprintf(stderr, "%s bus %d %s: HTTP %d, retrying in %.0f s (%zu held)\n",
+                timeOfDay().c_str(), busId, m.kind.c_str(), res.status, wait,
+                bus.queue.size());
+        return;
+    }
+
+    if (permanent) {
+        stats.refused++;
+        fprintf(stderr, "%s bus %d %s: refused (HTTP %d) %s\n", timeOfDay().c_str(), busId,
+                m.kind.c_str(), res.status, jsonMember(res.body, "message").c_str());
+    } else {
+        stats.forwarded++;
+        std::string rejected = jsonMember(res.body, "rejected");
+        if (!rejected.empty() && rejected != "0") {
+            fprintf(stderr, "%s bus %d %s: %s record(s) rejected: %s\n", timeOfDay().c_str(),
+                    busId, m.kind.c_str(), rejected.c_str(),
+                    jsonMember(res.body, "errors").c_str());
+        }
+    }
+
+    // Only now may the broker forget it
+    if (m.packetId != 0 && !broker.puback(m.packetId)) return;
+    double latency = nowSeconds() - m.received;
+    stats.latencySum += latency;
+    stats.latencyMax = std::max(stats.latencyMax, latency);
+    bus.queue.pop_front();
+    bus.backoff = 0;
+    bus.nextTry = 0;
+}
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: sawari-mqtt-bridge --forward URL [--host H] [--port N] [--user U --password P]\n"
+            "                          [--prefix sawari/bus/] [--format json|cbor|msgpack]\n"
+            "                          [--max-backoff SEC] [--stats SEC]\n");
+}
+
+static void onSignal(int)
+{
+    gStop = 1;
+}
+
+// ── Main ─────────────────────────────────────────────────────
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    double statsEvery = 60;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        auto next = [&]() -> const char* {
+            if (i + 1 >= argc) {
+                usage();
+                exit(2);
+            }
+            return argv[++i];
+        };
+        if (a == "--host") opt.host = next();
+        else if (a == "--port") opt.port = atoi(next());
+        else if (a == "--user") opt.user = next();
+        else if (a == "--password") opt.password = next();
+        else if (a == "--prefix") opt.prefix = next();
+        else if (a == "--forward") opt.forwardUrl = next();
+        else if (a == "--max-backoff") opt.maxBackoff = std::max(1.0, atof(next()));
+        else if (a == "--stats") statsEvery = atof(next());
+        else if (a == "--format") {
+            std::string f = next();
+            if (f == "json") opt.contentType = "application/json";
+            else if (f == "cbor") opt.contentType = "application/cbor";
+            else if (f == "msgpack") opt.contentType = "application/msgpack";
+            else {
+                usage();
+                return 2;
+            }
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    if (opt.forwardUrl.compare(0, 7, "http://") != 0) {
+        fprintf(stderr, "--forward takes a plain http:// URL\n");
+        usage();
+        return 2;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "bridge: %s:%d %s+/... -> %s (%s)\n", opt.host.c_str(), opt.port,
+            opt.prefix.c_str(), opt.forwardUrl.c_str(), opt.contentType.c_str());
+
+    Broker broker;
+    std::map<int, Bus> buses;
+    Stats stats;
+    double nextConnect = 0;
+    double nextStats = statsEvery > 0 ? nowSeconds() + statsEvery : 0;
+    std::vector<std::pair<std::string, Message>> incoming;
+
+    while (!gStop) {
+        double now = nowSeconds();
+        if (nextStats > 0 && now >= nextStats) {
+            printStats(stats, buses);
+            nextStats = now + statsEvery;
+        }
+
+        if (!broker.up()) {
+            // Whatever was held is redelivered by the broker on reconnect
+            buses.clear();
+            if (now < nextConnect) {
+                usleep(100 * 1000);
+                continue;
+            }
+            nextConnect = now + kReconnectMs / 1000.0;
+            if (!broker.connect(opt.host, opt.port, opt.user, opt.password, opt.prefix)) {
+                fprintf(stderr, "mqtt: cannot reach %s:%d\n", opt.host.c_str(), opt.port);
+                continue;
+            }
+        }
+
+        // Sleep until the next bus is due (new messages wake us up)
+        int waitMs = 200;
+        for (const auto& b : buses) {
+            if (b.second.queue.empty()) continue;
+            waitMs = std::min(waitMs, std::max(0, (int)((b.second.nextTry - now) * 1000)));
+        }
+        incoming.clear();
+        broker.poll(waitMs, incoming);
+        for (auto& in : incoming) {
+            const std::string& topic = in.first;
+            size_t slash = topic.find('/', opt.prefix.size());
+            int busId = atoi(topic.c_str() + opt.prefix.size());
+            if (topic.compare(0, opt.prefix.size(), opt.prefix) != 0 ||
+                slash == std::string::npos || busId <= 0) {
+                if (in.second.packetId) broker.puback(in.second.packetId);  // Not ours
+                continue;
+            }
+            in.second.kind = topic.substr(slash + 1);
+            buses[busId].queue.push_back(std::move(in.second));
+            stats.received++;
+        }
+
+        // One POST per due bus per pass
+        now = nowSeconds();
+        for (auto& b : buses) {
+            if (!broker.up() || gStop) break;
+            if (!b.second.queue.empty() && b.second.nextTry <= now) {
+                forward(b.first, b.second, broker, opt, stats);
+            }
+        }
+    }
+
+    printStats(stats, buses);
+    broker.close();
+    return 0;
+}
@@ -0,0 +1,1122 @@
+/**
+ * SAWARI — USB Bulk Offload Receiver
+ *
+ * Pulls the offline queue and/or the track archive off a SAWARI telemetry
+ * device over its USB serial port, much faster than the device draining
+ * its queue one HTTP POST at a time over weak depot WiFi. The samples are
+ * written as JSONL (same objects the device POSTs) and/or forwarded to the
+ * API as track blocks of up to --batch samples per request.
+ *
+ * Wire format: sawari_telemetry/offload_protocol.h (shared with the
+ * firmware). Files arrive raw, as stored on the device (CRC-framed track
+ * blocks), in CRC-checked chunks. A damaged or lost chunk is read again
+ * from its offset; with --state, an interrupted run resumes where the
+ * last one stopped. With --commit, queue data is dropped on the device
+ * once it has been written out (and forwarded, with --forward).
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -o sawari-offload tools/sawari-offload.cpp
+ *
+ * Usage:
+ *   sawari-offload --port /dev/ttyUSB0 [--queue] [--archive FROM TO]
+ *                  [--out samples.jsonl] [--forward URL] [--batch N]
+ *                  [--commit] [--state FILE] [--baud 115200]
+ *
+ *   FROM / TO are Unix seconds. Without --queue or --archive, the queue
+ *   is offloaded. --forward takes a plain http:// URL, e.g.
+ *   http://zenithkandel.com.np/sawari/api/gps-device.php
+ *
+ * Loopback benchmark (no hardware): a built-in device emulator serves a
+ * synthetic queue on a pseudo-terminal and the receiver pulls it through
+ * the same code path as a real port.
+ *   sawari-offload --bench [--bench-kb 2048] [--bench-errors N]
+ *   (--bench-errors N corrupts every Nth data chunk to exercise resume)
+ */
+
+#include "../sawari_telemetry/offload_protocol.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Track block format (sawari_telemetry/track_codec.h)
+static const uint8_t  kBlockVersion   = 4;
+static const int      kFieldCount     = 9;
+static const size_t   kMaxBlockBytes  = 2 + 255 * (1 + kFieldCount * 5);
+static const uint16_t kFrameCrc       = 0x8000;
+static const uint16_t kFrameLenMask   = 0x7FFF;
+
+static const int kFrameTimeoutMs = 2000;
+static const int kMaxRetries     = 8;
+
+// ── CRC32 (IEEE 802.3), same as trackCrc32() ─────────────────
+
+static uint32_t crc32(const uint8_t* data, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFFu;
+    while (len--) {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t getLE32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static double nowSeconds()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// ── Track Codec (mirrors sawari_telemetry/track_codec.cpp) ───
+
+struct Point {
+    int32_t  latitude;      // degrees x1e6
+    int32_t  longitude;     // degrees x1e6
+    uint32_t timestamp;     // Unix seconds
+    int32_t  altitude;      // metres x10
+    uint16_t speed;         // km/h x10
+    uint16_t direction;     // degrees x10
+    uint8_t  satellites;
+    uint16_t hdop;          // x10
+    uint32_t seq;           // Per-device sequence number (0 = none)
+};
+
+// Mask bit per field: satellites and hdop share bit 6
+static const uint8_t kMaskBit[kFieldCount] = { 0, 1, 2, 3, 4, 5, 6, 6, 7 };
+
+static void toFields(const Point& p, uint32_t f[kFieldCount])
+{
+    f[0] = (uint32_t)p.latitude;
+    f[1] = (uint32_t)p.longitude;
+    f[2] = p.timestamp;
+    f[3] = (uint32_t)p.altitude;
+    f[4] = p.speed;
+    f[5] = p.direction;
+    f[6] = p.satellites;
+    f[7] = p.hdop;
+    f[8] = p.seq;
+}
+
+static Point fromFields(const uint32_t f[kFieldCount])
+{
+    Point p;
+    p.latitude = (int32_t)f[0];
+    p.longitude = (int32_t)f[1];
+    p.timestamp = f[2];
+    p.altitude = (int32_t)f[3];
+    p.speed = (uint16_t)f[4];
+    p.direction = (uint16_t)f[5];
+    p.satellites = (uint8_t)f[6];
+    p.hdop = (uint16_t)f[7];
+    p.seq = f[8];
+    return p;
+}
+
+static uint32_t zigzag(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+static int32_t unzigzag(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+static void putVarint(std::vector<uint8_t>& out, uint32_t v)
+{
+    while (v >= 0x80) {
+        out.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((uint8_t)v);
+}
+
+/** Decode one track block. Returns false if it is malformed. */
+static bool decodeBlock(const uint8_t* b, size_t len, std::vector<Point>& out)
+{
+    if (len < 2 || b[0] != kBlockVersion || b[1] == 0) {
+        return false;
+    }
+    size_t pos = 2;
+    auto varint = [&](uint32_t& v) {
+        v = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            if (pos >= len) return false;
+            uint8_t c = b[pos++];
+            v |= (uint32_t)(c & 0x7F) << shift;
+            if (!(c & 0x80)) return true;
+        }
+        return false;
+    };
+
+    uint32_t f[kFieldCount] = {0};
+    uint32_t lastDelta = 0;
+    uint32_t v;
+    for (int n = 0; n < b[1]; n++) {
+        if (n == 0) {
+            for (int i = 0; i < kFieldCount; i++) {
+                if (!varint(v)) return false;
+                f[i] = (uint32_t)unzigzag(v);
+            }
+        } else {
+            if (pos >= len) return false;
+            uint8_t mask = b[pos++];
+            int32_t d[kFieldCount] = {0};
+            for (int i = 0; i < kFieldCount; i++) {
+                if (mask & (1 << kMaskBit[i])) {
+                    if (!varint(v)) return false;
+                    d[i] = unzigzag(v);
+                }
+            }
+            lastDelta += (uint32_t)d[2];
+            f[2] += lastDelta;
+            for (int i = 0; i < kFieldCount; i++) {
+                if (i != 2 && i != 5) f[i] += (uint32_t)d[i];
+            }
+            f[5] = (uint32_t)(((int32_t)f[5] + d[5] + 3600) % 3600);
+            f[8] += 1;
+        }
+        out.push_back(fromFields(f));
+    }
+    return true;
+}
+
+/** Encode samples (at most 255) into one track block. */
+static std::vector<uint8_t> encodeBlock(const std::vector<Point>& points)
+{
+    std::vector<uint8_t> out = { kBlockVersion, (uint8_t)points.size() };
+    uint32_t lastDelta = 0;
+    for (size_t n = 0; n < points.size(); n++) {
+        uint32_t cur[kFieldCount];
+        toFields(points[n], cur);
+        if (n == 0) {
+            for (int i = 0; i < kFieldCount; i++) putVarint(out, zigzag((int32_t)cur[i]));
+            continue;
+        }
+        uint32_t prev[kFieldCount];
+        toFields(points[n - 1], prev);
+        int32_t d[kFieldCount];
+        for (int i = 0; i < kFieldCount; i++) d[i] = (int32_t)(cur[i] - prev[i]);
+        uint32_t delta = cur[2] - prev[2];
+        d[2] = (int32_t)(delta - lastDelta);
+        lastDelta = delta;
+        int32_t h = (int32_t)cur[5] - (int32_t)prev[5];
+        d[5] = h > 1800 ? h - 3600 : (h < -1800 ? h + 3600 : h);
+        d[8] = (int32_t)(cur[8] - prev[8] - 1);
+
+        uint8_t mask = 0;
+        for (int i = 0; i < kFieldCount; i++) {
+            if (d[i] != 0) mask |= (1 << kMaskBit[i]);
+        }
+        out.push_back(mask);
+        for (int i = 0; i < kFieldCount; i++) {
+            if (mask & (1 << kMaskBit[i])) putVarint(out, zigzag(d[i]));
+        }
+    }
+    return out;
+}
+
+/** Wrap a block as stored on the device: [len | 0x8000][block][CRC32]. */
+static void appendStoredFrame(std::vector<uint8_t>& out, const std::vector<uint8_t>& block)
+{
+    uint16_t prefix = (uint16_t)block.size() | kFrameCrc;
+    uint32_t crc = crc32(block.data(), block.size());
+    out.push_back(prefix & 0xFF);
+    out.push_back(prefix >> 8);
+    out.insert(out.end(), block.begin(), block.end());
+    for (int i = 0; i < 4; i++) out.push_back((uint8_t)(crc >> (8 * i)));
+}
+
+// ── Serial Link ──────────────────────────────────────────────
+
+static bool baudConstant(int baud, speed_t* out)
+{
+    static const struct { int baud; speed_t code; } table[] = {
+        { 9600, B9600 }, { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 },
+        { 115200, B115200 }, { 230400, B230400 }, { 460800, B460800 },
+        { 921600, B921600 }, { 1000000, B1000000 }, { 1500000, B1500000 },
+        { 2000000, B2000000 }, { 3000000, B3000000 },
+    };
+    for (const auto& e : table) {
+        if (e.baud == baud) {
+            *out = e.code;
+            return true;
+        }
+    }
+    return false;
+}
+
+struct Frame {
+    uint8_t type = 0;
+    std::vector<uint8_t> payload;
+};
+
+/**
+ * Framed link over a file descriptor (serial port or pseudo-terminal).
+ * Bytes outside valid frames (device log lines) are skipped.
+ */
+class Link {
+public:
+    explicit Link(int fd) : fd_(fd) {}
+
+    bool setBaud(int baud)
+    {
+        speed_t code;
+        struct termios tio;
+        if (!baudConstant(baud, &code) || tcgetattr(fd_, &tio) != 0) return false;
+        cfmakeraw(&tio);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tio.c_cc[VMIN] = 0;
+        tio.c_cc[VTIME] = 0;
+        cfsetispeed(&tio, code);
+        cfsetospeed(&tio, code);
+        return tcsetattr(fd_, TCSANOW, &tio) == 0;
+    }
+
+    bool writeAll(const void* data, size_t len)
+    {
+        const uint8_t* p = (const uint8_t*)data;
+        while (len > 0) {
+            ssize_t n = ::write(fd_, p, len);
+            if (n < 0) {
+                if (errno == EINTR || errno == EAGAIN) {
+                    struct pollfd pfd = { fd_, POLLOUT, 0 };
+                    poll(&pfd, 1, 100);
+                    continue;
+                }
+                return false;
+            }
+            p += n;
+            len -= n;
+            bytesOut += n;
+        }
+        return true;
+    }
+
+    bool sendFrame(uint8_t type, const void* payload, size_t len)
+    {
+        std::vector<uint8_t> f = { OFFLOAD_SYNC0, OFFLOAD_SYNC1, type,
+                                   (uint8_t)(len & 0xFF), (uint8_t)(len >> 8) };
+        f.insert(f.end(), (const uint8_t*)payload, (const uint8_t*)payload + len);
+        uint32_t crc = crc32(f.data() + 2, 3 + len);
+        for (int i = 0; i < 4; i++) f.push_back((uint8_t)(crc >> (8 * i)));
+        return writeAll(f.data(), f.size());
+    }
+
+    /** Read one text line (handshake). */
+    bool readLine(std::string& line, int timeoutMs)
+    {
+        double deadline = nowSeconds() + timeoutMs / 1000.0;
+        for (;;) {
+            auto nl = std::find(rx_.begin(), rx_.end(), '\n');
+            if (nl != rx_.end()) {
+                line.assign(rx_.begin(), nl);
+                rx_.erase(rx_.begin(), nl + 1);
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                return true;
+            }
+            if (!fill(deadline)) return false;
+        }
+    }
+
+    /** Read the next valid frame. Returns false on timeout. */
+    bool readFrame(Frame& frame, int timeoutMs)
+    {
+        double deadline = nowSeconds() + timeoutMs / 1000.0;
+        for (;;) {
+            // Find a sync pair
+            size_t i = 0;
+            while (i + 1 < rx_.size() && !(rx_[i] == OFFLOAD_SYNC0 && rx_[i + 1] == OFFLOAD_SYNC1)) i++;
+            if (i > 0) {
+                skipped += i;
+                rx_.erase(rx_.begin(), rx_.begin() + i);
+            }
+
+            if (rx_.size() >= OFFLOAD_HEADER_BYTES) {
+                size_t len = rx_[3] | (rx_[4] << 8);
+                size_t total = OFFLOAD_HEADER_BYTES + len + OFFLOAD_TRAILER_BYTES;
+                if (len > OFFLOAD_MAX_PAYLOAD) {
+                    rx_.erase(rx_.begin());         // Not a frame: resync
+                    skipped++;
+                    continue;
+                }
+                if (rx_.size() >= total) {
+                    uint32_t crc = getLE32(&rx_[OFFLOAD_HEADER_BYTES + len]);
+                    if (crc != crc32(&rx_[2], 3 + len)) {
+                        badFrames++;
+                        rx_.erase(rx_.begin());     // Damaged: resync past it
+                        continue;
+                    }
+                    frame.type = rx_[2];
+                    frame.payload.assign(rx_.begin() + OFFLOAD_HEADER_BYTES,
+                                         rx_.begin() + OFFLOAD_HEADER_BYTES + len);
+                    rx_.erase(rx_.begin(), rx_.begin() + total);
+                    return true;
+                }
+            }
+            if (!fill(deadline)) return false;
+        }
+    }
+
+    void discardInput()
+    {
+        tcflush(fd_, TCIFLUSH);
+        rx_.clear();
+    }
+
+    size_t bytesIn = 0, bytesOut = 0, skipped = 0, badFrames = 0;
+
+private:
+    bool fill(double deadline)
+    {
+        int wait = (int)((deadline - nowSeconds()) * 1000);
+        if (wait <= 0) return false;
+        struct pollfd pfd = { fd_, POLLIN, 0 };
+        if (poll(&pfd, 1, wait) <= 0) return false;
+        uint8_t buf[8192];
+        ssize_t n = ::read(fd_, buf, sizeof(buf));
+        if (n <= 0) return false;
+        rx_.insert(rx_.end(), buf, buf + n);
+        bytesIn += n;
+        return true;
+    }
+
+    int fd_;
+    std::vector<uint8_t> rx_;
+};
+
+// ── Output: JSONL and API Forwarding ─────────────────────────
+
+static std::string formatJson(int busId, const Point& p)
+{
+    char ts[32];
+    time_t t = p.timestamp;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+    char line[400];
+    snprintf(line, sizeof(line),
+             "{\"data\":{\"bus_id\":%d,\"latitude\":%.6f,\"longitude\":%.6f,"
+             "\"speed\":%.1f,\"direction\":%.1f,\"altitude\":%.1f,"
+             "\"satellites\":%d,\"hdop\":%.1f,\"timestamp\":\"%s\",\"seq\":%lu}}",
+             busId, p.latitude / 1e6, p.longitude / 1e6, p.speed / 10.0,
+             p.direction / 10.0, p.altitude / 10.0, p.satellites, p.hdop / 10.0, ts,
+             (unsigned long)p.seq);
+    return line;
+}
+
+/** Minimal HTTP/1.1 POST (plain http:// only). Returns the status code or -1. */
+static int httpPost(const std::string& url, const std::vector<uint8_t>& body,
+                    const std::vector<std::string>& headers)
+{
+    if (url.compare(0, 7, "http://") != 0) return -1;
+    std::string rest = url.substr(7);
+    size_t slash = rest.find('/');
+    std::string hostPort = rest.substr(0, slash);
+    std::string path = slash == std::string::npos ? "/" : rest.substr(slash);
+    std::string host = hostPort, port = "80";
+    size_t colon = hostPort.find(':');
+    if (colon != std::string::npos) {
+        host = hostPort.substr(0, colon);
+        port = hostPort.substr(colon + 1);
+    }
+
+    struct addrinfo hints = {}, *res = nullptr;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) return -1;
+    int sock = -1;
+    for (struct addrinfo* a = res; a; a = a->ai_next) {
+        sock = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (sock >= 0 && connect(sock, a->ai_addr, a->ai_addrlen) == 0) break;
+        if (sock >= 0) close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+    if (sock < 0) return -1;
+
+    std::string req = "POST " + path + " HTTP/1.1\r\nHost: " + host + "\r\n";
+    for (const auto& h : headers) req += h + "\r\n";
+    req += "Content-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+
+    Link link(sock);
+    int status = -1;
+    if (link.writeAll(req.data(), req.size()) && link.writeAll(body.data(), body.size())) {
+        std::string line;
+        if (link.readLine(line, 10000) && line.compare(0, 5, "HTTP/") == 0) {
+            size_t sp = line.find(' ');
+            if (sp != std::string::npos) status = atoi(line.c_str() + sp + 1);
+        }
+    }
+    close(sock);
+    return status;
+}
+
+/** Where decoded samples go. */
+class Sink {
+public:
+    Sink(const std::string& outPath, const std::string& forwardUrl, int batch)
+        : url_(forwardUrl), batch_(batch)
+    {
+        if (!outPath.empty()) {
+            out_ = fopen(outPath.c_str(), "a");
+            if (!out_) perror(outPath.c_str());
+        }
+    }
+
+    ~Sink()
+    {
+        if (out_) fclose(out_);
+    }
+
+    void add(int busId, const Point& p, bool backfill)
+    {
+        samples++;
+        if (out_) {
+            std::string line = formatJson(busId, p);
+            fputs(line.c_str(), out_);
+            fputc('\n', out_);
+        }
+        if (!url_.empty()) {
+            if (!pending_.empty() && pendingBackfill_ != backfill) failed_ |= !flushBatch();
+            busId_ = busId;
+            pendingBackfill_ = backfill;
+            pending_.push_back(p);
+            if ((int)pending_.size() >= batch_) failed_ |= !flushBatch();
+        }
+    }
+
+    /** Make everything so far durable / delivered. False if a POST failed. */
+    bool sync()
+    {
+        if (!url_.empty() && !pending_.empty()) failed_ |= !flushBatch();
+        if (out_) {
+            fflush(out_);
+            fsync(fileno(out_));
+        }
+        bool ok = !failed_;
+        failed_ = false;
+        return ok;
+    }
+
+    size_t samples = 0, posts = 0;
+
+private:
+    bool flushBatch()
+    {
+        std::vector<std::string> headers = {
+            "Content-Type: application/x-sawari-track",
+            "X-Bus-Id: " + std::to_string(busId_),
+        };
+        if (pendingBackfill_) headers.push_back("X-Backfill: 1");
+
+        int status = httpPost(url_, encodeBlock(pending_), headers);
+        posts++;
+        if (status < 200 || status >= 300) {
+            fprintf(stderr, "forward: POST failed (HTTP %d), %zu samples kept for retry\n",
+                    status, pending_.size());
+            return false;
+        }
+        pending_.clear();
+        return true;
+    }
+
+    FILE* out_ = nullptr;
+    std::string url_;
+    int batch_;
+    int busId_ = 0;
+    bool pendingBackfill_ = false;
+    bool failed_ = false;
+    std::vector<Point> pending_;
+};
+
+// ── Stored Frame Parser ──────────────────────────────────────
+
+/**
+ * Splits a file's raw bytes into stored block frames and decodes them.
+ * `offset` is always the end of the last whole frame: the resume point.
+ */
+class FileParser {
+public:
+    FileParser(uint32_t offset, int skip) : offset(offset), skip_(skip) {}
+
+    template <typename Emit>
+    void feed(const uint8_t* data, size_t n, Emit emit)
+    {
+        buf_.insert(buf_.end(), data, data + n);
+        size_t pos = 0;
+        std::vector<Point> points;
+        while (!broken && buf_.size() - pos >= 2) {
+            uint16_t prefix = buf_[pos] | (buf_[pos + 1] << 8);
+            bool hasCrc = prefix & kFrameCrc;
+            size_t len = prefix & kFrameLenMask;
+            size_t frameBytes = 2 + len + (hasCrc ? 4 : 0);
+            if (len == 0 || len > kMaxBlockBytes) {
+                broken = true;          // Lost framing (torn or garbage data)
+                break;
+            }
+            if (buf_.size() - pos < frameBytes) break;
+
+            const uint8_t* block = &buf_[pos + 2];
+            bool valid = !hasCrc || getLE32(block + len) == crc32(block, len);
+            points.clear();
+            if (valid && decodeBlock(block, len, points)) {
+                for (size_t i = skip_; i < points.size(); i++) emit(points[i]);
+                blocks++;
+            } else {
+                badBlocks++;
+            }
+            skip_ = 0;
+            pos += frameBytes;
+        }
+        buf_.erase(buf_.begin(), buf_.begin() + pos);
+        offset += pos;
+    }
+
+    uint32_t offset;
+    size_t blocks = 0, badBlocks = 0;
+    bool broken = false;
+
+private:
+    int skip_;
+    std::vector<uint8_t> buf_;
+};
+
+// ── Resume State ─────────────────────────────────────────────
+
+static std::map<std::pair<int, uint32_t>, uint32_t> loadState(const std::string& path)
+{
+    std::map<std::pair<int, uint32_t>, uint32_t> state;
+    FILE* f = path.empty() ? nullptr : fopen(path.c_str(), "r");
+    if (!f) return state;
+    int kind;
+    unsigned long id, offset;
+    while (fscanf(f, "%d %lu %lu", &kind, &id, &offset) == 3) {
+        state[{ kind, (uint32_t)id }] = (uint32_t)offset;
+    }
+    fclose(f);
+    return state;
+}
+
+static void saveState(const std::string& path, const std::map<std::pair<int, uint32_t>, uint32_t>& state)
+{
+    if (path.empty()) return;
+    std::string tmp = path + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "w");
+    if (!f) return;
+    for (const auto& e : state) {
+        fprintf(f, "%d %lu %lu\n", e.first.first, (unsigned long)e.first.second, (unsigned long)e.second);
+    }
+    fflush(f);
+    fsync(fileno(f));
+    fclose(f);
+    rename(tmp.c_str(), path.c_str());
+}
+
+// ── Offload Session ──────────────────────────────────────────
+
+struct Options {
+    std::string port;
+    int baud = 115200;
+    bool queue = false;
+    bool archive = false;
+    uint32_t from = 0, to = 0;
+    std::string out, forward, state;
+    int batch = 128;
+    bool commit = false;
+};
+
+struct Stats {
+    size_t files = 0, bytes = 0, samples = 0, rereads = 0, badBlocks = 0;
+    size_t wireBytes = 0, badFrames = 0;
+};
+
+class Session {
+public:
+    Session(Link& link, const Options& opt, Sink& sink) : link_(link), opt_(opt), sink_(sink) {}
+
+    /** Console handshake: ask for offload mode and follow the baud switch. */
+    bool connect()
+    {
+        for (int attempt = 0; attempt < 3; attempt++) {
+            link_.writeAll("\noffload\n", 9);
+            std::string line;
+            double deadline = nowSeconds() + 3;
+            while (nowSeconds() < deadline && link_.readLine(line, 1000)) {
+                if (line.compare(0, strlen(OFFLOAD_READY_LINE), OFFLOAD_READY_LINE) == 0) {
+                    int baud = atoi(line.c_str() + strlen(OFFLOAD_READY_LINE));
+                    if (!link_.setBaud(baud)) {
+                        fprintf(stderr, "offload: cannot set %d baud on this port\n", baud);
+                        return false;
+                    }
+                    usleep(50000);      // Let the device switch too
+                    link_.discardInput();
+                    fprintf(stderr, "offload: device ready at %d baud\n", baud);
+                    return true;
+                }
+            }
+        }
+        fprintf(stderr, "offload: no answer from the device console\n");
+        return false;
+    }
+
+    bool run(Stats& stats)
+    {
+        if (!list()) return false;
+        auto state = loadState(opt_.state);
+        fprintf(stderr, "offload: bus %u, %u queued samples, %zu files\n",
+                info_.busId, info_.queueSamples, files_.size());
+
+        bool ok = true;
+        for (const OffloadFile& file : files_) {
+            bool wanted = file.kind == OFFLOAD_KIND_QUEUE
+                          ? opt_.queue
+                          : opt_.archive && file.id >= opt_.from / 3600 && file.id <= opt_.to / 3600;
+            if (!wanted) continue;
+
+            // Resume after the last whole frame a previous run kept
+            uint32_t start = file.start;
+            int skip = file.skip;
+            auto saved = state.find({ file.kind, file.id });
+            if (saved != state.end() && saved->second > start) {
+                start = saved->second;
+                skip = 0;
+            }
+
+            FileParser parser(start, skip);
+            bool archive = file.kind == OFFLOAD_KIND_ARCHIVE;
+            auto emit = [&](const Point& p) {
+                if (archive && (p.timestamp < opt_.from || p.timestamp > opt_.to)) return;
+                sink_.add(info_.busId, p, archive);
+            };
+
+            if (start < file.size && !readFile(file, start, parser, emit, stats)) {
+                ok = false;
+                break;
+            }
+            stats.files++;
+            stats.badBlocks += parser.badBlocks;
+            if (parser.broken) {
+                fprintf(stderr, "offload: file %u/%u has a damaged tail after byte %u\n",
+                        file.kind, file.id, parser.offset);
+            }
+
+            if (!sink_.sync()) {
+                ok = false;
+                break;
+            }
+            state[{ file.kind, file.id }] = parser.offset;
+            saveState(opt_.state, state);
+
+            if (opt_.commit && file.kind == OFFLOAD_KIND_QUEUE && !commit(file.id, parser.offset)) {
+                ok = false;
+                break;
+            }
+        }
+
+        link_.sendFrame(OFFLOAD_QUIT, nullptr, 0);
+        return ok;
+    }
+
+private:
+    bool list()
+    {
+        for (int attempt = 0; attempt < kMaxRetries; attempt++) {
+            files_.clear();
+            link_.sendFrame(OFFLOAD_LIST, nullptr, 0);
+            Frame f;
+            bool gotInfo = false;
+            while (link_.readFrame(f, kFrameTimeoutMs)) {
+                if (f.type == OFFLOAD_INFO && f.payload.size() == sizeof(OffloadInfo)) {
+                    memcpy(&info_, f.payload.data(), sizeof(info_));
+                    gotInfo = true;
+                } else if (f.type == OFFLOAD_FILE && f.payload.size() == sizeof(OffloadFile)) {
+                    OffloadFile file;
+                    memcpy(&file, f.payload.data(), sizeof(file));
+                    files_.push_back(file);
+                } else if (f.type == OFFLOAD_END && f.payload.size() == sizeof(OffloadEnd)) {
+                    OffloadEnd end;
+                    memcpy(&end, f.payload.data(), sizeof(end));
+                    if (gotInfo && end.bytes == files_.size()) return true;
+                    break;      // A FILE frame was lost: list again
+                }
+            }
+        }
+        fprintf(stderr, "offload: LIST failed\n");
+        return false;
+    }
+
+    template <typename Emit>
+    bool readFile(const OffloadFile& file, uint32_t start, FileParser& parser, Emit emit, Stats& stats)
+    {
+        uint32_t expected = start;
+        uint32_t jobStart = start;
+        bool resync = false;
+        int retries = 0;
+
+        auto request = [&]() {
+            OffloadRead req = { file.kind, file.id, expected, file.size - expected };
+            link_.sendFrame(OFFLOAD_READ, &req, sizeof(req));
+            jobStart = expected;
+        };
+        request();
+
+        Frame f;
+        for (;;) {
+            if (!link_.readFrame(f, kFrameTimeoutMs)) {
+                if (expected >= file.size) return true;     // Only the END was lost
+                if (++retries > kMaxRetries) break;
+                stats.rereads++;
+                request();
+                resync = true;
+                continue;
+            }
+
+            if (f.type == OFFLOAD_DATA && f.payload.size() >= sizeof(OffloadData)) {
+                OffloadData hdr;
+                memcpy(&hdr, f.payload.data(), sizeof(hdr));
+                if (hdr.kind != file.kind || hdr.id != file.id) continue;
+                if (hdr.offset != expected) {
+                    // A chunk went missing: read again from the gap. Chunks
+                    // of the old request still in flight are ignored.
+                    if (hdr.offset > expected && !resync) {
+                        stats.rereads++;
+                        request();
+                        resync = true;
+                    }
+                    continue;
+                }
+                resync = false;
+                size_t n = f.payload.size() - sizeof(OffloadData);
+                parser.feed(f.payload.data() + sizeof(OffloadData), n, emit);
+                expected += n;
+                stats.bytes += n;
+            } else if (f.type == OFFLOAD_END && f.payload.size() == sizeof(OffloadEnd)) {
+                if (resync) continue;           // END of a superseded request
+                OffloadEnd end;
+                memcpy(&end, f.payload.data(), sizeof(end));
+                if (end.status == OFFLOAD_END_MISSING) {
+                    fprintf(stderr, "offload: file %u/%u is gone (evicted?)\n", file.kind, file.id);
+                    return true;
+                }
+                if (jobStart + end.bytes > expected) {
+                    stats.rereads++;            // The last chunk(s) went missing
+                    request();
+                    resync = true;
+                    continue;
+                }
+                return true;
+            }
+        }
+        fprintf(stderr, "offload: giving up on file %u/%u at byte %u\n", file.kind, file.id, expected);
+        return false;
+    }
+
+    bool commit(uint32_t segment, uint32_t offset)
+    {
+        OffloadCommit c = { segment, offset, info_.queueToken };
+        for (int attempt = 0; attempt < kMaxRetries; attempt++) {
+            link_.sendFrame(OFFLOAD_COMMIT, &c, sizeof(c));
+            Frame f;
+            while (link_.readFrame(f, kFrameTimeoutMs)) {
+                if (f.type == OFFLOAD_ACK) return true;
+                if (f.type == OFFLOAD_NAK) {
+                    fprintf(stderr, "offload: device refused the commit (queue rewritten); run again\n");
+                    return false;
+                }
+            }
+        }
+        return false;
+    }
+
+    Link& link_;
+    const Options& opt_;
+    Sink& sink_;
+    OffloadInfo info_ = {};
+    std::vector<OffloadFile> files_;
+};
+
+static int openPort(const std::string& path, int baud, int* fdOut)
+{
+    int fd = open(path.c_str(), O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        perror(path.c_str());
+        return -1;
+    }
+    Link link(fd);
+    if (!link.setBaud(baud)) {
+        fprintf(stderr, "%s: cannot configure %d baud\n", path.c_str(), baud);
+        close(fd);
+        return -1;
+    }
+    *fdOut = fd;
+    return 0;
+}
+
+static int runOffload(const Options& opt, Stats& stats)
+{
+    int fd;
+    if (openPort(opt.port, opt.baud, &fd) != 0) return 1;
+    Link link(fd);
+    Sink sink(opt.out, opt.forward, opt.batch);
+    Session session(link, opt, sink);
+
+    bool ok = session.connect() && session.run(stats);
+    stats.samples = sink.samples;
+    stats.wireBytes = link.bytesIn;
+    stats.badFrames = link.badFrames;
+    close(fd);
+    return ok ? 0 : 1;
+}
+
+// ── Loopback Benchmark: Device Emulator ──────────────────────
+
+static Point benchPoint(uint32_t i)
+{
+    Point p;
+    p.latitude = 27700000 + (int32_t)(i * 7 % 5000);
+    p.longitude = 85300000 + (int32_t)(i * 3 % 7000);
+    p.timestamp = 1771495553u + i * 5;
+    p.altitude = 13000 + (int32_t)(i % 50);
+    p.speed = (uint16_t)(i * 13 % 400);
+    p.direction = (uint16_t)(i * 37 % 3600);
+    p.satellites = 8;
+    p.hdop = 9;
+    p.seq = i + 1;
+    return p;
+}
+
+/** Synthetic queue: 4KB segments of 32-sample blocks, like the device. */
+static std::map<uint32_t, std::vector<uint8_t>> benchQueue(size_t kb, uint32_t* samples)
+{
+    std::map<uint32_t, std::vector<uint8_t>> segs;
+    uint32_t seq = 1, n = 0;
+    size_t total = 0;
+    while (total < kb * 1024) {
+        std::vector<Point> pts;
+        for (int k = 0; k < 32; k++) pts.push_back(benchPoint(n++));
+        std::vector<uint8_t> frame;
+        appendStoredFrame(frame, encodeBlock(pts));
+        if (segs[seq].size() + frame.size() > 4096) seq++;
+        segs[seq].insert(segs[seq].end(), frame.begin(), frame.end());
+        total += frame.size();
+    }
+    *samples = n;
+    return segs;
+}
+
+static void runEmulator(int fd, size_t kb, int errorEvery)
+{
+    uint32_t samples;
+    auto segs = benchQueue(kb, &samples);
+    Link link(fd);
+
+    std::string line;
+    while (link.readLine(line, 10000) && line != "offload") {}
+    const char* ready = OFFLOAD_READY_LINE " 921600\n";
+    link.writeAll(ready, strlen(ready));
+
+    bool reading = false;
+    OffloadRead job = {};
+    uint32_t sent = 0, chunks = 0;
+    Frame f;
+    for (;;) {
+        // Like the device: serve requests, then a few chunks per pass
+        if (link.readFrame(f, reading ? 0 : 10000)) {
+            if (f.type == OFFLOAD_LIST) {
+                OffloadInfo info = { OFFLOAD_PROTOCOL_VERSION, 1, samples, 7 };
+                link.sendFrame(OFFLOAD_INFO, &info, sizeof(info));
+                for (const auto& s : segs) {
+                    OffloadFile file = { OFFLOAD_KIND_QUEUE, s.first, (uint32_t)s.second.size(), 0, 0 };
+                    link.sendFrame(OFFLOAD_FILE, &file, sizeof(file));
+                }
+                OffloadEnd end = { OFFLOAD_END_OK, (uint32_t)segs.size() };
+                link.sendFrame(OFFLOAD_END, &end, sizeof(end));
+            } else if (f.type == OFFLOAD_READ && f.payload.size() == sizeof(job)) {
+                memcpy(&job, f.payload.data(), sizeof(job));
+                sent = 0;
+                reading = true;
+            } else if (f.type == OFFLOAD_COMMIT && f.payload.size() == sizeof(OffloadCommit)) {
+                OffloadCommit c;
+                memcpy(&c, f.payload.data(), sizeof(c));
+                while (!segs.empty() && segs.begin()->first < c.segment) segs.erase(segs.begin());
+                link.sendFrame(c.queueToken == 7 ? OFFLOAD_ACK : OFFLOAD_NAK, nullptr, 0);
+            } else if (f.type == OFFLOAD_QUIT) {
+                link.sendFrame(OFFLOAD_ACK, nullptr, 0);
+                return;
+            }
+            continue;
+        }
+        if (!reading) return;       // Idle timeout
+
+        for (int i = 0; i < 8 && reading; i++) {
+            auto it = segs.find(job.id);
+            uint32_t size = it == segs.end() ? 0 : (uint32_t)it->second.size();
+            uint32_t n = std::min({ (uint32_t)OFFLOAD_CHUNK_BYTES, job.length - sent,
+                                    job.offset < size ? size - job.offset : 0u });
+            if (n == 0) {
+                OffloadEnd end = { it == segs.end() ? (uint8_t)OFFLOAD_END_MISSING : (uint8_t)OFFLOAD_END_OK, sent };
+                link.sendFrame(OFFLOAD_END, &end, sizeof(end));
+                reading = false;
+                break;
+            }
+
+            std::vector<uint8_t> payload(sizeof(OffloadData) + n);
+            OffloadData hdr = { job.kind, job.id, job.offset };
+            memcpy(payload.data(), &hdr, sizeof(hdr));
+            memcpy(payload.data() + sizeof(hdr), it->second.data() + job.offset, n);
+
+            if (errorEvery > 0 && ++chunks % errorEvery == 0) {
+                payload[sizeof(hdr) + n / 2] ^= 0x5A;       // Damaged in transit
+                std::vector<uint8_t> raw = { OFFLOAD_SYNC0, OFFLOAD_SYNC1, OFFLOAD_DATA,
+                                             (uint8_t)(payload.size() & 0xFF), (uint8_t)(payload.size() >> 8) };
+                raw.insert(raw.end(), payload.begin(), payload.end());
+                raw.insert(raw.end(), 4, 0);                // Wrong CRC
+                link.writeAll(raw.data(), raw.size());
+            } else {
+                link.sendFrame(OFFLOAD_DATA, payload.data(), payload.size());
+            }
+            if (chunks % 64 == 0) {
+                const char* log = "[GPS] Fix: 27.700000, 85.300000 | Sats: 8\r\n";   // Stray log line
+                link.writeAll(log, strlen(log));
+            }
+            job.offset += n;
+            sent += n;
+        }
+    }
+}
+
+static int runBench(size_t kb, int errorEvery)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        perror("posix_openpt");
+        return 1;
+    }
+    std::string slave = ptsname(master);
+    struct termios tio;
+    tcgetattr(master, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(master, TCSANOW, &tio);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        runEmulator(master, kb, errorEvery);
+        _exit(0);
+    }
+
+    Options opt;
+    opt.port = slave;
+    opt.queue = true;
+    opt.commit = true;
+    opt.out = "/dev/null";
+
+    Stats stats;
+    double t0 = nowSeconds();
+    int rc = runOffload(opt, stats);
+    double dt = nowSeconds() - t0;
+    waitpid(pid, nullptr, 0);
+    close(master);
+
+    uint32_t expected;
+    benchQueue(kb, &expected);
+    double wireSeconds = stats.wireBytes * 10.0 / 921600;     // 8N1 = 10 bits per byte
+
+    printf("bench: %zu files, %zu data bytes, %zu samples (expected %u)\n",
+           stats.files, stats.bytes, stats.samples, expected);
+    printf("bench: loopback %.3f s = %.1f MB/s, %.0f samples/s\n",
+           dt, stats.bytes / dt / 1e6, stats.samples / dt);
+    printf("bench: %zu bytes on the wire (%.1f%% framing), %zu re-reads, %zu bad frames\n",
+           stats.wireBytes, 100.0 * (stats.wireBytes - stats.bytes) / stats.wireBytes,
+           stats.rereads, stats.badFrames);
+    printf("bench: at 921600 baud: %.2f s, %.0f samples/s (vs one HTTP POST per record)\n",
+           wireSeconds, stats.samples / wireSeconds);
+
+    bool pass = rc == 0 && stats.samples == expected;
+    printf("bench: %s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : 1;
+}
+
+// ── Main ─────────────────────────────────────────────────────
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: sawari-offload --port DEV [--queue] [--archive FROM TO] [--out FILE]\n"
+            "                      [--forward URL] [--batch N] [--commit] [--state FILE]\n"
+            "                      [--baud N]\n"
+            "       sawari-offload --bench [--bench-kb N] [--bench-errors N]\n");
+}
+
+int main(int argc, char** argv)
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    Options opt;
+    bool bench = false;
+    size_t benchKb = 2048;
+    int benchErrors = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        auto next = [&]() -> const char* {
+            if (i + 1 >= argc) {
+                usage();
+                exit(2);
+            }
+            return argv[++i];
+        };
+        if (a == "--port") opt.port = next();
+        else if (a == "--baud") opt.baud = atoi(next());
+        else if (a == "--queue") opt.queue = true;
+        else if (a == "--archive") {
+            opt.archive = true;
+            opt.from = strtoul(next(), nullptr, 10);
+            opt.to = strtoul(next(), nullptr, 10);
+        }
+        else if (a == "--out") opt.out = next();
+        else if (a == "--forward") opt.forward = next();
+        else if (a == "--batch") opt.batch = std::max(1, std::min(255, atoi(next())));
+        else if (a == "--commit") opt.commit = true;
+        else if (a == "--state") opt.state = next();
+        else if (a == "--bench") bench = true;
+        else if (a == "--bench-kb") benchKb = strtoul(next(), nullptr, 10);
+        else if (a == "--bench-errors") benchErrors = atoi(next());
+        else {
+            usage();
+            return 2;
+        }
+    }
+
+    if (bench) {
+        return runBench(benchKb, benchErrors);
+    }
+    if (opt.port.empty() || (opt.out.empty() && opt.forward.empty())) {
+        usage();
+        return 2;
+    }
+    if (!opt.queue && !opt.archive) opt.queue = true;
+
+    Stats stats;
+    int rc = runOffload(opt, stats);
+    fprintf(stderr, "offload: %zu files, %zu bytes, %zu samples, %zu re-reads, %zu bad blocks\n",
+            stats.files, stats.bytes, stats.samples, stats.rereads, stats.badBlocks);
+    return rc;
+}
@@ -0,0 +1,586 @@
+/**
+ * SAWARI — UDP Telemetry Receiver
+ *
+ * Receives live fixes sent by SAWARI telemetry devices built with
+ * UDP_TELEMETRY, acknowledges them and writes every new sample as JSONL
+ * (same objects the device POSTs) and/or forwards it to the API.
+ *
+ * A device drops a fix once it is acknowledged, so in production run it
+ * with --forward (api/gps-device.php): each datagram's track block is
+ * POSTed as-is (application/x-sawari-track, X-Bus-Id) and its sequence
+ * numbers are acknowledged only after the API answered 2xx. A failed POST
+ * sends no ACK; the device repeats the fixes and, past
+ * UDP_ACK_TIMEOUT_MS, queues them for its HTTP backlog upload. The API
+ * drops repeats by (bus_id, seq).
+ *
+ * Wire format: sawari_telemetry/udp_protocol.h (shared with the firmware).
+ * Each DATA datagram carries a sequence number and a track block; every
+ * DATA is answered with an ACK listing the newest ranges of sequence
+ * numbers held for that device session. Samples seen before (repeated
+ * because an ACK was lost) are counted as duplicates and not written.
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -o sawari-udp-receiver tools/sawari-udp-receiver.cpp
+ *
+ * Usage:
+ *   sawari-udp-receiver [--port 5684] [--out samples.jsonl] [--forward URL]
+ *                       [--stats SEC] [--loss PCT] [--delay MS] [--jitter MS]
+ *                       [--seed N]
+ *
+ *   --forward takes a plain http:// URL, e.g.
+ *   http://zenithkandel.com.np/sawari/api/gps-device.php
+ *
+ * Impairment: --loss drops that percentage of datagrams in each direction
+ * (DATA in, ACK out); --delay / --jitter hold each surviving datagram for
+ * delay ± jitter ms (so jitter also reorders). This emulates a lossy link
+ * where netem is not available; with netem, leave them at 0 and use e.g.
+ *   tc qdisc add dev lo root netem delay 40ms 20ms loss 10%
+ */
+
+#include "../sawari_telemetry/udp_protocol.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Track block format (sawari_telemetry/track_codec.h)
+static const uint8_t kBlockVersion = 4;
+static const int     kFieldCount   = 9;
+
+// Sequence ranges remembered per device session (oldest are forgotten)
+static const size_t kMaxRanges = 256;
+
+// A forward POST taking longer than this counts as failed
+static const int kForwardTimeoutMs = 5000;
+
+static volatile sig_atomic_t gStop = 0;
+
+// ── CRC32 (IEEE 802.3), same as trackCrc32() ─────────────────
+
+static uint32_t crc32(const uint8_t* data, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFFu;
+    while (len--) {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+static double nowSeconds()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// ── Track Codec (mirrors sawari_telemetry/track_codec.cpp) ───
+
+struct Point {
+    int32_t  latitude;      // degrees x1e6
+    int32_t  longitude;     // degrees x1e6
+    uint32_t timestamp;     // Unix seconds
+    int32_t  altitude;      // metres x10
+    uint16_t speed;         // km/h x10
+    uint16_t direction;     // degrees x10
+    uint8_t  satellites;
+    uint16_t hdop;          // x10
+    uint32_t seq;           // Per-device sequence number (0 = none)
+};
+
+// Mask bit per field: satellites and hdop share bit 6
+static const uint8_t kMaskBit[kFieldCount] = { 0, 1, 2, 3, 4, 5, 6, 6, 7 };
+
+static int32_t unzigzag(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+/** Decode one track block. Returns false if it is malformed. */
+static bool decodeBlock(const uint8_t* b, size_t len, std::vector<Point>& out)
+{
+    if (len < 2 || b[0] != kBlockVersion || b[1] == 0) {
+        return false;
+    }
+    size_t pos = 2;
+    auto varint = [&](uint32_t& v) {
+        v = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            if (pos >= len) return false;
+            uint8_t c = b[pos++];
+            v |= (uint32_t)(c & 0x7F) << shift;
+            if (!(c & 0x80)) return true;
+        }
+        return false;
+    };
+
+    uint32_t f[kFieldCount] = {0};
+    uint32_t lastDelta = 0;
+    uint32_t v;
+    for (int n = 0; n < b[1]; n++) {
+        if (n == 0) {
+            for (int i = 0; i < kFieldCount; i++) {
+                if (!varint(v)) return false;
+                f[i] = (uint32_t)unzigzag(v);
+            }
+        } else {
+            if (pos >= len) return false;
+            uint8_t mask = b[pos++];
+            int32_t d[kFieldCount] = {0};
+            for (int i = 0; i < kFieldCount; i++) {
+                if (mask & (1 << kMaskBit[i])) {
+                    if (!varint(v)) return false;
+                    d[i] = unzigzag(v);
+                }
+            }
+            lastDelta += (uint32_t)d[2];
+            f[2] += lastDelta;
+            for (int i = 0; i < kFieldCount; i++) {
+                if (i != 2 && i != 5) f[i] += (uint32_t)d[i];
+            }
+            f[5] = (uint32_t)(((int32_t)f[5] + d[5] + 3600) % 3600);
+            f[8] += 1;
+        }
+
+        Point p;
+        p.latitude = (int32_t)f[0];
+        p.longitude = (int32_t)f[1];
+        p.timestamp = f[2];
+        p.altitude = (int32_t)f[3];
+        p.speed = (uint16_t)f[4];
+        p.direction = (uint16_t)f[5];
+        p.satellites = (uint8_t)f[6];
+        p.hdop = (uint16_t)f[7];
+        p.seq = f[8];
+        out.push_back(p);
+    }
+    return pos == len;
+}
+
+static std::string formatJson(int busId, const Point& p)
+{
+    char ts[32];
+    time_t t = p.timestamp;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+    char line[400];
+    snprintf(line, sizeof(line),
+             "{\"data\":{\"bus_id\":%d,\"latitude\":%.6f,\"longitude\":%.6f,"
+             "\"speed\":%.1f,\"direction\":%.1f,\"altitude\":%.1f,"
+             "\"satellites\":%d,\"hdop\":%.1f,\"timestamp\":\"%s\",\"seq\":%lu}}",
+             busId, p.latitude / 1e6, p.longitude / 1e6, p.speed / 10.0,
+             p.direction / 10.0, p.altitude / 10.0, p.satellites, p.hdop / 10.0, ts,
+             (unsigned long)p.seq);
+    return line;
+}
+
+// ── API Forwarding (as sawari-offload --forward) ─────────────
+
+/** Wait for `fd` to be ready for `events`. False on timeout / error. */
+static bool waitFd(int fd, short events, double deadline)
+{
+    int wait = (int)((deadline - nowSeconds()) * 1000);
+    if (wait <= 0) return false;
+    struct pollfd pfd = { fd, events, 0 };
+    return poll(&pfd, 1, wait) > 0;
+}
+
+/** Minimal HTTP/1.1 POST (plain http:// only). Returns the status code or -1. */
+static int httpPost(const std::string& url, const uint8_t* body, size_t len,
+                    const std::vector<std::string>& headers)
+{
+    if (url.compare(0, 7, "http://") != 0) return -1;
+    std::string rest = url.substr(7);
+    size_t slash = rest.find('/');
+    std::string hostPort = rest.substr(0, slash);
+    std::string path = slash == std::string::npos ? "/" : rest.substr(slash);
+    std::string host = hostPort, port = "80";
+    size_t colon = hostPort.find(':');
+    if (colon != std::string::npos) {
+        host = hostPort.substr(0, colon);
+        port = hostPort.substr(colon + 1);
+    }
+
+    struct addrinfo hints = {}, *res = nullptr;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) return -1;
+    int sock = -1;
+    for (struct addrinfo* a = res; a; a = a->ai_next) {
+        sock = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (sock >= 0 && connect(sock, a->ai_addr, a->ai_addrlen) == 0) break;
+        if (sock >= 0) close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+    if (sock < 0) return -1;
+
+    std::string req = "POST " + path + " HTTP/1.1\r\nHost: " + host + "\r\n";
+    for (const auto& h : headers) req += h + "\r\n";
+    req += "Content-Length: " + std::to_string(len) + "\r\nConnection: close\r\n\r\n";
+    req.append((const char*)body, len);
+
+    double deadline = nowSeconds() + kForwardTimeoutMs / 1000.0;
+    size_t sent = 0;
+    while (sent < req.size() && waitFd(sock, POLLOUT, deadline)) {
+        ssize_t n = send(sock, req.data() + sent, req.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) break;
+        sent += n;
+    }
+
+    // Status line: "HTTP/1.1 200 OK"
+    std::string line;
+    char c;
+    while (sent == req.size() && line.size() < 64 && waitFd(sock, POLLIN, deadline) &&
+           recv(sock, &c, 1, 0) == 1 && c != '\n') {
+        line += c;
+    }
+    char drain[512];        // Read the rest, so close() does not reset the server's send
+    while (!line.empty() && waitFd(sock, POLLIN, deadline) && recv(sock, drain, sizeof(drain), 0) > 0) {}
+    close(sock);
+
+    int status = -1;
+    size_t sp = line.find(' ');
+    if (line.compare(0, 5, "HTTP/") == 0 && sp != std::string::npos) {
+        status = atoi(line.c_str() + sp + 1);
+    }
+    return status;
+}
+
+// ── Sequence Ranges ──────────────────────────────────────────
+
+/** Sequence numbers received in one device session, as merged ranges. */
+struct Session {
+    std::map<uint32_t, uint32_t> ranges;    // first -> last (inclusive)
+
+    bool has(uint32_t seq) const
+    {
+        auto it = ranges.upper_bound(seq);
+        return it != ranges.begin() && std::prev(it)->second >= seq;
+    }
+
+    void add(uint32_t seq)
+    {
+        auto next = ranges.upper_bound(seq);
+        bool joinsPrev = next != ranges.begin() && std::prev(next)->second + 1 == seq;
+        bool joinsNext = next != ranges.end() && next->first == seq + 1;
+
+        if (joinsPrev && joinsNext) {
+            std::prev(next)->second = next->second;
+            ranges.erase(next);
+        } else if (joinsPrev) {
+            std::prev(next)->second = seq;
+        } else if (joinsNext) {
+            uint32_t last = next->second;
+            ranges.erase(next);
+            ranges[seq] = last;
+        } else {
+            ranges[seq] = seq;
+        }
+
+        if (ranges.size() > kMaxRanges) ranges.erase(ranges.begin());
+    }
+};
+
+// ── Impairment ───────────────────────────────────────────────
+
+struct Held {
+    double at;                  // Release time (nowSeconds)
+    bool toDevice;              // ACK out (true) or DATA in (false)
+    sockaddr_in peer;
+    std::vector<uint8_t> bytes;
+
+    bool operator>(const Held& o) const { return at > o.at; }
+};
+
+struct Impairment {
+    double lossPct = 0;
+    int delayMs = 0;
+    int jitterMs = 0;
+    std::mt19937 rng{1};
+    std::priority_queue<Held, std::vector<Held>, std::greater<Held>> held;
+
+    bool drop()
+    {
+        return lossPct > 0 && std::uniform_real_distribution<double>(0, 100)(rng) < lossPct;
+    }
+
+    double releaseAt()
+    {
+        int ms = delayMs;
+        if (jitterMs > 0) ms += std::uniform_int_distribution<int>(-jitterMs, jitterMs)(rng);
+        return nowSeconds() + std::max(0, ms) / 1000.0;
+    }
+};
+
+// ── Receiver ─────────────────────────────────────────────────
+
+struct Stats {
+    size_t datagrams = 0;       // DATA handled
+    size_t bad = 0;             // Failed CRC / version / block checks
+    size_t dropped = 0;         // Lost to --loss (both directions)
+    size_t fresh = 0;           // New samples
+    size_t duplicates = 0;      // Samples received before
+    size_t acks = 0;            // ACKs sent
+    size_t posts = 0;           // Forward POSTs
+    size_t postFailures = 0;    // Forward POSTs not answered 2xx (no ACK sent)
+    double ageSum = 0;          // Sample age on arrival (wall clock - timestamp)
+    double ageMax = 0;
+};
+
+static void printStats(const Stats& s)
+{
+    fprintf(stderr, "udp: %zu datagrams (%zu bad, %zu dropped by --loss), %zu samples "
+            "(%zu duplicates), %zu acks, %zu posts (%zu failed), "
+            "age on arrival mean %.1f s max %.0f s\n",
+            s.datagrams, s.bad, s.dropped, s.fresh, s.duplicates, s.acks,
+            s.posts, s.postFailures, s.fresh ? s.ageSum / s.fresh : 0.0, s.ageMax);
+}
+
+/**
+ * Handle one DATA datagram. Fills `ack` with the reply (empty if none).
+ * With `forwardUrl`, new samples are acknowledged only once the API has
+ * taken the block.
+ */
+static void handleData(const std::vector<uint8_t>& dg, std::map<uint64_t, Session>& sessions,
+                       FILE* out, const std::string& forwardUrl, Stats& stats,
+                       std::vector<uint8_t>& ack)
+{
+    const size_t dataAt = sizeof(UdpHeader) + sizeof(uint32_t);
+    ack.clear();
+
+    UdpHeader header;
+    uint32_t crc;
+    if (dg.size() < dataAt + UDP_TRAILER_BYTES) {
+        stats.bad++;
+        return;
+    }
+    memcpy(&header, dg.data(), sizeof(header));
+    memcpy(&crc, dg.data() + dg.size() - UDP_TRAILER_BYTES, sizeof(crc));
+    if (crc != crc32(dg.data(), dg.size() - UDP_TRAILER_BYTES) ||
+        header.version != UDP_PROTOCOL_VERSION || header.type != UDP_DATA) {
+        stats.bad++;
+        return;
+    }
+
+    uint32_t first;
+    memcpy(&first, dg.data() + sizeof(header), sizeof(first));
+    std::vector<Point> points;
+    if (!decodeBlock(dg.data() + dataAt, dg.size() - dataAt - UDP_TRAILER_BYTES, points)) {
+        stats.bad++;
+        return;
+    }
+    stats.datagrams++;
+
+    Session& session = sessions[(uint64_t)header.busId << 32 | header.session];
+    bool fresh = false;
+    for (size_t i = 0; i < points.size() && !fresh; i++) {
+        fresh = !session.has(first + (uint32_t)i);
+    }
+    if (fresh && !forwardUrl.empty()) {
+        // The block goes as-is: the API drops the samples it already holds
+        std::vector<std::string> headers = {
+            "Content-Type: application/x-sawari-track",
+            "X-Bus-Id: " + std::to_string(header.busId),
+        };
+        int status = httpPost(forwardUrl, dg.data() + dataAt,
+                              dg.size() - dataAt - UDP_TRAILER_BYTES, headers);
+        stats.posts++;
+        if (status < 200 || status >= 300) {
+            stats.postFailures++;
+            fprintf(stderr, "forward: POST failed (HTTP %d), bus %u seq %lu..%lu not acknowledged\n",
+                    status, (unsigned)header.busId, (unsigned long)first,
+                    (unsigned long)(first + points.size() - 1));
+            return;
+        }
+    }
+
+    double wall = (double)time(nullptr);
+    for (size_t i = 0; i < points.size(); i++) {
+        uint32_t seq = first + (uint32_t)i;
+        if (session.has(seq)) {
+            stats.duplicates++;
+            continue;
+        }
+        session.add(seq);
+        stats.fresh++;
+        double age = std::max(0.0, wall - points[i].timestamp);
+        stats.ageSum += age;
+        stats.ageMax = std::max(stats.ageMax, age);
+        if (out) fprintf(out, "%s\n", formatJson((int)header.busId, points[i]).c_str());
+    }
+    if (out) fflush(out);
+
+    // ACK: newest ranges first
+    UdpHeader reply = { UDP_PROTOCOL_VERSION, UDP_ACK, header.busId, header.session };
+    ack.resize(sizeof(reply) + 1);
+    memcpy(ack.data(), &reply, sizeof(reply));
+    uint8_t count = 0;
+    for (auto it = session.ranges.rbegin();
+         it != session.ranges.rend() && count < UDP_MAX_ACK_RANGES; ++it, ++count) {
+        UdpRange range = { it->first, it->second };
+        const uint8_t* p = (const uint8_t*)&range;
+        ack.insert(ack.end(), p, p + sizeof(range));
+    }
+    ack[sizeof(reply)] = count;
+    crc = crc32(ack.data(), ack.size());
+    for (int i = 0; i < 4; i++) ack.push_back((uint8_t)(crc >> (8 * i)));
+}
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: sawari-udp-receiver [--port N] [--out FILE] [--forward URL] [--stats SEC]\n"
+            "                           [--loss PCT] [--delay MS] [--jitter MS] [--seed N]\n");
+}
+
+static void onSignal(int)
+{
+    gStop = 1;
+}
+
+// ── Main ─────────────────────────────────────────────────────
+
+int main(int argc, char** argv)
+{
+    int port = 5684;
+    std::string outPath, forwardUrl;
+    double statsEvery = 10;
+    Impairment imp;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        auto next = [&]() -> const char* {
+            if (i + 1 >= argc) {
+                usage();
+                exit(2);
+            }
+            return argv[++i];
+        };
+        if (a == "--port") port = atoi(next());
+        else if (a == "--out") outPath = next();
+        else if (a == "--forward") forwardUrl = next();
+        else if (a == "--stats") statsEvery = atof(next());
+        else if (a == "--loss") imp.lossPct = atof(next());
+        else if (a == "--delay") imp.delayMs = atoi(next());
+        else if (a == "--jitter") imp.jitterMs = atoi(next());
+        else if (a == "--seed") imp.rng.seed((unsigned)strtoul(next(), nullptr, 10));
+        else {
+            usage();
+            return 2;
+        }
+    }
+
+    FILE* out = nullptr;
+    if (!outPath.empty()) {
+        out = outPath == "-" ? stdout : fopen(outPath.c_str(), "a");
+        if (!out) {
+            fprintf(stderr, "cannot open %s: %s\n", outPath.c_str(), strerror(errno));
+            return 1;
+        }
+    }
+
+    if (!forwardUrl.empty() && forwardUrl.compare(0, 7, "http://") != 0) {
+        fprintf(stderr, "--forward takes a plain http:// URL\n");
+        return 2;
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "cannot bind UDP port %d: %s\n", port, strerror(errno));
+        return 1;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    fprintf(stderr, "udp: listening on port %d (loss %.1f%%, delay %d ± %d ms)\n",
+            port, imp.lossPct, imp.delayMs, imp.jitterMs);
+    if (!forwardUrl.empty()) fprintf(stderr, "udp: forwarding to %s\n", forwardUrl.c_str());
+
+    std::map<uint64_t, Session> sessions;
+    Stats stats;
+    std::vector<uint8_t> ack;
+    double nextStats = statsEvery > 0 ? nowSeconds() + statsEvery : 0;
+
+    auto sendAck = [&](const std::vector<uint8_t>& bytes, const sockaddr_in& peer) {
+        sendto(fd, bytes.data(), bytes.size(), 0, (const sockaddr*)&peer, sizeof(peer));
+        stats.acks++;
+    };
+
+    auto deliver = [&](const std::vector<uint8_t>& dg, const sockaddr_in& peer) {
+        handleData(dg, sessions, out, forwardUrl, stats, ack);
+        if (ack.empty()) return;
+        if (imp.drop()) {
+            stats.dropped++;
+        } else if (imp.delayMs > 0 || imp.jitterMs > 0) {
+            imp.held.push({ imp.releaseAt(), true, peer, ack });
+        } else {
+            sendAck(ack, peer);
+        }
+    };
+
+    while (!gStop) {
+        // Release held datagrams that are due
+        double now = nowSeconds();
+        while (!imp.held.empty() && imp.held.top().at <= now) {
+            Held h = imp.held.top();
+            imp.held.pop();
+            if (h.toDevice) {
+                sendAck(h.bytes, h.peer);
+            } else {
+                deliver(h.bytes, h.peer);
+            }
+        }
+        if (nextStats > 0 && now >= nextStats) {
+            printStats(stats);
+            nextStats = now + statsEvery;
+        }
+
+        int waitMs = 200;
+        if (!imp.held.empty()) {
+            waitMs = std::min(waitMs, (int)((imp.held.top().at - now) * 1000) + 1);
+        }
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, std::max(0, waitMs)) <= 0) continue;
+
+        uint8_t buf[UDP_MAX_DATAGRAM];
+        sockaddr_in peer;
+        socklen_t peerLen = sizeof(peer);
+        ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, (sockaddr*)&peer, &peerLen);
+        if (n <= 0) continue;
+
+        std::vector<uint8_t> dg(buf, buf + n);
+        if (imp.drop()) {
+            stats.dropped++;
+        } else if (imp.delayMs > 0 || imp.jitterMs > 0) {
+            imp.held.push({ imp.releaseAt(), false, peer, dg });
+        } else {
+            deliver(dg, peer);
+        }
+    }
+
+    printStats(stats);
+    if (out && out != stdout) fclose(out);
+    close(fd);
+    return 0;
+}